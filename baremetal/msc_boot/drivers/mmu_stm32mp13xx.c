@@ -108,6 +108,7 @@
 // Descriptors should place all memory in domain 0
 
 #include "stm32mp13xx.h"
+#include <stddef.h>
 #include <stdint.h>
 
 //--------------------- TTB sizes  -------------------
@@ -132,6 +133,11 @@ extern uint32_t __RO_END__;   // End of RO section (4096 bytes aligned)
 extern uint32_t TTB[];
 #endif
 
+// Optional non-cacheable DDR window for DMA buffers. Linker scripts that need
+// one place it on 1 MB boundaries; images without it leave these undefined.
+extern uint32_t __DMA_NC_START__ __attribute__((weak));
+extern uint32_t __DMA_NC_END__ __attribute__((weak));
+
 // Level 2 table pointers
 //-----------------------------------------------------
 
@@ -141,6 +147,8 @@ static uint32_t Sect_Normal; // outer & inner wb/wa, non-shareable, executable,
                              // rw, domain 0, base addr 0
 static uint32_t Sect_Normal_Shared; // outer & inner wb/wa, shareable,
                                     // executable, rw, domain 0, base addr 0
+static uint32_t Sect_Normal_NC; // outer & inner non-cacheable, non-shareable,
+                                // executable, rw, domain 0, base addr 0
 static uint32_t Sect_Device_RO; // device, non-shareable, non-executable, ro,
                                 // domain 0, base addr 0
 static uint32_t Sect_Device_RW; // as Sect_Device_RO, but writeable
@@ -209,6 +217,8 @@ void MMU_CreateTranslationTable(void)
    Sect_Normal_Shared = Sect_Normal;
    MMU_SharedSection(&Sect_Normal_Shared, SHARED);
 
+   section_normal_nc(Sect_Normal_NC, region);
+
    // Create descriptors for peripherals
    section_device_ro(Sect_Device_RO, region);
    section_device_rw(Sect_Device_RW, region);
@@ -226,7 +236,7 @@ void MMU_CreateTranslationTable(void)
    region.g_t    = GLOBAL;
    region.mem_t  = NORMAL;
    region.sec_t  = SECURE;
-   region.sh_t   = SHARED;
+   region.sh_t   = NON_SHARED; // shareable WB is not cached while SMP = 0
 
    /* Code L2 pages. */
    region.inner_norm_t = WB_WA;
@@ -281,8 +291,18 @@ void MMU_CreateTranslationTable(void)
    MMU_TTSection(ttb_addr, (uint32_t)FMC_NAND_MEM_BASE, 256U, Sect_Device_RW);
 
    // All DDR (1GB) Executable, Cacheable & RW - applications may choose to
-   // divide memory into RO executable
-   MMU_TTSection(ttb_addr, (uint32_t)DRAM_MEM_BASE, 1024U, Sect_Normal_Shared);
+   // divide memory into RO executable. Non-shareable, since a shareable
+   // section would be treated as non-cacheable while ACTLR.SMP = 0.
+   MMU_TTSection(ttb_addr, (uint32_t)DRAM_MEM_BASE, 1024U, Sect_Normal);
+
+   // DMA buffers in DDR: non-cacheable, so no cache maintenance is needed
+   if ((&__DMA_NC_START__ != NULL) && (&__DMA_NC_END__ > &__DMA_NC_START__)) {
+      MMU_TTSection(ttb_addr, (uint32_t)&__DMA_NC_START__,
+                    ((uint32_t)&__DMA_NC_END__ - (uint32_t)&__DMA_NC_START__ +
+                     PAGE_1MB_MASK) >>
+                        20,
+                    Sect_Normal_NC);
+   }
 
    //-------------------- SYSRAM ------------------
    // Create (256 * 4k)=1MB faulting entries to cover SYSRAM 1M aligned range
@@ -292,8 +312,7 @@ void MMU_CreateTranslationTable(void)
    // Create (32 * 4k)=128k Normal entries to cover full SYSRAM, if the
    // executable is in SYSRAM, part of this table will be overwritten
    MMU_TTPage4k(ttb_addr, SYSRAM_BASE, 128U / 4U, Page_L1_4k,
-                (uint32_t *)sysram_table_l2_base_4k,
-                Page_4k_Normal_RW_NonCacheable);
+                (uint32_t *)sysram_table_l2_base_4k, Page_4k_Normal_RW);
 
    //-------------------- SRAM ------------------
    // Create (256 * 4k)=1MB faulting entries to cover SRAM 1M aligned range
@@ -369,7 +388,7 @@ void MMU_CreateTranslationTable(void)
       // to be done again because this is not the same L2 page table)
       MMU_TTPage4k(ttb_addr, SYSRAM_BASE, 128U / 4U, Page_L1_4k,
                    (uint32_t *)code_and_data_table_l2_base_4k,
-                   Page_4k_Normal_RW_NonCacheable);
+                   Page_4k_Normal_RW);
 
       // Create Normal, executable+RO entries to cover Code
       pageNum =
@@ -384,7 +403,7 @@ void MMU_CreateTranslationTable(void)
           4096U;
       MMU_TTPage4k(ttb_addr, (uint32_t)rodata_start_addr, pageNum, Page_L1_4k,
                    (uint32_t *)code_and_data_table_l2_base_4k,
-                   Page_4k_Normal_RO_NonCacheable);
+                   Page_4k_Normal_RO);
    }
 
    /* Set location of level 1 page table
@@ -386,10 +386,6 @@ static void FMC_IRQHandler(void)
 {
 }
 
-static void SDMMC1_IRQHandler(void)
-{
-}
-
 static void TIM5_IRQHandler(void)
 {
 }
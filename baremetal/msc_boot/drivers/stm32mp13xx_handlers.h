@@ -8,5 +8,6 @@ void pabt_handler(void);
 void svc_handler(void);
 void undef_handler(void);
 void OTG_IRQHandler(void);
+void SDMMC1_IRQHandler(void);
 void SecurePhysicalTimer_IRQHandler(void);
 void irq_handler(void);
@@ -0,0 +1,384 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file replay.c
+ * @brief Replay recorded Bulk-Only Transport traffic through the MSC stack
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * The trace is the byte stream the host sent on the bulk OUT endpoint: each
+ * 31-byte CBW, followed by dDataLength bytes of data for host-to-device
+ * commands (see scripts/mkreplay.py). The driver plays the USB host against
+ * the fake device driver in usbd_host.c, following the BOT rules for short
+ * packets, stalls and reset recovery, and reports the time each command
+ * spends in the stack, the longest endpoint interrupt, and how many bytes
+ * the stack copies per byte it transfers.
+ */
+
+#include "evlog.h"
+#include "storage_file.h"
+#include "usbd_core.h"
+#include "usbd_host.h"
+#include "usbd_msc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HS_MPS      512U
+#define CSW_SIG     0x53425355U
+#define MAX_STEPS   1000000U
+#define STATUS_NONE 0xFFU // command lost, no CSW
+
+struct op_stats {
+   uint32_t cmds;
+   uint32_t failed;
+   uint64_t bytes;
+   uint64_t ns;
+   uint64_t ns_min;
+   uint64_t ns_max;
+};
+
+static USBD_HandleTypeDef dev;
+static struct op_stats ops[256];
+static uint64_t wire_bytes;
+static uint64_t irq_ns_max;
+static int verbose;
+
+static uint64_t now_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+   return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+          ((uint32_t)p[3] << 24);
+}
+
+static void setup(uint8_t bm, uint8_t req, uint16_t value, uint16_t index)
+{
+   uint8_t pkt[8] = {bm,
+                     req,
+                     (uint8_t)value,
+                     (uint8_t)(value >> 8),
+                     (uint8_t)index,
+                     (uint8_t)(index >> 8),
+                     0,
+                     0};
+
+   USBD_LL_SetupStage(&dev, pkt);
+}
+
+static void clear_halt(uint8_t ep)
+{
+   setup(0x02, USB_REQ_CLEAR_FEATURE, USB_FEATURE_EP_HALT, ep);
+}
+
+static void reset_recovery(void)
+{
+   setup(0x21, BOT_RESET, 0, 0);
+   clear_halt(MSC_EPIN_ADDR);
+   clear_halt(MSC_EPOUT_ADDR);
+}
+
+// endpoint interrupt, then the main loop's share of the work
+static void data_stage(uint8_t ep_addr, uint8_t *buf)
+{
+   const uint64_t t0 = now_ns();
+
+   if ((ep_addr & 0x80U) != 0U)
+      USBD_LL_DataInStage(&dev, ep_addr & 0x7FU, buf);
+   else
+      USBD_LL_DataOutStage(&dev, ep_addr, buf);
+
+   const uint64_t ns = now_ns() - t0;
+   if (ns > irq_ns_max)
+      irq_ns_max = ns;
+
+#if (MSC_DEFER_ENABLE == 1U)
+   USBD_MSC_Process(&dev);
+#endif
+}
+
+static void enumerate(void)
+{
+   USBD_LL_Reset(&dev);
+   USBD_LL_SetSpeed(&dev, USBD_SPEED_HIGH);
+   setup(0x00, USB_REQ_SET_ADDRESS, 1, 0);
+   setup(0x00, USB_REQ_SET_CONFIGURATION, 1, 0);
+}
+
+// hand the device one IN transfer; returns its length
+static uint32_t take_in(struct usbd_host_ep *in)
+{
+   uint32_t len = in->len;
+
+   in->armed = 0U;
+   wire_bytes += len;
+   data_stage(MSC_EPIN_ADDR, in->buf);
+   return len;
+}
+
+// run one BOT command to its CSW; returns the CSW status or STATUS_NONE
+static uint8_t run_cmd(const uint8_t *cbw, const uint8_t *out_data)
+{
+   struct usbd_host_ep *in  = &usbd_host_in[MSC_EPIN_ADDR & 0xFU];
+   struct usbd_host_ep *out = &usbd_host_out[MSC_EPOUT_ADDR & 0xFU];
+   const uint32_t dlen      = get_le32(&cbw[8]);
+   const int dir_in         = (cbw[12] & 0x80U) != 0U;
+   uint32_t done            = 0U;
+   int data_phase           = dlen != 0U;
+   int stalls               = 0;
+
+   if (!out->armed || (out->len < USBD_BOT_CBW_LENGTH)) {
+      fprintf(stderr, "device not waiting for a CBW\n");
+      return STATUS_NONE;
+   }
+
+   memcpy(out->buf, cbw, USBD_BOT_CBW_LENGTH);
+   out->count = USBD_BOT_CBW_LENGTH;
+   out->armed = 0U;
+   data_stage(MSC_EPOUT_ADDR, out->buf);
+
+   for (uint32_t step = 0U; step < MAX_STEPS; step++) {
+      if (data_phase && dir_in) {
+         if (in->stall) {
+            clear_halt(MSC_EPIN_ADDR);
+            data_phase = 0;
+         } else if (in->armed) {
+            const uint32_t len = take_in(in);
+            done += len;
+            if ((done >= dlen) || ((len % HS_MPS) != 0U) || (len == 0U))
+               data_phase = 0;
+         } else {
+            break;
+         }
+      } else if (data_phase) {
+         if (out->stall) {
+            clear_halt(MSC_EPOUT_ADDR);
+            data_phase = 0;
+         } else if (out->armed) {
+            uint32_t n = dlen - done;
+            if (n > out->len)
+               n = out->len;
+            memcpy(out->buf, &out_data[done], n);
+            out->count = n;
+            out->armed = 0U;
+            done += n;
+            wire_bytes += n;
+            if (done >= dlen)
+               data_phase = 0;
+            data_stage(MSC_EPOUT_ADDR, out->buf);
+         } else {
+            break;
+         }
+      } else {
+         // status phase: a stall here is retried once, then reset recovery
+         if (in->stall) {
+            if (++stalls > 1)
+               break;
+            clear_halt(MSC_EPIN_ADDR);
+         } else if (in->armed) {
+            const uint8_t *csw = in->buf;
+            const uint32_t len = take_in(in);
+            if ((len != USBD_BOT_CSW_LENGTH) || (get_le32(csw) != CSW_SIG) ||
+                (get_le32(&csw[4]) != get_le32(&cbw[4]))) {
+               fprintf(stderr, "bad CSW (%u bytes)\n", len);
+               break;
+            }
+            return csw[12];
+         } else {
+            break;
+         }
+      }
+   }
+
+   reset_recovery();
+   return STATUS_NONE;
+}
+
+static void record(const uint8_t *cbw, uint8_t status, uint64_t ns,
+                   uint32_t idx)
+{
+   struct op_stats *op = &ops[cbw[15]];
+   const uint32_t dlen = get_le32(&cbw[8]);
+
+   if ((op->cmds == 0U) || (ns < op->ns_min))
+      op->ns_min = ns;
+   if (ns > op->ns_max)
+      op->ns_max = ns;
+   op->cmds++;
+   op->ns += ns;
+   if (status != USBD_CSW_CMD_PASSED)
+      op->failed++;
+   else
+      op->bytes += dlen;
+
+   if (verbose)
+      printf("%u,0x%02x,%u,%u,%.3f\n", idx, cbw[15], dlen, status,
+             (double)ns / 1000.0);
+}
+
+static void report(uint64_t elapsed_ns)
+{
+   const struct storage_file_stats *s = storage_file_get_stats();
+   uint64_t data_bytes                = 0U;
+   uint32_t cmds                      = 0U;
+   uint32_t failed                    = 0U;
+
+   printf("opcode    cmds  failed        MB   min us   avg us   max us\n");
+   for (unsigned i = 0; i < 256U; i++) {
+      const struct op_stats *op = &ops[i];
+      if (op->cmds == 0U)
+         continue;
+      printf("  0x%02x %7u %7u %9.2f %8.2f %8.2f %8.2f\n", i, op->cmds,
+             op->failed, (double)op->bytes / 1e6, (double)op->ns_min / 1e3,
+             (double)op->ns / op->cmds / 1e3, (double)op->ns_max / 1e3);
+      cmds += op->cmds;
+      failed += op->failed;
+      data_bytes += op->bytes;
+   }
+
+   printf("%u commands, %u failed, %.2f MB in %.3f s (%.1f MB/s in the "
+          "stack)\n",
+          cmds, failed, (double)data_bytes / 1e6, (double)elapsed_ns / 1e9,
+          (elapsed_ns == 0U) ? 0.0
+                             : (double)data_bytes * 1e3 / (double)elapsed_ns);
+   printf("%llu bytes on the wire, %llu copied: %.3f bytes copied per byte "
+          "transferred, %u syncs\n",
+          (unsigned long long)wire_bytes, (unsigned long long)s->copy_bytes,
+          (wire_bytes == 0U) ? 0.0
+                             : (double)s->copy_bytes / (double)wire_bytes,
+          s->syncs);
+   printf("longest endpoint interrupt: %.2f us\n", (double)irq_ns_max / 1e3);
+}
+
+static uint8_t *load(const char *path, size_t *size)
+{
+   FILE *f = fopen(path, "rb");
+   uint8_t *buf;
+   long len;
+
+   if (f == NULL) {
+      perror(path);
+      return NULL;
+   }
+
+   if ((fseek(f, 0, SEEK_END) != 0) || ((len = ftell(f)) < 0) ||
+       (fseek(f, 0, SEEK_SET) != 0)) {
+      perror(path);
+      fclose(f);
+      return NULL;
+   }
+
+   buf = malloc((size_t)len + 1U);
+   if ((buf == NULL) || (fread(buf, 1, (size_t)len, f) != (size_t)len)) {
+      fprintf(stderr, "%s: read failed\n", path);
+      free(buf);
+      fclose(f);
+      return NULL;
+   }
+
+   fclose(f);
+   *size = (size_t)len;
+   return buf;
+}
+
+static void usage(const char *prog)
+{
+   fprintf(stderr,
+           "usage: %s [-d] [-n repeat] [-v] image trace\n"
+           "  -d  serve the image through GetBuffer (zero-copy)\n"
+           "  -n  replay the trace this many times\n"
+           "  -v  print idx,opcode,bytes,status,us for every command\n",
+           prog);
+}
+
+int main(int argc, char **argv)
+{
+   int direct      = 0;
+   unsigned repeat = 1U;
+   uint32_t idx    = 0U;
+   uint8_t *trace;
+   size_t trace_len;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "dn:v")) != -1) {
+      switch (opt) {
+         case 'd': direct = 1; break;
+         case 'n': repeat = (unsigned)strtoul(optarg, NULL, 0); break;
+         case 'v': verbose = 1; break;
+         default: usage(argv[0]); return 2;
+      }
+   }
+
+   if (argc - optind != 2) {
+      usage(argv[0]);
+      return 2;
+   }
+
+   if (storage_file_open(argv[optind], direct) != 0)
+      return 1;
+
+   trace = load(argv[optind + 1], &trace_len);
+   if (trace == NULL)
+      return 1;
+
+   USBD_Init(&dev, NULL, 0);
+   USBD_RegisterClass(&dev, USBD_MSC_CLASS);
+   USBD_MSC_RegisterStorage(&dev, &storage_file_fops);
+   USBD_Start(&dev);
+   enumerate();
+
+   if (verbose)
+      printf("idx,opcode,bytes,status,us\n");
+
+   const uint64_t t_start = now_ns();
+
+   for (unsigned r = 0U; r < repeat; r++) {
+      size_t pos = 0U;
+
+      while (pos + USBD_BOT_CBW_LENGTH <= trace_len) {
+         const uint8_t *cbw  = &trace[pos];
+         const uint32_t dlen = get_le32(&cbw[8]);
+         const uint8_t *data = &cbw[USBD_BOT_CBW_LENGTH];
+
+         if (get_le32(cbw) != USBD_BOT_CBW_SIGNATURE) {
+            fprintf(stderr, "trace offset %zu: not a CBW\n", pos);
+            return 1;
+         }
+
+         pos += USBD_BOT_CBW_LENGTH;
+         if ((cbw[12] & 0x80U) == 0U) {
+            if (dlen > trace_len - pos) {
+               fprintf(stderr, "trace offset %zu: data truncated\n", pos);
+               return 1;
+            }
+            pos += dlen;
+         }
+
+         const uint64_t t0    = now_ns();
+         const uint8_t status = run_cmd(cbw, data);
+         record(cbw, status, now_ns() - t0, idx++);
+      }
+   }
+
+   evlog_drain();
+   report(now_ns() - t_start);
+
+   USBD_Stop(&dev);
+   USBD_DeInit(&dev);
+#if (MSC_DEFER_ENABLE == 1U)
+   // the write-back the unplug left for the main loop
+   USBD_MSC_Process(&dev);
+#endif
+   storage_file_close();
+   free(trace);
+   return 0;
+}
+
+// end file replay.c
@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file storage_file.c
+ * @brief File-backed MSC storage for the host build
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * A single LUN backed by an image file mapped into memory. Every byte moved
+ * by Read and Write is counted, so the replay driver can report how many
+ * bytes the stack copies per byte it transfers.
+ */
+
+#include "storage_file.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BLK_SIZE    512U
+#define STAGING_SIZ 0x800000U
+
+static struct {
+   int fd;
+   uint8_t *mem;
+   uint32_t blk_nbr;
+   int direct;
+   struct storage_file_stats stats;
+} sf = {.fd = -1};
+
+static uint8_t inquiry[STANDARD_INQUIRY_DATA_LEN] = {
+    0x00, 0x80, 0x05, 0x02, (STANDARD_INQUIRY_DATA_LEN - 5),
+    0x00, 0x00, 0x00, 'S',  'T',  'M',  ' ',  ' ',  ' ',  ' ',  ' ',
+    'H',  'o',  's',  't',  ' ',  'i',  'm',  'a',  'g',  'e',  ' ',
+    ' ',  ' ',  ' ',  ' ',  ' ',  '0',  '.',  '0',  '1'};
+
+int storage_file_open(const char *path, int direct)
+{
+   struct stat st;
+
+   sf.fd = open(path, O_RDWR);
+   if (sf.fd < 0) {
+      perror(path);
+      return -1;
+   }
+
+   if ((fstat(sf.fd, &st) != 0) || (st.st_size < (off_t)BLK_SIZE)) {
+      fprintf(stderr, "%s: not a usable image\n", path);
+      close(sf.fd);
+      return -1;
+   }
+
+   sf.blk_nbr = (uint32_t)(st.st_size / BLK_SIZE);
+   sf.mem     = mmap(NULL, (size_t)sf.blk_nbr * BLK_SIZE,
+                     PROT_READ | PROT_WRITE, MAP_SHARED, sf.fd, 0);
+   if (sf.mem == MAP_FAILED) {
+      perror("mmap");
+      close(sf.fd);
+      return -1;
+   }
+
+   sf.direct = direct;
+   memset(&sf.stats, 0, sizeof(sf.stats));
+   return 0;
+}
+
+void storage_file_close(void)
+{
+   if (sf.fd < 0)
+      return;
+
+   munmap(sf.mem, (size_t)sf.blk_nbr * BLK_SIZE);
+   close(sf.fd);
+   sf.fd = -1;
+}
+
+const struct storage_file_stats *storage_file_get_stats(void)
+{
+   return &sf.stats;
+}
+
+static int check_range(uint32_t blk_addr, uint32_t blk_len)
+{
+   return (blk_addr > sf.blk_nbr) || (blk_len > sf.blk_nbr - blk_addr);
+}
+
+static uint8_t storage_init(uint8_t lun)
+{
+   (void)lun;
+   return 0;
+}
+
+static uint8_t storage_get_capacity(uint8_t lun, uint32_t *block_num,
+                                    uint16_t *block_size)
+{
+   (void)lun;
+   *block_num  = sf.blk_nbr;
+   *block_size = BLK_SIZE;
+   return 0;
+}
+
+static uint8_t storage_is_ready(uint8_t lun)
+{
+   (void)lun;
+   return (sf.fd < 0) ? 1U : 0U;
+}
+
+static uint8_t storage_is_write_protected(uint8_t lun)
+{
+   (void)lun;
+   return 0;
+}
+
+static uint8_t storage_read(uint8_t lun, uint8_t *buf, uint32_t blk_addr,
+                            uint16_t blk_len)
+{
+   (void)lun;
+
+   if (check_range(blk_addr, blk_len))
+      return 1;
+
+   memcpy(buf, &sf.mem[(size_t)blk_addr * BLK_SIZE],
+          (size_t)blk_len * BLK_SIZE);
+   sf.stats.copy_bytes += (uint64_t)blk_len * BLK_SIZE;
+   return 0;
+}
+
+static uint8_t storage_write(uint8_t lun, uint8_t *buf, uint32_t blk_addr,
+                             uint16_t blk_len)
+{
+   (void)lun;
+
+   if (check_range(blk_addr, blk_len))
+      return 1;
+
+   memcpy(&sf.mem[(size_t)blk_addr * BLK_SIZE], buf,
+          (size_t)blk_len * BLK_SIZE);
+   sf.stats.copy_bytes += (uint64_t)blk_len * BLK_SIZE;
+   return 0;
+}
+
+static uint8_t storage_get_max_lun(void)
+{
+   return 0;
+}
+
+static uint8_t storage_get_buffer(uint8_t lun, uint32_t blk_addr,
+                                  uint32_t blk_len, uint8_t **pbuf,
+                                  uint32_t *len)
+{
+   (void)lun;
+
+   if (!sf.direct || check_range(blk_addr, blk_len))
+      return 1;
+
+   *pbuf = &sf.mem[(size_t)blk_addr * BLK_SIZE];
+   *len  = blk_len * BLK_SIZE;
+   return 0;
+}
+
+static uint8_t storage_sync(uint8_t lun)
+{
+   (void)lun;
+
+   sf.stats.syncs++;
+   return (msync(sf.mem, (size_t)sf.blk_nbr * BLK_SIZE, MS_SYNC) == 0) ? 0U
+                                                                       : 1U;
+}
+
+static uint8_t *storage_get_staging(uint32_t *len)
+{
+   static uint8_t staging[STAGING_SIZ];
+
+   *len = STAGING_SIZ;
+   return staging;
+}
+
+// unmapped blocks read as zeros, like a sparse file with holes punched
+static uint8_t storage_unmap(uint8_t lun, uint32_t blk_addr, uint32_t blk_len)
+{
+   (void)lun;
+
+   if (check_range(blk_addr, blk_len))
+      return 1;
+
+   memset(&sf.mem[(size_t)blk_addr * BLK_SIZE], 0, (size_t)blk_len * BLK_SIZE);
+   return 0;
+}
+
+static uint8_t storage_get_unmap(uint8_t lun, uint8_t *zeroes)
+{
+   (void)lun;
+
+   *zeroes = 1U;
+   return 0;
+}
+
+// writes land in the page cache of the mapping until storage_sync()
+static uint8_t storage_get_write_cache(uint8_t lun)
+{
+   (void)lun;
+
+   return 1U;
+}
+
+USBD_StorageTypeDef storage_file_fops = {
+    storage_init,
+    storage_get_capacity,
+    storage_is_ready,
+    storage_is_write_protected,
+    storage_read,
+    storage_write,
+    storage_get_max_lun,
+    inquiry,
+    storage_get_buffer,
+    storage_sync,
+    storage_get_staging,
+    storage_unmap,
+    storage_get_unmap,
+    storage_get_write_cache,
+};
+
+// end file storage_file.c
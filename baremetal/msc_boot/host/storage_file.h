@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file storage_file.h
+ * @brief File-backed MSC storage for the host build
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ */
+
+#ifndef STORAGE_FILE_H
+#define STORAGE_FILE_H
+
+#include "usbd_msc.h"
+#include <stdint.h>
+
+struct storage_file_stats {
+   uint64_t copy_bytes; // bytes memcpy'd between the image and the class
+   uint32_t syncs;
+};
+
+// direct != 0 offers GetBuffer, like the DDR LUN on the board; otherwise all
+// data goes through Read/Write, like the SD LUN
+int storage_file_open(const char *path, int direct);
+void storage_file_close(void);
+const struct storage_file_stats *storage_file_get_stats(void);
+
+extern USBD_StorageTypeDef storage_file_fops;
+
+#endif // STORAGE_FILE_H
+
+// end file storage_file.h
@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file usbd_host.c
+ * @brief Fake USB device driver for running the MSC stack on a Linux host
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * Takes the place of usbd_conf.c: instead of programming the OTG core, every
+ * USBD_LL_* call only records the transfer in usbd_host_in[] or
+ * usbd_host_out[]. The replay driver plays the USB host, moves the data and
+ * reports completion through USBD_LL_DataInStage() and
+ * USBD_LL_DataOutStage(), just like the PCD callbacks do on the board.
+ */
+
+#include "usbd_host.h"
+#include "setup.h"
+#include "usbd_core.h"
+#include "usbd_msc.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+struct usbd_host_ep usbd_host_in[16];
+struct usbd_host_ep usbd_host_out[16];
+
+static struct usbd_host_ep *get_ep(uint8_t ep_addr)
+{
+   if ((ep_addr & 0x80U) != 0U)
+      return &usbd_host_in[ep_addr & 0xFU];
+   return &usbd_host_out[ep_addr & 0xFU];
+}
+
+USBD_StatusTypeDef USBD_LL_Init(USBD_HandleTypeDef *pdev)
+{
+   pdev->pData = NULL;
+   memset(usbd_host_in, 0, sizeof(usbd_host_in));
+   memset(usbd_host_out, 0, sizeof(usbd_host_out));
+   return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_DeInit(USBD_HandleTypeDef *pdev)
+{
+   (void)pdev;
+   return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_Start(USBD_HandleTypeDef *pdev)
+{
+   (void)pdev;
+   return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_Stop(USBD_HandleTypeDef *pdev)
+{
+   (void)pdev;
+   return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_OpenEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr,
+                                  uint8_t ep_type, uint16_t ep_mps)
+{
+   (void)pdev;
+   (void)ep_type;
+   (void)ep_mps;
+
+   struct usbd_host_ep *ep = get_ep(ep_addr);
+   memset(ep, 0, sizeof(*ep));
+   ep->open = 1U;
+   return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_CloseEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+   (void)pdev;
+   memset(get_ep(ep_addr), 0, sizeof(struct usbd_host_ep));
+   return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_FlushEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+   (void)pdev;
+   (void)ep_addr;
+   return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_StallEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+   (void)pdev;
+   get_ep(ep_addr)->stall = 1U;
+   return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_ClearStallEP(USBD_HandleTypeDef *pdev,
+                                        uint8_t ep_addr)
+{
+   (void)pdev;
+   get_ep(ep_addr)->stall = 0U;
+   return USBD_OK;
+}
+
+uint8_t USBD_LL_IsStallEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+   (void)pdev;
+   return get_ep(ep_addr)->stall;
+}
+
+USBD_StatusTypeDef USBD_LL_SetUSBAddress(USBD_HandleTypeDef *pdev,
+                                         uint8_t dev_addr)
+{
+   (void)pdev;
+   (void)dev_addr;
+   return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_Transmit(USBD_HandleTypeDef *pdev, uint8_t ep_addr,
+                                    uint8_t *pbuf, uint32_t size)
+{
+   (void)pdev;
+
+   struct usbd_host_ep *ep = get_ep(ep_addr | 0x80U);
+   ep->buf                 = pbuf;
+   ep->len                 = size;
+   ep->armed               = 1U;
+   return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_PrepareReceive(USBD_HandleTypeDef *pdev,
+                                          uint8_t ep_addr, uint8_t *pbuf,
+                                          uint32_t size)
+{
+   (void)pdev;
+
+   struct usbd_host_ep *ep = get_ep(ep_addr & 0x7FU);
+   ep->buf                 = pbuf;
+   ep->len                 = size;
+   ep->count               = 0U;
+   ep->armed               = 1U;
+   return USBD_OK;
+}
+
+uint32_t USBD_LL_GetRxDataSize(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+   (void)pdev;
+   return get_ep(ep_addr & 0x7FU)->count;
+}
+
+void *USBD_static_malloc(uint32_t size)
+{
+   (void)size;
+
+   static uint32_t mem[(sizeof(USBD_MSC_BOT_HandleTypeDef) / 4) + 1];
+
+   memset(mem, 0, sizeof(mem));
+   return mem;
+}
+
+void USBD_static_free(void *p)
+{
+   (void)p;
+}
+
+uint32_t get_time_us(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint32_t)((uint64_t)ts.tv_sec * 1000000U + ts.tv_nsec / 1000U);
+}
+
+uint32_t USBD_LL_GetTimeUs(void)
+{
+   return get_time_us();
+}
+
+// output of the tiny printf used by evlog_drain()
+void _putchar(char character)
+{
+   putchar(character);
+}
+
+void USBD_LL_Delay(uint32_t Delay)
+{
+   (void)Delay;
+}
+
+// end file usbd_host.c
@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file usbd_host.h
+ * @brief Fake USB device driver for running the MSC stack on a Linux host
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ */
+
+#ifndef USBD_HOST_H
+#define USBD_HOST_H
+
+#include <stdint.h>
+
+// transfer the class has queued on an endpoint, as the PCD would hold it
+struct usbd_host_ep {
+   uint8_t *buf;
+   uint32_t len;   // bytes to send (IN) or room in buf (OUT)
+   uint32_t count; // bytes received (OUT)
+   uint8_t armed;
+   uint8_t stall;
+   uint8_t open;
+};
+
+extern struct usbd_host_ep usbd_host_in[16];
+extern struct usbd_host_ep usbd_host_out[16];
+
+#endif // USBD_HOST_H
+
+// end file usbd_host.h
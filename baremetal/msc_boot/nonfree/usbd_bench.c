@@ -0,0 +1,562 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file usbd_bench.c
+ * @brief Vendor bulk source/sink/loopback class for USB throughput tests
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * In the spirit of the Linux "gadget zero": one vendor-specific interface
+ * with a bulk IN and a bulk OUT endpoint, and a vendor request selecting
+ * the mode and the transfer size. The source mode sends transfers back to
+ * back from a DDR buffer holding the "mod 63" pattern, the sink mode
+ * receives and discards them, and the loopback mode sends each received
+ * transfer back. No media and no SCSI are involved, so the result is the
+ * ceiling for what the OTG FIFOs, DMA and interrupt handling allow.
+ *
+ * Unlike the MSC and fastboot classes, the endpoints are rearmed directly
+ * in the interrupt: there is no work to defer, and going through the main
+ * loop would measure the main loop.
+ *
+ * GET_STATS returns the device's counters: bytes and transfers since the
+ * last SET_MODE, the rate over the last full second, and the time from
+ * arming a transfer to its completion.
+ */
+
+#include "usbd_bench.h"
+#include "stm32mp13xx_hal_def.h"
+#include "usbd_core.h"
+#include "usbd_ctlreq.h"
+#include <string.h>
+
+uint8_t USBD_BENCH_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+uint8_t USBD_BENCH_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+uint8_t USBD_BENCH_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req);
+uint8_t USBD_BENCH_EP0_RxReady(USBD_HandleTypeDef *pdev);
+uint8_t USBD_BENCH_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum);
+uint8_t USBD_BENCH_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum);
+uint8_t *USBD_BENCH_GetHSCfgDesc(uint16_t *length);
+uint8_t *USBD_BENCH_GetFSCfgDesc(uint16_t *length);
+uint8_t *USBD_BENCH_GetOtherSpeedCfgDesc(uint16_t *length);
+uint8_t *USBD_BENCH_GetDeviceQualifierDescriptor(uint16_t *length);
+
+static void BENCH_SetMaxPacket(uint16_t mps);
+static void BENCH_SetMode(USBD_HandleTypeDef *pdev, uint8_t mode,
+                          uint32_t xfer_len);
+static void BENCH_Transmit(USBD_HandleTypeDef *pdev, uint32_t len);
+static void BENCH_Receive(USBD_HandleTypeDef *pdev);
+static void BENCH_Count(USBD_BENCH_HandleTypeDef *hb, uint32_t len,
+                        uint32_t t_armed);
+
+USBD_ClassTypeDef USBD_BENCH = {
+    USBD_BENCH_Init,
+    USBD_BENCH_DeInit,
+    USBD_BENCH_Setup,
+    NULL, /*EP0_TxSent*/
+    USBD_BENCH_EP0_RxReady,
+    USBD_BENCH_DataIn,
+    USBD_BENCH_DataOut,
+    NULL, /*SOF */
+    NULL,
+    NULL,
+    USBD_BENCH_GetHSCfgDesc,
+    USBD_BENCH_GetFSCfgDesc,
+    USBD_BENCH_GetOtherSpeedCfgDesc,
+    USBD_BENCH_GetDeviceQualifierDescriptor,
+};
+
+__ALIGN_BEGIN static uint8_t
+    USBD_BENCH_CfgDesc[USB_BENCH_CONFIG_DESC_SIZ] __ALIGN_END = {
+        0x09, /* bLength: Configuration Descriptor size */
+        USB_DESC_TYPE_CONFIGURATION, /* bDescriptorType: Configuration */
+        USB_BENCH_CONFIG_DESC_SIZ,
+
+        0x00, 0x01, /* bNumInterfaces: 1 interface */
+        0x01,       /* bConfigurationValue */
+        0x00,       /* iConfiguration */
+#if (USBD_SELF_POWERED == 1U)
+        0xC0, /* bmAttributes: Bus Powered according to user configuration */
+#else
+        0x80, /* bmAttributes: Bus Powered according to user configuration */
+#endif                  /* USBD_SELF_POWERED */
+        USBD_MAX_POWER, /* MaxPower (mA) */
+
+        /********************  Benchmark interface ********************/
+        0x09, /* bLength: Interface Descriptor size */
+        0x04, /* bDescriptorType: */
+        0x00, /* bInterfaceNumber: Number of Interface */
+        0x00, /* bAlternateSetting: Alternate setting */
+        0x02, /* bNumEndpoints */
+        0xFF, /* bInterfaceClass: vendor specific */
+        0x00, /* bInterfaceSubClass */
+        0x00, /* nInterfaceProtocol */
+        0x00, /* iInterface: */
+        /********************  Benchmark Endpoints ********************/
+        0x07,            /* Endpoint descriptor length = 7 */
+        0x05,            /* Endpoint descriptor type */
+        BENCH_EPIN_ADDR, /* Endpoint address (IN, address 1) */
+        0x02,            /* Bulk endpoint type */
+        LOBYTE(BENCH_MAX_FS_PACKET), HIBYTE(BENCH_MAX_FS_PACKET),
+        0x00, /* Polling interval in milliseconds */
+
+        0x07,             /* Endpoint descriptor length = 7 */
+        0x05,             /* Endpoint descriptor type */
+        BENCH_EPOUT_ADDR, /* Endpoint address (OUT, address 1) */
+        0x02,             /* Bulk endpoint type */
+        LOBYTE(BENCH_MAX_FS_PACKET), HIBYTE(BENCH_MAX_FS_PACKET),
+        0x00, /* Polling interval in milliseconds */
+};
+
+__ALIGN_BEGIN static uint8_t
+    USBD_BENCH_DeviceQualifierDesc[USB_LEN_DEV_QUALIFIER_DESC] __ALIGN_END = {
+        USB_LEN_DEV_QUALIFIER_DESC,
+        USB_DESC_TYPE_DEVICE_QUALIFIER,
+        0x00,
+        0x02,
+        0x00,
+        0x00,
+        0x00,
+        BENCH_MAX_FS_PACKET,
+        0x01,
+        0x00,
+};
+
+/* source data and loopback buffer */
+__attribute__((section(".virtdrive"), aligned(64))) static uint8_t
+    bench_buf[BENCH_MAX_XFER];
+
+/**
+ * @brief  USBD_BENCH_Init
+ *         Open the endpoints; transfers start with SET_MODE
+ * @param  pdev: device instance
+ * @param  cfgidx: configuration index
+ * @retval status
+ */
+uint8_t USBD_BENCH_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+   UNUSED(cfgidx);
+   USBD_BENCH_HandleTypeDef *hb;
+   uint16_t mps = (pdev->dev_speed == USBD_SPEED_HIGH) ? BENCH_MAX_HS_PACKET
+                                                       : BENCH_MAX_FS_PACKET;
+
+   hb = (USBD_BENCH_HandleTypeDef *)USBD_malloc(
+       sizeof(USBD_BENCH_HandleTypeDef));
+
+   if (hb == NULL) {
+      pdev->pClassDataCmsit[pdev->classId] = NULL;
+      return (uint8_t)USBD_EMEM;
+   }
+
+   pdev->pClassDataCmsit[pdev->classId] = (void *)hb;
+   pdev->pClassData                     = pdev->pClassDataCmsit[pdev->classId];
+
+   hb->buf = bench_buf;
+
+   (void)USBD_LL_OpenEP(pdev, BENCH_EPOUT_ADDR, USBD_EP_TYPE_BULK, mps);
+   pdev->ep_out[BENCH_EPOUT_ADDR & 0xFU].is_used = 1U;
+
+   (void)USBD_LL_OpenEP(pdev, BENCH_EPIN_ADDR, USBD_EP_TYPE_BULK, mps);
+   pdev->ep_in[BENCH_EPIN_ADDR & 0xFU].is_used = 1U;
+
+   BENCH_SetMode(pdev, BENCH_IDLE, mps);
+
+   return (uint8_t)USBD_OK;
+}
+
+/**
+ * @brief  USBD_BENCH_DeInit
+ *         Close the endpoints
+ * @param  pdev: device instance
+ * @param  cfgidx: configuration index
+ * @retval status
+ */
+uint8_t USBD_BENCH_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+   UNUSED(cfgidx);
+
+   (void)USBD_LL_CloseEP(pdev, BENCH_EPOUT_ADDR);
+   pdev->ep_out[BENCH_EPOUT_ADDR & 0xFU].is_used = 0U;
+
+   (void)USBD_LL_CloseEP(pdev, BENCH_EPIN_ADDR);
+   pdev->ep_in[BENCH_EPIN_ADDR & 0xFU].is_used = 0U;
+
+   if (pdev->pClassDataCmsit[pdev->classId] != NULL) {
+      (void)USBD_free(pdev->pClassDataCmsit[pdev->classId]);
+      pdev->pClassDataCmsit[pdev->classId] = NULL;
+      pdev->pClassData                     = NULL;
+   }
+
+   return (uint8_t)USBD_OK;
+}
+
+/**
+ * @brief  USBD_BENCH_Setup
+ *         Handle the vendor requests and the standard interface requests
+ * @param  pdev: device instance
+ * @param  req: USB request
+ * @retval status
+ */
+uint8_t USBD_BENCH_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req)
+{
+   USBD_BENCH_HandleTypeDef *hb =
+       (USBD_BENCH_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   static uint8_t alt_setting;
+   uint16_t status_info   = 0U;
+   USBD_StatusTypeDef ret = USBD_OK;
+
+   if (hb == NULL) {
+      return (uint8_t)USBD_FAIL;
+   }
+
+   switch (req->bmRequest & USB_REQ_TYPE_MASK) {
+      case USB_REQ_TYPE_VENDOR:
+         if ((req->bRequest == BENCH_REQ_SET_MODE) &&
+             (req->wLength == sizeof(hb->ctrl)) &&
+             (req->wValue <= (uint16_t)BENCH_LOOPBACK)) {
+            /* applied in USBD_BENCH_EP0_RxReady() */
+            hb->ctrl_mode = (uint8_t)req->wValue;
+            (void)USBD_CtlPrepareRx(pdev, hb->ctrl, sizeof(hb->ctrl));
+         } else if (req->bRequest == BENCH_REQ_GET_STATS) {
+            (void)USBD_CtlSendData(
+                pdev, (uint8_t *)&hb->stats,
+                MIN(req->wLength, (uint16_t)sizeof(hb->stats)));
+         } else {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+         }
+         break;
+
+      case USB_REQ_TYPE_STANDARD:
+         switch (req->bRequest) {
+            case USB_REQ_GET_STATUS:
+               if (pdev->dev_state == USBD_STATE_CONFIGURED) {
+                  (void)USBD_CtlSendData(pdev, (uint8_t *)&status_info, 2U);
+               } else {
+                  USBD_CtlError(pdev, req);
+                  ret = USBD_FAIL;
+               }
+               break;
+
+            case USB_REQ_GET_INTERFACE:
+               if (pdev->dev_state == USBD_STATE_CONFIGURED) {
+                  (void)USBD_CtlSendData(pdev, &alt_setting, 1U);
+               } else {
+                  USBD_CtlError(pdev, req);
+                  ret = USBD_FAIL;
+               }
+               break;
+
+            case USB_REQ_SET_INTERFACE:
+               if ((pdev->dev_state != USBD_STATE_CONFIGURED) ||
+                   (req->wValue != 0U)) {
+                  USBD_CtlError(pdev, req);
+                  ret = USBD_FAIL;
+               }
+               break;
+
+            case USB_REQ_CLEAR_FEATURE:
+               break;
+
+            default:
+               USBD_CtlError(pdev, req);
+               ret = USBD_FAIL;
+               break;
+         }
+         break;
+
+      default:
+         USBD_CtlError(pdev, req);
+         ret = USBD_FAIL;
+         break;
+   }
+
+   return (uint8_t)ret;
+}
+
+/**
+ * @brief  USBD_BENCH_EP0_RxReady
+ *         The transfer size of SET_MODE arrived
+ * @param  pdev: device instance
+ * @retval status
+ */
+uint8_t USBD_BENCH_EP0_RxReady(USBD_HandleTypeDef *pdev)
+{
+   USBD_BENCH_HandleTypeDef *hb =
+       (USBD_BENCH_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   if (hb == NULL) {
+      return (uint8_t)USBD_FAIL;
+   }
+
+   const uint32_t len = (uint32_t)hb->ctrl[0] | ((uint32_t)hb->ctrl[1] << 8) |
+                        ((uint32_t)hb->ctrl[2] << 16) |
+                        ((uint32_t)hb->ctrl[3] << 24);
+
+   BENCH_SetMode(pdev, hb->ctrl_mode, len);
+
+   return (uint8_t)USBD_OK;
+}
+
+/**
+ * @brief  USBD_BENCH_DataIn
+ *         A transfer to the host completed: count it and start the next
+ * @param  pdev: device instance
+ * @param  epnum: endpoint index
+ * @retval status
+ */
+uint8_t USBD_BENCH_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+   USBD_BENCH_HandleTypeDef *hb =
+       (USBD_BENCH_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   if (hb == NULL) {
+      return (uint8_t)USBD_FAIL;
+   }
+
+   UNUSED(epnum);
+
+   hb->in_busy = 0U;
+   BENCH_Count(hb, hb->in_len, hb->t_in);
+
+   if (hb->stats.mode == (uint32_t)BENCH_SOURCE) {
+      BENCH_Transmit(pdev, hb->stats.xfer_len);
+   } else if (hb->stats.mode == (uint32_t)BENCH_LOOPBACK) {
+      BENCH_Receive(pdev);
+   }
+
+   return (uint8_t)USBD_OK;
+}
+
+/**
+ * @brief  USBD_BENCH_DataOut
+ *         A transfer from the host completed: count it and start the next,
+ *         or send it back
+ * @param  pdev: device instance
+ * @param  epnum: endpoint index
+ * @retval status
+ */
+uint8_t USBD_BENCH_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+   USBD_BENCH_HandleTypeDef *hb =
+       (USBD_BENCH_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   if (hb == NULL) {
+      return (uint8_t)USBD_FAIL;
+   }
+
+   const uint32_t len = USBD_LL_GetRxDataSize(pdev, epnum);
+
+   hb->out_busy = 0U;
+   BENCH_Count(hb, len, hb->t_out);
+
+   if (hb->stats.mode == (uint32_t)BENCH_SINK) {
+      BENCH_Receive(pdev);
+   } else if (hb->stats.mode == (uint32_t)BENCH_LOOPBACK) {
+      BENCH_Transmit(pdev, len);
+   }
+
+   return (uint8_t)USBD_OK;
+}
+
+/**
+ * @brief  USBD_BENCH_GetStats
+ * @param  pdev: device instance
+ * @retval counters since the last SET_MODE, NULL if not configured
+ */
+const USBD_BENCH_StatsTypeDef *USBD_BENCH_GetStats(USBD_HandleTypeDef *pdev)
+{
+   const USBD_BENCH_HandleTypeDef *hb =
+       (const USBD_BENCH_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   return (hb == NULL) ? NULL : &hb->stats;
+}
+
+/**
+ * @brief  BENCH_SetMode
+ *         Reset the counters and start the transfers of a mode. A transfer
+ *         still in flight from the previous mode is left to complete.
+ * @param  pdev: device instance
+ * @param  mode: USBD_BENCH_ModeTypeDef
+ * @param  xfer_len: bytes per transfer, clamped to 1..BENCH_MAX_XFER
+ * @retval None
+ */
+static void BENCH_SetMode(USBD_HandleTypeDef *pdev, uint8_t mode,
+                          uint32_t xfer_len)
+{
+   USBD_BENCH_HandleTypeDef *hb =
+       (USBD_BENCH_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   if (xfer_len == 0U) {
+      xfer_len = 1U;
+   }
+   if (xfer_len > BENCH_MAX_XFER) {
+      xfer_len = BENCH_MAX_XFER;
+   }
+
+   (void)memset(&hb->stats, 0, sizeof(hb->stats));
+   hb->stats.mode       = mode;
+   hb->stats.xfer_len   = xfer_len;
+   hb->stats.lat_min_us = 0xFFFFFFFFU;
+   hb->win_start        = USBD_LL_GetTimeUs();
+   hb->win_bytes        = 0U;
+
+   if (mode == (uint8_t)BENCH_SOURCE) {
+      /* the "mod 63" pattern of the Linux usbtest driver */
+      for (uint32_t i = 0U; i < xfer_len; i++) {
+         hb->buf[i] = (uint8_t)(i % 63U);
+      }
+      if (hb->in_busy == 0U) {
+         BENCH_Transmit(pdev, xfer_len);
+      }
+   } else if ((mode == (uint8_t)BENCH_SINK) ||
+              (mode == (uint8_t)BENCH_LOOPBACK)) {
+      if ((hb->out_busy == 0U) && (hb->in_busy == 0U)) {
+         BENCH_Receive(pdev);
+      }
+   }
+}
+
+/**
+ * @brief  BENCH_Transmit
+ *         Send len bytes of the buffer on bulk IN
+ * @param  pdev: device instance
+ * @param  len: bytes to send
+ * @retval None
+ */
+static void BENCH_Transmit(USBD_HandleTypeDef *pdev, uint32_t len)
+{
+   USBD_BENCH_HandleTypeDef *hb =
+       (USBD_BENCH_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   hb->in_busy = 1U;
+   hb->in_len  = len;
+   hb->t_in    = USBD_LL_GetTimeUs();
+   (void)USBD_LL_Transmit(pdev, BENCH_EPIN_ADDR, hb->buf, len);
+}
+
+/**
+ * @brief  BENCH_Receive
+ *         Arm bulk OUT for one transfer of the current size
+ * @param  pdev: device instance
+ * @retval None
+ */
+static void BENCH_Receive(USBD_HandleTypeDef *pdev)
+{
+   USBD_BENCH_HandleTypeDef *hb =
+       (USBD_BENCH_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   hb->out_busy = 1U;
+   hb->t_out    = USBD_LL_GetTimeUs();
+   (void)USBD_LL_PrepareReceive(pdev, BENCH_EPOUT_ADDR, hb->buf,
+                                hb->stats.xfer_len);
+}
+
+/**
+ * @brief  BENCH_Count
+ *         Account for a completed transfer
+ * @param  hb: class handle
+ * @param  len: bytes transferred
+ * @param  t_armed: when the transfer was armed
+ * @retval None
+ */
+static void BENCH_Count(USBD_BENCH_HandleTypeDef *hb, uint32_t len,
+                        uint32_t t_armed)
+{
+   USBD_BENCH_StatsTypeDef *s = &hb->stats;
+   const uint32_t now         = USBD_LL_GetTimeUs();
+   const uint32_t lat         = now - t_armed;
+
+   s->xfers++;
+   s->bytes += len;
+   s->lat_sum_us += lat;
+   if (lat < s->lat_min_us) {
+      s->lat_min_us = lat;
+   }
+   if (lat > s->lat_max_us) {
+      s->lat_max_us = lat;
+   }
+
+   if ((now - hb->win_start) >= 1000000U) {
+      s->rate = (uint32_t)(((s->bytes - hb->win_bytes) * 1000000U) /
+                           (now - hb->win_start));
+      hb->win_start = now;
+      hb->win_bytes = s->bytes;
+   }
+}
+
+/**
+ * @brief  USBD_BENCH_GetHSCfgDesc
+ *         return configuration descriptor
+ * @param  length : pointer data length
+ * @retval pointer to descriptor buffer
+ */
+uint8_t *USBD_BENCH_GetHSCfgDesc(uint16_t *length)
+{
+   BENCH_SetMaxPacket(BENCH_MAX_HS_PACKET);
+
+   *length = (uint16_t)sizeof(USBD_BENCH_CfgDesc);
+   return USBD_BENCH_CfgDesc;
+}
+
+/**
+ * @brief  USBD_BENCH_GetFSCfgDesc
+ *         return configuration descriptor
+ * @param  length : pointer data length
+ * @retval pointer to descriptor buffer
+ */
+uint8_t *USBD_BENCH_GetFSCfgDesc(uint16_t *length)
+{
+   BENCH_SetMaxPacket(BENCH_MAX_FS_PACKET);
+
+   *length = (uint16_t)sizeof(USBD_BENCH_CfgDesc);
+   return USBD_BENCH_CfgDesc;
+}
+
+/**
+ * @brief  USBD_BENCH_GetOtherSpeedCfgDesc
+ *         return other speed configuration descriptor
+ * @param  length : pointer data length
+ * @retval pointer to descriptor buffer
+ */
+uint8_t *USBD_BENCH_GetOtherSpeedCfgDesc(uint16_t *length)
+{
+   BENCH_SetMaxPacket(BENCH_MAX_FS_PACKET);
+
+   *length = (uint16_t)sizeof(USBD_BENCH_CfgDesc);
+   return USBD_BENCH_CfgDesc;
+}
+
+/**
+ * @brief  USBD_BENCH_GetDeviceQualifierDescriptor
+ *         return Device Qualifier descriptor
+ * @param  length : pointer data length
+ * @retval pointer to descriptor buffer
+ */
+uint8_t *USBD_BENCH_GetDeviceQualifierDescriptor(uint16_t *length)
+{
+   *length = (uint16_t)sizeof(USBD_BENCH_DeviceQualifierDesc);
+
+   return USBD_BENCH_DeviceQualifierDesc;
+}
+
+/**
+ * @brief  BENCH_SetMaxPacket
+ *         Patch wMaxPacketSize of both endpoints for the current speed
+ * @param  mps : max packet size
+ * @retval None
+ */
+static void BENCH_SetMaxPacket(uint16_t mps)
+{
+   uint16_t ptr = 0U;
+
+   while (ptr < sizeof(USBD_BENCH_CfgDesc)) {
+      if (USBD_BENCH_CfgDesc[ptr + 1U] == USB_DESC_TYPE_ENDPOINT) {
+         USBD_BENCH_CfgDesc[ptr + 4U] = LOBYTE(mps);
+         USBD_BENCH_CfgDesc[ptr + 5U] = HIBYTE(mps);
+      }
+
+      ptr += USBD_BENCH_CfgDesc[ptr];
+   }
+}
+
+// end file usbd_bench.c
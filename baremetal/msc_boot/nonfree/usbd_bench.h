@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file usbd_bench.h
+ * @brief Vendor bulk source/sink/loopback class for USB throughput tests
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ */
+
+#ifndef USBD_BENCH_H
+#define USBD_BENCH_H
+
+#include "usbd_ioreq.h"
+
+#ifndef BENCH_EPIN_ADDR
+#define BENCH_EPIN_ADDR 0x81U
+#endif /* BENCH_EPIN_ADDR */
+
+#ifndef BENCH_EPOUT_ADDR
+#define BENCH_EPOUT_ADDR 0x01U
+#endif /* BENCH_EPOUT_ADDR */
+
+#define BENCH_MAX_FS_PACKET 0x40U
+#define BENCH_MAX_HS_PACKET 0x200U
+
+/* largest transfer; the OTG core counts at most 1023 packets per transfer */
+#define BENCH_MAX_XFER 0x40000U
+
+#define USB_BENCH_CONFIG_DESC_SIZ 32U
+
+/* vendor requests to the device (bmRequestType 0x40 / 0xC0) */
+#define BENCH_REQ_SET_MODE  0x01U /* wValue: mode; data: le32 transfer size */
+#define BENCH_REQ_GET_STATS 0x02U /* data: USBD_BENCH_StatsTypeDef */
+
+typedef enum {
+   BENCH_IDLE = 0U, /* no transfers */
+   BENCH_SOURCE,    /* bulk IN only, back to back */
+   BENCH_SINK,      /* bulk OUT only, back to back */
+   BENCH_LOOPBACK,  /* each OUT transfer is sent back on IN */
+} USBD_BENCH_ModeTypeDef;
+
+/* counters since the last SET_MODE, as returned by GET_STATS */
+typedef struct {
+   uint32_t mode;
+   uint32_t xfer_len;
+   uint32_t xfers; /* completed transfers, IN and OUT */
+   uint32_t rate;  /* bytes per second over the last full second */
+   uint64_t bytes;
+   uint32_t lat_min_us; /* from arming a transfer to its completion */
+   uint32_t lat_max_us;
+   uint64_t lat_sum_us;
+} USBD_BENCH_StatsTypeDef;
+
+typedef struct {
+   USBD_BENCH_StatsTypeDef stats;
+   uint8_t ctrl[4]; /* SET_MODE data stage */
+   uint8_t ctrl_mode;
+
+   uint8_t *buf;
+   uint8_t in_busy;
+   uint8_t out_busy;
+   uint32_t in_len; /* bytes of the IN transfer */
+   uint32_t t_in;   /* when the IN transfer was armed */
+   uint32_t t_out;  /* when the OUT transfer was armed */
+
+   /* for the per-second rate */
+   uint32_t win_start;
+   uint64_t win_bytes;
+} USBD_BENCH_HandleTypeDef;
+
+extern USBD_ClassTypeDef USBD_BENCH;
+#define USBD_BENCH_CLASS &USBD_BENCH
+
+const USBD_BENCH_StatsTypeDef *USBD_BENCH_GetStats(USBD_HandleTypeDef *pdev);
+
+#endif // USBD_BENCH_H
+
+// end file usbd_bench.h
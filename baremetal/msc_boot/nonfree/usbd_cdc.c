@@ -0,0 +1,448 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file usbd_cdc.c
+ * @brief CDC-ACM (virtual serial port) USB class
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * The second function of the composite device, next to mass storage: a
+ * serial port the host sees as /dev/ttyACM0 or a COM port. Line coding is
+ * stored and reported back but otherwise ignored, since there is no UART
+ * behind the port. The host raising DTR (opening the port) starts the
+ * transmission of whatever the application has to send.
+ *
+ * As with the other classes, the interrupt only notes endpoint events and
+ * control line changes; USBD_CDC_Process() in the main loop calls the
+ * application and rearms the endpoints. The descriptors come from the
+ * composite builder, so the class is only used with USE_USBD_COMPOSITE.
+ */
+
+#include "usbd_cdc.h"
+#include "stm32mp13xx_hal_def.h"
+#include "usbd_core.h"
+#include "usbd_ctlreq.h"
+#include <string.h>
+
+#ifdef USE_USBD_COMPOSITE
+
+uint8_t USBD_CDC_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+uint8_t USBD_CDC_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+uint8_t USBD_CDC_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req);
+uint8_t USBD_CDC_EP0_RxReady(USBD_HandleTypeDef *pdev);
+uint8_t USBD_CDC_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum);
+uint8_t USBD_CDC_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum);
+
+static void CDC_GetEpAdd(USBD_HandleTypeDef *pdev);
+static void CDC_Transmit(USBD_HandleTypeDef *pdev,
+                         USBD_CDC_HandleTypeDef *hcdc,
+                         USBD_CDC_ItfTypeDef *fops);
+
+USBD_ClassTypeDef USBD_CDC = {
+    USBD_CDC_Init,
+    USBD_CDC_DeInit,
+    USBD_CDC_Setup,
+    NULL, /*EP0_TxSent*/
+    USBD_CDC_EP0_RxReady,
+    USBD_CDC_DataIn,
+    USBD_CDC_DataOut,
+    NULL, /*SOF */
+    NULL,
+    NULL,
+    NULL, /* descriptors come from the composite builder */
+    NULL,
+    NULL,
+    NULL,
+};
+
+static uint8_t CDCInEpAdd  = CDC_IN_EP;
+static uint8_t CDCOutEpAdd = CDC_OUT_EP;
+static uint8_t CDCCmdEpAdd = CDC_CMD_EP;
+
+/* port state last reported to the application through Open() */
+static uint8_t CDC_Opened;
+
+/**
+ * @brief  USBD_CDC_Init
+ *         Open the endpoints and wait for data from the host
+ * @param  pdev: device instance
+ * @param  cfgidx: configuration index
+ * @retval status
+ */
+uint8_t USBD_CDC_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+   UNUSED(cfgidx);
+   USBD_CDC_HandleTypeDef *hcdc;
+   const uint16_t mps = (pdev->dev_speed == USBD_SPEED_HIGH)
+                            ? CDC_DATA_HS_MAX_PACKET_SIZE
+                            : CDC_DATA_FS_MAX_PACKET_SIZE;
+   const uint8_t interval = (pdev->dev_speed == USBD_SPEED_HIGH)
+                                ? CDC_HS_BINTERVAL
+                                : CDC_FS_BINTERVAL;
+
+   hcdc = (USBD_CDC_HandleTypeDef *)USBD_malloc(sizeof(USBD_CDC_HandleTypeDef));
+
+   if (hcdc == NULL) {
+      pdev->pClassDataCmsit[pdev->classId] = NULL;
+      return (uint8_t)USBD_EMEM;
+   }
+
+   pdev->pClassDataCmsit[pdev->classId] = (void *)hcdc;
+   pdev->pClassData                     = pdev->pClassDataCmsit[pdev->classId];
+
+   /* 115200 8N1 until the host says otherwise */
+   hcdc->line_coding[0] = 0x00;
+   hcdc->line_coding[1] = 0xC2;
+   hcdc->line_coding[2] = 0x01;
+   hcdc->line_coding[6] = 8U;
+
+   CDC_GetEpAdd(pdev);
+
+   (void)USBD_LL_OpenEP(pdev, CDCInEpAdd, USBD_EP_TYPE_BULK, mps);
+   pdev->ep_in[CDCInEpAdd & 0xFU].is_used = 1U;
+
+   (void)USBD_LL_OpenEP(pdev, CDCOutEpAdd, USBD_EP_TYPE_BULK, mps);
+   pdev->ep_out[CDCOutEpAdd & 0xFU].is_used = 1U;
+
+   (void)USBD_LL_OpenEP(pdev, CDCCmdEpAdd, USBD_EP_TYPE_INTR,
+                        CDC_CMD_PACKET_SIZE);
+   pdev->ep_in[CDCCmdEpAdd & 0xFU].is_used   = 1U;
+   pdev->ep_in[CDCCmdEpAdd & 0xFU].bInterval = interval;
+
+   (void)USBD_LL_PrepareReceive(pdev, CDCOutEpAdd, hcdc->rx,
+                                sizeof(hcdc->rx));
+
+   return (uint8_t)USBD_OK;
+}
+
+/**
+ * @brief  USBD_CDC_DeInit
+ *         Close the endpoints
+ * @param  pdev: device instance
+ * @param  cfgidx: configuration index
+ * @retval status
+ */
+uint8_t USBD_CDC_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+   UNUSED(cfgidx);
+
+   CDC_GetEpAdd(pdev);
+
+   (void)USBD_LL_CloseEP(pdev, CDCInEpAdd);
+   pdev->ep_in[CDCInEpAdd & 0xFU].is_used = 0U;
+
+   (void)USBD_LL_CloseEP(pdev, CDCOutEpAdd);
+   pdev->ep_out[CDCOutEpAdd & 0xFU].is_used = 0U;
+
+   (void)USBD_LL_CloseEP(pdev, CDCCmdEpAdd);
+   pdev->ep_in[CDCCmdEpAdd & 0xFU].is_used   = 0U;
+   pdev->ep_in[CDCCmdEpAdd & 0xFU].bInterval = 0U;
+
+   if (pdev->pClassDataCmsit[pdev->classId] != NULL) {
+      (void)USBD_free(pdev->pClassDataCmsit[pdev->classId]);
+      pdev->pClassDataCmsit[pdev->classId] = NULL;
+      pdev->pClassData                     = NULL;
+   }
+
+   return (uint8_t)USBD_OK;
+}
+
+/**
+ * @brief  USBD_CDC_Setup
+ *         Handle the CDC class requests and the standard interface requests
+ * @param  pdev: device instance
+ * @param  req: USB request
+ * @retval status
+ */
+uint8_t USBD_CDC_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req)
+{
+   USBD_CDC_HandleTypeDef *hcdc =
+       (USBD_CDC_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   static uint8_t alt_setting;
+   uint16_t status_info   = 0U;
+   USBD_StatusTypeDef ret = USBD_OK;
+   uint16_t len;
+
+   if (hcdc == NULL) {
+      return (uint8_t)USBD_FAIL;
+   }
+
+   switch (req->bmRequest & USB_REQ_TYPE_MASK) {
+      case USB_REQ_TYPE_CLASS:
+         len = MIN(req->wLength, (uint16_t)sizeof(hcdc->ctrl));
+
+         switch (req->bRequest) {
+            case CDC_GET_LINE_CODING:
+               (void)USBD_CtlSendData(
+                   pdev, hcdc->line_coding,
+                   MIN(req->wLength, (uint16_t)sizeof(hcdc->line_coding)));
+               break;
+
+            case CDC_SET_CONTROL_LINE_STATE:
+               hcdc->line_state = LOBYTE(req->wValue);
+               break;
+
+            default:
+               if ((req->bmRequest & 0x80U) != 0U) {
+                  /* nothing else to report */
+                  USBD_CtlError(pdev, req);
+                  ret = USBD_FAIL;
+               } else if (len != 0U) {
+                  /* SET_LINE_CODING and the requests we accept but ignore;
+                   * the data stage ends in USBD_CDC_EP0_RxReady() */
+                  hcdc->ctrl_req = req->bRequest;
+                  (void)USBD_CtlPrepareRx(pdev, hcdc->ctrl, len);
+               }
+               break;
+         }
+         break;
+
+      case USB_REQ_TYPE_STANDARD:
+         switch (req->bRequest) {
+            case USB_REQ_GET_STATUS:
+               if (pdev->dev_state == USBD_STATE_CONFIGURED) {
+                  (void)USBD_CtlSendData(pdev, (uint8_t *)&status_info, 2U);
+               } else {
+                  USBD_CtlError(pdev, req);
+                  ret = USBD_FAIL;
+               }
+               break;
+
+            case USB_REQ_GET_INTERFACE:
+               if (pdev->dev_state == USBD_STATE_CONFIGURED) {
+                  (void)USBD_CtlSendData(pdev, &alt_setting, 1U);
+               } else {
+                  USBD_CtlError(pdev, req);
+                  ret = USBD_FAIL;
+               }
+               break;
+
+            case USB_REQ_SET_INTERFACE:
+               if ((pdev->dev_state != USBD_STATE_CONFIGURED) ||
+                   (req->wValue != 0U)) {
+                  USBD_CtlError(pdev, req);
+                  ret = USBD_FAIL;
+               }
+               break;
+
+            case USB_REQ_CLEAR_FEATURE:
+               break;
+
+            default:
+               USBD_CtlError(pdev, req);
+               ret = USBD_FAIL;
+               break;
+         }
+         break;
+
+      default:
+         USBD_CtlError(pdev, req);
+         ret = USBD_FAIL;
+         break;
+   }
+
+   return (uint8_t)ret;
+}
+
+/**
+ * @brief  USBD_CDC_EP0_RxReady
+ *         The data stage of a class request arrived
+ * @param  pdev: device instance
+ * @retval status
+ */
+uint8_t USBD_CDC_EP0_RxReady(USBD_HandleTypeDef *pdev)
+{
+   USBD_CDC_HandleTypeDef *hcdc =
+       (USBD_CDC_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   if (hcdc == NULL) {
+      return (uint8_t)USBD_FAIL;
+   }
+
+   if (hcdc->ctrl_req == CDC_SET_LINE_CODING) {
+      (void)memcpy(hcdc->line_coding, hcdc->ctrl, sizeof(hcdc->line_coding));
+   }
+   hcdc->ctrl_req = 0xFFU;
+
+   return (uint8_t)USBD_OK;
+}
+
+/**
+ * @brief  USBD_CDC_DataIn
+ *         A transfer to the host completed; noted for USBD_CDC_Process()
+ * @param  pdev: device instance
+ * @param  epnum: endpoint index
+ * @retval status
+ */
+uint8_t USBD_CDC_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+   USBD_CDC_HandleTypeDef *hcdc =
+       (USBD_CDC_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   if (hcdc == NULL) {
+      return (uint8_t)USBD_FAIL;
+   }
+
+   /* nothing is ever sent on the notification endpoint */
+   if (epnum == (CDCInEpAdd & 0x7FU)) {
+      hcdc->defer_in = 1U;
+   }
+
+   return (uint8_t)USBD_OK;
+}
+
+/**
+ * @brief  USBD_CDC_DataOut
+ *         Data from the host arrived; noted for USBD_CDC_Process()
+ * @param  pdev: device instance
+ * @param  epnum: endpoint index
+ * @retval status
+ */
+uint8_t USBD_CDC_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+   USBD_CDC_HandleTypeDef *hcdc =
+       (USBD_CDC_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   UNUSED(epnum);
+
+   if (hcdc == NULL) {
+      return (uint8_t)USBD_FAIL;
+   }
+
+   hcdc->defer_out = 1U;
+   return (uint8_t)USBD_OK;
+}
+
+/**
+ * @brief  USBD_CDC_Process
+ *         Handle the events noted by the interrupt and start the next
+ *         transfer to the host. Call from the main loop with the USB
+ *         interrupt masked and pdev->classId selecting this class.
+ * @param  pdev: device instance
+ * @retval number of events handled
+ */
+uint32_t USBD_CDC_Process(USBD_HandleTypeDef *pdev)
+{
+   USBD_CDC_HandleTypeDef *hcdc =
+       (USBD_CDC_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   USBD_CDC_ItfTypeDef *fops =
+       (USBD_CDC_ItfTypeDef *)pdev->pUserData[pdev->classId];
+   uint32_t n = 0U;
+
+   if (fops == NULL) {
+      return 0U;
+   }
+
+   /* the port closes with DTR, or with the configuration (reset, unplug) */
+   const uint8_t open = (hcdc != NULL) &&
+                        (pdev->dev_state == USBD_STATE_CONFIGURED) &&
+                        ((hcdc->line_state & CDC_DTR) != 0U);
+   if (open != CDC_Opened) {
+      CDC_Opened = open;
+      fops->Open(open);
+      n++;
+   }
+
+   if (hcdc == NULL) {
+      return n;
+   }
+
+   if (hcdc->defer_out != 0U) {
+      hcdc->defer_out = 0U;
+      n++;
+
+      fops->Receive(hcdc->rx, USBD_LL_GetRxDataSize(pdev, CDCOutEpAdd));
+      (void)USBD_LL_PrepareReceive(pdev, CDCOutEpAdd, hcdc->rx,
+                                   sizeof(hcdc->rx));
+   }
+
+   if (hcdc->defer_in != 0U) {
+      hcdc->defer_in = 0U;
+      n++;
+
+      if (hcdc->tx_zlp != 0U) {
+         hcdc->tx_zlp = 0U;
+      } else if (hcdc->tx_len != 0U) {
+         const uint32_t len = hcdc->tx_len;
+         const uint32_t mps = pdev->ep_in[CDCInEpAdd & 0xFU].maxpacket;
+
+         hcdc->tx_len = 0U;
+         fops->TxDone(len);
+
+         /* a transfer that fills its last packet needs a zero-length one
+          * to end the host's read */
+         if ((mps != 0U) && ((len % mps) == 0U)) {
+            hcdc->tx_zlp = 1U;
+            (void)USBD_LL_Transmit(pdev, CDCInEpAdd, NULL, 0U);
+         }
+      }
+   }
+
+   if (open != 0U) {
+      CDC_Transmit(pdev, hcdc, fops);
+   }
+
+   return n;
+}
+
+/**
+ * @brief  USBD_CDC_RegisterInterface
+ * @param  pdev: device instance
+ * @param  fops: application end of the port
+ * @retval status
+ */
+uint8_t USBD_CDC_RegisterInterface(USBD_HandleTypeDef *pdev,
+                                   USBD_CDC_ItfTypeDef *fops)
+{
+   if (fops == NULL) {
+      return (uint8_t)USBD_FAIL;
+   }
+
+   pdev->pUserData[pdev->classId] = fops;
+
+   return (uint8_t)USBD_OK;
+}
+
+/**
+ * @brief  CDC_GetEpAdd
+ *         Look up the endpoints given to this class at registration
+ * @param  pdev: device instance
+ * @retval None
+ */
+static void CDC_GetEpAdd(USBD_HandleTypeDef *pdev)
+{
+   CDCInEpAdd  = USBD_CoreGetEPAdd(pdev, USBD_EP_IN, USBD_EP_TYPE_BULK,
+                                   (uint8_t)pdev->classId);
+   CDCOutEpAdd = USBD_CoreGetEPAdd(pdev, USBD_EP_OUT, USBD_EP_TYPE_BULK,
+                                   (uint8_t)pdev->classId);
+   CDCCmdEpAdd = USBD_CoreGetEPAdd(pdev, USBD_EP_IN, USBD_EP_TYPE_INTR,
+                                   (uint8_t)pdev->classId);
+}
+
+/**
+ * @brief  CDC_Transmit
+ *         Send the next piece of application data if the endpoint is idle
+ * @param  pdev: device instance
+ * @param  hcdc: class handle
+ * @param  fops: application end of the port
+ * @retval None
+ */
+static void CDC_Transmit(USBD_HandleTypeDef *pdev,
+                         USBD_CDC_HandleTypeDef *hcdc,
+                         USBD_CDC_ItfTypeDef *fops)
+{
+   uint8_t *buf;
+
+   if ((hcdc->tx_len != 0U) || (hcdc->tx_zlp != 0U)) {
+      return;
+   }
+
+   const uint32_t len = fops->GetTx(&buf, CDC_TX_CHUNK);
+   if (len != 0U) {
+      hcdc->tx_len = len;
+      (void)USBD_LL_Transmit(pdev, CDCInEpAdd, buf, len);
+   }
+}
+
+#endif /* USE_USBD_COMPOSITE */
+
+// end file usbd_cdc.c
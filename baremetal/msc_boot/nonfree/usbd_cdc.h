@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file usbd_cdc.h
+ * @brief CDC-ACM (virtual serial port) USB class
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ */
+
+#ifndef USBD_CDC_H
+#define USBD_CDC_H
+
+#include "usbd_ioreq.h"
+
+#ifndef CDC_IN_EP
+#define CDC_IN_EP 0x83U
+#endif /* CDC_IN_EP */
+
+#ifndef CDC_OUT_EP
+#define CDC_OUT_EP 0x03U
+#endif /* CDC_OUT_EP */
+
+#ifndef CDC_CMD_EP
+#define CDC_CMD_EP 0x84U
+#endif /* CDC_CMD_EP */
+
+#define CDC_DATA_HS_MAX_PACKET_SIZE 0x200U
+#define CDC_DATA_FS_MAX_PACKET_SIZE 0x40U
+#define CDC_CMD_PACKET_SIZE         8U
+
+/* notification endpoint polling: 16 ms at either speed */
+#define CDC_HS_BINTERVAL 0x08U
+#define CDC_FS_BINTERVAL 0x10U
+
+/* largest single IN transfer; the OTG core counts at most 1023 packets */
+#ifndef CDC_TX_CHUNK
+#define CDC_TX_CHUNK 0x10000U
+#endif /* CDC_TX_CHUNK */
+
+/* class requests */
+#define CDC_SEND_ENCAPSULATED_COMMAND 0x00U
+#define CDC_GET_ENCAPSULATED_RESPONSE 0x01U
+#define CDC_SET_COMM_FEATURE          0x02U
+#define CDC_GET_COMM_FEATURE          0x03U
+#define CDC_CLEAR_COMM_FEATURE        0x04U
+#define CDC_SET_LINE_CODING           0x20U
+#define CDC_GET_LINE_CODING           0x21U
+#define CDC_SET_CONTROL_LINE_STATE    0x22U
+#define CDC_SEND_BREAK                0x23U
+
+/* SET_CONTROL_LINE_STATE: the host has the port open */
+#define CDC_DTR 0x01U
+
+/* the application end of the port; all callbacks run from
+ * USBD_CDC_Process(), i.e. from the main loop */
+typedef struct {
+   /* the host opened (DTR set) or closed the port */
+   void (*Open)(uint8_t open);
+   /* data from the host */
+   void (*Receive)(const uint8_t *buf, uint32_t len);
+   /* next contiguous data for the host, 0 if none; the buffer must stay
+    * valid until TxDone() */
+   uint32_t (*GetTx)(uint8_t **buf, uint32_t max_len);
+   /* the data from the last GetTx() has been sent */
+   void (*TxDone)(uint32_t len);
+} USBD_CDC_ItfTypeDef;
+
+typedef struct {
+   uint8_t rx[CDC_DATA_HS_MAX_PACKET_SIZE];
+   uint8_t ctrl[8]; /* class request data stage */
+   uint8_t line_coding[7];
+   uint8_t line_state; /* SET_CONTROL_LINE_STATE, read by Process */
+   uint8_t ctrl_req; /* request whose data stage is in ctrl */
+
+   uint32_t tx_len; /* in flight, 0 if idle */
+   uint8_t tx_zlp;  /* a zero-length packet ends the last transfer */
+
+   /* work noted by the interrupt for USBD_CDC_Process() */
+   volatile uint8_t defer_in;
+   volatile uint8_t defer_out;
+} USBD_CDC_HandleTypeDef;
+
+extern USBD_ClassTypeDef USBD_CDC;
+#define USBD_CDC_CLASS &USBD_CDC
+
+uint8_t USBD_CDC_RegisterInterface(USBD_HandleTypeDef *pdev,
+                                   USBD_CDC_ItfTypeDef *fops);
+uint32_t USBD_CDC_Process(USBD_HandleTypeDef *pdev);
+
+#endif // USBD_CDC_H
+
+// end file usbd_cdc.h
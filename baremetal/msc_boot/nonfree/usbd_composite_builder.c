@@ -0,0 +1,477 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file usbd_composite_builder.c
+ * @brief Configuration descriptor builder for the composite USB device
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * USBD_RegisterClassComposite() calls USBD_CMPSIT_AddClass() once per class.
+ * Each call appends the interfaces and endpoints of the class to a full-speed
+ * and a high-speed configuration descriptor, and records the interface
+ * numbers and endpoint addresses in pdev->tclasslist[] so the core can route
+ * requests and transfers to the class. Interfaces are numbered in the order
+ * the classes are registered; the endpoint addresses come from the EpAddr
+ * array passed at registration.
+ *
+ * Only the classes of this project are supported: MSC (with the UAS
+ * alternate setting if MSC_UAS_ENABLE) and CDC-ACM.
+ */
+
+#include "usbd_composite_builder.h"
+#include "stm32mp13xx_hal_def.h"
+#include "usbd_cdc.h"
+#include "usbd_msc.h"
+#include <string.h>
+
+#ifdef USE_USBD_COMPOSITE
+
+static uint8_t *USBD_CMPSIT_GetHSCfgDesc(uint16_t *length);
+static uint8_t *USBD_CMPSIT_GetFSCfgDesc(uint16_t *length);
+static uint8_t *USBD_CMPSIT_GetOtherSpeedCfgDesc(uint16_t *length);
+static uint8_t *USBD_CMPSIT_GetDeviceQualifierDescriptor(uint16_t *length);
+
+static void CMPSIT_AddConfDesc(uint8_t *desc);
+static void CMPSIT_AddBytes(uint8_t *desc, const uint8_t *src, uint16_t len);
+static void CMPSIT_AddItfDesc(uint8_t *desc, uint8_t itf, uint8_t alt,
+                              uint8_t neps, uint8_t cls, uint8_t subcls,
+                              uint8_t proto, uint8_t str);
+static void CMPSIT_AddEpDesc(uint8_t *desc, uint8_t add, uint8_t type,
+                             uint16_t mps, uint8_t interval);
+static void CMPSIT_AssignEp(USBD_HandleTypeDef *pdev, uint8_t add,
+                            uint8_t type, uint16_t size);
+static void CMPSIT_AddMSCDesc(USBD_HandleTypeDef *pdev, uint8_t *desc,
+                              uint8_t itf, uint16_t mps);
+static void CMPSIT_AddCDCDesc(USBD_HandleTypeDef *pdev, uint8_t *desc,
+                              uint8_t itf, uint16_t mps, uint8_t interval);
+
+/* the descriptor callbacks are all the core needs from this "class" */
+USBD_ClassTypeDef USBD_CMPSIT = {
+    NULL, /* Init */
+    NULL, /* DeInit */
+    NULL, /* Setup */
+    NULL, /* EP0_TxSent */
+    NULL, /* EP0_RxReady */
+    NULL, /* DataIn */
+    NULL, /* DataOut */
+    NULL, /* SOF */
+    NULL,
+    NULL,
+    USBD_CMPSIT_GetHSCfgDesc,
+    USBD_CMPSIT_GetFSCfgDesc,
+    USBD_CMPSIT_GetOtherSpeedCfgDesc,
+    USBD_CMPSIT_GetDeviceQualifierDescriptor,
+};
+
+__ALIGN_BEGIN static uint8_t
+    USBD_CMPSIT_HSCfgDesc[USBD_CMPST_MAX_CONFDESC_SZ] __ALIGN_END;
+__ALIGN_BEGIN static uint8_t
+    USBD_CMPSIT_FSCfgDesc[USBD_CMPST_MAX_CONFDESC_SZ] __ALIGN_END;
+
+__ALIGN_BEGIN static uint8_t
+    USBD_CMPSIT_DeviceQualifierDesc[USB_LEN_DEV_QUALIFIER_DESC] __ALIGN_END = {
+        USB_LEN_DEV_QUALIFIER_DESC,
+        USB_DESC_TYPE_DEVICE_QUALIFIER,
+        0x00,
+        0x02,
+        0xEF, /* bDeviceClass: miscellaneous (uses IAD) */
+        0x02, /* bDeviceSubClass: common class */
+        0x01, /* bDeviceProtocol: interface association */
+        0x40,
+        0x01,
+        0x00,
+};
+
+/* bytes of the descriptors written so far, the same at both speeds */
+static uint16_t CMPSIT_CfgLen;
+
+/**
+ * @brief  USBD_CMPSIT_AddClass
+ *         Append the descriptors of a class to the configuration descriptors
+ *         and record its interfaces and endpoints
+ * @param  pdev: device instance
+ * @param  pclass: class handle
+ * @param  class: class type
+ * @param  cfgidx: configuration index
+ * @retval 1 if the class was added, 0 otherwise
+ */
+uint8_t USBD_CMPSIT_AddClass(USBD_HandleTypeDef *pdev,
+                             USBD_ClassTypeDef *pclass,
+                             USBD_CompositeClassTypeDef class, uint8_t cfgidx)
+{
+   USBD_CompositeElementTypeDef *elem = &pdev->tclasslist[pdev->classId];
+   uint16_t start;
+   uint8_t itf;
+
+   UNUSED(pclass);
+   UNUSED(cfgidx);
+
+   if (CMPSIT_CfgLen == 0U) {
+      CMPSIT_AddConfDesc(USBD_CMPSIT_HSCfgDesc);
+      CMPSIT_AddConfDesc(USBD_CMPSIT_FSCfgDesc);
+      CMPSIT_CfgLen = USB_CONF_DESC_SIZE;
+   }
+
+   /* interfaces are numbered in order of registration */
+   itf   = USBD_CMPSIT_HSCfgDesc[4];
+   start = CMPSIT_CfgLen;
+
+   elem->ClassType = class;
+   elem->ClassId   = pdev->classId;
+   elem->NumEps    = 0U;
+   elem->NumIf     = 0U;
+
+   switch (class) {
+      case CLASS_TYPE_MSC:
+         CMPSIT_AddMSCDesc(pdev, USBD_CMPSIT_HSCfgDesc, itf, MSC_MAX_HS_PACKET);
+         CMPSIT_CfgLen = start;
+         CMPSIT_AddMSCDesc(pdev, USBD_CMPSIT_FSCfgDesc, itf, MSC_MAX_FS_PACKET);
+
+         elem->NumIf  = 1U;
+         elem->Ifs[0] = itf;
+         CMPSIT_AssignEp(pdev, elem->EpAdd[0], USBD_EP_TYPE_BULK,
+                         MSC_MAX_HS_PACKET);
+         CMPSIT_AssignEp(pdev, elem->EpAdd[1], USBD_EP_TYPE_BULK,
+                         MSC_MAX_HS_PACKET);
+#if (MSC_UAS_ENABLE == 1U)
+         CMPSIT_AssignEp(pdev, elem->EpAdd[2], USBD_EP_TYPE_BULK,
+                         MSC_MAX_HS_PACKET);
+         CMPSIT_AssignEp(pdev, elem->EpAdd[3], USBD_EP_TYPE_BULK,
+                         MSC_MAX_HS_PACKET);
+#endif /* MSC_UAS_ENABLE */
+         break;
+
+      case CLASS_TYPE_CDC:
+         CMPSIT_AddCDCDesc(pdev, USBD_CMPSIT_HSCfgDesc, itf,
+                           CDC_DATA_HS_MAX_PACKET_SIZE, CDC_HS_BINTERVAL);
+         CMPSIT_CfgLen = start;
+         CMPSIT_AddCDCDesc(pdev, USBD_CMPSIT_FSCfgDesc, itf,
+                           CDC_DATA_FS_MAX_PACKET_SIZE, CDC_FS_BINTERVAL);
+
+         elem->NumIf  = 2U;
+         elem->Ifs[0] = itf;
+         elem->Ifs[1] = itf + 1U;
+         CMPSIT_AssignEp(pdev, elem->EpAdd[0], USBD_EP_TYPE_BULK,
+                         CDC_DATA_HS_MAX_PACKET_SIZE);
+         CMPSIT_AssignEp(pdev, elem->EpAdd[1], USBD_EP_TYPE_BULK,
+                         CDC_DATA_HS_MAX_PACKET_SIZE);
+         CMPSIT_AssignEp(pdev, elem->EpAdd[2], USBD_EP_TYPE_INTR,
+                         CDC_CMD_PACKET_SIZE);
+         break;
+
+      default:
+         return 0U;
+   }
+
+   elem->Active = 1U;
+
+   /* wTotalLength and bNumInterfaces */
+   USBD_CMPSIT_HSCfgDesc[2] = LOBYTE(CMPSIT_CfgLen);
+   USBD_CMPSIT_HSCfgDesc[3] = HIBYTE(CMPSIT_CfgLen);
+   USBD_CMPSIT_HSCfgDesc[4] = (uint8_t)(itf + elem->NumIf);
+   (void)memcpy(USBD_CMPSIT_FSCfgDesc + 2U, USBD_CMPSIT_HSCfgDesc + 2U, 3U);
+
+   return 1U;
+}
+
+/**
+ * @brief  USBD_CMPST_ClearConfDesc
+ *         Forget all classes added so far
+ * @param  pdev: device instance
+ * @retval USBD_OK
+ */
+uint8_t USBD_CMPST_ClearConfDesc(USBD_HandleTypeDef *pdev)
+{
+   UNUSED(pdev);
+
+   (void)memset(USBD_CMPSIT_HSCfgDesc, 0, sizeof(USBD_CMPSIT_HSCfgDesc));
+   (void)memset(USBD_CMPSIT_FSCfgDesc, 0, sizeof(USBD_CMPSIT_FSCfgDesc));
+   CMPSIT_CfgLen = 0U;
+
+   return (uint8_t)USBD_OK;
+}
+
+/**
+ * @brief  USBD_CMPSIT_GetClassID
+ *         Find the class ID of an instance of a class type
+ * @param  pdev: device instance
+ * @param  Class: class type
+ * @param  Instance: 0 for the first instance of the type, 1 for the second...
+ * @retval class ID, or 0xFF if not registered
+ */
+uint32_t USBD_CMPSIT_GetClassID(USBD_HandleTypeDef *pdev,
+                                USBD_CompositeClassTypeDef Class,
+                                uint32_t Instance)
+{
+   uint32_t inst = 0U;
+
+   for (uint32_t i = 0U; i < pdev->NumClasses; i++) {
+      if (pdev->tclasslist[i].ClassType == Class) {
+         if (inst == Instance) {
+            return i;
+         }
+         inst++;
+      }
+   }
+
+   return 0xFFU;
+}
+
+/**
+ * @brief  USBD_CMPSIT_SetClassID
+ *         Select a class instance for the calls that use pdev->classId
+ * @param  pdev: device instance
+ * @param  Class: class type
+ * @param  Instance: 0 for the first instance of the type, 1 for the second...
+ * @retval class ID, or 0xFF (and pdev->classId unchanged) if not registered
+ */
+uint32_t USBD_CMPSIT_SetClassID(USBD_HandleTypeDef *pdev,
+                                USBD_CompositeClassTypeDef Class,
+                                uint32_t Instance)
+{
+   uint32_t id = USBD_CMPSIT_GetClassID(pdev, Class, Instance);
+
+   if (id != 0xFFU) {
+      pdev->classId = id;
+   }
+
+   return id;
+}
+
+/**
+ * @brief  USBD_CMPSIT_GetHSCfgDesc
+ *         return the high-speed configuration descriptor
+ * @param  length : pointer data length
+ * @retval pointer to descriptor buffer
+ */
+static uint8_t *USBD_CMPSIT_GetHSCfgDesc(uint16_t *length)
+{
+   *length = CMPSIT_CfgLen;
+   return USBD_CMPSIT_HSCfgDesc;
+}
+
+/**
+ * @brief  USBD_CMPSIT_GetFSCfgDesc
+ *         return the full-speed configuration descriptor
+ * @param  length : pointer data length
+ * @retval pointer to descriptor buffer
+ */
+static uint8_t *USBD_CMPSIT_GetFSCfgDesc(uint16_t *length)
+{
+   *length = CMPSIT_CfgLen;
+   return USBD_CMPSIT_FSCfgDesc;
+}
+
+/**
+ * @brief  USBD_CMPSIT_GetOtherSpeedCfgDesc
+ *         return the other speed configuration descriptor; only asked for
+ *         when running at high speed
+ * @param  length : pointer data length
+ * @retval pointer to descriptor buffer
+ */
+static uint8_t *USBD_CMPSIT_GetOtherSpeedCfgDesc(uint16_t *length)
+{
+   *length = CMPSIT_CfgLen;
+   return USBD_CMPSIT_FSCfgDesc;
+}
+
+/**
+ * @brief  USBD_CMPSIT_GetDeviceQualifierDescriptor
+ *         return Device Qualifier descriptor
+ * @param  length : pointer data length
+ * @retval pointer to descriptor buffer
+ */
+static uint8_t *USBD_CMPSIT_GetDeviceQualifierDescriptor(uint16_t *length)
+{
+   *length = (uint16_t)sizeof(USBD_CMPSIT_DeviceQualifierDesc);
+   return USBD_CMPSIT_DeviceQualifierDesc;
+}
+
+/**
+ * @brief  CMPSIT_AddConfDesc
+ *         Write the configuration descriptor header with no interfaces
+ * @param  desc: configuration descriptor buffer
+ * @retval None
+ */
+static void CMPSIT_AddConfDesc(uint8_t *desc)
+{
+   desc[0] = USB_CONF_DESC_SIZE;          /* bLength */
+   desc[1] = USB_DESC_TYPE_CONFIGURATION; /* bDescriptorType */
+   desc[2] = USB_CONF_DESC_SIZE;          /* wTotalLength */
+   desc[3] = 0x00;
+   desc[4] = 0x00; /* bNumInterfaces */
+   desc[5] = 0x01; /* bConfigurationValue */
+   desc[6] = 0x04; /* iConfiguration */
+#if (USBD_SELF_POWERED == 1U)
+   desc[7] = 0xC0; /* bmAttributes: self powered */
+#else
+   desc[7] = 0x80; /* bmAttributes: bus powered */
+#endif /* USBD_SELF_POWERED */
+   desc[8] = USBD_MAX_POWER;
+}
+
+/**
+ * @brief  CMPSIT_AddBytes
+ *         Append raw bytes to a configuration descriptor
+ * @param  desc: configuration descriptor buffer
+ * @param  src: bytes to append
+ * @param  len: number of bytes
+ * @retval None
+ */
+static void CMPSIT_AddBytes(uint8_t *desc, const uint8_t *src, uint16_t len)
+{
+   if ((CMPSIT_CfgLen + len) > USBD_CMPST_MAX_CONFDESC_SZ) {
+      USBD_ErrLog("composite descriptor overflow");
+      return;
+   }
+
+   (void)memcpy(desc + CMPSIT_CfgLen, src, len);
+   CMPSIT_CfgLen += len;
+}
+
+/**
+ * @brief  CMPSIT_AddItfDesc
+ *         Append an interface descriptor
+ * @retval None
+ */
+static void CMPSIT_AddItfDesc(uint8_t *desc, uint8_t itf, uint8_t alt,
+                              uint8_t neps, uint8_t cls, uint8_t subcls,
+                              uint8_t proto, uint8_t str)
+{
+   const uint8_t d[] = {
+       USB_IF_DESC_SIZE, USB_DESC_TYPE_INTERFACE, itf, alt, neps, cls, subcls,
+       proto, str,
+   };
+
+   CMPSIT_AddBytes(desc, d, (uint16_t)sizeof(d));
+}
+
+/**
+ * @brief  CMPSIT_AddEpDesc
+ *         Append an endpoint descriptor
+ * @retval None
+ */
+static void CMPSIT_AddEpDesc(uint8_t *desc, uint8_t add, uint8_t type,
+                             uint16_t mps, uint8_t interval)
+{
+   const uint8_t d[] = {
+       USB_EP_DESC_SIZE, USB_DESC_TYPE_ENDPOINT, add, type, LOBYTE(mps),
+       HIBYTE(mps), interval,
+   };
+
+   CMPSIT_AddBytes(desc, d, (uint16_t)sizeof(d));
+}
+
+/**
+ * @brief  CMPSIT_AssignEp
+ *         Record an endpoint of the class being added
+ * @retval None
+ */
+static void CMPSIT_AssignEp(USBD_HandleTypeDef *pdev, uint8_t add,
+                            uint8_t type, uint16_t size)
+{
+   USBD_CompositeElementTypeDef *elem = &pdev->tclasslist[pdev->classId];
+
+   if (elem->NumEps >= USBD_MAX_CLASS_ENDPOINTS) {
+      USBD_ErrLog("too many endpoints");
+      return;
+   }
+
+   elem->Eps[elem->NumEps].add     = add;
+   elem->Eps[elem->NumEps].type    = type;
+   elem->Eps[elem->NumEps].size    = size;
+   elem->Eps[elem->NumEps].is_used = 1U;
+   elem->NumEps++;
+}
+
+/**
+ * @brief  CMPSIT_AddMSCDesc
+ *         Append the mass storage interface: Bulk-Only Transport as
+ *         alternate setting 0, UAS as alternate setting 1. The endpoint
+ *         addresses are EpAdd[] = { BOT/UAS data IN, BOT/UAS data OUT,
+ *         UAS status, UAS command }.
+ * @param  pdev: device instance
+ * @param  desc: configuration descriptor buffer
+ * @param  itf: interface number
+ * @param  mps: bulk max packet size at this speed
+ * @retval None
+ */
+static void CMPSIT_AddMSCDesc(USBD_HandleTypeDef *pdev, uint8_t *desc,
+                              uint8_t itf, uint16_t mps)
+{
+   const uint8_t *ep = pdev->tclasslist[pdev->classId].EpAdd;
+
+   CMPSIT_AddItfDesc(desc, itf, 0x00, 0x02, 0x08, 0x06, 0x50, 0x05);
+   CMPSIT_AddEpDesc(desc, ep[0], USBD_EP_TYPE_BULK, mps, 0x00);
+   CMPSIT_AddEpDesc(desc, ep[1], USBD_EP_TYPE_BULK, mps, 0x00);
+
+#if (MSC_UAS_ENABLE == 1U)
+   const uint8_t pipe_cmd[]    = {0x04, 0x24, MSC_UAS_PIPE_CMD, 0x00};
+   const uint8_t pipe_status[] = {0x04, 0x24, MSC_UAS_PIPE_STATUS, 0x00};
+   const uint8_t pipe_in[]     = {0x04, 0x24, MSC_UAS_PIPE_DATA_IN, 0x00};
+   const uint8_t pipe_out[]    = {0x04, 0x24, MSC_UAS_PIPE_DATA_OUT, 0x00};
+
+   CMPSIT_AddItfDesc(desc, itf, MSC_UAS_ALT, 0x04, 0x08, 0x06, 0x62, 0x05);
+   CMPSIT_AddEpDesc(desc, ep[3], USBD_EP_TYPE_BULK, mps, 0x00);
+   CMPSIT_AddBytes(desc, pipe_cmd, (uint16_t)sizeof(pipe_cmd));
+   CMPSIT_AddEpDesc(desc, ep[2], USBD_EP_TYPE_BULK, mps, 0x00);
+   CMPSIT_AddBytes(desc, pipe_status, (uint16_t)sizeof(pipe_status));
+   CMPSIT_AddEpDesc(desc, ep[0], USBD_EP_TYPE_BULK, mps, 0x00);
+   CMPSIT_AddBytes(desc, pipe_in, (uint16_t)sizeof(pipe_in));
+   CMPSIT_AddEpDesc(desc, ep[1], USBD_EP_TYPE_BULK, mps, 0x00);
+   CMPSIT_AddBytes(desc, pipe_out, (uint16_t)sizeof(pipe_out));
+#endif /* MSC_UAS_ENABLE */
+}
+
+/**
+ * @brief  CMPSIT_AddCDCDesc
+ *         Append the CDC-ACM function: an interface association, the
+ *         communication interface with its notification endpoint and the
+ *         data interface. The endpoint addresses are EpAdd[] = { data IN,
+ *         data OUT, notification IN }.
+ * @param  pdev: device instance
+ * @param  desc: configuration descriptor buffer
+ * @param  itf: number of the communication interface; data is itf + 1
+ * @param  mps: bulk max packet size at this speed
+ * @param  interval: notification endpoint bInterval at this speed
+ * @retval None
+ */
+static void CMPSIT_AddCDCDesc(USBD_HandleTypeDef *pdev, uint8_t *desc,
+                              uint8_t itf, uint16_t mps, uint8_t interval)
+{
+   const uint8_t *ep = pdev->tclasslist[pdev->classId].EpAdd;
+   const uint8_t iad[] = {
+       0x08, /* bLength */
+       0x0B, /* bDescriptorType: interface association */
+       itf,  /* bFirstInterface */
+       0x02, /* bInterfaceCount */
+       0x02, /* bFunctionClass: communication */
+       0x02, /* bFunctionSubClass: abstract control model */
+       0x01, /* bFunctionProtocol: AT commands */
+       0x00, /* iFunction */
+   };
+   const uint8_t func[] = {
+       /* header: CDC 1.10 */
+       0x05, 0x24, 0x00, 0x10, 0x01,
+       /* call management: none, data interface */
+       0x05, 0x24, 0x01, 0x00, (uint8_t)(itf + 1U),
+       /* ACM: supports line coding and control line state */
+       0x04, 0x24, 0x02, 0x02,
+       /* union: communication and data interface */
+       0x05, 0x24, 0x06, itf, (uint8_t)(itf + 1U),
+   };
+
+   CMPSIT_AddBytes(desc, iad, (uint16_t)sizeof(iad));
+   CMPSIT_AddItfDesc(desc, itf, 0x00, 0x01, 0x02, 0x02, 0x01, 0x00);
+   CMPSIT_AddBytes(desc, func, (uint16_t)sizeof(func));
+   CMPSIT_AddEpDesc(desc, ep[2], USBD_EP_TYPE_INTR, CDC_CMD_PACKET_SIZE,
+                    interval);
+
+   CMPSIT_AddItfDesc(desc, itf + 1U, 0x00, 0x02, 0x0A, 0x00, 0x00, 0x00);
+   CMPSIT_AddEpDesc(desc, ep[1], USBD_EP_TYPE_BULK, mps, 0x00);
+   CMPSIT_AddEpDesc(desc, ep[0], USBD_EP_TYPE_BULK, mps, 0x00);
+}
+
+#endif /* USE_USBD_COMPOSITE */
+
+// end file usbd_composite_builder.c
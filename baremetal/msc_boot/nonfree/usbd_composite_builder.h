@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file usbd_composite_builder.h
+ * @brief Configuration descriptor builder for the composite USB device
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ */
+
+#ifndef USBD_COMPOSITE_BUILDER_H
+#define USBD_COMPOSITE_BUILDER_H
+
+#include "usbd_ioreq.h"
+
+#ifdef USE_USBD_COMPOSITE
+
+/* room for the configuration descriptor of all classes together */
+#ifndef USBD_CMPST_MAX_CONFDESC_SZ
+#define USBD_CMPST_MAX_CONFDESC_SZ 256U
+#endif /* USBD_CMPST_MAX_CONFDESC_SZ */
+
+extern USBD_ClassTypeDef USBD_CMPSIT;
+
+uint8_t USBD_CMPSIT_AddClass(USBD_HandleTypeDef *pdev,
+                             USBD_ClassTypeDef *pclass,
+                             USBD_CompositeClassTypeDef class, uint8_t cfgidx);
+uint8_t USBD_CMPST_ClearConfDesc(USBD_HandleTypeDef *pdev);
+uint32_t USBD_CMPSIT_GetClassID(USBD_HandleTypeDef *pdev,
+                                USBD_CompositeClassTypeDef Class,
+                                uint32_t Instance);
+uint32_t USBD_CMPSIT_SetClassID(USBD_HandleTypeDef *pdev,
+                                USBD_CompositeClassTypeDef Class,
+                                uint32_t Instance);
+
+#endif /* USE_USBD_COMPOSITE */
+
+#endif // USBD_COMPOSITE_BUILDER_H
+
+// end file usbd_composite_builder.h
@@ -20,11 +20,17 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "usbd_conf.h"
+#include "cache.h"
 #include "setup.h"
 #include "stm32mp13xx.h"
 #include "stm32mp13xx_hal.h"
 #include "usbd_core.h"
 #include "usbd_msc.h" /* Include class header file */
+#include "usbd_fastboot.h"
+#include "usbd_bench.h"
+#ifdef USE_USBD_COMPOSITE
+#include "usbd_cdc.h"
+#endif /* USE_USBD_COMPOSITE */
 
 #include "stm32mp13xx_hal_def.h"
 #include "stm32mp13xx_hal_pcd.h"
@@ -32,18 +38,78 @@
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
+
+/* OTG HS FIFO RAM is 1024 words. The RX FIFO and the small IN FIFOs are
+ * sized in whole packets; the bulk IN FIFO (TX1) takes what is left, which
+ * is not a whole number of 512-byte packets but still lets the DMA run a
+ * packet ahead of the wire.
+ *
+ * In internal DMA mode the core keeps the DMA address of each endpoint
+ * direction in the FIFO RAM, one word each, above the TX FIFOs (reference
+ * manual, OTG "FIFO RAM allocation"). The endpoints in use are EP0-EP2 in
+ * both directions, plus EP3 both ways and EP4 IN for the console: at most 9
+ * words, under the 12 left here. */
+#define USB_FIFO_RAM_WORDS 0x400U
+#define USB_DMA_ADDR_WORDS 9U
+
+#define USB_RX_FIFO_WORDS  0x200U // 4 bulk OUT packets + setup/status
+#define USB_TX0_FIFO_WORDS 0x80U  // EP0 IN, 512 bytes
+#define USB_TX2_FIFO_WORDS 0x10U  // UAS status IN, one IU
+#ifdef USE_USBD_COMPOSITE
+/* the console takes one packet's worth from the MSC bulk IN FIFO */
+#define USB_TX1_FIFO_WORDS 0xD4U // bulk IN, 1.6 packets
+#define USB_TX3_FIFO_WORDS 0x80U // CDC bulk IN, one packet
+#define USB_TX4_FIFO_WORDS 0x10U // CDC notification IN
+#else
+#define USB_TX1_FIFO_WORDS 0x164U // bulk IN, almost 3 packets
+#define USB_TX3_FIFO_WORDS 0U
+#define USB_TX4_FIFO_WORDS 0U
+#endif /* USE_USBD_COMPOSITE */
+
+#if (USB_RX_FIFO_WORDS + USB_TX0_FIFO_WORDS + USB_TX1_FIFO_WORDS +           \
+     USB_TX2_FIFO_WORDS + USB_TX3_FIFO_WORDS + USB_TX4_FIFO_WORDS +          \
+     USB_DMA_ADDR_WORDS) > USB_FIFO_RAM_WORDS
+#error "USB FIFOs overlap the DMA address words"
+#endif
+
 /* Private macro -------------------------------------------------------------*/
+
+#if (USBD_DMA_ENABLE == 1U)
+/* Data the USB DMA writes into outside the endpoint buffers (setup packets in
+ * the PCD handle, CBW/CSW in the class data) is kept out of the cache */
+#define USBD_DMA_NC DMA_NC
+#else
+#define USBD_DMA_NC
+#endif
+
 /* Private variables ---------------------------------------------------------*/
-PCD_HandleTypeDef hpcd_handle;
+PCD_HandleTypeDef hpcd_handle USBD_DMA_NC;
+
+#if (USBD_DMA_ENABLE == 1U)
+/* OUT buffer in flight per endpoint, in whole cache lines; discarded from
+ * the cache again on completion */
+static uint8_t *rx_buf[16];
+static uint32_t rx_len[16];
+#endif
 
 /* Private function prototypes -----------------------------------------------*/
 /* Private functions ---------------------------------------------------------*/
 
+
+/* longest OTG interrupt, i.e. how long it kept other interrupts waiting */
+static uint32_t irq_max_us;
+
 void OTG_IRQHandler(void);
 
 void OTG_IRQHandler(void)
 {
+   const uint32_t t0 = get_time_us();
+
    HAL_PCD_IRQHandler(&hpcd_handle);
+
+   const uint32_t dt = get_time_us() - t0;
+   if (dt > irq_max_us)
+      irq_max_us = dt;
 }
 
 /*******************************************************************************
@@ -125,6 +191,11 @@ void HAL_PCD_SetupStageCallback(PCD_HandleTypeDef *hpcd)
  */
 void HAL_PCD_DataOutStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum)
 {
+#if (USBD_DMA_ENABLE == 1U)
+   /* lines may have been speculatively refilled while the DMA was running;
+    * drop them without a write-back, which would land on the new data */
+   cache_discard(rx_buf[epnum & 0xFU], rx_len[epnum & 0xFU]);
+#endif
    USBD_LL_DataOutStage(hpcd->pData, epnum, hpcd->OUT_ep[epnum].xfer_buff);
 }
 
@@ -251,7 +322,11 @@ USBD_StatusTypeDef USBD_LL_Init(USBD_HandleTypeDef *pdev)
    hpcd_handle.Instance                 = USB_OTG_HS;
    hpcd_handle.Init.dev_endpoints       = 9;
    hpcd_handle.Init.speed               = PCD_SPEED_HIGH;
+#if (USBD_DMA_ENABLE == 1U)
+   hpcd_handle.Init.dma_enable          = ENABLE;
+#else
    hpcd_handle.Init.dma_enable          = DISABLE;
+#endif
    hpcd_handle.Init.phy_itface          = USB_OTG_HS_EMBEDDED_PHY;
    hpcd_handle.Init.Sof_enable          = DISABLE;
    hpcd_handle.Init.low_power_enable    = DISABLE;
@@ -267,9 +342,14 @@ USBD_StatusTypeDef USBD_LL_Init(USBD_HandleTypeDef *pdev)
       return USBD_FAIL;
    }
 
-   HAL_PCDEx_SetRxFiFo(&hpcd_handle, 0x200);
-   HAL_PCDEx_SetTxFiFo(&hpcd_handle, 0, 0x40);
-   HAL_PCDEx_SetTxFiFo(&hpcd_handle, 1, 0x100);
+   HAL_PCDEx_SetRxFiFo(&hpcd_handle, USB_RX_FIFO_WORDS);
+   HAL_PCDEx_SetTxFiFo(&hpcd_handle, 0, USB_TX0_FIFO_WORDS);
+   HAL_PCDEx_SetTxFiFo(&hpcd_handle, 1, USB_TX1_FIFO_WORDS);
+   HAL_PCDEx_SetTxFiFo(&hpcd_handle, 2, USB_TX2_FIFO_WORDS);
+#ifdef USE_USBD_COMPOSITE
+   HAL_PCDEx_SetTxFiFo(&hpcd_handle, 3, USB_TX3_FIFO_WORDS);
+   HAL_PCDEx_SetTxFiFo(&hpcd_handle, 4, USB_TX4_FIFO_WORDS);
+#endif /* USE_USBD_COMPOSITE */
 
    return USBD_OK;
 }
@@ -412,6 +492,9 @@ USBD_StatusTypeDef USBD_LL_SetUSBAddress(USBD_HandleTypeDef *pdev,
 USBD_StatusTypeDef USBD_LL_Transmit(USBD_HandleTypeDef *pdev, uint8_t ep_addr,
                                     uint8_t *pbuf, uint32_t size)
 {
+#if (USBD_DMA_ENABLE == 1U)
+   cache_clean(pbuf, size);
+#endif
    HAL_PCD_EP_Transmit(pdev->pData, ep_addr, pbuf, size);
    return USBD_OK;
 }
@@ -428,6 +511,21 @@ USBD_StatusTypeDef USBD_LL_PrepareReceive(USBD_HandleTypeDef *pdev,
                                           uint8_t ep_addr, uint8_t *pbuf,
                                           uint32_t size)
 {
+#if (USBD_DMA_ENABLE == 1U)
+   /* a cacheable OUT buffer must start on a cache line and own the lines up
+    * to its end, rounded up: the completion discards them without cleaning.
+    * The buffers outside .dma_nc (download, staging, zero-copy medium and
+    * benchmark buffers) are all aligned and sized that way. */
+   const uint32_t lines = (size + CACHE_LINE - 1U) & ~(CACHE_LINE - 1U);
+
+   if (!cache_is_coherent(pbuf, size) &&
+       (((uint32_t)pbuf & (CACHE_LINE - 1U)) != 0U)) {
+      return USBD_FAIL;
+   }
+   rx_buf[ep_addr & 0xFU] = pbuf;
+   rx_len[ep_addr & 0xFU] = lines;
+   cache_invalidate(pbuf, lines);
+#endif
    HAL_PCD_EP_Receive(pdev->pData, ep_addr, pbuf, size);
    return USBD_OK;
 }
@@ -443,28 +541,75 @@ uint32_t USBD_LL_GetRxDataSize(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
    return HAL_PCD_EP_GetRxCount(pdev->pData, ep_addr);
 }
 
+/* One class handle per registered class: MSC, fastboot or bench, plus the CDC
+ * console in the composite device. Allocated in Init and freed in DeInit,
+ * both from the USB interrupt. */
+typedef union {
+   USBD_MSC_BOT_HandleTypeDef msc;
+   USBD_FASTBOOT_HandleTypeDef fastboot;
+   USBD_BENCH_HandleTypeDef bench;
+#ifdef USE_USBD_COMPOSITE
+   USBD_CDC_HandleTypeDef cdc;
+#endif /* USE_USBD_COMPOSITE */
+} USBD_ClassMemTypeDef;
+
+static USBD_ClassMemTypeDef class_mem[USBD_MAX_SUPPORTED_CLASS] USBD_DMA_NC;
+static uint8_t class_mem_used[USBD_MAX_SUPPORTED_CLASS];
+
 /**
- * @brief  Static single allocation.
+ * @brief  Static allocation of a class handle
  * @param  size: Size of allocated memory
- * @retval None
+ * @retval pointer to a free slot, or NULL if none is left or it is too small
  */
 void *USBD_static_malloc(uint32_t size)
 {
-   (void)size;
+   if (size > sizeof(USBD_ClassMemTypeDef)) {
+      return NULL;
+   }
+
+   for (uint32_t i = 0U; i < USBD_MAX_SUPPORTED_CLASS; i++) {
+      if (class_mem_used[i] == 0U) {
+         class_mem_used[i] = 1U;
 
-   static uint32_t mem[(sizeof(USBD_MSC_BOT_HandleTypeDef) / 4) +
-                       1]; /* On 32-bit boundary */
-   return mem;
+         /* .dma_nc is not zeroed at startup */
+         memset(&class_mem[i], 0, sizeof(class_mem[i]));
+         return &class_mem[i];
+      }
+   }
+
+   return NULL;
 }
 
 /**
- * @brief  Dummy memory free
+ * @brief  Return a class handle to the static pool
  * @param  p: Pointer to allocated  memory address
  * @retval None
  */
 void USBD_static_free(void *p)
 {
-   (void)p;
+   for (uint32_t i = 0U; i < USBD_MAX_SUPPORTED_CLASS; i++) {
+      if (p == &class_mem[i]) {
+         class_mem_used[i] = 0U;
+      }
+   }
+}
+
+/**
+ * @brief  Free-running microsecond timestamp for class statistics.
+ * @retval Time in us (wraps around)
+ */
+uint32_t USBD_LL_GetTimeUs(void)
+{
+   return get_time_us();
+}
+
+/**
+ * @brief  Longest time spent in the OTG interrupt handler so far.
+ * @retval Time in us
+ */
+uint32_t USBD_LL_GetIrqMaxUs(void)
+{
+   return irq_max_us;
 }
 
 /**
@@ -25,6 +25,7 @@ extern "C" {
 #endif
 
 /* Includes ------------------------------------------------------------------*/
+#include "evlog.h"
 #include "stm32mp13xx.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -45,14 +46,57 @@ extern "C" {
  * @{
  */
 
+#ifdef USE_USBD_COMPOSITE
+/* MSC on interface 0, the CDC-ACM console on interfaces 1 and 2 */
+#define USBD_MAX_NUM_INTERFACES    3U
+#define USBD_MAX_SUPPORTED_CLASS   2U
+#else
 #define USBD_MAX_NUM_INTERFACES    1U
+#endif /* USE_USBD_COMPOSITE */
 #define USBD_MAX_NUM_CONFIGURATION 1U
 #define USBD_MAX_STR_DESC_SIZ      0x100U
 #define USBD_SELF_POWERED          1U
 #define USBD_DEBUG_LEVEL           2U
 
+/* OTG HS internal DMA; endpoint buffers must then be in the .dma_nc window
+ * or start and end on a D-cache line (CACHE_LINE in cache.h) */
+#ifndef USBD_DMA_ENABLE
+#define USBD_DMA_ENABLE 1U
+#endif
+
 /* MSC Class Config */
-#define MSC_MEDIA_PACKET 8192U
+#define MSC_MEDIA_PACKET  8192U
+#define MSC_MEDIA_BUF_NBR 2U
+
+/* Block Limits VPD page: transfer sizes for the host, in blocks */
+#define MSC_OPT_XFER_GRAN 8U    /* 4 kB */
+#define MSC_OPT_XFER_BLKS 512U  /* 256 kB */
+#define MSC_MAX_XFER_BLKS 2048U /* 1 MB */
+
+/* most blocks one UNMAP or WRITE SAME may cover, which bounds the time the
+ * command takes */
+#define MSC_UNMAP_MAX_BLKS 0x40000U /* 128 MB */
+
+/* UNMAP block descriptors that fit the media buffers, which receive the
+ * parameter list */
+#define MSC_UNMAP_MAX_DESC ((MSC_MEDIA_BUF_NBR * MSC_MEDIA_PACKET - 8U) / 16U)
+
+/* Most LUNs the class keeps state for; the LUN table is in
+ * usbd_msc_storage.c */
+#ifdef EMMC_USE
+#define MSC_MAX_LUN_NBR 6U
+#else
+#define MSC_MAX_LUN_NBR 4U
+#endif
+
+/* USB Attached SCSI on alternate setting 1, next to the Bulk-Only Transport
+ * on alternate setting 0 */
+#define MSC_UAS_ENABLE      1U
+#define MSC_UAS_QUEUE_DEPTH 4U
+
+/* The OTG interrupt only notes endpoint events; the SCSI commands and all
+ * media I/O run from USBD_MSC_Process() in the main loop */
+#define MSC_DEFER_ENABLE 1U
 
 /** @defgroup USBD_Exported_Macros
  * @{
@@ -74,13 +118,10 @@ extern "C" {
 /** Alias for delay. */
 #define USBD_Delay HAL_Delay
 
-/* DEBUG macros */
+/* DEBUG macros: events go to the log ring (evlog.h) and are printed from
+ * the main loop, so they never block the USB interrupt */
 #if (USBD_DEBUG_LEVEL > 0U)
-#define USBD_UsrLog(...)                                                       \
-   do {                                                                        \
-      printf(__VA_ARGS__);                                                     \
-      printf("\n");                                                            \
-   } while (0)
+#define USBD_UsrLog(...) EVLOG(EVLOG_USR, __VA_ARGS__)
 #else
 #define USBD_UsrLog(...)                                                       \
    do {                                                                        \
@@ -89,12 +130,7 @@ extern "C" {
 
 #if (USBD_DEBUG_LEVEL > 1U)
 
-#define USBD_ErrLog(...)                                                       \
-   do {                                                                        \
-      printf("ERROR: ");                                                       \
-      printf(__VA_ARGS__);                                                     \
-      printf("\n");                                                            \
-   } while (0)
+#define USBD_ErrLog(...) EVLOG(EVLOG_ERR, __VA_ARGS__)
 #else
 #define USBD_ErrLog(...)                                                       \
    do {                                                                        \
@@ -102,12 +138,7 @@ extern "C" {
 #endif /* (USBD_DEBUG_LEVEL > 1U) */
 
 #if (USBD_DEBUG_LEVEL > 2U)
-#define USBD_DbgLog(...)                                                       \
-   do {                                                                        \
-      printf("DEBUG : ");                                                      \
-      printf(__VA_ARGS__);                                                     \
-      printf("\n");                                                            \
-   } while (0)
+#define USBD_DbgLog(...) EVLOG(EVLOG_DBG, __VA_ARGS__)
 #else
 #define USBD_DbgLog(...)                                                       \
    do {                                                                        \
@@ -149,6 +180,8 @@ extern "C" {
 /* Exported functions -------------------------------------------------------*/
 void *USBD_static_malloc(uint32_t size);
 void USBD_static_free(void *p);
+uint32_t USBD_LL_GetTimeUs(void);
+uint32_t USBD_LL_GetIrqMaxUs(void);
 /**
  * @}
  */
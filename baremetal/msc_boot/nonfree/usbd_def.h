@@ -332,7 +332,7 @@ typedef enum {
 typedef struct {
    uint8_t add;
    uint8_t type;
-   uint8_t size;
+   uint16_t size;
    uint8_t is_used;
 } USBD_EPTypeDef;
 
@@ -70,9 +70,15 @@ __ALIGN_BEGIN uint8_t USBD_DeviceDesc[USB_LEN_DEV_DESC] __ALIGN_END = {
     USB_DESC_TYPE_DEVICE, /* bDescriptorType */
     0x00,                 /* bcdUSB */
     0x02,
+#ifdef USE_USBD_COMPOSITE
+    0xEF, /* bDeviceClass: miscellaneous, the CDC function uses an IAD */
+    0x02, /* bDeviceSubClass: common class */
+    0x01, /* bDeviceProtocol: interface association */
+#else
     0x00,             /* bDeviceClass */
     0x00,             /* bDeviceSubClass */
     0x00,             /* bDeviceProtocol */
+#endif /* USE_USBD_COMPOSITE */
     USB_MAX_EP0_SIZE, /* bMaxPacketSize */
     LOBYTE(USBD_VID), /* idVendor */
     HIBYTE(USBD_VID), /* idVendor */
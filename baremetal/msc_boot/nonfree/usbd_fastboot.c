@@ -0,0 +1,855 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file usbd_fastboot.c
+ * @brief Android fastboot protocol as a vendor-specific USB class
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * The host sends ASCII commands of up to 64 bytes on the bulk OUT endpoint
+ * and reads one response per command from bulk IN: "OKAY", "FAIL" or, for a
+ * download, "DATA" with the length, after which the image arrives on bulk
+ * OUT. Supported: getvar, download, flash (raw and Android sparse images)
+ * and reboot.
+ *
+ * As with the MSC class, the interrupt only notes endpoint events and
+ * USBD_FASTBOOT_Process() in the main loop parses commands and writes the
+ * medium.
+ */
+
+#include "usbd_fastboot.h"
+#include "printf.h"
+#include "stm32mp13xx_hal_def.h"
+#include "usbd_core.h"
+#include "usbd_ctlreq.h"
+#include <string.h>
+
+/* Android sparse image format */
+#define SPARSE_HEADER_MAGIC   0xED26FF3AU
+#define SPARSE_HEADER_SIZE    28U
+#define SPARSE_CHUNK_SIZE     12U
+#define SPARSE_CHUNK_RAW      0xCAC1U
+#define SPARSE_CHUNK_FILL     0xCAC2U
+#define SPARSE_CHUNK_DONTCARE 0xCAC3U
+#define SPARSE_CHUNK_CRC32    0xCAC4U
+
+#define FASTBOOT_VERSION "0.4"
+
+#ifndef FASTBOOT_PRODUCT
+#define FASTBOOT_PRODUCT "STM32MP135"
+#endif /* FASTBOOT_PRODUCT */
+
+uint8_t USBD_FASTBOOT_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+uint8_t USBD_FASTBOOT_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+uint8_t USBD_FASTBOOT_Setup(USBD_HandleTypeDef *pdev,
+                            USBD_SetupReqTypedef *req);
+uint8_t USBD_FASTBOOT_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum);
+uint8_t USBD_FASTBOOT_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum);
+uint8_t *USBD_FASTBOOT_GetHSCfgDesc(uint16_t *length);
+uint8_t *USBD_FASTBOOT_GetFSCfgDesc(uint16_t *length);
+uint8_t *USBD_FASTBOOT_GetOtherSpeedCfgDesc(uint16_t *length);
+uint8_t *USBD_FASTBOOT_GetDeviceQualifierDescriptor(uint16_t *length);
+
+static void FASTBOOT_SetMaxPacket(uint16_t mps);
+static void FASTBOOT_ReceiveCmd(USBD_HandleTypeDef *pdev);
+static void FASTBOOT_ReceiveData(USBD_HandleTypeDef *pdev);
+static void FASTBOOT_Respond(USBD_HandleTypeDef *pdev, const char *kind,
+                             const char *msg);
+static void FASTBOOT_Command(USBD_HandleTypeDef *pdev);
+static void FASTBOOT_GetVar(USBD_HandleTypeDef *pdev, const char *name);
+static void FASTBOOT_Flash(USBD_HandleTypeDef *pdev, const char *part);
+static const char *FASTBOOT_FlashSparse(USBD_FASTBOOT_ItfTypeDef *fops,
+                                        USBD_FASTBOOT_HandleTypeDef *hfb,
+                                        uint32_t blk_addr, uint32_t blk_nbr);
+static const char *FASTBOOT_WriteBlocks(USBD_FASTBOOT_ItfTypeDef *fops,
+                                        const uint8_t *buf, uint32_t blk_addr,
+                                        uint32_t blk_len);
+static uint32_t get_le16(const uint8_t *p);
+static uint32_t get_le32(const uint8_t *p);
+
+USBD_ClassTypeDef USBD_FASTBOOT = {
+    USBD_FASTBOOT_Init,
+    USBD_FASTBOOT_DeInit,
+    USBD_FASTBOOT_Setup,
+    NULL, /*EP0_TxSent*/
+    NULL, /*EP0_RxReady*/
+    USBD_FASTBOOT_DataIn,
+    USBD_FASTBOOT_DataOut,
+    NULL, /*SOF */
+    NULL,
+    NULL,
+    USBD_FASTBOOT_GetHSCfgDesc,
+    USBD_FASTBOOT_GetFSCfgDesc,
+    USBD_FASTBOOT_GetOtherSpeedCfgDesc,
+    USBD_FASTBOOT_GetDeviceQualifierDescriptor,
+};
+
+__ALIGN_BEGIN static uint8_t
+    USBD_FASTBOOT_CfgDesc[USB_FASTBOOT_CONFIG_DESC_SIZ] __ALIGN_END = {
+        0x09, /* bLength: Configuration Descriptor size */
+        USB_DESC_TYPE_CONFIGURATION, /* bDescriptorType: Configuration */
+        USB_FASTBOOT_CONFIG_DESC_SIZ,
+
+        0x00, 0x01, /* bNumInterfaces: 1 interface */
+        0x01,       /* bConfigurationValue */
+        0x00,       /* iConfiguration */
+#if (USBD_SELF_POWERED == 1U)
+        0xC0, /* bmAttributes: Bus Powered according to user configuration */
+#else
+        0x80, /* bmAttributes: Bus Powered according to user configuration */
+#endif                  /* USBD_SELF_POWERED */
+        USBD_MAX_POWER, /* MaxPower (mA) */
+
+        /********************  Fastboot interface ********************/
+        0x09, /* bLength: Interface Descriptor size */
+        0x04, /* bDescriptorType: */
+        0x00, /* bInterfaceNumber: Number of Interface */
+        0x00, /* bAlternateSetting: Alternate setting */
+        0x02, /* bNumEndpoints */
+        0xFF, /* bInterfaceClass: vendor specific */
+        0x42, /* bInterfaceSubClass: fastboot */
+        0x03, /* nInterfaceProtocol: fastboot */
+        0x00, /* iInterface: */
+        /********************  Fastboot Endpoints ********************/
+        0x07,               /* Endpoint descriptor length = 7 */
+        0x05,               /* Endpoint descriptor type */
+        FASTBOOT_EPIN_ADDR, /* Endpoint address (IN, address 1) */
+        0x02,               /* Bulk endpoint type */
+        LOBYTE(FASTBOOT_MAX_FS_PACKET), HIBYTE(FASTBOOT_MAX_FS_PACKET),
+        0x00, /* Polling interval in milliseconds */
+
+        0x07,                /* Endpoint descriptor length = 7 */
+        0x05,                /* Endpoint descriptor type */
+        FASTBOOT_EPOUT_ADDR, /* Endpoint address (OUT, address 1) */
+        0x02,                /* Bulk endpoint type */
+        LOBYTE(FASTBOOT_MAX_FS_PACKET), HIBYTE(FASTBOOT_MAX_FS_PACKET),
+        0x00, /* Polling interval in milliseconds */
+};
+
+__ALIGN_BEGIN static uint8_t
+    USBD_FASTBOOT_DeviceQualifierDesc[USB_LEN_DEV_QUALIFIER_DESC] __ALIGN_END =
+        {
+            USB_LEN_DEV_QUALIFIER_DESC,
+            USB_DESC_TYPE_DEVICE_QUALIFIER,
+            0x00,
+            0x02,
+            0x00,
+            0x00,
+            0x00,
+            FASTBOOT_MAX_FS_PACKET,
+            0x01,
+            0x00,
+};
+
+/**
+ * @brief  USBD_FASTBOOT_Init
+ *         Open the endpoints and wait for the first command
+ * @param  pdev: device instance
+ * @param  cfgidx: configuration index
+ * @retval status
+ */
+uint8_t USBD_FASTBOOT_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+   UNUSED(cfgidx);
+   USBD_FASTBOOT_ItfTypeDef *fops =
+       (USBD_FASTBOOT_ItfTypeDef *)pdev->pUserData[pdev->classId];
+   USBD_FASTBOOT_HandleTypeDef *hfb;
+   uint16_t mps = (pdev->dev_speed == USBD_SPEED_HIGH)
+                      ? FASTBOOT_MAX_HS_PACKET
+                      : FASTBOOT_MAX_FS_PACKET;
+   uint32_t len;
+
+   hfb = (USBD_FASTBOOT_HandleTypeDef *)USBD_malloc(
+       sizeof(USBD_FASTBOOT_HandleTypeDef));
+
+   if ((hfb == NULL) || (fops == NULL)) {
+      pdev->pClassDataCmsit[pdev->classId] = NULL;
+      return (uint8_t)USBD_EMEM;
+   }
+
+   pdev->pClassDataCmsit[pdev->classId] = (void *)hfb;
+   pdev->pClassData                     = pdev->pClassDataCmsit[pdev->classId];
+
+   /* the end of the buffer holds expanded sparse FILL chunks */
+   hfb->buf = fops->GetBuffer(&len);
+   if ((hfb->buf == NULL) || (len < (2U * FASTBOOT_FILL_SIZE))) {
+      return (uint8_t)USBD_EMEM;
+   }
+   hfb->buf_len = (len - FASTBOOT_FILL_SIZE) & ~(FASTBOOT_BLK_SIZE - 1U);
+
+   (void)USBD_LL_OpenEP(pdev, FASTBOOT_EPOUT_ADDR, USBD_EP_TYPE_BULK, mps);
+   pdev->ep_out[FASTBOOT_EPOUT_ADDR & 0xFU].is_used = 1U;
+
+   (void)USBD_LL_OpenEP(pdev, FASTBOOT_EPIN_ADDR, USBD_EP_TYPE_BULK, mps);
+   pdev->ep_in[FASTBOOT_EPIN_ADDR & 0xFU].is_used = 1U;
+
+   FASTBOOT_ReceiveCmd(pdev);
+
+   return (uint8_t)USBD_OK;
+}
+
+/**
+ * @brief  USBD_FASTBOOT_DeInit
+ *         Close the endpoints
+ * @param  pdev: device instance
+ * @param  cfgidx: configuration index
+ * @retval status
+ */
+uint8_t USBD_FASTBOOT_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+   UNUSED(cfgidx);
+
+   (void)USBD_LL_CloseEP(pdev, FASTBOOT_EPOUT_ADDR);
+   pdev->ep_out[FASTBOOT_EPOUT_ADDR & 0xFU].is_used = 0U;
+
+   (void)USBD_LL_CloseEP(pdev, FASTBOOT_EPIN_ADDR);
+   pdev->ep_in[FASTBOOT_EPIN_ADDR & 0xFU].is_used = 0U;
+
+   if (pdev->pClassDataCmsit[pdev->classId] != NULL) {
+      (void)USBD_free(pdev->pClassDataCmsit[pdev->classId]);
+      pdev->pClassDataCmsit[pdev->classId] = NULL;
+      pdev->pClassData                     = NULL;
+   }
+
+   return (uint8_t)USBD_OK;
+}
+
+/**
+ * @brief  USBD_FASTBOOT_Setup
+ *         Handle the standard interface requests; fastboot has no class
+ *         requests
+ * @param  pdev: device instance
+ * @param  req: USB request
+ * @retval status
+ */
+uint8_t USBD_FASTBOOT_Setup(USBD_HandleTypeDef *pdev,
+                            USBD_SetupReqTypedef *req)
+{
+   static uint8_t alt_setting;
+   uint16_t status_info   = 0U;
+   USBD_StatusTypeDef ret = USBD_OK;
+
+   if (pdev->pClassDataCmsit[pdev->classId] == NULL) {
+      return (uint8_t)USBD_FAIL;
+   }
+
+   if ((req->bmRequest & USB_REQ_TYPE_MASK) != USB_REQ_TYPE_STANDARD) {
+      USBD_CtlError(pdev, req);
+      return (uint8_t)USBD_FAIL;
+   }
+
+   switch (req->bRequest) {
+      case USB_REQ_GET_STATUS:
+         if (pdev->dev_state == USBD_STATE_CONFIGURED) {
+            (void)USBD_CtlSendData(pdev, (uint8_t *)&status_info, 2U);
+         } else {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+         }
+         break;
+
+      case USB_REQ_GET_INTERFACE:
+         if (pdev->dev_state == USBD_STATE_CONFIGURED) {
+            (void)USBD_CtlSendData(pdev, &alt_setting, 1U);
+         } else {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+         }
+         break;
+
+      case USB_REQ_SET_INTERFACE:
+         if ((pdev->dev_state != USBD_STATE_CONFIGURED) ||
+             (req->wValue != 0U)) {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+         }
+         break;
+
+      case USB_REQ_CLEAR_FEATURE:
+         if ((pdev->dev_state == USBD_STATE_CONFIGURED) &&
+             (req->wValue == USB_FEATURE_EP_HALT)) {
+            (void)USBD_LL_FlushEP(pdev, (uint8_t)req->wIndex);
+         }
+         break;
+
+      default:
+         USBD_CtlError(pdev, req);
+         ret = USBD_FAIL;
+         break;
+   }
+
+   return (uint8_t)ret;
+}
+
+/**
+ * @brief  USBD_FASTBOOT_DataIn
+ *         A response went out; noted for USBD_FASTBOOT_Process()
+ * @param  pdev: device instance
+ * @param  epnum: endpoint index
+ * @retval status
+ */
+uint8_t USBD_FASTBOOT_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+   USBD_FASTBOOT_HandleTypeDef *hfb =
+       (USBD_FASTBOOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   UNUSED(epnum);
+
+   if (hfb == NULL) {
+      return (uint8_t)USBD_FAIL;
+   }
+
+   hfb->defer_in = 1U;
+   return (uint8_t)USBD_OK;
+}
+
+/**
+ * @brief  USBD_FASTBOOT_DataOut
+ *         A command or download data arrived; noted for
+ *         USBD_FASTBOOT_Process()
+ * @param  pdev: device instance
+ * @param  epnum: endpoint index
+ * @retval status
+ */
+uint8_t USBD_FASTBOOT_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+   USBD_FASTBOOT_HandleTypeDef *hfb =
+       (USBD_FASTBOOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   UNUSED(epnum);
+
+   if (hfb == NULL) {
+      return (uint8_t)USBD_FAIL;
+   }
+
+   hfb->defer_out = 1U;
+   return (uint8_t)USBD_OK;
+}
+
+/**
+ * @brief  USBD_FASTBOOT_Process
+ *         Handle the endpoint events noted by the interrupt. Call from the
+ *         main loop with the USB interrupt masked.
+ * @param  pdev: device instance
+ * @retval number of events handled
+ */
+uint32_t USBD_FASTBOOT_Process(USBD_HandleTypeDef *pdev)
+{
+   USBD_FASTBOOT_HandleTypeDef *hfb =
+       (USBD_FASTBOOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   uint32_t n = 0U;
+
+   if (hfb == NULL) {
+      return 0U;
+   }
+
+   /* a response goes out before the host sends more, so handle it first */
+   if (hfb->defer_in != 0U) {
+      hfb->defer_in = 0U;
+      n++;
+
+      if (hfb->state == FASTBOOT_REBOOT) {
+         ((USBD_FASTBOOT_ItfTypeDef *)pdev->pUserData[pdev->classId])
+             ->Reboot();
+      }
+   }
+
+   if (hfb->defer_out != 0U) {
+      hfb->defer_out = 0U;
+      n++;
+
+      const uint32_t len = USBD_LL_GetRxDataSize(pdev, FASTBOOT_EPOUT_ADDR);
+
+      if (hfb->state == FASTBOOT_DOWNLOAD) {
+         hfb->dl_rx += len;
+         if ((len == 0U) || (hfb->dl_rx >= hfb->dl_size)) {
+            hfb->dl_size = hfb->dl_rx;
+            FASTBOOT_Respond(pdev, "OKAY", "");
+         } else {
+            FASTBOOT_ReceiveData(pdev);
+         }
+      } else if (hfb->state == FASTBOOT_IDLE) {
+         hfb->cmd[(len < FASTBOOT_CMD_SIZE) ? len : FASTBOOT_CMD_SIZE] = 0U;
+         FASTBOOT_Command(pdev);
+      } else {
+         /* nothing is accepted after reboot */
+         FASTBOOT_ReceiveCmd(pdev);
+      }
+   }
+
+   return n;
+}
+
+/**
+ * @brief  FASTBOOT_ReceiveCmd
+ *         Arm bulk OUT for the next command
+ * @param  pdev: device instance
+ * @retval None
+ */
+static void FASTBOOT_ReceiveCmd(USBD_HandleTypeDef *pdev)
+{
+   USBD_FASTBOOT_HandleTypeDef *hfb =
+       (USBD_FASTBOOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   (void)USBD_LL_PrepareReceive(pdev, FASTBOOT_EPOUT_ADDR, hfb->cmd,
+                                FASTBOOT_CMD_SIZE);
+}
+
+/**
+ * @brief  FASTBOOT_ReceiveData
+ *         Arm bulk OUT for the next piece of a download
+ * @param  pdev: device instance
+ * @retval None
+ */
+static void FASTBOOT_ReceiveData(USBD_HandleTypeDef *pdev)
+{
+   USBD_FASTBOOT_HandleTypeDef *hfb =
+       (USBD_FASTBOOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   uint32_t len = hfb->dl_size - hfb->dl_rx;
+
+   if (len > FASTBOOT_RX_CHUNK) {
+      len = FASTBOOT_RX_CHUNK;
+   }
+
+   (void)USBD_LL_PrepareReceive(pdev, FASTBOOT_EPOUT_ADDR,
+                                hfb->buf + hfb->dl_rx, len);
+}
+
+/**
+ * @brief  FASTBOOT_Respond
+ *         Send a response and get ready for what the host sends next
+ * @param  pdev: device instance
+ * @param  kind: "OKAY", "FAIL" or "DATA"
+ * @param  msg: text after the kind
+ * @retval None
+ */
+static void FASTBOOT_Respond(USBD_HandleTypeDef *pdev, const char *kind,
+                             const char *msg)
+{
+   USBD_FASTBOOT_HandleTypeDef *hfb =
+       (USBD_FASTBOOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   /* snprintf() returns the untruncated length */
+   uint32_t len = (uint32_t)snprintf((char *)hfb->resp, sizeof(hfb->resp),
+                                     "%s%s", kind, msg);
+
+   if (len > FASTBOOT_RESP_SIZE) {
+      len = FASTBOOT_RESP_SIZE;
+   }
+
+   if (strcmp(kind, "DATA") == 0) {
+      hfb->state = FASTBOOT_DOWNLOAD;
+      hfb->dl_rx = 0U;
+      FASTBOOT_ReceiveData(pdev);
+   } else {
+      if (strcmp(kind, "FAIL") == 0) {
+         USBD_ErrLog("fastboot: %s", msg);
+      }
+      if (hfb->state != FASTBOOT_REBOOT) {
+         hfb->state = FASTBOOT_IDLE;
+      }
+      FASTBOOT_ReceiveCmd(pdev);
+   }
+
+   (void)USBD_LL_Transmit(pdev, FASTBOOT_EPIN_ADDR, hfb->resp, len);
+}
+
+/**
+ * @brief  FASTBOOT_Command
+ *         Parse and run the command in hfb->cmd
+ * @param  pdev: device instance
+ * @retval None
+ */
+static void FASTBOOT_Command(USBD_HandleTypeDef *pdev)
+{
+   USBD_FASTBOOT_HandleTypeDef *hfb =
+       (USBD_FASTBOOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   const char *cmd = (const char *)hfb->cmd;
+   char msg[16];
+
+   if (strncmp(cmd, "getvar:", 7U) == 0) {
+      FASTBOOT_GetVar(pdev, cmd + 7U);
+   } else if (strncmp(cmd, "download:", 9U) == 0) {
+      uint32_t size = 0U;
+      const char *p = cmd + 9U;
+
+      for (uint32_t i = 0U; i < 8U; i++, p++) {
+         const char c = *p;
+         uint32_t d;
+
+         if ((c >= '0') && (c <= '9')) {
+            d = (uint32_t)(c - '0');
+         } else if ((c >= 'a') && (c <= 'f')) {
+            d = (uint32_t)(c - 'a' + 10);
+         } else if ((c >= 'A') && (c <= 'F')) {
+            d = (uint32_t)(c - 'A' + 10);
+         } else {
+            break;
+         }
+         size = (size << 4) | d;
+      }
+
+      if ((*p != '\0') || (size == 0U)) {
+         FASTBOOT_Respond(pdev, "FAIL", "bad download size");
+      } else if (size > hfb->buf_len) {
+         FASTBOOT_Respond(pdev, "FAIL", "data too large");
+      } else {
+         hfb->dl_size = size;
+         (void)snprintf(msg, sizeof(msg), "%08x", (unsigned)size);
+         FASTBOOT_Respond(pdev, "DATA", msg);
+      }
+   } else if (strncmp(cmd, "flash:", 6U) == 0) {
+      FASTBOOT_Flash(pdev, cmd + 6U);
+   } else if (strcmp(cmd, "reboot") == 0) {
+      hfb->state = FASTBOOT_REBOOT;
+      FASTBOOT_Respond(pdev, "OKAY", "");
+   } else {
+      FASTBOOT_Respond(pdev, "FAIL", "unknown command");
+   }
+}
+
+/**
+ * @brief  FASTBOOT_GetVar
+ *         Answer getvar:<name>
+ * @param  pdev: device instance
+ * @param  name: variable, possibly with a ":<partition>" argument
+ * @retval None
+ */
+static void FASTBOOT_GetVar(USBD_HandleTypeDef *pdev, const char *name)
+{
+   USBD_FASTBOOT_HandleTypeDef *hfb =
+       (USBD_FASTBOOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   USBD_FASTBOOT_ItfTypeDef *fops =
+       (USBD_FASTBOOT_ItfTypeDef *)pdev->pUserData[pdev->classId];
+   char val[FASTBOOT_RESP_SIZE - 4U];
+   uint32_t blk_addr;
+   uint32_t blk_nbr;
+
+   if (strcmp(name, "version") == 0) {
+      FASTBOOT_Respond(pdev, "OKAY", FASTBOOT_VERSION);
+   } else if (strcmp(name, "product") == 0) {
+      FASTBOOT_Respond(pdev, "OKAY", FASTBOOT_PRODUCT);
+   } else if (strcmp(name, "max-download-size") == 0) {
+      (void)snprintf(val, sizeof(val), "0x%08x", (unsigned)hfb->buf_len);
+      FASTBOOT_Respond(pdev, "OKAY", val);
+   } else if ((strcmp(name, "is-userspace") == 0) ||
+              (strcmp(name, "secure") == 0) ||
+              (strncmp(name, "has-slot:", 9U) == 0) ||
+              (strncmp(name, "is-logical:", 11U) == 0)) {
+      FASTBOOT_Respond(pdev, "OKAY", "no");
+   } else if (strncmp(name, "partition-size:", 15U) == 0) {
+      if (fops->GetPartition(name + 15U, &blk_addr, &blk_nbr) != 0) {
+         FASTBOOT_Respond(pdev, "FAIL", "unknown partition");
+      } else {
+         (void)snprintf(val, sizeof(val), "0x%llx",
+                        (unsigned long long)blk_nbr * FASTBOOT_BLK_SIZE);
+         FASTBOOT_Respond(pdev, "OKAY", val);
+      }
+   } else if (strncmp(name, "partition-type:", 15U) == 0) {
+      if (fops->GetPartition(name + 15U, &blk_addr, &blk_nbr) != 0) {
+         FASTBOOT_Respond(pdev, "FAIL", "unknown partition");
+      } else {
+         FASTBOOT_Respond(pdev, "OKAY", "raw");
+      }
+   } else {
+      FASTBOOT_Respond(pdev, "FAIL", "unknown variable");
+   }
+}
+
+/**
+ * @brief  FASTBOOT_Flash
+ *         Write the downloaded image, raw or sparse, to a partition
+ * @param  pdev: device instance
+ * @param  part: partition name
+ * @retval None
+ */
+static void FASTBOOT_Flash(USBD_HandleTypeDef *pdev, const char *part)
+{
+   USBD_FASTBOOT_HandleTypeDef *hfb =
+       (USBD_FASTBOOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   USBD_FASTBOOT_ItfTypeDef *fops =
+       (USBD_FASTBOOT_ItfTypeDef *)pdev->pUserData[pdev->classId];
+   const char *err = NULL;
+   uint32_t blk_addr;
+   uint32_t blk_nbr;
+
+   if (fops->GetPartition(part, &blk_addr, &blk_nbr) != 0) {
+      err = "unknown partition";
+   } else if (hfb->dl_size == 0U) {
+      err = "no image downloaded";
+   } else if ((hfb->dl_size >= SPARSE_HEADER_SIZE) &&
+              (get_le32(hfb->buf) == SPARSE_HEADER_MAGIC)) {
+      err = FASTBOOT_FlashSparse(fops, hfb, blk_addr, blk_nbr);
+   } else {
+      /* raw image: pad the last block with zeros */
+      const uint32_t blks =
+          (hfb->dl_size + FASTBOOT_BLK_SIZE - 1U) / FASTBOOT_BLK_SIZE;
+
+      memset(hfb->buf + hfb->dl_size, 0,
+             (blks * FASTBOOT_BLK_SIZE) - hfb->dl_size);
+
+      if (blks > blk_nbr) {
+         err = "image larger than partition";
+      } else {
+         err = FASTBOOT_WriteBlocks(fops, hfb->buf, blk_addr, blks);
+      }
+   }
+
+   if (err != NULL) {
+      FASTBOOT_Respond(pdev, "FAIL", err);
+   } else {
+      USBD_UsrLog("fastboot: flashed %u byte image", hfb->dl_size);
+      FASTBOOT_Respond(pdev, "OKAY", "");
+   }
+
+   /* the image is consumed either way */
+   hfb->dl_size = 0U;
+}
+
+/**
+ * @brief  FASTBOOT_FlashSparse
+ *         Write an Android sparse image from the download buffer
+ * @param  fops: backend
+ * @param  hfb: class handle, with the image in hfb->buf
+ * @param  blk_addr: first block of the partition
+ * @param  blk_nbr: size of the partition in blocks
+ * @retval NULL, or the reason of the failure
+ */
+static const char *FASTBOOT_FlashSparse(USBD_FASTBOOT_ItfTypeDef *fops,
+                                        USBD_FASTBOOT_HandleTypeDef *hfb,
+                                        uint32_t blk_addr, uint32_t blk_nbr)
+{
+   const uint8_t *img         = hfb->buf;
+   const uint32_t file_hdr_sz = get_le16(img + 8U);
+   const uint32_t chunk_hdr_sz = get_le16(img + 10U);
+   const uint32_t blk_sz       = get_le32(img + 12U);
+   const uint32_t total_blks   = get_le32(img + 16U);
+   const uint32_t total_chunks = get_le32(img + 20U);
+   uint8_t *fill               = hfb->buf + hfb->buf_len;
+   uint32_t pos                = file_hdr_sz;
+   uint32_t out                = 0U; /* in 512-byte blocks */
+   const char *err;
+
+   if ((get_le16(img + 4U) != 1U) || (file_hdr_sz < SPARSE_HEADER_SIZE) ||
+       (file_hdr_sz > hfb->dl_size) ||
+       (chunk_hdr_sz < SPARSE_CHUNK_SIZE) || (blk_sz == 0U) ||
+       ((blk_sz % FASTBOOT_BLK_SIZE) != 0U) ||
+       (blk_sz > FASTBOOT_FILL_SIZE)) {
+      return "bad sparse header";
+   }
+
+   const uint32_t ratio = blk_sz / FASTBOOT_BLK_SIZE;
+
+   if (((uint64_t)total_blks * ratio) > blk_nbr) {
+      return "image larger than partition";
+   }
+
+   for (uint32_t i = 0U; i < total_chunks; i++) {
+      if ((hfb->dl_size - pos) < chunk_hdr_sz) {
+         return "truncated sparse image";
+      }
+
+      const uint8_t *chunk = img + pos;
+      const uint32_t type  = get_le16(chunk);
+      const uint32_t sz    = get_le32(chunk + 4U); /* in blk_sz blocks */
+      const uint32_t total = get_le32(chunk + 8U); /* bytes with header */
+      const uint8_t *data  = chunk + chunk_hdr_sz;
+      const uint64_t blks  = (uint64_t)sz * ratio;
+
+      if ((total < chunk_hdr_sz) || (total > (hfb->dl_size - pos))) {
+         return "truncated sparse image";
+      }
+      if ((out + blks) > ((uint64_t)total_blks * ratio)) {
+         return "sparse chunk past the end";
+      }
+
+      switch (type) {
+         case SPARSE_CHUNK_RAW:
+            if ((uint64_t)(total - chunk_hdr_sz) !=
+                (blks * FASTBOOT_BLK_SIZE)) {
+               return "bad raw chunk";
+            }
+            if (((uintptr_t)data & 3U) != 0U) {
+               return "unaligned raw chunk";
+            }
+            err = FASTBOOT_WriteBlocks(fops, data, blk_addr + out,
+                                       (uint32_t)blks);
+            if (err != NULL) {
+               return err;
+            }
+            break;
+
+         case SPARSE_CHUNK_FILL: {
+            if ((total - chunk_hdr_sz) != 4U) {
+               return "bad fill chunk";
+            }
+
+            const uint32_t val = get_le32(data);
+            for (uint32_t j = 0U; j < (FASTBOOT_FILL_SIZE / 4U); j++) {
+               ((uint32_t *)fill)[j] = val;
+            }
+
+            for (uint32_t done = 0U; done < blks;) {
+               uint32_t n = (uint32_t)blks - done;
+               if (n > (FASTBOOT_FILL_SIZE / FASTBOOT_BLK_SIZE)) {
+                  n = FASTBOOT_FILL_SIZE / FASTBOOT_BLK_SIZE;
+               }
+               if (fops->Write(fill, blk_addr + out + done, n) != 0) {
+                  return "write error";
+               }
+               done += n;
+            }
+            break;
+         }
+
+         case SPARSE_CHUNK_DONTCARE:
+            break;
+
+         case SPARSE_CHUNK_CRC32:
+            if ((total - chunk_hdr_sz) != 4U) {
+               return "bad crc32 chunk";
+            }
+            break;
+
+         default:
+            return "unknown sparse chunk";
+      }
+
+      out += (uint32_t)blks;
+      pos += total;
+   }
+
+   return NULL;
+}
+
+/**
+ * @brief  FASTBOOT_WriteBlocks
+ *         Write to the medium in pieces of FASTBOOT_WRITE_BLKS
+ * @param  fops: backend
+ * @param  buf: data, 32-bit aligned
+ * @param  blk_addr: first block
+ * @param  blk_len: number of blocks
+ * @retval NULL, or the reason of the failure
+ */
+static const char *FASTBOOT_WriteBlocks(USBD_FASTBOOT_ItfTypeDef *fops,
+                                        const uint8_t *buf, uint32_t blk_addr,
+                                        uint32_t blk_len)
+{
+   while (blk_len > 0U) {
+      const uint32_t n =
+          (blk_len > FASTBOOT_WRITE_BLKS) ? FASTBOOT_WRITE_BLKS : blk_len;
+
+      if (fops->Write(buf, blk_addr, n) != 0) {
+         return "write error";
+      }
+
+      buf += n * FASTBOOT_BLK_SIZE;
+      blk_addr += n;
+      blk_len -= n;
+   }
+
+   return NULL;
+}
+
+static uint32_t get_le16(const uint8_t *p)
+{
+   return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+   return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+          ((uint32_t)p[3] << 24);
+}
+
+/**
+ * @brief  USBD_FASTBOOT_GetHSCfgDesc
+ *         return configuration descriptor
+ * @param  length : pointer data length
+ * @retval pointer to descriptor buffer
+ */
+uint8_t *USBD_FASTBOOT_GetHSCfgDesc(uint16_t *length)
+{
+   FASTBOOT_SetMaxPacket(FASTBOOT_MAX_HS_PACKET);
+
+   *length = (uint16_t)sizeof(USBD_FASTBOOT_CfgDesc);
+   return USBD_FASTBOOT_CfgDesc;
+}
+
+/**
+ * @brief  USBD_FASTBOOT_GetFSCfgDesc
+ *         return configuration descriptor
+ * @param  length : pointer data length
+ * @retval pointer to descriptor buffer
+ */
+uint8_t *USBD_FASTBOOT_GetFSCfgDesc(uint16_t *length)
+{
+   FASTBOOT_SetMaxPacket(FASTBOOT_MAX_FS_PACKET);
+
+   *length = (uint16_t)sizeof(USBD_FASTBOOT_CfgDesc);
+   return USBD_FASTBOOT_CfgDesc;
+}
+
+/**
+ * @brief  USBD_FASTBOOT_GetOtherSpeedCfgDesc
+ *         return other speed configuration descriptor
+ * @param  length : pointer data length
+ * @retval pointer to descriptor buffer
+ */
+uint8_t *USBD_FASTBOOT_GetOtherSpeedCfgDesc(uint16_t *length)
+{
+   FASTBOOT_SetMaxPacket(FASTBOOT_MAX_FS_PACKET);
+
+   *length = (uint16_t)sizeof(USBD_FASTBOOT_CfgDesc);
+   return USBD_FASTBOOT_CfgDesc;
+}
+
+/**
+ * @brief  USBD_FASTBOOT_GetDeviceQualifierDescriptor
+ *         return Device Qualifier descriptor
+ * @param  length : pointer data length
+ * @retval pointer to descriptor buffer
+ */
+uint8_t *USBD_FASTBOOT_GetDeviceQualifierDescriptor(uint16_t *length)
+{
+   *length = (uint16_t)sizeof(USBD_FASTBOOT_DeviceQualifierDesc);
+
+   return USBD_FASTBOOT_DeviceQualifierDesc;
+}
+
+/**
+ * @brief  FASTBOOT_SetMaxPacket
+ *         Patch wMaxPacketSize of both endpoints for the current speed
+ * @param  mps : max packet size
+ * @retval None
+ */
+static void FASTBOOT_SetMaxPacket(uint16_t mps)
+{
+   uint16_t ptr = 0U;
+
+   while (ptr < sizeof(USBD_FASTBOOT_CfgDesc)) {
+      if (USBD_FASTBOOT_CfgDesc[ptr + 1U] == USB_DESC_TYPE_ENDPOINT) {
+         USBD_FASTBOOT_CfgDesc[ptr + 4U] = LOBYTE(mps);
+         USBD_FASTBOOT_CfgDesc[ptr + 5U] = HIBYTE(mps);
+      }
+
+      ptr += USBD_FASTBOOT_CfgDesc[ptr];
+   }
+}
+
+/**
+ * @brief  USBD_FASTBOOT_RegisterInterface
+ * @param  pdev: device instance
+ * @param  fops: download buffer and partition backend
+ * @retval status
+ */
+uint8_t USBD_FASTBOOT_RegisterInterface(USBD_HandleTypeDef *pdev,
+                                        USBD_FASTBOOT_ItfTypeDef *fops)
+{
+   if (fops == NULL) {
+      return (uint8_t)USBD_FAIL;
+   }
+
+   pdev->pUserData[pdev->classId] = fops;
+
+   return (uint8_t)USBD_OK;
+}
+
+// end file usbd_fastboot.c
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file usbd_fastboot.h
+ * @brief Android fastboot protocol as a vendor-specific USB class
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ */
+
+#ifndef USBD_FASTBOOT_H
+#define USBD_FASTBOOT_H
+
+#include "usbd_ioreq.h"
+
+#ifndef FASTBOOT_EPIN_ADDR
+#define FASTBOOT_EPIN_ADDR 0x81U
+#endif /* FASTBOOT_EPIN_ADDR */
+
+#ifndef FASTBOOT_EPOUT_ADDR
+#define FASTBOOT_EPOUT_ADDR 0x01U
+#endif /* FASTBOOT_EPOUT_ADDR */
+
+#define FASTBOOT_MAX_FS_PACKET 0x40U
+#define FASTBOOT_MAX_HS_PACKET 0x200U
+
+/* commands fit one packet; responses are at most 64 bytes */
+#define FASTBOOT_CMD_SIZE  FASTBOOT_MAX_HS_PACKET
+#define FASTBOOT_RESP_SIZE 64U
+
+/* largest single OUT transfer of the download data phase; the OTG core
+ * counts at most 1023 packets per transfer */
+#ifndef FASTBOOT_RX_CHUNK
+#define FASTBOOT_RX_CHUNK 0x40000U
+#endif /* FASTBOOT_RX_CHUNK */
+
+/* blocks per write to the medium */
+#ifndef FASTBOOT_WRITE_BLKS
+#define FASTBOOT_WRITE_BLKS 8192U
+#endif /* FASTBOOT_WRITE_BLKS */
+
+/* expanded pattern of sparse FILL chunks, taken from the end of the
+ * download buffer */
+#ifndef FASTBOOT_FILL_SIZE
+#define FASTBOOT_FILL_SIZE 0x100000U
+#endif /* FASTBOOT_FILL_SIZE */
+
+#define FASTBOOT_BLK_SIZE 512U
+
+#define USB_FASTBOOT_CONFIG_DESC_SIZ 32U
+
+typedef enum {
+   FASTBOOT_IDLE = 0U, /* waiting for a command */
+   FASTBOOT_DOWNLOAD,  /* receiving download data */
+   FASTBOOT_REBOOT,    /* reboot once the response is sent */
+} USBD_FASTBOOT_StateTypeDef;
+
+/* where downloads go and where partitions are; 512-byte blocks */
+typedef struct {
+   /* DDR buffer for downloads, cache line aligned */
+   uint8_t *(*GetBuffer)(uint32_t *len);
+   /* first block and size of a named partition */
+   int8_t (*GetPartition)(const char *name, uint32_t *blk_addr,
+                          uint32_t *blk_nbr);
+   int8_t (*Write)(const uint8_t *buf, uint32_t blk_addr, uint32_t blk_len);
+   void (*Reboot)(void);
+} USBD_FASTBOOT_ItfTypeDef;
+
+typedef struct {
+   uint8_t cmd[FASTBOOT_CMD_SIZE + 1U];
+   uint8_t resp[FASTBOOT_RESP_SIZE + 1U];
+   uint8_t state;
+
+   uint8_t *buf;
+   uint32_t buf_len;  /* most a download may hold */
+   uint32_t dl_size;  /* bytes announced by the last download */
+   uint32_t dl_rx;    /* of which received */
+
+   /* work noted by the interrupt for USBD_FASTBOOT_Process() */
+   volatile uint8_t defer_in;
+   volatile uint8_t defer_out;
+} USBD_FASTBOOT_HandleTypeDef;
+
+extern USBD_ClassTypeDef USBD_FASTBOOT;
+#define USBD_FASTBOOT_CLASS &USBD_FASTBOOT
+
+uint8_t USBD_FASTBOOT_RegisterInterface(USBD_HandleTypeDef *pdev,
+                                        USBD_FASTBOOT_ItfTypeDef *fops);
+uint32_t USBD_FASTBOOT_Process(USBD_HandleTypeDef *pdev);
+
+#endif // USBD_FASTBOOT_H
+
+// end file usbd_fastboot.h
@@ -0,0 +1,214 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file usbd_fastboot_storage.c
+ * @brief Fastboot backend: DDR download buffer and the SD card's GPT
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * Partitions are looked up by name in the GUID partition table of the SD
+ * card, e.g. fsbl1, fsbl2 or rootfs of the usual STM32MP1 layout. The name
+ * "sd" stands for the whole card. Writes go straight to the card; the MSC
+ * block cache is not in use when fastboot is built in.
+ *
+ * With the eMMC built in, "emmc", "emmc-boot0" and "emmc-boot1" stand for
+ * its user area and boot partitions, and "emmc:<name>" for a partition of
+ * the GPT on the eMMC user area. A write goes to the device of the last
+ * partition looked up, which the fastboot class always does first.
+ */
+
+#include "usbd_fastboot_storage.h"
+#include "sd.h"
+#ifdef EMMC_USE
+#include "emmc.h"
+#endif
+#include "stm32mp13xx.h"
+#include <stdint.h>
+#include <string.h>
+
+#define FASTBOOT_BUF_SIZE 0x4000000U // 64 MB
+
+#define GPT_HEADER_LBA    1U
+#define GPT_SIGNATURE     "EFI PART"
+#define GPT_NAME_CHARS    36U
+#define GPT_MAX_ENTRY_SIZ 512U
+
+// a block device partitions can live on
+struct fb_dev {
+   const char *name;
+   int (*ready)(void);
+   int (*capacity)(uint32_t *blk_nbr, uint32_t *blk_size);
+   int (*read)(uint8_t *buf, uint32_t blk_addr, uint32_t blk_len);
+   int (*write)(const uint8_t *buf, uint32_t blk_addr, uint32_t blk_len);
+};
+
+static const struct fb_dev fb_devs[] = {
+    {"sd", sd_ready, sd_get_capacity, sd_read, sd_write},
+#ifdef EMMC_USE
+    {"emmc", emmc_ready, emmc_get_capacity, emmc_read, emmc_write},
+    {"emmc-boot0", emmc_ready, emmc_get_boot_capacity, emmc_boot0_read,
+     emmc_boot0_write},
+    {"emmc-boot1", emmc_ready, emmc_get_boot_capacity, emmc_boot1_read,
+     emmc_boot1_write},
+#endif
+};
+
+#define FB_DEV_NBR (sizeof(fb_devs) / sizeof(fb_devs[0]))
+
+// device of the last partition looked up
+static const struct fb_dev *cur_dev = &fb_devs[0];
+
+static uint8_t *FASTBOOT_GetBuffer(uint32_t *len);
+static int8_t FASTBOOT_GetPartition(const char *name, uint32_t *blk_addr,
+                                    uint32_t *blk_nbr);
+static int8_t FASTBOOT_Write(const uint8_t *buf, uint32_t blk_addr,
+                             uint32_t blk_len);
+static void FASTBOOT_Reboot(void);
+
+USBD_FASTBOOT_ItfTypeDef USBD_FASTBOOT_fops = {
+    FASTBOOT_GetBuffer,
+    FASTBOOT_GetPartition,
+    FASTBOOT_Write,
+    FASTBOOT_Reboot,
+};
+
+__attribute__((section(".virtdrive"), aligned(64))) static uint8_t
+    dl_buf[FASTBOOT_BUF_SIZE];
+
+// one block of the GPT; the reads invalidate whole cache lines
+__attribute__((section(".virtdrive"), aligned(64))) static uint8_t
+    gpt_blk[FASTBOOT_BLK_SIZE];
+
+static uint32_t get_le32(const uint8_t *p)
+{
+   return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+          ((uint32_t)p[3] << 24);
+}
+
+static uint8_t *FASTBOOT_GetBuffer(uint32_t *len)
+{
+   *len = sizeof(dl_buf);
+   return dl_buf;
+}
+
+// compare an ASCII name with a UTF-16LE GPT partition name
+static int gpt_name_eq(const uint8_t *utf16, const char *name)
+{
+   for (uint32_t i = 0U; i < GPT_NAME_CHARS; i++) {
+      const uint8_t c = utf16[2U * i];
+
+      if ((utf16[(2U * i) + 1U] != 0U) || (c != (uint8_t)name[i]))
+         return 0;
+      if (c == 0U)
+         return 1;
+   }
+
+   return name[GPT_NAME_CHARS] == '\0';
+}
+
+static const struct fb_dev *find_dev(const char *name, const size_t len)
+{
+   for (uint32_t i = 0U; i < FB_DEV_NBR; i++) {
+      if ((strncmp(fb_devs[i].name, name, len) == 0) &&
+          (fb_devs[i].name[len] == '\0'))
+         return &fb_devs[i];
+   }
+
+   return NULL;
+}
+
+static int8_t FASTBOOT_GetPartition(const char *name, uint32_t *blk_addr,
+                                    uint32_t *blk_nbr)
+{
+   uint32_t size;
+   uint32_t blk_size;
+
+   // "<device>" is all of it, "<device>:<name>" a GPT partition on it, and
+   // a bare name a GPT partition on the SD card
+   const struct fb_dev *dev = find_dev(name, strlen(name));
+   const char *colon        = strchr(name, ':');
+   const int whole          = (dev != NULL);
+
+   if (dev == NULL) {
+      dev = (colon != NULL) ? find_dev(name, (size_t)(colon - name))
+                            : &fb_devs[0];
+      if (colon != NULL)
+         name = colon + 1;
+   }
+
+   if ((dev == NULL) || !dev->ready() ||
+       (dev->capacity(&size, &blk_size) != 0))
+      return -1;
+
+   if (whole) {
+      cur_dev   = dev;
+      *blk_addr = 0U;
+      *blk_nbr  = size;
+      return 0;
+   }
+
+   if ((dev->read(gpt_blk, GPT_HEADER_LBA, 1U) != 0) ||
+       (memcmp(gpt_blk, GPT_SIGNATURE, 8U) != 0))
+      return -1;
+
+   // header fields at their offsets in the GPT header block
+   const uint32_t entry_lba = get_le32(gpt_blk + 72U);
+   const uint32_t entry_nbr = get_le32(gpt_blk + 80U);
+   const uint32_t entry_siz = get_le32(gpt_blk + 84U);
+
+   if ((entry_siz < 128U) || (entry_siz > GPT_MAX_ENTRY_SIZ) ||
+       ((FASTBOOT_BLK_SIZE % entry_siz) != 0U))
+      return -1;
+
+   const uint32_t per_blk = FASTBOOT_BLK_SIZE / entry_siz;
+   uint32_t lba           = UINT32_MAX;
+
+   for (uint32_t i = 0U; i < entry_nbr; i++) {
+      if ((entry_lba + (i / per_blk)) != lba) {
+         lba = entry_lba + (i / per_blk);
+         if (dev->read(gpt_blk, lba, 1U) != 0)
+            return -1;
+      }
+
+      const uint8_t *e = gpt_blk + ((i % per_blk) * entry_siz);
+
+      // the first LBA, the last LBA (inclusive) and the name; an all-zero
+      // type GUID marks an unused entry
+      if ((get_le32(e) | get_le32(e + 4U) | get_le32(e + 8U) |
+           get_le32(e + 12U)) == 0U)
+         continue;
+      if (!gpt_name_eq(e + 56U, name))
+         continue;
+
+      const uint32_t first = get_le32(e + 32U);
+      const uint32_t last  = get_le32(e + 40U);
+
+      // cards are below 2 TB, so the high words must be zero
+      if ((get_le32(e + 36U) != 0U) || (get_le32(e + 44U) != 0U) ||
+          (last < first) || (last >= size))
+         return -1;
+
+      cur_dev   = dev;
+      *blk_addr = first;
+      *blk_nbr  = last - first + 1U;
+      return 0;
+   }
+
+   return -1;
+}
+
+static int8_t FASTBOOT_Write(const uint8_t *buf, uint32_t blk_addr,
+                             uint32_t blk_len)
+{
+   return (cur_dev->write(buf, blk_addr, blk_len) == 0) ? 0 : -1;
+}
+
+static void FASTBOOT_Reboot(void)
+{
+   // system reset, like the reset button
+   RCC->MP_GRSTCSETR = RCC_MP_GRSTCSETR_MPSYSRST;
+   while (1) {
+   }
+}
+
+// end file usbd_fastboot_storage.c
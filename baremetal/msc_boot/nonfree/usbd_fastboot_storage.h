@@ -0,0 +1,19 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file usbd_fastboot_storage.h
+ * @brief Fastboot backend: DDR download buffer and the SD card's GPT
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ */
+
+#ifndef USBD_FASTBOOT_STORAGE_H
+#define USBD_FASTBOOT_STORAGE_H
+
+#include "usbd_fastboot.h"
+
+extern USBD_FASTBOOT_ItfTypeDef USBD_FASTBOOT_fops;
+
+#endif // USBD_FASTBOOT_STORAGE_H
+
+// end file usbd_fastboot_storage.h
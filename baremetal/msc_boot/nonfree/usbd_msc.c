@@ -88,7 +88,15 @@ uint8_t *USBD_MSC_GetHSCfgDesc(uint16_t *length);
 uint8_t *USBD_MSC_GetFSCfgDesc(uint16_t *length);
 uint8_t *USBD_MSC_GetOtherSpeedCfgDesc(uint16_t *length);
 uint8_t *USBD_MSC_GetDeviceQualifierDescriptor(uint16_t *length);
+static void USBD_MSC_SetMaxPacket(uint16_t mps);
 #endif /* USE_USBD_COMPOSITE */
+
+#if (MSC_UAS_ENABLE == 1U)
+static void USBD_MSC_SetAlt(USBD_HandleTypeDef *pdev, uint8_t alt);
+#endif /* MSC_UAS_ENABLE */
+
+static void MSC_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum);
+static void MSC_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum);
 /**
  * @}
  */
@@ -164,7 +172,60 @@ __ALIGN_BEGIN static uint8_t
         MSC_EPOUT_ADDR, /* Endpoint address (OUT, address 1) */
         0x02,           /* Bulk endpoint type */
         LOBYTE(MSC_MAX_FS_PACKET), HIBYTE(MSC_MAX_FS_PACKET),
-        0x00 /* Polling interval in milliseconds */
+        0x00, /* Polling interval in milliseconds */
+
+#if (MSC_UAS_ENABLE == 1U)
+        /********************  USB Attached SCSI interface ****************/
+        0x09,        /* bLength: Interface Descriptor size */
+        0x04,        /* bDescriptorType: */
+        0x00,        /* bInterfaceNumber: Number of Interface */
+        MSC_UAS_ALT, /* bAlternateSetting: Alternate setting */
+        0x04,        /* bNumEndpoints */
+        0x08,        /* bInterfaceClass: MSC Class */
+        0x06,        /* bInterfaceSubClass : SCSI transparent*/
+        0x62,        /* nInterfaceProtocol: UAS */
+        0x05,        /* iInterface: */
+        /********************  UAS Endpoints ********************/
+        0x07,           /* Endpoint descriptor length = 7 */
+        0x05,           /* Endpoint descriptor type */
+        MSC_UAS_CMD_EP, /* Endpoint address (OUT, address 2) */
+        0x02,           /* Bulk endpoint type */
+        LOBYTE(MSC_MAX_FS_PACKET), HIBYTE(MSC_MAX_FS_PACKET),
+        0x00, /* Polling interval in milliseconds */
+        0x04, /* Pipe usage descriptor length = 4 */
+        0x24, /* Pipe usage descriptor type */
+        MSC_UAS_PIPE_CMD, 0x00,
+
+        0x07,              /* Endpoint descriptor length = 7 */
+        0x05,              /* Endpoint descriptor type */
+        MSC_UAS_STATUS_EP, /* Endpoint address (IN, address 2) */
+        0x02,              /* Bulk endpoint type */
+        LOBYTE(MSC_MAX_FS_PACKET), HIBYTE(MSC_MAX_FS_PACKET),
+        0x00, /* Polling interval in milliseconds */
+        0x04, /* Pipe usage descriptor length = 4 */
+        0x24, /* Pipe usage descriptor type */
+        MSC_UAS_PIPE_STATUS, 0x00,
+
+        0x07,          /* Endpoint descriptor length = 7 */
+        0x05,          /* Endpoint descriptor type */
+        MSC_EPIN_ADDR, /* Endpoint address (IN, address 1) */
+        0x02,          /* Bulk endpoint type */
+        LOBYTE(MSC_MAX_FS_PACKET), HIBYTE(MSC_MAX_FS_PACKET),
+        0x00, /* Polling interval in milliseconds */
+        0x04, /* Pipe usage descriptor length = 4 */
+        0x24, /* Pipe usage descriptor type */
+        MSC_UAS_PIPE_DATA_IN, 0x00,
+
+        0x07,           /* Endpoint descriptor length = 7 */
+        0x05,           /* Endpoint descriptor type */
+        MSC_EPOUT_ADDR, /* Endpoint address (OUT, address 1) */
+        0x02,           /* Bulk endpoint type */
+        LOBYTE(MSC_MAX_FS_PACKET), HIBYTE(MSC_MAX_FS_PACKET),
+        0x00, /* Polling interval in milliseconds */
+        0x04, /* Pipe usage descriptor length = 4 */
+        0x24, /* Pipe usage descriptor type */
+        MSC_UAS_PIPE_DATA_OUT, 0x00,
+#endif /* MSC_UAS_ENABLE */
 };
 
 /* USB Standard Device Descriptor */
@@ -186,6 +247,12 @@ __ALIGN_BEGIN static uint8_t
 uint8_t MSCInEpAdd  = MSC_EPIN_ADDR;
 uint8_t MSCOutEpAdd = MSC_EPOUT_ADDR;
 
+#if (MSC_DEFER_ENABLE == 1U)
+/* set by a bus reset or unplug: the class data is gone by then, so the
+ * write-back USBD_MSC_Process() owes is noted here */
+static volatile uint8_t MSC_SyncPending;
+#endif /* MSC_DEFER_ENABLE */
+
 /**
  * @}
  */
@@ -280,10 +347,17 @@ uint8_t USBD_MSC_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
    (void)USBD_LL_CloseEP(pdev, MSCInEpAdd);
    pdev->ep_in[MSCInEpAdd & 0xFU].is_used = 0U;
 
+#if (MSC_UAS_ENABLE == 1U)
+   MSC_UAS_DeInit(pdev);
+#endif /* MSC_UAS_ENABLE */
+
    /* Free MSC Class Resources */
    if (pdev->pClassDataCmsit[pdev->classId] != NULL) {
       /* De-Init the BOT layer */
       MSC_BOT_DeInit(pdev);
+#if (MSC_DEFER_ENABLE == 1U)
+      MSC_SyncPending = 1U;
+#endif /* MSC_DEFER_ENABLE */
 
       (void)USBD_free(pdev->pClassDataCmsit[pdev->classId]);
       pdev->pClassDataCmsit[pdev->classId] = NULL;
@@ -375,7 +449,16 @@ uint8_t USBD_MSC_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req)
 
             case USB_REQ_SET_INTERFACE:
                if (pdev->dev_state == USBD_STATE_CONFIGURED) {
+#if (MSC_UAS_ENABLE == 1U)
+                  if (req->wValue > MSC_UAS_ALT) {
+                     USBD_CtlError(pdev, req);
+                     ret = USBD_FAIL;
+                  } else {
+                     USBD_MSC_SetAlt(pdev, (uint8_t)(req->wValue));
+                  }
+#else
                   hmsc->interface = (uint8_t)(req->wValue);
+#endif /* MSC_UAS_ENABLE */
                } else {
                   USBD_CtlError(pdev, req);
                   ret = USBD_FAIL;
@@ -388,8 +471,10 @@ uint8_t USBD_MSC_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req)
                      /* Flush the FIFO */
                      (void)USBD_LL_FlushEP(pdev, (uint8_t)req->wIndex);
 
-                     /* Handle BOT error */
-                     MSC_BOT_CplClrFeature(pdev, (uint8_t)req->wIndex);
+                     /* Handle BOT error; UAS has no stall recovery */
+                     if (hmsc->interface != MSC_UAS_ALT) {
+                        MSC_BOT_CplClrFeature(pdev, (uint8_t)req->wIndex);
+                     }
                   }
                }
                break;
@@ -419,7 +504,19 @@ uint8_t USBD_MSC_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req)
  */
 uint8_t USBD_MSC_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
 {
-   MSC_BOT_DataIn(pdev, epnum);
+#if (MSC_DEFER_ENABLE == 1U)
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   if (hmsc == NULL) {
+      return (uint8_t)USBD_FAIL;
+   }
+
+   /* only note the event, USBD_MSC_Process() handles it */
+   hmsc->defer_in |= (uint16_t)(1U << (epnum & 0xFU));
+#else
+   MSC_DataIn(pdev, epnum);
+#endif /* MSC_DEFER_ENABLE */
 
    return (uint8_t)USBD_OK;
 }
@@ -433,10 +530,139 @@ uint8_t USBD_MSC_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
  */
 uint8_t USBD_MSC_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum)
 {
-   MSC_BOT_DataOut(pdev, epnum);
+#if (MSC_DEFER_ENABLE == 1U)
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   if (hmsc == NULL) {
+      return (uint8_t)USBD_FAIL;
+   }
+
+   hmsc->defer_out |= (uint16_t)(1U << (epnum & 0xFU));
+#else
+   MSC_DataOut(pdev, epnum);
+#endif /* MSC_DEFER_ENABLE */
 
    return (uint8_t)USBD_OK;
 }
+
+#if (MSC_DEFER_ENABLE == 1U)
+/**
+ * @brief  USBD_MSC_Process
+ *         Handle the work the interrupt deferred: SCSI commands, media I/O
+ *         and rearming the endpoints. Call from the main loop with the USB
+ *         interrupt masked; other interrupts stay enabled.
+ * @param  pdev: device instance
+ * @retval number of events handled
+ */
+uint32_t USBD_MSC_Process(USBD_HandleTypeDef *pdev)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   uint32_t n = 0U;
+
+   /* write-back after a bus reset or unplug, outside the interrupt */
+   if (MSC_SyncPending != 0U) {
+      MSC_SyncPending = 0U;
+      MSC_BOT_Sync(pdev);
+      n++;
+   }
+
+   if ((hmsc == NULL) || ((hmsc->defer_in | hmsc->defer_out |
+                           hmsc->defer_sync) == 0U)) {
+      return n;
+   }
+
+   const uint32_t t0 = USBD_LL_GetTimeUs();
+
+   if (hmsc->defer_sync != 0U) {
+      hmsc->defer_sync = 0U;
+      MSC_BOT_Sync(pdev);
+      n++;
+   }
+
+   const uint16_t out = hmsc->defer_out;
+   const uint16_t in  = hmsc->defer_in;
+   hmsc->defer_out    = 0U;
+   hmsc->defer_in     = 0U;
+
+   for (uint8_t ep = 0U; ep < 16U; ep++) {
+      if ((out & (1U << ep)) != 0U) {
+         MSC_DataOut(pdev, ep);
+         n++;
+      }
+      if ((in & (1U << ep)) != 0U) {
+         MSC_DataIn(pdev, ep);
+         n++;
+      }
+   }
+
+   const uint32_t dt = USBD_LL_GetTimeUs() - t0;
+   if (dt > hmsc->stats.work_max_us) {
+      hmsc->stats.work_max_us = dt;
+   }
+
+   return n;
+}
+#endif /* MSC_DEFER_ENABLE */
+
+/**
+ * @brief  MSC_DataIn
+ *         handle data IN Stage, from the interrupt or USBD_MSC_Process()
+ * @param  pdev: device instance
+ * @param  epnum: endpoint index
+ * @retval None
+ */
+static void MSC_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+#if (MSC_UAS_ENABLE == 1U)
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   if ((hmsc != NULL) && (hmsc->interface == MSC_UAS_ALT)) {
+      if (epnum == (MSC_UAS_STATUS_EP & 0x7FU)) {
+         MSC_UAS_StatusIn(pdev);
+      } else {
+         MSC_BOT_DataIn(pdev, epnum);
+      }
+
+      /* start the next queued command once the data pipes are free */
+      MSC_UAS_Schedule(pdev);
+      return;
+   }
+#endif /* MSC_UAS_ENABLE */
+
+   MSC_BOT_DataIn(pdev, epnum);
+}
+
+/**
+ * @brief  MSC_DataOut
+ *         handle data OUT Stage, from the interrupt or USBD_MSC_Process()
+ * @param  pdev: device instance
+ * @param  epnum: endpoint index
+ * @retval None
+ */
+static void MSC_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+#if (MSC_UAS_ENABLE == 1U)
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   if ((hmsc != NULL) && (hmsc->interface == MSC_UAS_ALT)) {
+      if (epnum == MSC_UAS_CMD_EP) {
+         MSC_UAS_CmdOut(pdev);
+      } else if (hmsc->bot_state == USBD_BOT_DATA_OUT) {
+         /* no CBWs here: only the data stage goes to the BOT */
+         MSC_BOT_DataOut(pdev, epnum);
+      }
+
+      MSC_UAS_Schedule(pdev);
+      return;
+   }
+#endif /* MSC_UAS_ENABLE */
+
+   MSC_BOT_DataOut(pdev, epnum);
+}
 #ifndef USE_USBD_COMPOSITE
 /**
  * @brief  USBD_MSC_GetHSCfgDesc
@@ -446,18 +672,7 @@ uint8_t USBD_MSC_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum)
  */
 uint8_t *USBD_MSC_GetHSCfgDesc(uint16_t *length)
 {
-   USBD_EpDescTypeDef *pEpInDesc =
-       USBD_GetEpDesc(USBD_MSC_CfgDesc, MSC_EPIN_ADDR);
-   USBD_EpDescTypeDef *pEpOutDesc =
-       USBD_GetEpDesc(USBD_MSC_CfgDesc, MSC_EPOUT_ADDR);
-
-   if (pEpInDesc != NULL) {
-      pEpInDesc->wMaxPacketSize = MSC_MAX_HS_PACKET;
-   }
-
-   if (pEpOutDesc != NULL) {
-      pEpOutDesc->wMaxPacketSize = MSC_MAX_HS_PACKET;
-   }
+   USBD_MSC_SetMaxPacket(MSC_MAX_HS_PACKET);
 
    *length = (uint16_t)sizeof(USBD_MSC_CfgDesc);
    return USBD_MSC_CfgDesc;
@@ -471,18 +686,7 @@ uint8_t *USBD_MSC_GetHSCfgDesc(uint16_t *length)
  */
 uint8_t *USBD_MSC_GetFSCfgDesc(uint16_t *length)
 {
-   USBD_EpDescTypeDef *pEpInDesc =
-       USBD_GetEpDesc(USBD_MSC_CfgDesc, MSC_EPIN_ADDR);
-   USBD_EpDescTypeDef *pEpOutDesc =
-       USBD_GetEpDesc(USBD_MSC_CfgDesc, MSC_EPOUT_ADDR);
-
-   if (pEpInDesc != NULL) {
-      pEpInDesc->wMaxPacketSize = MSC_MAX_FS_PACKET;
-   }
-
-   if (pEpOutDesc != NULL) {
-      pEpOutDesc->wMaxPacketSize = MSC_MAX_FS_PACKET;
-   }
+   USBD_MSC_SetMaxPacket(MSC_MAX_FS_PACKET);
 
    *length = (uint16_t)sizeof(USBD_MSC_CfgDesc);
    return USBD_MSC_CfgDesc;
@@ -496,18 +700,7 @@ uint8_t *USBD_MSC_GetFSCfgDesc(uint16_t *length)
  */
 uint8_t *USBD_MSC_GetOtherSpeedCfgDesc(uint16_t *length)
 {
-   USBD_EpDescTypeDef *pEpInDesc =
-       USBD_GetEpDesc(USBD_MSC_CfgDesc, MSC_EPIN_ADDR);
-   USBD_EpDescTypeDef *pEpOutDesc =
-       USBD_GetEpDesc(USBD_MSC_CfgDesc, MSC_EPOUT_ADDR);
-
-   if (pEpInDesc != NULL) {
-      pEpInDesc->wMaxPacketSize = MSC_MAX_FS_PACKET;
-   }
-
-   if (pEpOutDesc != NULL) {
-      pEpOutDesc->wMaxPacketSize = MSC_MAX_FS_PACKET;
-   }
+   USBD_MSC_SetMaxPacket(MSC_MAX_FS_PACKET);
 
    *length = (uint16_t)sizeof(USBD_MSC_CfgDesc);
    return USBD_MSC_CfgDesc;
@@ -525,7 +718,68 @@ uint8_t *USBD_MSC_GetDeviceQualifierDescriptor(uint16_t *length)
 
    return USBD_MSC_DeviceQualifierDesc;
 }
+
+/**
+ * @brief  USBD_MSC_SetMaxPacket
+ *         Patch wMaxPacketSize of every endpoint in the configuration
+ *         descriptor; the data endpoints appear once per alternate setting
+ * @param  mps : max packet size for the current speed
+ * @retval None
+ */
+static void USBD_MSC_SetMaxPacket(uint16_t mps)
+{
+   uint16_t ptr = 0U;
+
+   while (ptr < sizeof(USBD_MSC_CfgDesc)) {
+      if (USBD_MSC_CfgDesc[ptr + 1U] == USB_DESC_TYPE_ENDPOINT) {
+         USBD_MSC_CfgDesc[ptr + 4U] = LOBYTE(mps);
+         USBD_MSC_CfgDesc[ptr + 5U] = HIBYTE(mps);
+      }
+
+      ptr += USBD_MSC_CfgDesc[ptr];
+   }
+}
 #endif /* USE_USBD_COMPOSITE */
+
+#if (MSC_UAS_ENABLE == 1U)
+/**
+ * @brief  USBD_MSC_SetAlt
+ *         Switch between the Bulk-Only Transport and UAS
+ * @param  pdev: device instance
+ * @param  alt: alternate setting
+ * @retval None
+ */
+static void USBD_MSC_SetAlt(USBD_HandleTypeDef *pdev, uint8_t alt)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   uint16_t mps = (pdev->dev_speed == USBD_SPEED_HIGH) ? MSC_MAX_HS_PACKET
+                                                       : MSC_MAX_FS_PACKET;
+
+   if (hmsc->interface == MSC_UAS_ALT) {
+      MSC_UAS_DeInit(pdev);
+   }
+
+   /* reopen the data endpoints to cancel transfers of the old protocol */
+   (void)USBD_LL_CloseEP(pdev, MSCOutEpAdd);
+   (void)USBD_LL_CloseEP(pdev, MSCInEpAdd);
+   (void)USBD_LL_OpenEP(pdev, MSCOutEpAdd, USBD_EP_TYPE_BULK, mps);
+   (void)USBD_LL_OpenEP(pdev, MSCInEpAdd, USBD_EP_TYPE_BULK, mps);
+
+   hmsc->interface = alt;
+
+#if (MSC_DEFER_ENABLE == 1U)
+   hmsc->defer_in  = 0U;
+   hmsc->defer_out = 0U;
+#endif /* MSC_DEFER_ENABLE */
+
+   if (alt == MSC_UAS_ALT) {
+      MSC_UAS_Init(pdev);
+   } else {
+      MSC_BOT_Init(pdev);
+   }
+}
+#endif /* MSC_UAS_ENABLE */
 /**
  * @brief  USBD_MSC_RegisterStorage
  * @param  fops: storage callback
@@ -28,6 +28,7 @@ extern "C" {
 #include "usbd_ioreq.h"
 #include "usbd_msc_bot.h"
 #include "usbd_msc_scsi.h"
+#include "usbd_msc_uas.h"
 
 /** @addtogroup USBD_MSC_BOT
  * @{
@@ -46,12 +47,46 @@ extern "C" {
 #define MSC_MEDIA_PACKET 512U
 #endif /* MSC_MEDIA_PACKET */
 
+/* Number of MSC_MEDIA_PACKET buffers used to pipeline the READ data stage */
+#ifndef MSC_MEDIA_BUF_NBR
+#define MSC_MEDIA_BUF_NBR 2U
+#endif /* MSC_MEDIA_BUF_NBR */
+
+/* Fill the free media buffers while the head one is sent. The reads only
+ * overlap the transfer if the OTG DMA moves the packets or the SCSI layer
+ * runs from the main loop; in the OTG interrupt with the FIFO filled by the
+ * CPU, the FIFO fill waits for the prefetch, so then fetch on demand only */
+#ifndef MSC_READ_PREFETCH
+#if (USBD_DMA_ENABLE == 1U) || (MSC_DEFER_ENABLE == 1U)
+#define MSC_READ_PREFETCH 1U
+#else
+#define MSC_READ_PREFETCH 0U
+#endif
+#endif /* MSC_READ_PREFETCH */
+
+/* Largest single transfer on the direct (zero-copy) media path */
+#ifndef MSC_DIRECT_PACKET
+#define MSC_DIRECT_PACKET 0x10000U
+#endif /* MSC_DIRECT_PACKET */
+
+/* READ HASH: extent size when the command leaves it at zero (64 kB) */
+#ifndef MSC_HASH_EXTENT_BLKS
+#define MSC_HASH_EXTENT_BLKS 128U
+#endif /* MSC_HASH_EXTENT_BLKS */
+
 #define MSC_MAX_FS_PACKET 0x40U
 #define MSC_MAX_HS_PACKET 0x200U
 
 #define BOT_GET_MAX_LUN         0xFE
 #define BOT_RESET               0xFF
+
+#if (MSC_UAS_ENABLE == 1U)
+/* alternate setting 1 adds the UAS interface with 4 endpoints, each followed
+ * by a pipe usage descriptor */
+#define USB_MSC_CONFIG_DESC_SIZ (32 + 9 + (4 * (7 + 4)))
+#else
 #define USB_MSC_CONFIG_DESC_SIZ 32
+#endif /* MSC_UAS_ENABLE */
 
 #ifndef MSC_EPIN_ADDR
 #define MSC_EPIN_ADDR 0x81U
@@ -81,28 +116,93 @@ typedef struct _USBD_STORAGE {
    uint8_t (*GetMaxLun)(void);
    uint8_t *pInquiry;
 
+   /* Optional, may be NULL: map blk_len blocks at blk_addr to memory the
+    * endpoint can use directly; *len is the contiguous length in bytes */
+   uint8_t (*GetBuffer)(uint8_t lun, uint32_t blk_addr, uint32_t blk_len,
+                        uint8_t **pbuf, uint32_t *len);
+
+   /* Optional, may be NULL: write back any data the medium still caches */
+   uint8_t (*Sync)(uint8_t lun);
+
+   /* Optional, may be NULL: scratch memory for commands that stage data
+    * before it goes to the medium; *len is its size in bytes */
+   uint8_t *(*GetStaging)(uint32_t *len);
+
+   /* Optional, may be NULL: deallocate blocks (UNMAP, WRITE SAME with the
+    * UNMAP bit) */
+   uint8_t (*Unmap)(uint8_t lun, uint32_t blk_addr, uint32_t blk_len);
+
+   /* Optional, may be NULL: 0 if the LUN can unmap; *zeroes is set if
+    * unmapped blocks then read as zeros */
+   uint8_t (*GetUnmap)(uint8_t lun, uint8_t *zeroes);
+
+   /* Optional, may be NULL: nonzero if the LUN has a write-back cache that
+    * Sync writes out (reported as WCE in the caching mode page) */
+   uint8_t (*GetWriteCache)(uint8_t lun);
 } USBD_StorageTypeDef;
 
+typedef struct {
+   uint32_t read_cmds;  /* READ commands completed */
+   uint64_t read_bytes; /* bytes sent in READ data stages */
+   uint64_t read_us;    /* time from CBW to last data packet sent */
+   uint32_t read_start;
+   uint8_t read_active;
+   uint32_t work_max_us; /* longest USBD_MSC_Process() call */
+} USBD_MSC_StatsTypeDef;
+
 typedef struct {
    uint32_t max_lun;
    uint32_t interface;
    uint8_t bot_state;
    uint8_t bot_status;
    uint32_t bot_data_length;
-   uint8_t bot_data[MSC_MEDIA_PACKET];
+   uint8_t bot_data[MSC_MEDIA_BUF_NBR * MSC_MEDIA_PACKET];
    USBD_MSC_BOT_CBWTypeDef cbw;
    USBD_MSC_BOT_CSWTypeDef csw;
 
    USBD_SCSI_SenseTypeDef scsi_sense[SENSE_LIST_DEEPTH];
    uint8_t scsi_sense_head;
    uint8_t scsi_sense_tail;
-   uint8_t scsi_medium_state;
 
-   uint16_t scsi_blk_size;
-   uint32_t scsi_blk_nbr;
+   /* per LUN: eject and removal lock */
+   uint8_t scsi_medium_state[MSC_MAX_LUN_NBR];
+
+   /* per LUN, as last reported by READ CAPACITY */
+   uint16_t scsi_blk_size[MSC_MAX_LUN_NBR];
+   uint32_t scsi_blk_nbr[MSC_MAX_LUN_NBR];
 
    uint32_t scsi_blk_addr;
    uint32_t scsi_blk_len;
+
+   /* READ pipeline: ring of filled MSC_MEDIA_PACKET slices of bot_data */
+   uint8_t media_buf_head;
+   uint8_t media_buf_count;
+   uint32_t media_buf_len[MSC_MEDIA_BUF_NBR];
+
+   /* OUT chunk received straight into the medium, NULL if into bot_data */
+   uint8_t *media_direct;
+   uint32_t media_direct_len;
+
+   /* WRITE LZ4: compressed data is received into the staging memory behind
+    * the area it is decompressed to */
+   uint8_t *lz4_out;
+   uint8_t *lz4_in;
+   uint32_t lz4_len; /* compressed bytes */
+   uint32_t lz4_rx;  /* of which received */
+
+   USBD_MSC_StatsTypeDef stats;
+
+#if (MSC_DEFER_ENABLE == 1U)
+   /* work noted by the interrupt for USBD_MSC_Process(): completed
+    * transfers, one bit per endpoint number, and a medium write-back */
+   volatile uint16_t defer_in;
+   volatile uint16_t defer_out;
+   volatile uint8_t defer_sync;
+#endif /* MSC_DEFER_ENABLE */
+
+#if (MSC_UAS_ENABLE == 1U)
+   USBD_MSC_UAS_HandleTypeDef uas;
+#endif /* MSC_UAS_ENABLE */
 } USBD_MSC_BOT_HandleTypeDef;
 
 /* Structure for MSC process */
@@ -111,6 +211,10 @@ extern USBD_ClassTypeDef USBD_MSC;
 
 uint8_t USBD_MSC_RegisterStorage(USBD_HandleTypeDef *pdev,
                                  USBD_StorageTypeDef *fops);
+
+#if (MSC_DEFER_ENABLE == 1U)
+uint32_t USBD_MSC_Process(USBD_HandleTypeDef *pdev);
+#endif /* MSC_DEFER_ENABLE */
 /**
  * @}
  */
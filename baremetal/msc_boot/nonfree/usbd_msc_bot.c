@@ -111,9 +111,18 @@ void MSC_BOT_Init(USBD_HandleTypeDef *pdev)
    hmsc->bot_state  = USBD_BOT_IDLE;
    hmsc->bot_status = USBD_BOT_STATUS_NORMAL;
 
-   hmsc->scsi_sense_tail   = 0U;
-   hmsc->scsi_sense_head   = 0U;
-   hmsc->scsi_medium_state = SCSI_MEDIUM_UNLOCKED;
+   hmsc->scsi_sense_tail = 0U;
+   hmsc->scsi_sense_head = 0U;
+   for (uint8_t lun = 0U; lun < MSC_MAX_LUN_NBR; lun++) {
+      hmsc->scsi_medium_state[lun] = SCSI_MEDIUM_UNLOCKED;
+   }
+
+#if (MSC_DEFER_ENABLE == 1U)
+   hmsc->defer_in  = 0U;
+   hmsc->defer_out = 0U;
+#endif /* MSC_DEFER_ENABLE */
+
+   (void)USBD_memset(&hmsc->stats, 0, sizeof(hmsc->stats));
 
    ((USBD_StorageTypeDef *)pdev->pUserData[pdev->classId])->Init(0U);
 
@@ -151,6 +160,17 @@ void MSC_BOT_Reset(USBD_HandleTypeDef *pdev)
    hmsc->bot_state  = USBD_BOT_IDLE;
    hmsc->bot_status = USBD_BOT_STATUS_RECOVERY;
 
+   /* the host may power the device down next; nothing to report on failure */
+#if (MSC_DEFER_ENABLE == 1U)
+   /* drop transfers of the aborted command; the write-back runs before the
+    * next command is processed */
+   hmsc->defer_in   = 0U;
+   hmsc->defer_out  = 0U;
+   hmsc->defer_sync = 1U;
+#else
+   MSC_BOT_Sync(pdev);
+#endif /* MSC_DEFER_ENABLE */
+
    (void)USBD_LL_ClearStallEP(pdev, MSCInEpAdd);
    (void)USBD_LL_ClearStallEP(pdev, MSCOutEpAdd);
 
@@ -173,6 +193,32 @@ void MSC_BOT_DeInit(USBD_HandleTypeDef *pdev)
    if (hmsc != NULL) {
       hmsc->bot_state = USBD_BOT_IDLE;
    }
+
+#if (MSC_DEFER_ENABLE == 0U)
+   /* bus reset or unplug: write back whatever the medium still caches;
+    * deferred, USBD_MSC_DeInit() leaves it to USBD_MSC_Process() */
+   MSC_BOT_Sync(pdev);
+#endif /* MSC_DEFER_ENABLE */
+}
+
+/**
+ * @brief  MSC_BOT_Sync
+ *         Write back data cached by the medium of every LUN
+ * @param  pdev: device instance
+ * @retval None
+ */
+void MSC_BOT_Sync(USBD_HandleTypeDef *pdev)
+{
+   USBD_StorageTypeDef *fops =
+       (USBD_StorageTypeDef *)pdev->pUserData[pdev->classId];
+
+   if ((fops == NULL) || (fops->Sync == NULL)) {
+      return;
+   }
+
+   for (uint8_t lun = 0U; lun <= fops->GetMaxLun(); lun++) {
+      (void)fops->Sync(lun);
+   }
 }
 
 /**
@@ -202,6 +248,11 @@ void MSC_BOT_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
 
       case USBD_BOT_SEND_DATA:
       case USBD_BOT_LAST_DATA_IN:
+         if (hmsc->stats.read_active != 0U) {
+            hmsc->stats.read_us += USBD_LL_GetTimeUs() - hmsc->stats.read_start;
+            hmsc->stats.read_cmds++;
+            hmsc->stats.read_active = 0U;
+         }
          MSC_BOT_SendCSW(pdev, USBD_CSW_CMD_PASSED);
          break;
 
@@ -268,13 +319,18 @@ static void MSC_BOT_CBW_Decode(USBD_HandleTypeDef *pdev)
 
    if ((USBD_LL_GetRxDataSize(pdev, MSCOutEpAdd) != USBD_BOT_CBW_LENGTH) ||
        (hmsc->cbw.dSignature != USBD_BOT_CBW_SIGNATURE) ||
-       (hmsc->cbw.bLUN > 1U) || (hmsc->cbw.bCBLength < 1U) ||
+       (hmsc->cbw.bLUN > ((USBD_StorageTypeDef *)pdev->pUserData[pdev->classId])
+                               ->GetMaxLun()) || (hmsc->cbw.bCBLength < 1U) ||
        (hmsc->cbw.bCBLength > 16U)) {
       SCSI_SenseCode(pdev, hmsc->cbw.bLUN, ILLEGAL_REQUEST, INVALID_CDB);
 
       hmsc->bot_status = USBD_BOT_STATUS_ERROR;
       MSC_BOT_Abort(pdev);
    } else {
+      /* a valid CBW ends any reset recovery, or a later failing command
+       * would never get its CSW after the host clears the stall */
+      hmsc->bot_status = USBD_BOT_STATUS_NORMAL;
+
       if (SCSI_ProcessCmd(pdev, hmsc->cbw.bLUN, &hmsc->cbw.CB[0]) != 0) {
          if (hmsc->bot_state == USBD_BOT_NO_DATA) {
             MSC_BOT_SendCSW(pdev, USBD_CSW_CMD_FAILED);
@@ -364,6 +420,16 @@ void MSC_BOT_SendCSW(USBD_HandleTypeDef *pdev, uint8_t CSW_Status)
    hmsc->csw.bStatus    = CSW_Status;
    hmsc->bot_state      = USBD_BOT_IDLE;
 
+   hmsc->stats.read_active = 0U;
+
+#if (MSC_UAS_ENABLE == 1U)
+   if (hmsc->interface == MSC_UAS_ALT) {
+      /* the status goes out as a Sense IU on the status pipe */
+      MSC_UAS_Complete(pdev, CSW_Status);
+      return;
+   }
+#endif /* MSC_UAS_ENABLE */
+
    (void)USBD_LL_Transmit(pdev, MSCInEpAdd, (uint8_t *)&hmsc->csw,
                           USBD_BOT_CSW_LENGTH);
 
@@ -117,6 +117,8 @@ void MSC_BOT_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum);
 void MSC_BOT_SendCSW(USBD_HandleTypeDef *pdev, uint8_t CSW_Status);
 
 void MSC_BOT_CplClrFeature(USBD_HandleTypeDef *pdev, uint8_t epnum);
+
+void MSC_BOT_Sync(USBD_HandleTypeDef *pdev);
 /**
  * @}
  */
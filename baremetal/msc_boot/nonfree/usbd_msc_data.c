@@ -61,7 +61,8 @@ EndBSPDependencies */
 
 /* USB Mass storage Page 0 Inquiry Data */
 uint8_t MSC_Page00_Inquiry_Data[LENGTH_INQUIRY_PAGE00] = {
-    0x00, 0x00, 0x00, (LENGTH_INQUIRY_PAGE00 - 4U), 0x00, 0x80};
+    0x00, 0x00, 0x00, (LENGTH_INQUIRY_PAGE00 - 4U), 0x00, 0x80, 0xB0, 0xB1,
+    0xB2};
 
 /* USB Mass storage VPD Page 0x80 Inquiry Data for Unit Serial Number */
 uint8_t MSC_Page80_Inquiry_Data[LENGTH_INQUIRY_PAGE80] = {
@@ -69,16 +70,45 @@ uint8_t MSC_Page80_Inquiry_Data[LENGTH_INQUIRY_PAGE80] = {
     0x20, /* Put Product Serial number */
     0x20, 0x20, 0x20};
 
-/* USB Mass storage sense 6 Data */
+/* USB Mass storage VPD Page 0xB0 Inquiry Data for Block Limits */
+uint8_t MSC_PageB0_Inquiry_Data[LENGTH_INQUIRY_PAGEB0] = {
+    0x00, 0xB0, 0x00, (LENGTH_INQUIRY_PAGEB0 - 4U), 0x00, 0x00,
+    (uint8_t)(MSC_OPT_XFER_GRAN >> 8), (uint8_t)MSC_OPT_XFER_GRAN,
+    (uint8_t)(MSC_MAX_XFER_BLKS >> 24), (uint8_t)(MSC_MAX_XFER_BLKS >> 16),
+    (uint8_t)(MSC_MAX_XFER_BLKS >> 8), (uint8_t)MSC_MAX_XFER_BLKS,
+    (uint8_t)(MSC_OPT_XFER_BLKS >> 24), (uint8_t)(MSC_OPT_XFER_BLKS >> 16),
+    (uint8_t)(MSC_OPT_XFER_BLKS >> 8), (uint8_t)MSC_OPT_XFER_BLKS,
+    0x00, 0x00, 0x00, 0x00, /* maximum prefetch length */
+    (uint8_t)(MSC_UNMAP_MAX_BLKS >> 24), (uint8_t)(MSC_UNMAP_MAX_BLKS >> 16),
+    (uint8_t)(MSC_UNMAP_MAX_BLKS >> 8), (uint8_t)MSC_UNMAP_MAX_BLKS,
+    0x00, 0x00, (uint8_t)(MSC_UNMAP_MAX_DESC >> 8), (uint8_t)MSC_UNMAP_MAX_DESC,
+    0x00, 0x00, 0x00, 0x00, /* optimal unmap granularity */
+    0x00, 0x00, 0x00, 0x00, /* unmap granularity alignment */
+    0x00, 0x00, 0x00, 0x00, /* maximum write same length */
+    (uint8_t)(MSC_UNMAP_MAX_BLKS >> 24), (uint8_t)(MSC_UNMAP_MAX_BLKS >> 16),
+    (uint8_t)(MSC_UNMAP_MAX_BLKS >> 8), (uint8_t)MSC_UNMAP_MAX_BLKS};
+
+/* USB Mass storage VPD Page 0xB1 Inquiry Data for Block Device
+ * Characteristics: non-rotating medium */
+uint8_t MSC_PageB1_Inquiry_Data[LENGTH_INQUIRY_PAGEB1] = {
+    0x00, 0xB1, 0x00, (LENGTH_INQUIRY_PAGEB1 - 4U), 0x00, 0x01};
+
+/* USB Mass storage VPD Page 0xB2 Inquiry Data for Logical Block
+ * Provisioning: UNMAP and WRITE SAME(16) may unmap; byte 5 is set per LUN */
+uint8_t MSC_PageB2_Inquiry_Data[LENGTH_INQUIRY_PAGEB2] = {
+    0x00, 0xB2, 0x00, (LENGTH_INQUIRY_PAGEB2 - 4U), 0x00, 0x00, 0x00, 0x00};
+
+/* USB Mass storage sense 6 Data: header and Caching page with WCE set */
 uint8_t MSC_Mode_Sense6_data[MODE_SENSE6_LEN] = {
-    0x22, 0x00, 0x00, 0x00, 0x08, 0x12, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    (MODE_SENSE6_LEN - 1U), 0x00, 0x00, 0x00, 0x08, 0x12, 0x04, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 
-/* USB Mass storage sense 10  Data */
+/* USB Mass storage sense 10 Data: header and Caching page with WCE set */
 uint8_t MSC_Mode_Sense10_data[MODE_SENSE10_LEN] = {
-    0x00, 0x26, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08,
-    0x12, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    0x00, (MODE_SENSE10_LEN - 2U), 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x08, 0x12, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 /**
  * @}
  */
@@ -28,6 +28,9 @@ EndBSPDependencies */
 #include "usbd_msc.h"
 #include "usbd_msc_bot.h"
 #include "usbd_msc_data.h"
+#include "crc32.h"
+#include "lz4.h"
+#include "sha256.h"
 
 /** @addtogroup STM32_USB_DEVICE_LIBRARY
  * @{
@@ -96,16 +99,45 @@ static uint8_t SCSI_Write10(USBD_HandleTypeDef *pdev, uint8_t lun,
                            uint8_t *params);
 static uint8_t SCSI_Write12(USBD_HandleTypeDef *pdev, uint8_t lun,
                            uint8_t *params);
+static uint8_t SCSI_Write16(USBD_HandleTypeDef *pdev, uint8_t lun,
+                           uint8_t *params);
+static uint8_t SCSI_WriteLZ4(USBD_HandleTypeDef *pdev, uint8_t lun,
+                            uint8_t *params);
+static uint8_t SCSI_ProcessWriteLZ4(USBD_HandleTypeDef *pdev, uint8_t lun);
+static uint8_t SCSI_Unmap(USBD_HandleTypeDef *pdev, uint8_t lun,
+                          uint8_t *params);
+static uint8_t SCSI_ProcessUnmap(USBD_HandleTypeDef *pdev, uint8_t lun);
+static uint8_t SCSI_WriteSame16(USBD_HandleTypeDef *pdev, uint8_t lun,
+                                uint8_t *params);
+static uint8_t SCSI_ProcessWriteSame(USBD_HandleTypeDef *pdev, uint8_t lun);
+static uint8_t SCSI_ProvisioningFlags(USBD_HandleTypeDef *pdev, uint8_t lun);
+static uint8_t SCSI_ReadHash(USBD_HandleTypeDef *pdev, uint8_t lun,
+                             uint8_t *params);
+static uint8_t SCSI_ReadDigest(USBD_HandleTypeDef *pdev, uint8_t lun,
+                               uint8_t *params);
 static uint8_t SCSI_Read10(USBD_HandleTypeDef *pdev, uint8_t lun,
                           uint8_t *params);
 static uint8_t SCSI_Read12(USBD_HandleTypeDef *pdev, uint8_t lun,
                           uint8_t *params);
+static uint8_t SCSI_Read16(USBD_HandleTypeDef *pdev, uint8_t lun,
+                          uint8_t *params);
 static uint8_t SCSI_Verify10(USBD_HandleTypeDef *pdev, uint8_t lun,
                             uint8_t *params);
+static uint8_t SCSI_SynchronizeCache(USBD_HandleTypeDef *pdev, uint8_t lun,
+                                     uint8_t *params);
+static uint8_t SCSI_Sync(USBD_HandleTypeDef *pdev, uint8_t lun);
 static uint8_t SCSI_CheckAddressRange(USBD_HandleTypeDef *pdev, uint8_t lun,
                                      uint32_t blk_offset, uint32_t blk_nbr);
+static uint8_t SCSI_GetLba16(USBD_HandleTypeDef *pdev, uint8_t lun,
+                            uint8_t *params);
+static void SCSI_ModeSenseCaching(USBD_HandleTypeDef *pdev, uint8_t lun,
+                                  uint8_t *params, uint16_t offset);
 
 static uint8_t SCSI_ProcessRead(USBD_HandleTypeDef *pdev, uint8_t lun);
+static uint8_t SCSI_FetchRead(USBD_HandleTypeDef *pdev, uint8_t lun,
+                             uint8_t idx);
+static uint8_t SCSI_DirectRead(USBD_HandleTypeDef *pdev, uint8_t lun);
+static void SCSI_PrepareWrite(USBD_HandleTypeDef *pdev, uint8_t lun);
 static uint8_t SCSI_ProcessWrite(USBD_HandleTypeDef *pdev, uint8_t lun);
 
 static uint8_t SCSI_UpdateBotData(USBD_MSC_BOT_HandleTypeDef *hmsc,
@@ -174,12 +206,31 @@ uint8_t SCSI_ProcessCmd(USBD_HandleTypeDef *pdev, uint8_t lun, uint8_t *cmd)
 
       case SCSI_READ12: ret = SCSI_Read12(pdev, lun, cmd); break;
 
+      case SCSI_READ16: ret = SCSI_Read16(pdev, lun, cmd); break;
+
       case SCSI_WRITE10: ret = SCSI_Write10(pdev, lun, cmd); break;
 
       case SCSI_WRITE12: ret = SCSI_Write12(pdev, lun, cmd); break;
 
+      case SCSI_WRITE16: ret = SCSI_Write16(pdev, lun, cmd); break;
+
+      case SCSI_WRITE_LZ4: ret = SCSI_WriteLZ4(pdev, lun, cmd); break;
+
+      case SCSI_UNMAP: ret = SCSI_Unmap(pdev, lun, cmd); break;
+
+      case SCSI_WRITE_SAME16: ret = SCSI_WriteSame16(pdev, lun, cmd); break;
+
+      case SCSI_READ_HASH: ret = SCSI_ReadHash(pdev, lun, cmd); break;
+
+      case SCSI_READ_DIGEST: ret = SCSI_ReadDigest(pdev, lun, cmd); break;
+
       case SCSI_VERIFY10: ret = SCSI_Verify10(pdev, lun, cmd); break;
 
+      case SCSI_SYNCHRONIZE_CACHE10:
+      case SCSI_SYNCHRONIZE_CACHE16:
+         ret = SCSI_SynchronizeCache(pdev, lun, cmd);
+         break;
+
       default:
          SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST, INVALID_CDB);
          hmsc->bot_status = USBD_BOT_STATUS_ERROR;
@@ -215,7 +266,7 @@ static uint8_t SCSI_TestUnitReady(USBD_HandleTypeDef *pdev, uint8_t lun,
       return -1;
    }
 
-   if (hmsc->scsi_medium_state == SCSI_MEDIUM_EJECTED) {
+   if (hmsc->scsi_medium_state[lun] == SCSI_MEDIUM_EJECTED) {
       SCSI_SenseCode(pdev, lun, NOT_READY, MEDIUM_NOT_PRESENT);
       hmsc->bot_state = USBD_BOT_NO_DATA;
       return -1;
@@ -261,13 +312,30 @@ static uint8_t SCSI_Inquiry(USBD_HandleTypeDef *pdev, uint8_t lun,
    {
       if (params[2] == 0U) /* Request for Supported Vital Product Data Pages*/
       {
-         (void)SCSI_UpdateBotData(hmsc, MSC_Page00_Inquiry_Data,
-                                  LENGTH_INQUIRY_PAGE00);
+         pPage = MSC_Page00_Inquiry_Data;
+         len   = LENGTH_INQUIRY_PAGE00;
       } else if (params[2] ==
                  0x80U) /* Request for VPD page 0x80 Unit Serial Number */
       {
-         (void)SCSI_UpdateBotData(hmsc, MSC_Page80_Inquiry_Data,
-                                  LENGTH_INQUIRY_PAGE80);
+         pPage = MSC_Page80_Inquiry_Data;
+         len   = LENGTH_INQUIRY_PAGE80;
+      } else if (params[2] ==
+                 0xB0U) /* Request for VPD page 0xB0 Block Limits */
+      {
+         pPage = MSC_PageB0_Inquiry_Data;
+         len   = LENGTH_INQUIRY_PAGEB0;
+      } else if (params[2] ==
+                 0xB1U) /* Request for VPD page 0xB1 Device Characteristics */
+      {
+         pPage = MSC_PageB1_Inquiry_Data;
+         len   = LENGTH_INQUIRY_PAGEB1;
+      } else if (params[2] ==
+                 0xB2U) /* Request for VPD page 0xB2 Logical Block
+                           Provisioning */
+      {
+         pPage    = MSC_PageB2_Inquiry_Data;
+         len      = LENGTH_INQUIRY_PAGEB2;
+         pPage[5] = SCSI_ProvisioningFlags(pdev, lun);
       } else /* Request Not supported */
       {
          SCSI_SenseCode(pdev, hmsc->cbw.bLUN, ILLEGAL_REQUEST,
@@ -275,6 +343,13 @@ static uint8_t SCSI_Inquiry(USBD_HandleTypeDef *pdev, uint8_t lun,
 
          return -1;
       }
+
+      /* Allocation length */
+      if ((uint16_t)(((uint16_t)params[3] << 8) | params[4]) < len) {
+         len = (uint16_t)(((uint16_t)params[3] << 8) | params[4]);
+      }
+
+      (void)SCSI_UpdateBotData(hmsc, pPage, len);
    } else {
 
       pPage =
@@ -312,22 +387,23 @@ static uint8_t SCSI_ReadCapacity10(USBD_HandleTypeDef *pdev, uint8_t lun,
    }
 
    ret = ((USBD_StorageTypeDef *)pdev->pUserData[pdev->classId])
-             ->GetCapacity(lun, &hmsc->scsi_blk_nbr, &hmsc->scsi_blk_size);
+             ->GetCapacity(lun, &hmsc->scsi_blk_nbr[lun],
+                            &hmsc->scsi_blk_size[lun]);
 
-   if ((ret != 0) || (hmsc->scsi_medium_state == SCSI_MEDIUM_EJECTED)) {
+   if ((ret != 0) || (hmsc->scsi_medium_state[lun] == SCSI_MEDIUM_EJECTED)) {
       SCSI_SenseCode(pdev, lun, NOT_READY, MEDIUM_NOT_PRESENT);
       return -1;
    }
 
-   hmsc->bot_data[0] = (uint8_t)((hmsc->scsi_blk_nbr - 1U) >> 24);
-   hmsc->bot_data[1] = (uint8_t)((hmsc->scsi_blk_nbr - 1U) >> 16);
-   hmsc->bot_data[2] = (uint8_t)((hmsc->scsi_blk_nbr - 1U) >> 8);
-   hmsc->bot_data[3] = (uint8_t)(hmsc->scsi_blk_nbr - 1U);
+   hmsc->bot_data[0] = (uint8_t)((hmsc->scsi_blk_nbr[lun] - 1U) >> 24);
+   hmsc->bot_data[1] = (uint8_t)((hmsc->scsi_blk_nbr[lun] - 1U) >> 16);
+   hmsc->bot_data[2] = (uint8_t)((hmsc->scsi_blk_nbr[lun] - 1U) >> 8);
+   hmsc->bot_data[3] = (uint8_t)(hmsc->scsi_blk_nbr[lun] - 1U);
 
-   hmsc->bot_data[4] = (uint8_t)(hmsc->scsi_blk_size >> 24);
-   hmsc->bot_data[5] = (uint8_t)(hmsc->scsi_blk_size >> 16);
-   hmsc->bot_data[6] = (uint8_t)(hmsc->scsi_blk_size >> 8);
-   hmsc->bot_data[7] = (uint8_t)(hmsc->scsi_blk_size);
+   hmsc->bot_data[4] = (uint8_t)(hmsc->scsi_blk_size[lun] >> 24);
+   hmsc->bot_data[5] = (uint8_t)(hmsc->scsi_blk_size[lun] >> 16);
+   hmsc->bot_data[6] = (uint8_t)(hmsc->scsi_blk_size[lun] >> 8);
+   hmsc->bot_data[7] = (uint8_t)(hmsc->scsi_blk_size[lun]);
 
    hmsc->bot_data_length = 8U;
 
@@ -347,17 +423,20 @@ static uint8_t SCSI_ReadCapacity16(USBD_HandleTypeDef *pdev, uint8_t lun,
    UNUSED(params);
    uint8_t idx;
    uint8_t ret;
+   uint8_t zeroes;
    USBD_MSC_BOT_HandleTypeDef *hmsc =
        (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   USBD_StorageTypeDef *fops =
+       (USBD_StorageTypeDef *)pdev->pUserData[pdev->classId];
 
    if (hmsc == NULL) {
       return -1;
    }
 
-   ret = ((USBD_StorageTypeDef *)pdev->pUserData[pdev->classId])
-             ->GetCapacity(lun, &hmsc->scsi_blk_nbr, &hmsc->scsi_blk_size);
+   ret = fops->GetCapacity(lun, &hmsc->scsi_blk_nbr[lun],
+                           &hmsc->scsi_blk_size[lun]);
 
-   if ((ret != 0) || (hmsc->scsi_medium_state == SCSI_MEDIUM_EJECTED)) {
+   if ((ret != 0) || (hmsc->scsi_medium_state[lun] == SCSI_MEDIUM_EJECTED)) {
       SCSI_SenseCode(pdev, lun, NOT_READY, MEDIUM_NOT_PRESENT);
       return -1;
    }
@@ -370,15 +449,20 @@ static uint8_t SCSI_ReadCapacity16(USBD_HandleTypeDef *pdev, uint8_t lun,
       hmsc->bot_data[idx] = 0U;
    }
 
-   hmsc->bot_data[4] = (uint8_t)((hmsc->scsi_blk_nbr - 1U) >> 24);
-   hmsc->bot_data[5] = (uint8_t)((hmsc->scsi_blk_nbr - 1U) >> 16);
-   hmsc->bot_data[6] = (uint8_t)((hmsc->scsi_blk_nbr - 1U) >> 8);
-   hmsc->bot_data[7] = (uint8_t)(hmsc->scsi_blk_nbr - 1U);
+   hmsc->bot_data[4] = (uint8_t)((hmsc->scsi_blk_nbr[lun] - 1U) >> 24);
+   hmsc->bot_data[5] = (uint8_t)((hmsc->scsi_blk_nbr[lun] - 1U) >> 16);
+   hmsc->bot_data[6] = (uint8_t)((hmsc->scsi_blk_nbr[lun] - 1U) >> 8);
+   hmsc->bot_data[7] = (uint8_t)(hmsc->scsi_blk_nbr[lun] - 1U);
+
+   hmsc->bot_data[8]  = (uint8_t)(hmsc->scsi_blk_size[lun] >> 24);
+   hmsc->bot_data[9]  = (uint8_t)(hmsc->scsi_blk_size[lun] >> 16);
+   hmsc->bot_data[10] = (uint8_t)(hmsc->scsi_blk_size[lun] >> 8);
+   hmsc->bot_data[11] = (uint8_t)(hmsc->scsi_blk_size[lun]);
 
-   hmsc->bot_data[8]  = (uint8_t)(hmsc->scsi_blk_size >> 24);
-   hmsc->bot_data[9]  = (uint8_t)(hmsc->scsi_blk_size >> 16);
-   hmsc->bot_data[10] = (uint8_t)(hmsc->scsi_blk_size >> 8);
-   hmsc->bot_data[11] = (uint8_t)(hmsc->scsi_blk_size);
+   /* LBPME, and LBPRZ if unmapped blocks read as zeros */
+   if ((fops->GetUnmap != NULL) && (fops->GetUnmap(lun, &zeroes) == 0U)) {
+      hmsc->bot_data[14] = (zeroes != 0U) ? 0xC0U : 0x80U;
+   }
 
    hmsc->bot_data_length = ((uint32_t)params[10] << 24) |
                            ((uint32_t)params[11] << 16) |
@@ -412,7 +496,7 @@ static uint8_t SCSI_ReadFormatCapacity(USBD_HandleTypeDef *pdev, uint8_t lun,
    ret = ((USBD_StorageTypeDef *)pdev->pUserData[pdev->classId])
              ->GetCapacity(lun, &blk_nbr, &blk_size);
 
-   if ((ret != 0) || (hmsc->scsi_medium_state == SCSI_MEDIUM_EJECTED)) {
+   if ((ret != 0) || (hmsc->scsi_medium_state[lun] == SCSI_MEDIUM_EJECTED)) {
       SCSI_SenseCode(pdev, lun, NOT_READY, MEDIUM_NOT_PRESENT);
       return -1;
    }
@@ -447,7 +531,6 @@ static uint8_t SCSI_ReadFormatCapacity(USBD_HandleTypeDef *pdev, uint8_t lun,
 static uint8_t SCSI_ModeSense6(USBD_HandleTypeDef *pdev, uint8_t lun,
                               uint8_t *params)
 {
-   UNUSED(lun);
    USBD_MSC_BOT_HandleTypeDef *hmsc =
        (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
    uint16_t len = MODE_SENSE6_LEN;
@@ -456,11 +539,18 @@ static uint8_t SCSI_ModeSense6(USBD_HandleTypeDef *pdev, uint8_t lun,
       return -1;
    }
 
+   /* only the Caching page is implemented */
+   if (((params[2] & 0x3FU) != 0x08U) && ((params[2] & 0x3FU) != 0x3FU)) {
+      SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST, INVALID_FIELED_IN_COMMAND);
+      return -1;
+   }
+
    if (params[4] <= len) {
       len = params[4];
    }
 
    (void)SCSI_UpdateBotData(hmsc, MSC_Mode_Sense6_data, len);
+   SCSI_ModeSenseCaching(pdev, lun, params, 4U);
 
    return 0;
 }
@@ -475,7 +565,6 @@ static uint8_t SCSI_ModeSense6(USBD_HandleTypeDef *pdev, uint8_t lun,
 static uint8_t SCSI_ModeSense10(USBD_HandleTypeDef *pdev, uint8_t lun,
                                uint8_t *params)
 {
-   UNUSED(lun);
    USBD_MSC_BOT_HandleTypeDef *hmsc =
        (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
    uint16_t len = MODE_SENSE10_LEN;
@@ -484,11 +573,18 @@ static uint8_t SCSI_ModeSense10(USBD_HandleTypeDef *pdev, uint8_t lun,
       return -1;
    }
 
+   /* only the Caching page is implemented */
+   if (((params[2] & 0x3FU) != 0x08U) && ((params[2] & 0x3FU) != 0x3FU)) {
+      SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST, INVALID_FIELED_IN_COMMAND);
+      return -1;
+   }
+
    if (params[8] <= len) {
       len = params[8];
    }
 
    (void)SCSI_UpdateBotData(hmsc, MSC_Mode_Sense10_data, len);
+   SCSI_ModeSenseCaching(pdev, lun, params, 8U);
 
    return 0;
 }
@@ -594,7 +690,7 @@ static uint8_t SCSI_StartStopUnit(USBD_HandleTypeDef *pdev, uint8_t lun,
       return -1;
    }
 
-   if ((hmsc->scsi_medium_state == SCSI_MEDIUM_LOCKED) &&
+   if ((hmsc->scsi_medium_state[lun] == SCSI_MEDIUM_LOCKED) &&
        ((params[4] & 0x3U) == 2U)) {
       SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST, INVALID_FIELED_IN_COMMAND);
 
@@ -603,15 +699,21 @@ static uint8_t SCSI_StartStopUnit(USBD_HandleTypeDef *pdev, uint8_t lun,
 
    if ((params[4] & 0x3U) == 0x1U) /* START=1 */
    {
-      hmsc->scsi_medium_state = SCSI_MEDIUM_UNLOCKED;
+      hmsc->scsi_medium_state[lun] = SCSI_MEDIUM_UNLOCKED;
    } else if ((params[4] & 0x3U) == 0x2U) /* START=0 and LOEJ Load Eject=1 */
    {
-      hmsc->scsi_medium_state = SCSI_MEDIUM_EJECTED;
+      if (SCSI_Sync(pdev, lun) != 0) {
+         return -1;
+      }
+      hmsc->scsi_medium_state[lun] = SCSI_MEDIUM_EJECTED;
    } else if ((params[4] & 0x3U) == 0x3U) /* START=1 and LOEJ Load Eject=1 */
    {
-      hmsc->scsi_medium_state = SCSI_MEDIUM_UNLOCKED;
-   } else {
-      /* .. */
+      hmsc->scsi_medium_state[lun] = SCSI_MEDIUM_UNLOCKED;
+   } else /* START=0: the host is about to stop using the medium */
+   {
+      if (SCSI_Sync(pdev, lun) != 0) {
+         return -1;
+      }
    }
    hmsc->bot_data_length = 0U;
 
@@ -637,9 +739,9 @@ static uint8_t SCSI_AllowPreventRemovable(USBD_HandleTypeDef *pdev, uint8_t lun,
    }
 
    if (params[4] == 0U) {
-      hmsc->scsi_medium_state = SCSI_MEDIUM_UNLOCKED;
+      hmsc->scsi_medium_state[lun] = SCSI_MEDIUM_UNLOCKED;
    } else {
-      hmsc->scsi_medium_state = SCSI_MEDIUM_LOCKED;
+      hmsc->scsi_medium_state[lun] = SCSI_MEDIUM_LOCKED;
    }
 
    hmsc->bot_data_length = 0U;
@@ -672,7 +774,7 @@ static uint8_t SCSI_Read10(USBD_HandleTypeDef *pdev, uint8_t lun,
          return -1;
       }
 
-      if (hmsc->scsi_medium_state == SCSI_MEDIUM_EJECTED) {
+      if (hmsc->scsi_medium_state[lun] == SCSI_MEDIUM_EJECTED) {
          SCSI_SenseCode(pdev, lun, NOT_READY, MEDIUM_NOT_PRESENT);
 
          return -1;
@@ -700,12 +802,17 @@ static uint8_t SCSI_Read10(USBD_HandleTypeDef *pdev, uint8_t lun,
       }
 
       /* cases 4,5 : Hi <> Dn */
-      if (hmsc->cbw.dDataLength != (hmsc->scsi_blk_len * hmsc->scsi_blk_size)) {
+      if (hmsc->cbw.dDataLength !=
+          (hmsc->scsi_blk_len * hmsc->scsi_blk_size[lun])) {
          SCSI_SenseCode(pdev, hmsc->cbw.bLUN, ILLEGAL_REQUEST, INVALID_CDB);
          return -1;
       }
 
-      hmsc->bot_state = USBD_BOT_DATA_IN;
+      hmsc->bot_state         = USBD_BOT_DATA_IN;
+      hmsc->media_buf_head    = 0U;
+      hmsc->media_buf_count   = 0U;
+      hmsc->stats.read_start  = USBD_LL_GetTimeUs();
+      hmsc->stats.read_active = 1U;
    }
    hmsc->bot_data_length = MSC_MEDIA_PACKET;
 
@@ -737,7 +844,7 @@ static uint8_t SCSI_Read12(USBD_HandleTypeDef *pdev, uint8_t lun,
          return -1;
       }
 
-      if (hmsc->scsi_medium_state == SCSI_MEDIUM_EJECTED) {
+      if (hmsc->scsi_medium_state[lun] == SCSI_MEDIUM_EJECTED) {
          SCSI_SenseCode(pdev, lun, NOT_READY, MEDIUM_NOT_PRESENT);
          return -1;
       }
@@ -766,12 +873,84 @@ static uint8_t SCSI_Read12(USBD_HandleTypeDef *pdev, uint8_t lun,
       }
 
       /* cases 4,5 : Hi <> Dn */
-      if (hmsc->cbw.dDataLength != (hmsc->scsi_blk_len * hmsc->scsi_blk_size)) {
+      if (hmsc->cbw.dDataLength !=
+          (hmsc->scsi_blk_len * hmsc->scsi_blk_size[lun])) {
+         SCSI_SenseCode(pdev, hmsc->cbw.bLUN, ILLEGAL_REQUEST, INVALID_CDB);
+         return -1;
+      }
+
+      hmsc->bot_state         = USBD_BOT_DATA_IN;
+      hmsc->media_buf_head    = 0U;
+      hmsc->media_buf_count   = 0U;
+      hmsc->stats.read_start  = USBD_LL_GetTimeUs();
+      hmsc->stats.read_active = 1U;
+   }
+   hmsc->bot_data_length = MSC_MEDIA_PACKET;
+
+   return SCSI_ProcessRead(pdev, lun);
+}
+
+/**
+ * @brief  SCSI_Read16
+ *         Process Read16 command
+ * @param  lun: Logical unit number
+ * @param  params: Command parameters
+ * @retval status
+ */
+static uint8_t SCSI_Read16(USBD_HandleTypeDef *pdev, uint8_t lun,
+                          uint8_t *params)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   if (hmsc == NULL) {
+      return -1;
+   }
+
+   if (hmsc->bot_state == USBD_BOT_IDLE) /* Idle */
+   {
+      /* case 10 : Ho <> Di */
+      if ((hmsc->cbw.bmFlags & 0x80U) != 0x80U) {
+         SCSI_SenseCode(pdev, hmsc->cbw.bLUN, ILLEGAL_REQUEST, INVALID_CDB);
+         return -1;
+      }
+
+      if (hmsc->scsi_medium_state[lun] == SCSI_MEDIUM_EJECTED) {
+         SCSI_SenseCode(pdev, lun, NOT_READY, MEDIUM_NOT_PRESENT);
+         return -1;
+      }
+
+      if (((USBD_StorageTypeDef *)pdev->pUserData[pdev->classId])
+              ->IsReady(lun) != 0) {
+         SCSI_SenseCode(pdev, lun, NOT_READY, MEDIUM_NOT_PRESENT);
+         return -1;
+      }
+
+      if (SCSI_GetLba16(pdev, lun, params) != 0) {
+         return -1; /* error */
+      }
+
+      hmsc->scsi_blk_len =
+          ((uint32_t)params[10] << 24) | ((uint32_t)params[11] << 16) |
+          ((uint32_t)params[12] << 8) | (uint32_t)params[13];
+
+      if (SCSI_CheckAddressRange(pdev, lun, hmsc->scsi_blk_addr,
+                                 hmsc->scsi_blk_len) != 0) {
+         return -1; /* error */
+      }
+
+      /* cases 4,5 : Hi <> Dn */
+      if (hmsc->cbw.dDataLength !=
+          (hmsc->scsi_blk_len * hmsc->scsi_blk_size[lun])) {
          SCSI_SenseCode(pdev, hmsc->cbw.bLUN, ILLEGAL_REQUEST, INVALID_CDB);
          return -1;
       }
 
-      hmsc->bot_state = USBD_BOT_DATA_IN;
+      hmsc->bot_state         = USBD_BOT_DATA_IN;
+      hmsc->media_buf_head    = 0U;
+      hmsc->media_buf_count   = 0U;
+      hmsc->stats.read_start  = USBD_LL_GetTimeUs();
+      hmsc->stats.read_active = 1U;
    }
    hmsc->bot_data_length = MSC_MEDIA_PACKET;
 
@@ -845,7 +1024,7 @@ static uint8_t SCSI_Write10(USBD_HandleTypeDef *pdev, uint8_t lun,
          return -1; /* error */
       }
 
-      len = hmsc->scsi_blk_len * hmsc->scsi_blk_size;
+      len = hmsc->scsi_blk_len * hmsc->scsi_blk_size[lun];
 
       /* cases 3,11,13 : Hn,Ho <> D0 */
       if (hmsc->cbw.dDataLength != len) {
@@ -853,11 +1032,9 @@ static uint8_t SCSI_Write10(USBD_HandleTypeDef *pdev, uint8_t lun,
          return -1;
       }
 
-      len = MIN(len, MSC_MEDIA_PACKET);
-
       /* Prepare EP to receive first data packet */
       hmsc->bot_state = USBD_BOT_DATA_OUT;
-      (void)USBD_LL_PrepareReceive(pdev, MSCOutEpAdd, hmsc->bot_data, len);
+      SCSI_PrepareWrite(pdev, lun);
    } else /* Write Process ongoing */
    {
       return SCSI_ProcessWrite(pdev, lun);
@@ -936,7 +1113,7 @@ static uint8_t SCSI_Write12(USBD_HandleTypeDef *pdev, uint8_t lun,
          return -1; /* error */
       }
 
-      len = hmsc->scsi_blk_len * hmsc->scsi_blk_size;
+      len = hmsc->scsi_blk_len * hmsc->scsi_blk_size[lun];
 
       /* cases 3,11,13 : Hn,Ho <> D0 */
       if (hmsc->cbw.dDataLength != len) {
@@ -944,11 +1121,9 @@ static uint8_t SCSI_Write12(USBD_HandleTypeDef *pdev, uint8_t lun,
          return -1;
       }
 
-      len = MIN(len, MSC_MEDIA_PACKET);
-
       /* Prepare EP to receive first data packet */
       hmsc->bot_state = USBD_BOT_DATA_OUT;
-      (void)USBD_LL_PrepareReceive(pdev, MSCOutEpAdd, hmsc->bot_data, len);
+      SCSI_PrepareWrite(pdev, lun);
    } else /* Write Process ongoing */
    {
       return SCSI_ProcessWrite(pdev, lun);
@@ -958,162 +1133,1134 @@ static uint8_t SCSI_Write12(USBD_HandleTypeDef *pdev, uint8_t lun,
 }
 
 /**
- * @brief  SCSI_Verify10
- *         Process Verify10 command
+ * @brief  SCSI_Write16
+ *         Process Write16 command
  * @param  lun: Logical unit number
  * @param  params: Command parameters
  * @retval status
  */
-static uint8_t SCSI_Verify10(USBD_HandleTypeDef *pdev, uint8_t lun,
-                            uint8_t *params)
+static uint8_t SCSI_Write16(USBD_HandleTypeDef *pdev, uint8_t lun,
+                           uint8_t *params)
 {
    USBD_MSC_BOT_HandleTypeDef *hmsc =
        (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   uint32_t len;
 
    if (hmsc == NULL) {
       return -1;
    }
+#ifdef USE_USBD_COMPOSITE
+   /* Get the Endpoints addresses allocated for this class instance */
+   MSCOutEpAdd = USBD_CoreGetEPAdd(pdev, USBD_EP_OUT, USBD_EP_TYPE_BULK,
+                                   (uint8_t)pdev->classId);
+#endif /* USE_USBD_COMPOSITE */
 
-   if ((params[1] & 0x02U) == 0x02U) {
-      SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST, INVALID_FIELED_IN_COMMAND);
-      return -1; /* Error, Verify Mode Not supported*/
-   }
+   if (hmsc->bot_state == USBD_BOT_IDLE) /* Idle */
+   {
+      if (hmsc->cbw.dDataLength == 0U) {
+         SCSI_SenseCode(pdev, hmsc->cbw.bLUN, ILLEGAL_REQUEST, INVALID_CDB);
+         return -1;
+      }
 
-   if (SCSI_CheckAddressRange(pdev, lun, hmsc->scsi_blk_addr,
-                              hmsc->scsi_blk_len) != 0) {
-      return -1; /* error */
-   }
+      /* case 8 : Hi <> Do */
+      if ((hmsc->cbw.bmFlags & 0x80U) == 0x80U) {
+         SCSI_SenseCode(pdev, hmsc->cbw.bLUN, ILLEGAL_REQUEST, INVALID_CDB);
+         return -1;
+      }
 
-   hmsc->bot_data_length = 0U;
+      /* Check whether Media is ready */
+      if (((USBD_StorageTypeDef *)pdev->pUserData[pdev->classId])
+              ->IsReady(lun) != 0) {
+         SCSI_SenseCode(pdev, lun, NOT_READY, MEDIUM_NOT_PRESENT);
+         hmsc->bot_state = USBD_BOT_NO_DATA;
+         return -1;
+      }
+
+      /* Check If media is write-protected */
+      if (((USBD_StorageTypeDef *)pdev->pUserData[pdev->classId])
+              ->IsWriteProtected(lun) != 0) {
+         SCSI_SenseCode(pdev, lun, NOT_READY, WRITE_PROTECTED);
+         hmsc->bot_state = USBD_BOT_NO_DATA;
+         return -1;
+      }
+
+      if (SCSI_GetLba16(pdev, lun, params) != 0) {
+         return -1; /* error */
+      }
+
+      hmsc->scsi_blk_len =
+          ((uint32_t)params[10] << 24) | ((uint32_t)params[11] << 16) |
+          ((uint32_t)params[12] << 8) | (uint32_t)params[13];
+
+      /* check if LBA address is in the right range */
+      if (SCSI_CheckAddressRange(pdev, lun, hmsc->scsi_blk_addr,
+                                 hmsc->scsi_blk_len) != 0) {
+         return -1; /* error */
+      }
+
+      len = hmsc->scsi_blk_len * hmsc->scsi_blk_size[lun];
+
+      /* cases 3,11,13 : Hn,Ho <> D0 */
+      if (hmsc->cbw.dDataLength != len) {
+         SCSI_SenseCode(pdev, hmsc->cbw.bLUN, ILLEGAL_REQUEST, INVALID_CDB);
+         return -1;
+      }
+
+      /* Prepare EP to receive first data packet */
+      hmsc->bot_state = USBD_BOT_DATA_OUT;
+      SCSI_PrepareWrite(pdev, lun);
+   } else /* Write Process ongoing */
+   {
+      return SCSI_ProcessWrite(pdev, lun);
+   }
 
    return 0;
 }
 
 /**
- * @brief  SCSI_CheckAddressRange
- *         Check address range
+ * @brief  SCSI_WriteLZ4
+ *         Process the vendor WRITE LZ4 command: the data phase is one LZ4
+ *         block that decompresses to the given number of blocks.
+ *         CDB: [2..5] LBA, [6..9] compressed length in bytes, [10..13]
+ *         decompressed length in blocks, all big-endian
  * @param  lun: Logical unit number
- * @param  blk_offset: first block address
- * @param  blk_nbr: number of block to be processed
+ * @param  params: Command parameters
  * @retval status
  */
-static uint8_t SCSI_CheckAddressRange(USBD_HandleTypeDef *pdev, uint8_t lun,
-                                     uint32_t blk_offset, uint32_t blk_nbr)
+static uint8_t SCSI_WriteLZ4(USBD_HandleTypeDef *pdev, uint8_t lun,
+                            uint8_t *params)
 {
    USBD_MSC_BOT_HandleTypeDef *hmsc =
        (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   USBD_StorageTypeDef *fops =
+       (USBD_StorageTypeDef *)pdev->pUserData[pdev->classId];
+   uint32_t stage_len;
+   uint32_t out_len;
 
    if (hmsc == NULL) {
       return -1;
    }
 
-   if ((blk_offset + blk_nbr) > hmsc->scsi_blk_nbr) {
-      SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST, ADDRESS_OUT_OF_RANGE);
+#ifdef USE_USBD_COMPOSITE
+   /* Get the Endpoints addresses allocated for this class instance */
+   MSCOutEpAdd = USBD_CoreGetEPAdd(pdev, USBD_EP_OUT, USBD_EP_TYPE_BULK,
+                                   (uint8_t)pdev->classId);
+#endif /* USE_USBD_COMPOSITE */
+
+   if (hmsc->bot_state != USBD_BOT_IDLE) {
+      return SCSI_ProcessWriteLZ4(pdev, lun);
+   }
+
+   if ((fops->GetStaging == NULL) || (hmsc->cbw.dDataLength == 0U) ||
+       ((hmsc->cbw.bmFlags & 0x80U) == 0x80U)) {
+      SCSI_SenseCode(pdev, hmsc->cbw.bLUN, ILLEGAL_REQUEST, INVALID_CDB);
+      return -1;
+   }
+
+   if (fops->IsReady(lun) != 0) {
+      SCSI_SenseCode(pdev, lun, NOT_READY, MEDIUM_NOT_PRESENT);
+      return -1;
+   }
+
+   if (fops->IsWriteProtected(lun) != 0) {
+      SCSI_SenseCode(pdev, lun, NOT_READY, WRITE_PROTECTED);
+      return -1;
+   }
+
+   hmsc->scsi_blk_addr = ((uint32_t)params[2] << 24) |
+                         ((uint32_t)params[3] << 16) |
+                         ((uint32_t)params[4] << 8) | (uint32_t)params[5];
+   hmsc->lz4_len = ((uint32_t)params[6] << 24) | ((uint32_t)params[7] << 16) |
+                   ((uint32_t)params[8] << 8) | (uint32_t)params[9];
+   hmsc->scsi_blk_len = ((uint32_t)params[10] << 24) |
+                        ((uint32_t)params[11] << 16) |
+                        ((uint32_t)params[12] << 8) | (uint32_t)params[13];
+
+   if (SCSI_CheckAddressRange(pdev, lun, hmsc->scsi_blk_addr,
+                              hmsc->scsi_blk_len) != 0) {
+      return -1;
+   }
+
+   /* cases 3,11,13 : Hn,Ho <> D0 */
+   if (hmsc->cbw.dDataLength != hmsc->lz4_len) {
+      SCSI_SenseCode(pdev, hmsc->cbw.bLUN, ILLEGAL_REQUEST, INVALID_CDB);
+      return -1;
+   }
+
+   /* both halves must fit the staging memory, and the result one Write */
+   hmsc->lz4_out = fops->GetStaging(&stage_len);
+   out_len       = hmsc->scsi_blk_len * hmsc->scsi_blk_size[lun];
+   if ((hmsc->lz4_out == NULL) || (hmsc->scsi_blk_len == 0U) ||
+       (hmsc->scsi_blk_len > 0xFFFFU) || (out_len > stage_len) ||
+       (hmsc->lz4_len > stage_len - out_len)) {
+      SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST, INVALID_FIELED_IN_COMMAND);
       return -1;
    }
 
+   hmsc->lz4_in    = hmsc->lz4_out + out_len;
+   hmsc->lz4_rx    = 0U;
+   hmsc->bot_state = USBD_BOT_DATA_OUT;
+   (void)USBD_LL_PrepareReceive(pdev, MSCOutEpAdd, hmsc->lz4_in,
+                                MIN(hmsc->lz4_len, MSC_DIRECT_PACKET));
+
    return 0;
 }
 
 /**
- * @brief  SCSI_ProcessRead
- *         Handle Read Process
+ * @brief  SCSI_ProcessWriteLZ4
+ *         Receive the next chunk of compressed data; after the last one,
+ *         decompress it and write the result to the medium
  * @param  lun: Logical unit number
  * @retval status
  */
-static uint8_t SCSI_ProcessRead(USBD_HandleTypeDef *pdev, uint8_t lun)
+static uint8_t SCSI_ProcessWriteLZ4(USBD_HandleTypeDef *pdev, uint8_t lun)
 {
    USBD_MSC_BOT_HandleTypeDef *hmsc =
        (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
-   uint32_t len;
-
-   if (hmsc == NULL) {
-      return -1;
-   }
+   const uint32_t len = MIN(hmsc->lz4_len - hmsc->lz4_rx, MSC_DIRECT_PACKET);
+   const uint32_t out_len = hmsc->scsi_blk_len * hmsc->scsi_blk_size[lun];
 
-   len = hmsc->scsi_blk_len * hmsc->scsi_blk_size;
+   hmsc->lz4_rx += len;
+   hmsc->csw.dDataResidue -= len;
 
-#ifdef USE_USBD_COMPOSITE
-   /* Get the Endpoints addresses allocated for this class instance */
-   MSCInEpAdd = USBD_CoreGetEPAdd(pdev, USBD_EP_IN, USBD_EP_TYPE_BULK,
-                                  (uint8_t)pdev->classId);
-#endif /* USE_USBD_COMPOSITE */
+   if (hmsc->lz4_rx < hmsc->lz4_len) {
+      (void)USBD_LL_PrepareReceive(
+          pdev, MSCOutEpAdd, &hmsc->lz4_in[hmsc->lz4_rx],
+          MIN(hmsc->lz4_len - hmsc->lz4_rx, MSC_DIRECT_PACKET));
+      return 0;
+   }
 
-   len = MIN(len, MSC_MEDIA_PACKET);
+   if (lz4_decompress(hmsc->lz4_in, hmsc->lz4_len, hmsc->lz4_out, out_len) !=
+       (int32_t)out_len) {
+      SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST,
+                     INVALID_FIELD_IN_PARAMETER_LIST);
+      return -1;
+   }
 
    if (((USBD_StorageTypeDef *)pdev->pUserData[pdev->classId])
-           ->Read(lun, hmsc->bot_data, hmsc->scsi_blk_addr,
-                  (len / hmsc->scsi_blk_size)) != 0) {
-      SCSI_SenseCode(pdev, lun, HARDWARE_ERROR, UNRECOVERED_READ_ERROR);
+           ->Write(lun, hmsc->lz4_out, hmsc->scsi_blk_addr,
+                   (uint16_t)hmsc->scsi_blk_len) != 0) {
+      SCSI_SenseCode(pdev, lun, HARDWARE_ERROR, WRITE_FAULT);
       return -1;
    }
 
-   (void)USBD_LL_Transmit(pdev, MSCInEpAdd, hmsc->bot_data, len);
-
-   hmsc->scsi_blk_addr += (len / hmsc->scsi_blk_size);
-   hmsc->scsi_blk_len -= (len / hmsc->scsi_blk_size);
+   MSC_BOT_SendCSW(pdev, USBD_CSW_CMD_PASSED);
+   return 0;
+}
 
-   /* case 6 : Hi = Di */
-   hmsc->csw.dDataResidue -= len;
+/**
+ * @brief  SCSI_ProvisioningFlags
+ *         Byte 5 of the Logical Block Provisioning VPD page: LBPU and LBPWS
+ *         if the LUN can unmap, and LBPRZ if unmapped blocks read as zeros
+ * @param  lun: Logical unit number
+ * @retval flags
+ */
+static uint8_t SCSI_ProvisioningFlags(USBD_HandleTypeDef *pdev, uint8_t lun)
+{
+   USBD_StorageTypeDef *fops =
+       (USBD_StorageTypeDef *)pdev->pUserData[pdev->classId];
+   uint8_t zeroes;
 
-   if (hmsc->scsi_blk_len == 0U) {
-      hmsc->bot_state = USBD_BOT_LAST_DATA_IN;
+   if ((fops->GetUnmap == NULL) || (fops->GetUnmap(lun, &zeroes) != 0U)) {
+      return 0U;
    }
 
-   return 0;
+   return (zeroes != 0U) ? 0xC4U : 0xC0U;
 }
 
 /**
- * @brief  SCSI_ProcessWrite
- *         Handle Write Process
+ * @brief  SCSI_Unmap
+ *         Process the UNMAP command: the data phase is a parameter list of
+ *         block descriptors, each an LBA and a number of blocks to discard
  * @param  lun: Logical unit number
+ * @param  params: Command parameters
  * @retval status
  */
-static uint8_t SCSI_ProcessWrite(USBD_HandleTypeDef *pdev, uint8_t lun)
+static uint8_t SCSI_Unmap(USBD_HandleTypeDef *pdev, uint8_t lun,
+                          uint8_t *params)
 {
    USBD_MSC_BOT_HandleTypeDef *hmsc =
        (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   USBD_StorageTypeDef *fops =
+       (USBD_StorageTypeDef *)pdev->pUserData[pdev->classId];
    uint32_t len;
 
    if (hmsc == NULL) {
       return -1;
    }
 
-   len = hmsc->scsi_blk_len * hmsc->scsi_blk_size;
-
 #ifdef USE_USBD_COMPOSITE
    /* Get the Endpoints addresses allocated for this class instance */
    MSCOutEpAdd = USBD_CoreGetEPAdd(pdev, USBD_EP_OUT, USBD_EP_TYPE_BULK,
                                    (uint8_t)pdev->classId);
 #endif /* USE_USBD_COMPOSITE */
 
-   len = MIN(len, MSC_MEDIA_PACKET);
+   if (hmsc->bot_state != USBD_BOT_IDLE) {
+      return SCSI_ProcessUnmap(pdev, lun);
+   }
 
-   if (((USBD_StorageTypeDef *)pdev->pUserData[pdev->classId])
-           ->Write(lun, hmsc->bot_data, hmsc->scsi_blk_addr,
-                   (len / hmsc->scsi_blk_size)) != 0) {
-      SCSI_SenseCode(pdev, lun, HARDWARE_ERROR, WRITE_FAULT);
+   if (SCSI_ProvisioningFlags(pdev, lun) == 0U) {
+      SCSI_SenseCode(pdev, hmsc->cbw.bLUN, ILLEGAL_REQUEST, INVALID_CDB);
       return -1;
    }
 
-   hmsc->scsi_blk_addr += (len / hmsc->scsi_blk_size);
-   hmsc->scsi_blk_len -= (len / hmsc->scsi_blk_size);
+   if (fops->IsReady(lun) != 0) {
+      SCSI_SenseCode(pdev, lun, NOT_READY, MEDIUM_NOT_PRESENT);
+      return -1;
+   }
 
-   /* case 12 : Ho = Do */
-   hmsc->csw.dDataResidue -= len;
+   if (fops->IsWriteProtected(lun) != 0) {
+      SCSI_SenseCode(pdev, lun, NOT_READY, WRITE_PROTECTED);
+      return -1;
+   }
 
-   if (hmsc->scsi_blk_len == 0U) {
+   len = ((uint32_t)params[7] << 8) | (uint32_t)params[8];
+
+   /* an empty parameter list is not an error */
+   if (len == 0U) {
+      hmsc->bot_data_length = 0U;
+      return 0;
+   }
+
+   /* cases 3,11,13 : Hn,Ho <> D0 */
+   if ((hmsc->cbw.dDataLength != len) ||
+       ((hmsc->cbw.bmFlags & 0x80U) == 0x80U)) {
+      SCSI_SenseCode(pdev, hmsc->cbw.bLUN, ILLEGAL_REQUEST, INVALID_CDB);
+      return -1;
+   }
+
+   if (len > sizeof(hmsc->bot_data)) {
+      SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST, PARAMETER_LIST_LENGTH_ERROR);
+      return -1;
+   }
+
+   hmsc->bot_state = USBD_BOT_DATA_OUT;
+   (void)USBD_LL_PrepareReceive(pdev, MSCOutEpAdd, hmsc->bot_data, len);
+
+   return 0;
+}
+
+/**
+ * @brief  SCSI_ProcessUnmap
+ *         Discard the block ranges of the received parameter list
+ * @param  lun: Logical unit number
+ * @retval status
+ */
+static uint8_t SCSI_ProcessUnmap(USBD_HandleTypeDef *pdev, uint8_t lun)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   USBD_StorageTypeDef *fops =
+       (USBD_StorageTypeDef *)pdev->pUserData[pdev->classId];
+   const uint32_t len = hmsc->cbw.dDataLength;
+   const uint8_t *desc;
+   uint32_t desc_len;
+   uint32_t addr;
+   uint32_t n;
+
+   hmsc->csw.dDataResidue -= len;
+
+   if (len < 8U) {
+      SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST, PARAMETER_LIST_LENGTH_ERROR);
+      return -1;
+   }
+
+   /* descriptors beyond the received data are ignored */
+   desc_len = ((uint32_t)hmsc->bot_data[2] << 8) | (uint32_t)hmsc->bot_data[3];
+   desc_len = MIN(desc_len, len - 8U) / 16U;
+
+   if (desc_len > MSC_UNMAP_MAX_DESC) {
+      SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST,
+                     INVALID_FIELD_IN_PARAMETER_LIST);
+      return -1;
+   }
+
+   for (desc = &hmsc->bot_data[8]; desc_len > 0U; desc_len--, desc += 16) {
+      addr = ((uint32_t)desc[4] << 24) | ((uint32_t)desc[5] << 16) |
+             ((uint32_t)desc[6] << 8) | (uint32_t)desc[7];
+      n    = ((uint32_t)desc[8] << 24) | ((uint32_t)desc[9] << 16) |
+             ((uint32_t)desc[10] << 8) | (uint32_t)desc[11];
+
+      if ((desc[0] | desc[1] | desc[2] | desc[3]) != 0U) {
+         SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST, ADDRESS_OUT_OF_RANGE);
+         return -1;
+      }
+
+      if (n == 0U) {
+         continue;
+      }
+
+      if (SCSI_CheckAddressRange(pdev, lun, addr, n) != 0) {
+         return -1;
+      }
+
+      if (n > MSC_UNMAP_MAX_BLKS) {
+         SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST,
+                        INVALID_FIELD_IN_PARAMETER_LIST);
+         return -1;
+      }
+
+      if (fops->Unmap(lun, addr, n) != 0U) {
+         SCSI_SenseCode(pdev, lun, HARDWARE_ERROR, WRITE_FAULT);
+         return -1;
+      }
+   }
+
+   MSC_BOT_SendCSW(pdev, USBD_CSW_CMD_PASSED);
+   return 0;
+}
+
+/**
+ * @brief  SCSI_WriteSame16
+ *         Process the WRITE SAME(16) command: write one block of data to a
+ *         range of blocks, or discard the range if the UNMAP bit is set and
+ *         the block is all zeros. With NDOB there is no data phase and the
+ *         block is taken as zeros.
+ * @param  lun: Logical unit number
+ * @param  params: Command parameters
+ * @retval status
+ */
+static uint8_t SCSI_WriteSame16(USBD_HandleTypeDef *pdev, uint8_t lun,
+                                uint8_t *params)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   USBD_StorageTypeDef *fops =
+       (USBD_StorageTypeDef *)pdev->pUserData[pdev->classId];
+   uint32_t idx;
+
+   if (hmsc == NULL) {
+      return -1;
+   }
+
+#ifdef USE_USBD_COMPOSITE
+   /* Get the Endpoints addresses allocated for this class instance */
+   MSCOutEpAdd = USBD_CoreGetEPAdd(pdev, USBD_EP_OUT, USBD_EP_TYPE_BULK,
+                                   (uint8_t)pdev->classId);
+#endif /* USE_USBD_COMPOSITE */
+
+   if (hmsc->bot_state != USBD_BOT_IDLE) {
+      hmsc->csw.dDataResidue -= hmsc->scsi_blk_size[lun];
+      return SCSI_ProcessWriteSame(pdev, lun);
+   }
+
+   if (fops->IsReady(lun) != 0) {
+      SCSI_SenseCode(pdev, lun, NOT_READY, MEDIUM_NOT_PRESENT);
+      return -1;
+   }
+
+   if (fops->IsWriteProtected(lun) != 0) {
+      SCSI_SenseCode(pdev, lun, NOT_READY, WRITE_PROTECTED);
+      return -1;
+   }
+
+   if (SCSI_GetLba16(pdev, lun, params) != 0) {
+      return -1;
+   }
+
+   hmsc->scsi_blk_len = ((uint32_t)params[10] << 24) |
+                        ((uint32_t)params[11] << 16) |
+                        ((uint32_t)params[12] << 8) | (uint32_t)params[13];
+
+   if ((hmsc->scsi_blk_len == 0U) ||
+       (hmsc->scsi_blk_len > MSC_UNMAP_MAX_BLKS) ||
+       (hmsc->scsi_blk_size[lun] > sizeof(hmsc->bot_data))) {
+      SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST, INVALID_FIELED_IN_COMMAND);
+      return -1;
+   }
+
+   if (SCSI_CheckAddressRange(pdev, lun, hmsc->scsi_blk_addr,
+                              hmsc->scsi_blk_len) != 0) {
+      return -1;
+   }
+
+   /* NDOB: no data-out buffer, the block is zeros */
+   if ((params[1] & 0x01U) != 0U) {
+      if (hmsc->cbw.dDataLength != 0U) {
+         SCSI_SenseCode(pdev, hmsc->cbw.bLUN, ILLEGAL_REQUEST, INVALID_CDB);
+         return -1;
+      }
+
+      for (idx = 0U; idx < hmsc->scsi_blk_size[lun]; idx++) {
+         hmsc->bot_data[idx] = 0U;
+      }
+
+      if (SCSI_ProcessWriteSame(pdev, lun) != 0) {
+         return -1;
+      }
+
+      hmsc->bot_data_length = 0U;
+      return 0;
+   }
+
+   /* cases 3,11,13 : Hn,Ho <> D0 */
+   if ((hmsc->cbw.dDataLength != hmsc->scsi_blk_size[lun]) ||
+       ((hmsc->cbw.bmFlags & 0x80U) == 0x80U)) {
+      SCSI_SenseCode(pdev, hmsc->cbw.bLUN, ILLEGAL_REQUEST, INVALID_CDB);
+      return -1;
+   }
+
+   hmsc->bot_state = USBD_BOT_DATA_OUT;
+   (void)USBD_LL_PrepareReceive(pdev, MSCOutEpAdd, hmsc->bot_data,
+                                hmsc->scsi_blk_size[lun]);
+
+   return 0;
+}
+
+/**
+ * @brief  SCSI_ProcessWriteSame
+ *         Discard or fill the range with the block in bot_data; the CSW is
+ *         sent here only if there was a data phase
+ * @param  lun: Logical unit number
+ * @retval status
+ */
+static uint8_t SCSI_ProcessWriteSame(USBD_HandleTypeDef *pdev, uint8_t lun)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   USBD_StorageTypeDef *fops =
+       (USBD_StorageTypeDef *)pdev->pUserData[pdev->classId];
+   const uint32_t blk_size = hmsc->scsi_blk_size[lun];
+   uint32_t addr           = hmsc->scsi_blk_addr;
+   uint32_t left           = hmsc->scsi_blk_len;
+   uint32_t stage_len;
+   uint32_t chunk;
+   uint32_t idx;
+   uint8_t *stage;
+   uint8_t zeroes = 0U;
+   uint8_t data   = 0U;
+
+   /* UNMAP bit: discard instead, if that leaves the same data behind */
+   if (((hmsc->cbw.CB[1] & 0x08U) != 0U) && (fops->Unmap != NULL) &&
+       (fops->GetUnmap != NULL) && (fops->GetUnmap(lun, &zeroes) == 0U) &&
+       (zeroes != 0U)) {
+      for (idx = 0U; idx < blk_size; idx++) {
+         data |= hmsc->bot_data[idx];
+      }
+
+      if (data == 0U) {
+         if (fops->Unmap(lun, addr, left) != 0U) {
+            SCSI_SenseCode(pdev, lun, HARDWARE_ERROR, WRITE_FAULT);
+            return -1;
+         }
+         left = 0U;
+      }
+   }
+
+   if (left != 0U) {
+      /* replicate the block over the staging memory, write it in chunks */
+      stage = (fops->GetStaging != NULL) ? fops->GetStaging(&stage_len) : NULL;
+      if ((stage == NULL) || (stage_len < blk_size)) {
+         SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST, INVALID_FIELED_IN_COMMAND);
+         return -1;
+      }
+
+      chunk = MIN(MIN(left, stage_len / blk_size), 0xFFFFU);
+      for (idx = 0U; idx < chunk; idx++) {
+         (void)USBD_memcpy(&stage[idx * blk_size], hmsc->bot_data, blk_size);
+      }
+
+      while (left != 0U) {
+         chunk = MIN(chunk, left);
+         if (fops->Write(lun, stage, addr, (uint16_t)chunk) != 0) {
+            SCSI_SenseCode(pdev, lun, HARDWARE_ERROR, WRITE_FAULT);
+            return -1;
+         }
+         addr += chunk;
+         left -= chunk;
+      }
+   }
+
+   if (hmsc->bot_state == USBD_BOT_DATA_OUT) {
       MSC_BOT_SendCSW(pdev, USBD_CSW_CMD_PASSED);
+   }
+
+   return 0;
+}
+
+/**
+ * @brief  SCSI_ReadHash
+ *         Vendor command READ HASH: return the CRC-32 (as computed by zlib)
+ *         of each of a run of equal extents, so the host can find the
+ *         extents that differ from its image without reading them.
+ *         CDB: [2..5] LBA, [6..9] number of extents, [10..11] blocks per
+ *         extent or 0 for MSC_HASH_EXTENT_BLKS, all big-endian. Data-in:
+ *         one big-endian CRC per extent.
+ * @param  lun: Logical unit number
+ * @param  params: Command parameters
+ * @retval status
+ */
+static uint8_t SCSI_ReadHash(USBD_HandleTypeDef *pdev, uint8_t lun,
+                             uint8_t *params)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   USBD_StorageTypeDef *fops =
+       (USBD_StorageTypeDef *)pdev->pUserData[pdev->classId];
+   uint8_t *stage;
+   uint32_t stage_len;
+
+   if (hmsc == NULL) {
+      return -1;
+   }
+
+   if ((fops->GetStaging == NULL) || (hmsc->cbw.dDataLength == 0U) ||
+       ((hmsc->cbw.bmFlags & 0x80U) != 0x80U)) {
+      SCSI_SenseCode(pdev, hmsc->cbw.bLUN, ILLEGAL_REQUEST, INVALID_CDB);
+      return -1;
+   }
+
+   if (fops->IsReady(lun) != 0) {
+      SCSI_SenseCode(pdev, lun, NOT_READY, MEDIUM_NOT_PRESENT);
+      return -1;
+   }
+
+   const uint32_t blk_addr = ((uint32_t)params[2] << 24) |
+                             ((uint32_t)params[3] << 16) |
+                             ((uint32_t)params[4] << 8) | (uint32_t)params[5];
+   const uint32_t ext_nbr = ((uint32_t)params[6] << 24) |
+                            ((uint32_t)params[7] << 16) |
+                            ((uint32_t)params[8] << 8) | (uint32_t)params[9];
+   uint32_t ext_blks = ((uint32_t)params[10] << 8) | (uint32_t)params[11];
+
+   if (ext_blks == 0U) {
+      ext_blks = MSC_HASH_EXTENT_BLKS;
+   }
+
+   /* the hashes go out of bot_data; an extent must fit the staging memory */
+   stage                   = fops->GetStaging(&stage_len);
+   const uint32_t ext_size = ext_blks * hmsc->scsi_blk_size[lun];
+   if ((stage == NULL) || (ext_nbr == 0U) || (ext_size == 0U) ||
+       (ext_nbr > (sizeof(hmsc->bot_data) / 4U)) || (ext_size > stage_len)) {
+      SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST, INVALID_FIELED_IN_COMMAND);
+      return -1;
+   }
+
+   if (SCSI_CheckAddressRange(pdev, lun, blk_addr, ext_nbr * ext_blks) != 0) {
+      return -1;
+   }
+
+   /* read as many extents at a time as the staging memory and one Read
+    * allow */
+   const uint32_t per_read = MIN(stage_len / ext_size, 0xFFFFU / ext_blks);
+   uint32_t ext            = 0U;
+
+   while (ext < ext_nbr) {
+      const uint32_t n = MIN(per_read, ext_nbr - ext);
+
+      if (fops->Read(lun, stage, blk_addr + (ext * ext_blks),
+                     (uint16_t)(n * ext_blks)) != 0) {
+         SCSI_SenseCode(pdev, lun, MEDIUM_ERROR, UNRECOVERED_READ_ERROR);
+         return -1;
+      }
+
+      for (uint32_t i = 0U; i < n; i++, ext++) {
+         const uint32_t crc = crc32_update(0U, &stage[i * ext_size], ext_size);
+
+         hmsc->bot_data[(4U * ext) + 0U] = (uint8_t)(crc >> 24);
+         hmsc->bot_data[(4U * ext) + 1U] = (uint8_t)(crc >> 16);
+         hmsc->bot_data[(4U * ext) + 2U] = (uint8_t)(crc >> 8);
+         hmsc->bot_data[(4U * ext) + 3U] = (uint8_t)crc;
+      }
+   }
+
+   hmsc->bot_data_length = 4U * ext_nbr;
+
+   return 0;
+}
+
+/**
+ * @brief  SCSI_ReadDigest
+ *         Vendor command READ DIGEST: read a range of the medium and return
+ *         one digest over all of it, to verify an image without reading it
+ *         back over USB.
+ *         CDB: [1] algorithm (SCSI_DIGEST_CRC32 or SCSI_DIGEST_SHA256),
+ *         [2..5] LBA, [6..9] number of blocks, big-endian. Data-in: the
+ *         digest, 4 bytes (big-endian) or 32 bytes.
+ * @param  lun: Logical unit number
+ * @param  params: Command parameters
+ * @retval status
+ */
+static uint8_t SCSI_ReadDigest(USBD_HandleTypeDef *pdev, uint8_t lun,
+                               uint8_t *params)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   USBD_StorageTypeDef *fops =
+       (USBD_StorageTypeDef *)pdev->pUserData[pdev->classId];
+   const uint8_t algo = params[1];
+   struct sha256_ctx sha;
+   uint32_t crc = 0U;
+   uint8_t *stage;
+   uint32_t stage_len;
+
+   if (hmsc == NULL) {
+      return -1;
+   }
+
+   if ((fops->GetStaging == NULL) || (hmsc->cbw.dDataLength == 0U) ||
+       ((hmsc->cbw.bmFlags & 0x80U) != 0x80U)) {
+      SCSI_SenseCode(pdev, hmsc->cbw.bLUN, ILLEGAL_REQUEST, INVALID_CDB);
+      return -1;
+   }
+
+   if (fops->IsReady(lun) != 0) {
+      SCSI_SenseCode(pdev, lun, NOT_READY, MEDIUM_NOT_PRESENT);
+      return -1;
+   }
+
+   const uint32_t blk_addr = ((uint32_t)params[2] << 24) |
+                             ((uint32_t)params[3] << 16) |
+                             ((uint32_t)params[4] << 8) | (uint32_t)params[5];
+   const uint32_t blk_len = ((uint32_t)params[6] << 24) |
+                            ((uint32_t)params[7] << 16) |
+                            ((uint32_t)params[8] << 8) | (uint32_t)params[9];
+   const uint32_t blk_size = hmsc->scsi_blk_size[lun];
+
+   stage = fops->GetStaging(&stage_len);
+   if ((stage == NULL) || (blk_len == 0U) || (blk_size == 0U) ||
+       (stage_len < blk_size) ||
+       ((algo != SCSI_DIGEST_CRC32) && (algo != SCSI_DIGEST_SHA256))) {
+      SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST, INVALID_FIELED_IN_COMMAND);
+      return -1;
+   }
+
+   if (SCSI_CheckAddressRange(pdev, lun, blk_addr, blk_len) != 0) {
+      return -1;
+   }
+
+   /* the medium fills the staging memory (by DMA for the SD card), then
+    * the digest runs over it */
+   const uint32_t per_read = MIN(stage_len / blk_size, 0xFFFFU);
+
+   if (algo == SCSI_DIGEST_SHA256) {
+      sha256_init(&sha);
+   }
+
+   for (uint32_t done = 0U; done < blk_len;) {
+      const uint32_t n = MIN(per_read, blk_len - done);
+
+      if (fops->Read(lun, stage, blk_addr + done, (uint16_t)n) != 0) {
+         SCSI_SenseCode(pdev, lun, MEDIUM_ERROR, UNRECOVERED_READ_ERROR);
+         return -1;
+      }
+
+      if (algo == SCSI_DIGEST_SHA256) {
+         sha256_update(&sha, stage, n * blk_size);
+      } else {
+         crc = crc32_update(crc, stage, n * blk_size);
+      }
+
+      done += n;
+   }
+
+   if (algo == SCSI_DIGEST_SHA256) {
+      sha256_final(&sha, hmsc->bot_data);
+      hmsc->bot_data_length = SHA256_SIZE;
    } else {
-      len = MIN((hmsc->scsi_blk_len * hmsc->scsi_blk_size), MSC_MEDIA_PACKET);
+      hmsc->bot_data[0]     = (uint8_t)(crc >> 24);
+      hmsc->bot_data[1]     = (uint8_t)(crc >> 16);
+      hmsc->bot_data[2]     = (uint8_t)(crc >> 8);
+      hmsc->bot_data[3]     = (uint8_t)crc;
+      hmsc->bot_data_length = 4U;
+   }
+
+   return 0;
+}
+
+/**
+ * @brief  SCSI_Verify10
+ *         Process Verify10 command
+ * @param  lun: Logical unit number
+ * @param  params: Command parameters
+ * @retval status
+ */
+static uint8_t SCSI_Verify10(USBD_HandleTypeDef *pdev, uint8_t lun,
+                            uint8_t *params)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   if (hmsc == NULL) {
+      return -1;
+   }
 
+   if ((params[1] & 0x02U) == 0x02U) {
+      SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST, INVALID_FIELED_IN_COMMAND);
+      return -1; /* Error, Verify Mode Not supported*/
+   }
+
+   if (SCSI_CheckAddressRange(pdev, lun, hmsc->scsi_blk_addr,
+                              hmsc->scsi_blk_len) != 0) {
+      return -1; /* error */
+   }
+
+   hmsc->bot_data_length = 0U;
+
+   return 0;
+}
+
+/**
+ * @brief  SCSI_SynchronizeCache
+ *         Process Synchronize Cache (10) and (16) commands
+ * @param  lun: Logical unit number
+ * @param  params: Command parameters
+ * @retval status
+ */
+static uint8_t SCSI_SynchronizeCache(USBD_HandleTypeDef *pdev, uint8_t lun,
+                                     uint8_t *params)
+{
+   UNUSED(params);
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   if (hmsc == NULL) {
+      return -1;
+   }
+
+   /* the range is advisory; write back everything */
+   if (SCSI_Sync(pdev, lun) != 0) {
+      return -1;
+   }
+
+   hmsc->bot_data_length = 0U;
+
+   return 0;
+}
+
+/**
+ * @brief  SCSI_Sync
+ *         Write back data cached by the medium, if it caches any
+ * @param  lun: Logical unit number
+ * @retval status
+ */
+static uint8_t SCSI_Sync(USBD_HandleTypeDef *pdev, uint8_t lun)
+{
+   USBD_StorageTypeDef *fops =
+       (USBD_StorageTypeDef *)pdev->pUserData[pdev->classId];
+
+   if ((fops->Sync != NULL) && (fops->Sync(lun) != 0)) {
+      SCSI_SenseCode(pdev, lun, HARDWARE_ERROR, WRITE_FAULT);
+      return -1;
+   }
+
+   return 0;
+}
+
+/**
+ * @brief  SCSI_GetLba16
+ *         Take the logical block address of a 16-byte command
+ * @param  lun: Logical unit number
+ * @param  params: Command parameters
+ * @retval status
+ */
+static uint8_t SCSI_GetLba16(USBD_HandleTypeDef *pdev, uint8_t lun,
+                            uint8_t *params)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   /* no medium here has 2^32 blocks */
+   if ((params[2] | params[3] | params[4] | params[5]) != 0U) {
+      SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST, ADDRESS_OUT_OF_RANGE);
+      return -1;
+   }
+
+   hmsc->scsi_blk_addr =
+       ((uint32_t)params[6] << 24) | ((uint32_t)params[7] << 16) |
+       ((uint32_t)params[8] << 8) | (uint32_t)params[9];
+
+   return 0;
+}
+
+/**
+ * @brief  SCSI_ModeSenseCaching
+ *         Fix up the WCE bit of the Caching page in a Mode Sense response
+ * @param  params: Command parameters
+ * @param  offset: Offset of the Caching page in the response
+ * @retval None
+ */
+static void SCSI_ModeSenseCaching(USBD_HandleTypeDef *pdev, uint8_t lun,
+                                  uint8_t *params, uint16_t offset)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   USBD_StorageTypeDef *fops =
+       (USBD_StorageTypeDef *)pdev->pUserData[pdev->classId];
+
+   /* write cache enabled if this LUN has one; the bit is reported as not
+    * changeable */
+   if ((fops->GetWriteCache == NULL) || (fops->GetWriteCache(lun) == 0U) ||
+       ((params[2] & 0xC0U) == 0x40U)) {
+      hmsc->bot_data[offset + 2U] &= (uint8_t)~0x04U;
+   }
+}
+
+/**
+ * @brief  SCSI_CheckAddressRange
+ *         Check address range
+ * @param  lun: Logical unit number
+ * @param  blk_offset: first block address
+ * @param  blk_nbr: number of block to be processed
+ * @retval status
+ */
+static uint8_t SCSI_CheckAddressRange(USBD_HandleTypeDef *pdev, uint8_t lun,
+                                     uint32_t blk_offset, uint32_t blk_nbr)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   if (hmsc == NULL) {
+      return -1;
+   }
+
+   /* written so that 32-bit lengths of 12- and 16-byte commands can't wrap */
+   if ((blk_offset > hmsc->scsi_blk_nbr[lun]) ||
+       (blk_nbr > (hmsc->scsi_blk_nbr[lun] - blk_offset))) {
+      SCSI_SenseCode(pdev, lun, ILLEGAL_REQUEST, ADDRESS_OUT_OF_RANGE);
+      return -1;
+   }
+
+   return 0;
+}
+
+/**
+ * @brief  SCSI_ProcessRead
+ *         Handle Read Process
+ * @param  lun: Logical unit number
+ * @retval status
+ */
+static uint8_t SCSI_ProcessRead(USBD_HandleTypeDef *pdev, uint8_t lun)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   uint8_t *pbuf;
+   uint32_t len;
+
+   if (hmsc == NULL) {
+      return -1;
+   }
+
+#ifdef USE_USBD_COMPOSITE
+   /* Get the Endpoints addresses allocated for this class instance */
+   MSCInEpAdd = USBD_CoreGetEPAdd(pdev, USBD_EP_IN, USBD_EP_TYPE_BULK,
+                                  (uint8_t)pdev->classId);
+#endif /* USE_USBD_COMPOSITE */
+
+   /* the medium can be sent from directly, no bounce buffer needed */
+   if ((hmsc->media_buf_count == 0U) && (SCSI_DirectRead(pdev, lun) == 0U)) {
+      return 0;
+   }
+
+   /* the buffer at the head has been sent, release it */
+   if (hmsc->media_buf_count != 0U) {
+      hmsc->media_buf_head =
+          (uint8_t)((hmsc->media_buf_head + 1U) % MSC_MEDIA_BUF_NBR);
+      hmsc->media_buf_count--;
+   }
+
+   /* nothing prefetched (first chunk, or a prefetch failed): fetch now */
+   if (hmsc->media_buf_count == 0U) {
+      if (SCSI_FetchRead(pdev, lun, hmsc->media_buf_head) != 0U) {
+         SCSI_SenseCode(pdev, lun, HARDWARE_ERROR, UNRECOVERED_READ_ERROR);
+         return -1;
+      }
+      hmsc->media_buf_count = 1U;
+   }
+
+   pbuf = &hmsc->bot_data[hmsc->media_buf_head * MSC_MEDIA_PACKET];
+   len  = hmsc->media_buf_len[hmsc->media_buf_head];
+
+   (void)USBD_LL_Transmit(pdev, MSCInEpAdd, pbuf, len);
+
+   /* case 6 : Hi = Di */
+   hmsc->csw.dDataResidue -= len;
+
+   if (hmsc->csw.dDataResidue == 0U) {
+      hmsc->bot_state = USBD_BOT_LAST_DATA_IN;
+   }
+
+#if (MSC_READ_PREFETCH == 1U)
+   /* fill the free buffers while the head one is on the wire; a failed
+    * prefetch is retried (and reported) when its turn comes */
+   while ((hmsc->media_buf_count < MSC_MEDIA_BUF_NBR) &&
+          (hmsc->scsi_blk_len != 0U)) {
+      if (SCSI_FetchRead(pdev, lun,
+                         (uint8_t)((hmsc->media_buf_head +
+                                    hmsc->media_buf_count) %
+                                   MSC_MEDIA_BUF_NBR)) != 0U) {
+         break;
+      }
+      hmsc->media_buf_count++;
+   }
+#endif /* MSC_READ_PREFETCH */
+
+   return 0;
+}
+
+/**
+ * @brief  SCSI_FetchRead
+ *         Read the next chunk of the current command into a media buffer
+ * @param  lun: Logical unit number
+ * @param  idx: Media buffer index
+ * @retval status
+ */
+static uint8_t SCSI_FetchRead(USBD_HandleTypeDef *pdev, uint8_t lun,
+                             uint8_t idx)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   uint32_t len;
+
+   len = MIN(hmsc->scsi_blk_len * hmsc->scsi_blk_size[lun], MSC_MEDIA_PACKET);
+
+   if (((USBD_StorageTypeDef *)pdev->pUserData[pdev->classId])
+           ->Read(lun, &hmsc->bot_data[idx * MSC_MEDIA_PACKET],
+                  hmsc->scsi_blk_addr, (len / hmsc->scsi_blk_size[lun])) != 0) {
+      return -1;
+   }
+
+   hmsc->media_buf_len[idx] = len;
+   hmsc->scsi_blk_addr += (len / hmsc->scsi_blk_size[lun]);
+   hmsc->scsi_blk_len -= (len / hmsc->scsi_blk_size[lun]);
+   hmsc->stats.read_bytes += len;
+
+   return 0;
+}
+
+/**
+ * @brief  SCSI_DirectRead
+ *         Send the next chunk straight from the medium, if it supports it
+ * @param  lun: Logical unit number
+ * @retval status: 0 if the chunk was sent, else use the media buffers
+ */
+static uint8_t SCSI_DirectRead(USBD_HandleTypeDef *pdev, uint8_t lun)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   USBD_StorageTypeDef *fops =
+       (USBD_StorageTypeDef *)pdev->pUserData[pdev->classId];
+   uint8_t *pbuf;
+   uint32_t len;
+
+   if ((fops->GetBuffer == NULL) ||
+       (fops->GetBuffer(lun, hmsc->scsi_blk_addr, hmsc->scsi_blk_len, &pbuf,
+                        &len) != 0U)) {
+      return -1;
+   }
+
+   len = MIN(len, MSC_DIRECT_PACKET);
+   len -= len % hmsc->scsi_blk_size[lun];
+   if ((len == 0U) && (hmsc->scsi_blk_len != 0U)) {
+      return -1;
+   }
+
+   (void)USBD_LL_Transmit(pdev, MSCInEpAdd, pbuf, len);
+
+   hmsc->scsi_blk_addr += (len / hmsc->scsi_blk_size[lun]);
+   hmsc->scsi_blk_len -= (len / hmsc->scsi_blk_size[lun]);
+   hmsc->stats.read_bytes += len;
+
+   /* case 6 : Hi = Di */
+   hmsc->csw.dDataResidue -= len;
+
+   if (hmsc->scsi_blk_len == 0U) {
+      hmsc->bot_state = USBD_BOT_LAST_DATA_IN;
+   }
+
+   return 0;
+}
+
+/**
+ * @brief  SCSI_ProcessWrite
+ *         Handle Write Process
+ * @param  lun: Logical unit number
+ * @retval status
+ */
+static uint8_t SCSI_ProcessWrite(USBD_HandleTypeDef *pdev, uint8_t lun)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   uint32_t len;
+
+   if (hmsc == NULL) {
+      return -1;
+   }
+
+   len = hmsc->scsi_blk_len * hmsc->scsi_blk_size[lun];
+
+#ifdef USE_USBD_COMPOSITE
+   /* Get the Endpoints addresses allocated for this class instance */
+   MSCOutEpAdd = USBD_CoreGetEPAdd(pdev, USBD_EP_OUT, USBD_EP_TYPE_BULK,
+                                   (uint8_t)pdev->classId);
+#endif /* USE_USBD_COMPOSITE */
+
+   if (hmsc->media_direct != NULL) {
+      /* the data was received in place */
+      len = hmsc->media_direct_len;
+   } else {
+      len = MIN(len, MSC_MEDIA_PACKET);
+
+      if (((USBD_StorageTypeDef *)pdev->pUserData[pdev->classId])
+              ->Write(lun, hmsc->bot_data, hmsc->scsi_blk_addr,
+                      (len / hmsc->scsi_blk_size[lun])) != 0) {
+         SCSI_SenseCode(pdev, lun, HARDWARE_ERROR, WRITE_FAULT);
+         return -1;
+      }
+   }
+
+   hmsc->scsi_blk_addr += (len / hmsc->scsi_blk_size[lun]);
+   hmsc->scsi_blk_len -= (len / hmsc->scsi_blk_size[lun]);
+
+   /* case 12 : Ho = Do */
+   hmsc->csw.dDataResidue -= len;
+
+   if (hmsc->scsi_blk_len == 0U) {
+      MSC_BOT_SendCSW(pdev, USBD_CSW_CMD_PASSED);
+   } else {
       /* Prepare EP to Receive next packet */
-      (void)USBD_LL_PrepareReceive(pdev, MSCOutEpAdd, hmsc->bot_data, len);
+      SCSI_PrepareWrite(pdev, lun);
    }
 
    return 0;
 }
 
+/**
+ * @brief  SCSI_PrepareWrite
+ *         Prepare the OUT endpoint for the next chunk of a write, straight
+ *         into the medium if it supports it, else into bot_data
+ * @param  lun: Logical unit number
+ * @retval None
+ */
+static void SCSI_PrepareWrite(USBD_HandleTypeDef *pdev, uint8_t lun)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   USBD_StorageTypeDef *fops =
+       (USBD_StorageTypeDef *)pdev->pUserData[pdev->classId];
+   uint8_t *pbuf;
+   uint32_t len;
+
+   if ((fops->GetBuffer != NULL) &&
+       (fops->GetBuffer(lun, hmsc->scsi_blk_addr, hmsc->scsi_blk_len, &pbuf,
+                        &len) == 0U)) {
+      len = MIN(len, MSC_DIRECT_PACKET);
+      len -= len % hmsc->scsi_blk_size[lun];
+
+      if (len != 0U) {
+         hmsc->media_direct     = pbuf;
+         hmsc->media_direct_len = len;
+         (void)USBD_LL_PrepareReceive(pdev, MSCOutEpAdd, pbuf, len);
+         return;
+      }
+   }
+
+   len = MIN((hmsc->scsi_blk_len * hmsc->scsi_blk_size[lun]), MSC_MEDIA_PACKET);
+
+   hmsc->media_direct = NULL;
+   (void)USBD_LL_PrepareReceive(pdev, MSCOutEpAdd, hmsc->bot_data, len);
+}
+
 /**
  * @brief  SCSI_UpdateBotData
  *         fill the requested Data to transmit buffer
@@ -66,13 +66,28 @@ extern "C" {
 #define SCSI_WRITE12         0xAAU
 #define SCSI_WRITE16         0x8AU
 
+#define SCSI_UNMAP        0x42U
+#define SCSI_WRITE_SAME16 0x93U
+
 #define SCSI_VERIFY10 0x2FU
 #define SCSI_VERIFY12 0xAFU
 #define SCSI_VERIFY16 0x8FU
 
+#define SCSI_SYNCHRONIZE_CACHE10 0x35U
+#define SCSI_SYNCHRONIZE_CACHE16 0x91U
+
 #define SCSI_SEND_DIAGNOSTIC        0x1DU
 #define SCSI_READ_FORMAT_CAPACITIES 0x23U
 
+/* Vendor specific */
+#define SCSI_WRITE_LZ4   0xC0U
+#define SCSI_READ_HASH   0xC1U
+#define SCSI_READ_DIGEST 0xC2U
+
+/* READ DIGEST algorithms, CDB byte 1 */
+#define SCSI_DIGEST_CRC32  0x00U
+#define SCSI_DIGEST_SHA256 0x01U
+
 #define NO_SENSE            0U
 #define RECOVERED_ERROR     1U
 #define NOT_READY           2U
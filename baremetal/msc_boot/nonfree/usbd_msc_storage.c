@@ -24,7 +24,13 @@ EndBSPDependencies */
 
 /* Includes ------------------------------------------------------------------*/
 #include "usbd_msc_storage.h"
+#include "blkcache.h"
+#ifdef EMMC_USE
+#include "emmc.h"
+#endif
+#include "sd.h"
 #include "stm32mp13xx_hal_def.h"
+#include <string.h>
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
@@ -34,12 +40,77 @@ EndBSPDependencies */
 /* Extern function prototypes ------------------------------------------------*/
 /* Private functions ---------------------------------------------------------*/
 
-#define STORAGE_LUN_NBR 1U
-#define STORAGE_BLK_NBR 0x100000U
+#ifdef EMMC_USE
+#define STORAGE_LUN_NBR 6U
+#else
+#define STORAGE_LUN_NBR 3U
+#endif
 #define STORAGE_BLK_SIZ 0x200U
 
-__attribute__((section(".virtdrive"))) static volatile uint8_t
-    virtdrive[STORAGE_BLK_NBR * STORAGE_BLK_SIZ];
+/* LUN 1: scratch disk in DDR */
+#define STORAGE_SCRATCH_BLK_NBR 0x80000U // 256 MB
+
+/* staging memory for the compressed write command (WRITE LZ4) */
+#define STORAGE_STAGING_SIZ 0x800000U // 8 MB
+
+/* LUN 2: window onto the SD card covering the fsbl1 and fsbl2 partitions of
+ * the usual STM32MP1 layout, 256 kB each starting right after the GPT */
+#define STORAGE_BOOT_BLK_ADDR 34U
+#define STORAGE_BOOT_BLK_NBR  1024U
+
+#if (STORAGE_LUN_NBR > MSC_MAX_LUN_NBR)
+#error "STORAGE_LUN_NBR exceeds MSC_MAX_LUN_NBR"
+#endif
+
+typedef struct {
+   uint32_t blk_addr;        /* first block of the backend used */
+   uint32_t blk_nbr;         /* 0: all of the backend from blk_addr */
+   uint8_t write_protected;
+   uint8_t *mem;             /* memory-mapped backend, or NULL */
+   int (*ready)(void);
+   int (*capacity)(uint32_t *blk_nbr, uint32_t *blk_size);
+   int (*read)(uint8_t *buf, uint32_t blk_addr, uint32_t blk_len);
+   int (*write)(const uint8_t *buf, uint32_t blk_addr, uint32_t blk_len);
+   int (*sync)(void);
+   int (*discard)(uint32_t blk_addr, uint32_t blk_len); /* NULL: no UNMAP */
+   int (*discard_zeroes)(void); /* nonzero if discarded blocks read as 0 */
+   int (*can_discard)(void);    /* NULL: whenever discard is set */
+} STORAGE_LunTypeDef;
+
+__attribute__((section(".virtdrive"), aligned(64))) static uint8_t
+    virtdrive[STORAGE_SCRATCH_BLK_NBR * STORAGE_BLK_SIZ];
+
+__attribute__((section(".virtdrive"), aligned(64))) static uint8_t
+    staging[STORAGE_STAGING_SIZ];
+
+static const STORAGE_LunTypeDef storage_lun[STORAGE_LUN_NBR] = {
+    /* LUN 0: SD card, through the DDR block cache */
+    {0U, 0U, 0U, NULL, sd_ready, sd_get_capacity, blkcache_read,
+     blkcache_write, blkcache_flush, blkcache_discard,
+     blkcache_discard_zeroes, NULL},
+
+    /* LUN 1: scratch disk in DDR */
+    {0U, STORAGE_SCRATCH_BLK_NBR, 0U, virtdrive, NULL, NULL, NULL, NULL,
+     NULL, NULL, NULL, NULL},
+
+    /* LUN 2: boot area of the SD card, through the same cache as LUN 0 */
+    {STORAGE_BOOT_BLK_ADDR, STORAGE_BOOT_BLK_NBR, 0U, NULL, sd_ready,
+     sd_get_capacity, blkcache_read, blkcache_write, blkcache_flush,
+     blkcache_discard, blkcache_discard_zeroes, NULL},
+
+#ifdef EMMC_USE
+    /* LUN 3: eMMC user area, direct (the block cache holds the SD card);
+     * UNMAP only on devices with TRIM */
+    {0U, 0U, 0U, NULL, emmc_ready, emmc_get_capacity, emmc_read, emmc_write,
+     NULL, emmc_discard, emmc_discard_zeroes, emmc_can_discard},
+
+    /* LUN 4, 5: eMMC boot partitions */
+    {0U, 0U, 0U, NULL, emmc_ready, emmc_get_boot_capacity, emmc_boot0_read,
+     emmc_boot0_write, NULL, NULL, NULL, NULL},
+    {0U, 0U, 0U, NULL, emmc_ready, emmc_get_boot_capacity, emmc_boot1_read,
+     emmc_boot1_write, NULL, NULL, NULL, NULL},
+#endif
+};
 
 uint8_t STORAGE_Init(uint8_t lun);
 
@@ -58,20 +129,93 @@ uint8_t STORAGE_Write(uint8_t lun, uint8_t *buf, uint32_t blk_addr,
 
 uint8_t STORAGE_GetMaxLun(void);
 
-/* USB Mass storage Standard Inquiry Data */
-uint8_t STORAGE_Inquirydata[] = /* 36 */
+uint8_t STORAGE_Sync(uint8_t lun);
+
+uint8_t *STORAGE_GetStaging(uint32_t *len);
+
+uint8_t STORAGE_Unmap(uint8_t lun, uint32_t blk_addr, uint32_t blk_len);
+
+uint8_t STORAGE_GetUnmap(uint8_t lun, uint8_t *zeroes);
+
+uint8_t STORAGE_GetWriteCache(uint8_t lun);
+
+uint8_t STORAGE_GetBuffer(uint8_t lun, uint32_t blk_addr, uint32_t blk_len,
+                          uint8_t **pbuf, uint32_t *len);
+
+static uint8_t STORAGE_CheckRange(uint8_t lun, uint32_t blk_addr,
+                                  uint32_t blk_len);
+
+/* USB Mass storage Standard Inquiry Data, one entry per LUN */
+uint8_t STORAGE_Inquirydata[] = /* 36 per LUN */
     {
 
         /* LUN 0 */
-        0x00, 0x80, 0x02, 0x02, (STANDARD_INQUIRY_DATA_LEN - 5),
+        0x00, 0x80, 0x05, 0x02, (STANDARD_INQUIRY_DATA_LEN - 5), /* SPC-3 */
         0x00, 0x00, 0x00, 'S',  'T',
         'M',  ' ',  ' ',  ' ',  ' ',
         ' ', /* Manufacturer : 8 bytes */
-        'P',  'r',  'o',  'd',  'u',
-        'c',  't',  ' ', /* Product      : 16 Bytes */
+        'S',  'D',  ' ',  'c',  'a',
+        'r',  'd',  ' ', /* Product      : 16 Bytes */
         ' ',  ' ',  ' ',  ' ',  ' ',
         ' ',  ' ',  ' ',  '0',  '.',
         '0',  '1', /* Version      : 4 Bytes */
+
+        /* LUN 1 */
+        0x00, 0x80, 0x05, 0x02, (STANDARD_INQUIRY_DATA_LEN - 5), /* SPC-3 */
+        0x00, 0x00, 0x00, 'S',  'T',
+        'M',  ' ',  ' ',  ' ',  ' ',
+        ' ', /* Manufacturer : 8 bytes */
+        'R',  'A',  'M',  ' ',  'd',
+        'i',  's',  'k', /* Product      : 16 Bytes */
+        ' ',  ' ',  ' ',  ' ',  ' ',
+        ' ',  ' ',  ' ',  '0',  '.',
+        '0',  '1', /* Version      : 4 Bytes */
+
+        /* LUN 2 */
+        0x00, 0x80, 0x05, 0x02, (STANDARD_INQUIRY_DATA_LEN - 5), /* SPC-3 */
+        0x00, 0x00, 0x00, 'S',  'T',
+        'M',  ' ',  ' ',  ' ',  ' ',
+        ' ', /* Manufacturer : 8 bytes */
+        'B',  'o',  'o',  't',  ' ',
+        'a',  'r',  'e', /* Product      : 16 Bytes */
+        'a',  ' ',  ' ',  ' ',  ' ',
+        ' ',  ' ',  ' ',  '0',  '.',
+        '0',  '1', /* Version      : 4 Bytes */
+
+#ifdef EMMC_USE
+        /* LUN 3 */
+        0x00, 0x80, 0x05, 0x02, (STANDARD_INQUIRY_DATA_LEN - 5), /* SPC-3 */
+        0x00, 0x00, 0x00, 'S',  'T',
+        'M',  ' ',  ' ',  ' ',  ' ',
+        ' ', /* Manufacturer : 8 bytes */
+        'e',  'M',  'M',  'C',  ' ',
+        ' ',  ' ',  ' ', /* Product      : 16 Bytes */
+        ' ',  ' ',  ' ',  ' ',  ' ',
+        ' ',  ' ',  ' ',  '0',  '.',
+        '0',  '1', /* Version      : 4 Bytes */
+
+        /* LUN 4 */
+        0x00, 0x80, 0x05, 0x02, (STANDARD_INQUIRY_DATA_LEN - 5), /* SPC-3 */
+        0x00, 0x00, 0x00, 'S',  'T',
+        'M',  ' ',  ' ',  ' ',  ' ',
+        ' ', /* Manufacturer : 8 bytes */
+        'e',  'M',  'M',  'C',  ' ',
+        'b',  'o',  'o', /* Product      : 16 Bytes */
+        't',  '0',  ' ',  ' ',  ' ',
+        ' ',  ' ',  ' ',  '0',  '.',
+        '0',  '1', /* Version      : 4 Bytes */
+
+        /* LUN 5 */
+        0x00, 0x80, 0x05, 0x02, (STANDARD_INQUIRY_DATA_LEN - 5), /* SPC-3 */
+        0x00, 0x00, 0x00, 'S',  'T',
+        'M',  ' ',  ' ',  ' ',  ' ',
+        ' ', /* Manufacturer : 8 bytes */
+        'e',  'M',  'M',  'C',  ' ',
+        'b',  'o',  'o', /* Product      : 16 Bytes */
+        't',  '1',  ' ',  ' ',  ' ',
+        ' ',  ' ',  ' ',  '0',  '.',
+        '0',  '1', /* Version      : 4 Bytes */
+#endif
 };
 
 USBD_StorageTypeDef USBD_MSC_fops = {
@@ -79,7 +223,9 @@ USBD_StorageTypeDef USBD_MSC_fops = {
     STORAGE_IsReady,   STORAGE_IsWriteProtected,
     STORAGE_Read,      STORAGE_Write,
     STORAGE_GetMaxLun, STORAGE_Inquirydata,
-
+    STORAGE_GetBuffer, STORAGE_Sync,
+    STORAGE_GetStaging, STORAGE_Unmap,
+    STORAGE_GetUnmap,   STORAGE_GetWriteCache,
 };
 
 /**
@@ -104,10 +250,30 @@ uint8_t STORAGE_Init(uint8_t lun)
 uint8_t STORAGE_GetCapacity(uint8_t lun, uint32_t *block_num,
                            uint16_t *block_size)
 {
-   UNUSED(lun);
+   if (lun >= STORAGE_LUN_NBR) {
+      return USBD_FAIL;
+   }
+
+   const STORAGE_LunTypeDef *l = &storage_lun[lun];
+   uint32_t blk_nbr            = l->blk_nbr;
+   uint32_t blk_size           = STORAGE_BLK_SIZ;
+
+   if (l->capacity != NULL) {
+      uint32_t dev_nbr;
+
+      if ((l->capacity(&dev_nbr, &blk_size) != 0) ||
+          (dev_nbr < l->blk_addr + blk_nbr)) {
+         return USBD_FAIL;
+      }
+
+      if (blk_nbr == 0U) {
+         blk_nbr = dev_nbr - l->blk_addr;
+      }
+   }
+
+   *block_num  = blk_nbr;
+   *block_size = (uint16_t)blk_size;
 
-   *block_num  = STORAGE_BLK_NBR;
-   *block_size = STORAGE_BLK_SIZ;
    return (0);
 }
 
@@ -118,7 +284,13 @@ uint8_t STORAGE_GetCapacity(uint8_t lun, uint32_t *block_num,
  */
 uint8_t STORAGE_IsReady(uint8_t lun)
 {
-   UNUSED(lun);
+   if (lun >= STORAGE_LUN_NBR) {
+      return USBD_FAIL;
+   }
+
+   if ((storage_lun[lun].ready != NULL) && !storage_lun[lun].ready()) {
+      return USBD_FAIL;
+   }
 
    return (0);
 }
@@ -130,7 +302,9 @@ uint8_t STORAGE_IsReady(uint8_t lun)
  */
 uint8_t STORAGE_IsWriteProtected(uint8_t lun)
 {
-   UNUSED(lun);
+   if ((lun >= STORAGE_LUN_NBR) || storage_lun[lun].write_protected) {
+      return USBD_FAIL;
+   }
 
    return 0;
 }
@@ -146,25 +320,22 @@ uint8_t STORAGE_IsWriteProtected(uint8_t lun)
 uint8_t STORAGE_Read(uint8_t lun, uint8_t *buf, uint32_t blk_addr,
                     uint16_t blk_len)
 {
-   (void)lun;
-
-   const uint32_t *src =
-       (const uint32_t *)&virtdrive[blk_addr * STORAGE_BLK_SIZ];
-   uint8_t *dst = buf;
-
-   for (uint32_t blk = 0; blk < blk_len; blk++) {
-      for (uint32_t i = 0; i < STORAGE_BLK_SIZ; i += 4) {
-         uint32_t w = *src++; /* 32-bit aligned read */
+   if (STORAGE_CheckRange(lun, blk_addr, blk_len) != 0) {
+      return USBD_FAIL;
+   }
 
-         dst[0] = (uint8_t)(w & 0xff);
-         dst[1] = (uint8_t)((w >> 8) & 0xff);
-         dst[2] = (uint8_t)((w >> 16) & 0xff);
-         dst[3] = (uint8_t)((w >> 24) & 0xff);
+   const STORAGE_LunTypeDef *l = &storage_lun[lun];
 
-         dst += 4;
+   if (l->mem == NULL) {
+      if (l->read(buf, l->blk_addr + blk_addr, blk_len) != 0) {
+         return USBD_FAIL;
       }
+      return USBD_OK;
    }
 
+   memcpy(buf, &l->mem[(l->blk_addr + blk_addr) * STORAGE_BLK_SIZ],
+          (uint32_t)blk_len * STORAGE_BLK_SIZ);
+
    return USBD_OK;
 }
 
@@ -179,24 +350,154 @@ uint8_t STORAGE_Read(uint8_t lun, uint8_t *buf, uint32_t blk_addr,
 uint8_t STORAGE_Write(uint8_t lun, uint8_t *buf, uint32_t blk_addr,
                      uint16_t blk_len)
 {
-   (void)lun;
+   if ((STORAGE_CheckRange(lun, blk_addr, blk_len) != 0) ||
+       storage_lun[lun].write_protected) {
+      return USBD_FAIL;
+   }
 
-   uint8_t *src  = buf;
-   uint32_t *dst = (uint32_t *)&virtdrive[blk_addr * STORAGE_BLK_SIZ];
+   const STORAGE_LunTypeDef *l = &storage_lun[lun];
 
-   for (uint32_t blk = 0; blk < blk_len; blk++) {
-      for (uint32_t i = 0; i < STORAGE_BLK_SIZ; i += 4) {
-         uint32_t w = ((uint32_t)src[i + 3] << 24) |
-                      ((uint32_t)src[i + 2] << 16) |
-                      ((uint32_t)src[i + 1] << 8) | ((uint32_t)src[i + 0]);
-         *dst++ = w; // 32-bit aligned write
+   if (l->mem == NULL) {
+      if (l->write(buf, l->blk_addr + blk_addr, blk_len) != 0) {
+         return USBD_FAIL;
       }
-      src += STORAGE_BLK_SIZ;
+      return USBD_OK;
    }
 
+   memcpy(&l->mem[(l->blk_addr + blk_addr) * STORAGE_BLK_SIZ], buf,
+          (uint32_t)blk_len * STORAGE_BLK_SIZ);
+
    return USBD_OK;
 }
 
+/**
+ * @brief  Maps a block range of the medium for direct USB transfers.
+ * @param  lun: Logical unit number
+ * @param  blk_addr: Logical block address
+ * @param  blk_len: Blocks number
+ * @param  pbuf: Returns the address of the first block
+ * @param  len: Returns the contiguous length in bytes
+ * @retval Status (0 : OK / -1 : Error)
+ */
+uint8_t STORAGE_GetBuffer(uint8_t lun, uint32_t blk_addr, uint32_t blk_len,
+                          uint8_t **pbuf, uint32_t *len)
+{
+   /* only memory-mapped LUNs can be transferred in place */
+   if ((STORAGE_CheckRange(lun, blk_addr, blk_len) != 0) ||
+       (storage_lun[lun].mem == NULL)) {
+      return USBD_FAIL;
+   }
+
+   const STORAGE_LunTypeDef *l = &storage_lun[lun];
+
+   // the drive is plain DDR, so the whole range is contiguous
+   *pbuf = &l->mem[(l->blk_addr + blk_addr) * STORAGE_BLK_SIZ];
+   *len  = blk_len * STORAGE_BLK_SIZ;
+
+   return USBD_OK;
+}
+
+/**
+ * @brief  Writes cached data back to the medium.
+ * @param  lun: Logical unit number
+ * @retval Status (0 : OK / -1 : Error)
+ */
+uint8_t STORAGE_Sync(uint8_t lun)
+{
+   if (lun >= STORAGE_LUN_NBR) {
+      return USBD_FAIL;
+   }
+
+   if ((storage_lun[lun].sync != NULL) && (storage_lun[lun].sync() != 0)) {
+      return USBD_FAIL;
+   }
+
+   return USBD_OK;
+}
+
+/**
+ * @brief  Returns scratch memory in DDR for staging data.
+ * @param  len: Returns its size in bytes
+ * @retval Address of the memory
+ */
+uint8_t *STORAGE_GetStaging(uint32_t *len)
+{
+   *len = STORAGE_STAGING_SIZ;
+   return staging;
+}
+
+/**
+ * @brief  Deallocates a block range; it then reads as zeros if
+ *         STORAGE_GetUnmap() says so.
+ * @param  lun: Logical unit number
+ * @param  blk_addr: Logical block address
+ * @param  blk_len: Blocks number
+ * @retval Status (0 : OK / -1 : Error)
+ */
+uint8_t STORAGE_Unmap(uint8_t lun, uint32_t blk_addr, uint32_t blk_len)
+{
+   if ((STORAGE_CheckRange(lun, blk_addr, blk_len) != 0) ||
+       storage_lun[lun].write_protected) {
+      return USBD_FAIL;
+   }
+
+   const STORAGE_LunTypeDef *l = &storage_lun[lun];
+
+   if (l->mem == NULL) {
+      if ((l->discard == NULL) ||
+          (l->discard(l->blk_addr + blk_addr, blk_len) != 0)) {
+         return USBD_FAIL;
+      }
+      return USBD_OK;
+   }
+
+   memset(&l->mem[(l->blk_addr + blk_addr) * STORAGE_BLK_SIZ], 0,
+          blk_len * STORAGE_BLK_SIZ);
+
+   return USBD_OK;
+}
+
+/**
+ * @brief  Tells whether a LUN can deallocate blocks.
+ * @param  lun: Logical unit number
+ * @param  zeroes: Returns 1 if deallocated blocks read as zeros
+ * @retval Status (0 : OK / -1 : not supported)
+ */
+uint8_t STORAGE_GetUnmap(uint8_t lun, uint8_t *zeroes)
+{
+   if (lun >= STORAGE_LUN_NBR) {
+      return USBD_FAIL;
+   }
+
+   const STORAGE_LunTypeDef *l = &storage_lun[lun];
+
+   if (l->mem != NULL) {
+      *zeroes = 1U;
+   } else if ((l->discard != NULL) &&
+              ((l->can_discard == NULL) || (l->can_discard() != 0))) {
+      *zeroes = (l->discard_zeroes() != 0) ? 1U : 0U;
+   } else {
+      return USBD_FAIL;
+   }
+
+   return USBD_OK;
+}
+
+/**
+ * @brief  Tells whether a LUN has a write-back cache: the LUNs with a sync
+ *         function, which are those behind the SD block cache.
+ * @param  lun: Logical unit number
+ * @retval 1 if writes are cached, else 0
+ */
+uint8_t STORAGE_GetWriteCache(uint8_t lun)
+{
+   if (lun >= STORAGE_LUN_NBR) {
+      return 0U;
+   }
+
+   return (storage_lun[lun].sync != NULL) ? 1U : 0U;
+}
+
 /**
  * @brief  Returns the Max Supported LUNs.
  * @param  None
@@ -206,3 +507,27 @@ uint8_t STORAGE_GetMaxLun(void)
 {
    return (STORAGE_LUN_NBR - 1);
 }
+
+/**
+ * @brief  Checks a block range against the size of a LUN.
+ * @param  lun: Logical unit number
+ * @param  blk_addr: Logical block address
+ * @param  blk_len: Blocks number
+ * @retval Status (0 : OK / -1 : Error)
+ */
+static uint8_t STORAGE_CheckRange(uint8_t lun, uint32_t blk_addr,
+                                  uint32_t blk_len)
+{
+   if (lun >= STORAGE_LUN_NBR) {
+      return USBD_FAIL;
+   }
+
+   /* LUNs sized by the backend rely on SCSI_CheckAddressRange() */
+   const uint32_t blk_nbr = storage_lun[lun].blk_nbr;
+   if ((blk_nbr != 0U) &&
+       ((blk_addr > blk_nbr) || (blk_len > blk_nbr - blk_addr))) {
+      return USBD_FAIL;
+   }
+
+   return USBD_OK;
+}
@@ -0,0 +1,732 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file usbd_msc_uas.c
+ * @brief USB Attached SCSI (UAS) on alternate setting 1 of the MSC interface
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * The host queues up to MSC_UAS_QUEUE_DEPTH tagged commands on the command
+ * pipe. One command at a time owns the data pipes and runs through the same
+ * SCSI handlers as the Bulk-Only Transport, with the CBW filled in from the
+ * Command IU and the CSW turned into a Sense IU. USB 2.0 has no bulk streams,
+ * so each data phase is announced with a READ READY or WRITE READY IU on the
+ * status pipe. Commands that do not touch the medium are started ahead of
+ * queued READs and WRITEs, so they may complete out of order.
+ */
+
+#include "usbd_msc.h"
+
+#if (MSC_UAS_ENABLE == 1U)
+
+#define NO_SLOT MSC_UAS_QUEUE_DEPTH
+
+/* Response IU codes */
+#define UAS_RC_COMPLETE      0x00U
+#define UAS_RC_INVALID_IU    0x02U
+#define UAS_RC_NOT_SUPPORTED 0x04U
+#define UAS_RC_SUCCEEDED     0x08U
+#define UAS_RC_INCORRECT_LUN 0x09U
+#define UAS_RC_OVERLAPPED    0x0AU
+
+/* Task management functions */
+#define UAS_TM_ABORT_TASK     0x01U
+#define UAS_TM_ABORT_TASK_SET 0x02U
+#define UAS_TM_CLEAR_TASK_SET 0x04U
+#define UAS_TM_LU_RESET       0x08U
+#define UAS_TM_IT_NEXUS_RESET 0x10U
+#define UAS_TM_QUERY_TASK     0x80U
+
+/* SCSI status in the Sense IU */
+#define UAS_STATUS_GOOD            0x00U
+#define UAS_STATUS_CHECK_CONDITION 0x02U
+
+extern uint8_t MSCInEpAdd;
+
+static USBD_MSC_UAS_HandleTypeDef *MSC_UAS_Handle(USBD_HandleTypeDef *pdev);
+static void MSC_UAS_Arm(USBD_HandleTypeDef *pdev);
+static void MSC_UAS_Post(USBD_HandleTypeDef *pdev, uint8_t entry);
+static void MSC_UAS_Send(USBD_HandleTypeDef *pdev);
+static void MSC_UAS_Response(USBD_HandleTypeDef *pdev, uint8_t idx,
+                             uint8_t code);
+static void MSC_UAS_Ready(USBD_HandleTypeDef *pdev, uint8_t idx, uint8_t iu);
+static uint8_t MSC_UAS_TaskMgmt(USBD_HandleTypeDef *pdev, const uint8_t *iu);
+static uint8_t MSC_UAS_IsMedium(uint8_t opcode);
+static uint8_t MSC_UAS_Pick(USBD_MSC_UAS_HandleTypeDef *uas);
+static uint32_t MSC_UAS_DataLength(USBD_HandleTypeDef *pdev, uint8_t lun,
+                                   const uint8_t *cdb, uint8_t *dir_in);
+static void MSC_UAS_Start(USBD_HandleTypeDef *pdev, uint8_t idx);
+
+/**
+ * @brief  MSC_UAS_Init
+ *         Open the command and status pipes and wait for the first command
+ * @param  pdev: device instance
+ * @retval None
+ */
+void MSC_UAS_Init(USBD_HandleTypeDef *pdev)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   uint16_t mps;
+
+   if (hmsc == NULL) {
+      return;
+   }
+
+   mps = (pdev->dev_speed == USBD_SPEED_HIGH) ? MSC_MAX_HS_PACKET
+                                              : MSC_MAX_FS_PACKET;
+
+   (void)USBD_LL_OpenEP(pdev, MSC_UAS_CMD_EP, USBD_EP_TYPE_BULK, mps);
+   pdev->ep_out[MSC_UAS_CMD_EP & 0xFU].is_used = 1U;
+
+   (void)USBD_LL_OpenEP(pdev, MSC_UAS_STATUS_EP, USBD_EP_TYPE_BULK, mps);
+   pdev->ep_in[MSC_UAS_STATUS_EP & 0xFU].is_used = 1U;
+
+   hmsc->bot_state  = USBD_BOT_IDLE;
+   hmsc->bot_status = USBD_BOT_STATUS_NORMAL;
+
+   hmsc->scsi_sense_tail = 0U;
+   hmsc->scsi_sense_head = 0U;
+   for (uint8_t lun = 0U; lun < MSC_MAX_LUN_NBR; lun++) {
+      hmsc->scsi_medium_state[lun] = SCSI_MEDIUM_UNLOCKED;
+   }
+
+   (void)USBD_memset(&hmsc->stats, 0, sizeof(hmsc->stats));
+   (void)USBD_memset(&hmsc->uas, 0, sizeof(hmsc->uas));
+   hmsc->uas.active = NO_SLOT;
+
+   ((USBD_StorageTypeDef *)pdev->pUserData[pdev->classId])->Init(0U);
+
+   MSC_UAS_Arm(pdev);
+}
+
+/**
+ * @brief  MSC_UAS_DeInit
+ *         Drop all queued commands and close the command and status pipes
+ * @param  pdev: device instance
+ * @retval None
+ */
+void MSC_UAS_DeInit(USBD_HandleTypeDef *pdev)
+{
+   USBD_MSC_UAS_HandleTypeDef *uas = MSC_UAS_Handle(pdev);
+
+   if (uas != NULL) {
+      (void)USBD_memset(uas, 0, sizeof(*uas));
+      uas->active = NO_SLOT;
+   }
+
+   (void)USBD_LL_CloseEP(pdev, MSC_UAS_CMD_EP);
+   pdev->ep_out[MSC_UAS_CMD_EP & 0xFU].is_used = 0U;
+
+   (void)USBD_LL_CloseEP(pdev, MSC_UAS_STATUS_EP);
+   pdev->ep_in[MSC_UAS_STATUS_EP & 0xFU].is_used = 0U;
+}
+
+/**
+ * @brief  MSC_UAS_CmdOut
+ *         Queue the Command or Task Management IU just received
+ * @param  pdev: device instance
+ * @retval None
+ */
+void MSC_UAS_CmdOut(USBD_HandleTypeDef *pdev)
+{
+   USBD_MSC_UAS_HandleTypeDef *uas = MSC_UAS_Handle(pdev);
+   USBD_MSC_UAS_SlotTypeDef *s;
+   const uint8_t *iu;
+   uint32_t len;
+   uint8_t idx;
+   uint8_t queued = 0U;
+
+   if (uas == NULL) {
+      return;
+   }
+
+   uas->rx_armed = 0U;
+   iu            = (const uint8_t *)uas->rx;
+   len           = USBD_LL_GetRxDataSize(pdev, MSC_UAS_CMD_EP);
+
+   for (idx = 0U; idx < MSC_UAS_QUEUE_DEPTH; idx++) {
+      if (uas->slot[idx].state == MSC_UAS_SLOT_FREE) {
+         break;
+      }
+   }
+
+   /* the pipe is only armed while a slot is free; drop runt IUs */
+   if ((idx == NO_SLOT) || (len < 16U)) {
+      MSC_UAS_Arm(pdev);
+      return;
+   }
+
+   s      = &uas->slot[idx];
+   s->tag = (uint16_t)(((uint16_t)iu[2] << 8) | iu[3]);
+   s->lun = iu[9];
+   s->seq = uas->seq++;
+
+   for (uint8_t i = 0U; i < MSC_UAS_QUEUE_DEPTH; i++) {
+      if ((i != idx) && (uas->slot[i].state != MSC_UAS_SLOT_FREE) &&
+          (uas->slot[i].tag == s->tag)) {
+         MSC_UAS_Response(pdev, idx, UAS_RC_OVERLAPPED);
+         MSC_UAS_Arm(pdev);
+         return;
+      }
+   }
+
+   switch (iu[0]) {
+      case MSC_UAS_IU_COMMAND:
+         /* no additional CDB bytes beyond the 16 in the IU */
+         if ((len < MSC_UAS_CMD_IU_LEN) || ((iu[6] & 0xFCU) != 0U)) {
+            MSC_UAS_Response(pdev, idx, UAS_RC_INVALID_IU);
+         } else if (s->lun >
+                    ((USBD_StorageTypeDef *)pdev->pUserData[pdev->classId])
+                        ->GetMaxLun()) {
+            MSC_UAS_Response(pdev, idx, UAS_RC_INCORRECT_LUN);
+         } else {
+            (void)USBD_memcpy(s->cdb, &iu[16], sizeof(s->cdb));
+            s->state = MSC_UAS_SLOT_QUEUED;
+            uas->cmds++;
+         }
+         break;
+
+      case MSC_UAS_IU_TASK_MGMT:
+         MSC_UAS_Response(pdev, idx, MSC_UAS_TaskMgmt(pdev, iu));
+         break;
+
+      default: MSC_UAS_Response(pdev, idx, UAS_RC_INVALID_IU); break;
+   }
+
+   for (uint8_t i = 0U; i < MSC_UAS_QUEUE_DEPTH; i++) {
+      if (uas->slot[i].state == MSC_UAS_SLOT_QUEUED) {
+         queued++;
+      }
+   }
+
+   if (queued > uas->max_queued) {
+      uas->max_queued = queued;
+   }
+
+   MSC_UAS_Arm(pdev);
+}
+
+/**
+ * @brief  MSC_UAS_StatusIn
+ *         An IU has gone out on the status pipe: release it, send the next
+ * @param  pdev: device instance
+ * @retval None
+ */
+void MSC_UAS_StatusIn(USBD_HandleTypeDef *pdev)
+{
+   USBD_MSC_UAS_HandleTypeDef *uas = MSC_UAS_Handle(pdev);
+   uint8_t entry;
+
+   if ((uas == NULL) || (uas->tx_count == 0U)) {
+      return;
+   }
+
+   entry        = uas->tx_fifo[uas->tx_head];
+   uas->tx_head = (uint8_t)((uas->tx_head + 1U) % sizeof(uas->tx_fifo));
+   uas->tx_count--;
+   uas->tx_busy = 0U;
+
+   if ((entry & MSC_UAS_TX_READY) == 0U) {
+      uas->slot[entry].state = MSC_UAS_SLOT_FREE;
+   }
+
+   MSC_UAS_Send(pdev);
+   MSC_UAS_Arm(pdev);
+}
+
+/**
+ * @brief  MSC_UAS_Complete
+ *         Turn the status of the active command into a Sense IU
+ * @param  pdev: device instance
+ * @param  CSW_Status: status the BOT would have put in the CSW
+ * @retval None
+ */
+void MSC_UAS_Complete(USBD_HandleTypeDef *pdev, uint8_t CSW_Status)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   USBD_MSC_UAS_SlotTypeDef *s;
+   uint8_t *iu;
+
+   if ((hmsc == NULL) || (hmsc->uas.active == NO_SLOT)) {
+      return;
+   }
+
+   s  = &hmsc->uas.slot[hmsc->uas.active];
+   iu = (uint8_t *)s->status;
+   (void)USBD_memset(iu, 0, sizeof(s->status));
+
+   iu[0] = MSC_UAS_IU_SENSE;
+   iu[2] = (uint8_t)(s->tag >> 8);
+   iu[3] = (uint8_t)s->tag;
+
+   if (CSW_Status == USBD_CSW_CMD_PASSED) {
+      iu[6]         = UAS_STATUS_GOOD;
+      s->status_len = 16U;
+   } else {
+      iu[6]         = UAS_STATUS_CHECK_CONDITION;
+      iu[15]        = MSC_UAS_SENSE_LEN;
+      s->status_len = MSC_UAS_STATUS_LEN;
+
+      /* fixed format sense data, as REQUEST SENSE would return it */
+      iu[16]      = 0x70U;
+      iu[16 + 7U] = MSC_UAS_SENSE_LEN - 8U;
+      if (hmsc->scsi_sense_head != hmsc->scsi_sense_tail) {
+         iu[16 + 2U]  = hmsc->scsi_sense[hmsc->scsi_sense_head].Skey;
+         iu[16 + 12U] = hmsc->scsi_sense[hmsc->scsi_sense_head].w.b.ASC;
+         iu[16 + 13U] = hmsc->scsi_sense[hmsc->scsi_sense_head].w.b.ASCQ;
+         hmsc->scsi_sense_head++;
+
+         if (hmsc->scsi_sense_head == SENSE_LIST_DEEPTH) {
+            hmsc->scsi_sense_head = 0U;
+         }
+      }
+   }
+
+   s->state         = MSC_UAS_SLOT_STATUS;
+   hmsc->bot_state  = USBD_BOT_IDLE;
+   hmsc->uas.active = NO_SLOT;
+
+   MSC_UAS_Post(pdev, (uint8_t)(s - hmsc->uas.slot));
+}
+
+/**
+ * @brief  MSC_UAS_Schedule
+ *         Give the data pipes to the next queued command, if they are free
+ * @param  pdev: device instance
+ * @retval None
+ */
+void MSC_UAS_Schedule(USBD_HandleTypeDef *pdev)
+{
+   USBD_MSC_UAS_HandleTypeDef *uas = MSC_UAS_Handle(pdev);
+   uint8_t idx;
+
+   if (uas == NULL) {
+      return;
+   }
+
+   /* commands without a data phase finish here and free the pipes again */
+   while (uas->active == NO_SLOT) {
+      idx = MSC_UAS_Pick(uas);
+      if (idx == NO_SLOT) {
+         break;
+      }
+
+      MSC_UAS_Start(pdev, idx);
+   }
+
+   MSC_UAS_Arm(pdev);
+}
+
+/**
+ * @brief  MSC_UAS_Handle
+ *         Return the UAS state of the class instance
+ * @param  pdev: device instance
+ * @retval UAS state, or NULL before the class is initialized
+ */
+static USBD_MSC_UAS_HandleTypeDef *MSC_UAS_Handle(USBD_HandleTypeDef *pdev)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+
+   return (hmsc == NULL) ? NULL : &hmsc->uas;
+}
+
+/**
+ * @brief  MSC_UAS_Arm
+ *         Receive the next IU on the command pipe while a slot is free; with
+ *         all slots taken the pipe NAKs, which is the flow control
+ * @param  pdev: device instance
+ * @retval None
+ */
+static void MSC_UAS_Arm(USBD_HandleTypeDef *pdev)
+{
+   USBD_MSC_UAS_HandleTypeDef *uas = MSC_UAS_Handle(pdev);
+
+   if ((uas == NULL) || (uas->rx_armed != 0U)) {
+      return;
+   }
+
+   for (uint8_t i = 0U; i < MSC_UAS_QUEUE_DEPTH; i++) {
+      if (uas->slot[i].state == MSC_UAS_SLOT_FREE) {
+         uas->rx_armed = 1U;
+         (void)USBD_LL_PrepareReceive(pdev, MSC_UAS_CMD_EP,
+                                      (uint8_t *)uas->rx, MSC_UAS_RX_LEN);
+         return;
+      }
+   }
+}
+
+/**
+ * @brief  MSC_UAS_Post
+ *         Queue an IU for the status pipe
+ * @param  pdev: device instance
+ * @param  entry: slot number, with MSC_UAS_TX_READY for its READY IU
+ * @retval None
+ */
+static void MSC_UAS_Post(USBD_HandleTypeDef *pdev, uint8_t entry)
+{
+   USBD_MSC_UAS_HandleTypeDef *uas = MSC_UAS_Handle(pdev);
+
+   /* at most a READY and a status IU per slot, so this never overflows */
+   uas->tx_fifo[(uas->tx_head + uas->tx_count) % sizeof(uas->tx_fifo)] = entry;
+   uas->tx_count++;
+
+   MSC_UAS_Send(pdev);
+}
+
+/**
+ * @brief  MSC_UAS_Send
+ *         Start the IU at the head of the status queue if the pipe is idle
+ * @param  pdev: device instance
+ * @retval None
+ */
+static void MSC_UAS_Send(USBD_HandleTypeDef *pdev)
+{
+   USBD_MSC_UAS_HandleTypeDef *uas = MSC_UAS_Handle(pdev);
+   USBD_MSC_UAS_SlotTypeDef *s;
+   uint8_t entry;
+
+   if ((uas->tx_busy != 0U) || (uas->tx_count == 0U)) {
+      return;
+   }
+
+   entry        = uas->tx_fifo[uas->tx_head];
+   s            = &uas->slot[entry & ~MSC_UAS_TX_READY];
+   uas->tx_busy = 1U;
+
+   if ((entry & MSC_UAS_TX_READY) != 0U) {
+      (void)USBD_LL_Transmit(pdev, MSC_UAS_STATUS_EP, (uint8_t *)&s->ready,
+                             4U);
+   } else {
+      (void)USBD_LL_Transmit(pdev, MSC_UAS_STATUS_EP, (uint8_t *)s->status,
+                             s->status_len);
+   }
+}
+
+/**
+ * @brief  MSC_UAS_Response
+ *         Answer the IU in a slot with a Response IU
+ * @param  pdev: device instance
+ * @param  idx: slot number
+ * @param  code: response code
+ * @retval None
+ */
+static void MSC_UAS_Response(USBD_HandleTypeDef *pdev, uint8_t idx,
+                             uint8_t code)
+{
+   USBD_MSC_UAS_SlotTypeDef *s = &MSC_UAS_Handle(pdev)->slot[idx];
+   uint8_t *iu                 = (uint8_t *)s->status;
+
+   (void)USBD_memset(iu, 0, 8U);
+   iu[0]         = MSC_UAS_IU_RESPONSE;
+   iu[2]         = (uint8_t)(s->tag >> 8);
+   iu[3]         = (uint8_t)s->tag;
+   iu[7]         = code;
+   s->status_len = 8U;
+   s->state      = MSC_UAS_SLOT_STATUS;
+
+   MSC_UAS_Post(pdev, idx);
+}
+
+/**
+ * @brief  MSC_UAS_Ready
+ *         Tell the host the active command is ready for its data phase
+ * @param  pdev: device instance
+ * @param  idx: slot number
+ * @param  iu: MSC_UAS_IU_READ_READY or MSC_UAS_IU_WRITE_READY
+ * @retval None
+ */
+static void MSC_UAS_Ready(USBD_HandleTypeDef *pdev, uint8_t idx, uint8_t iu)
+{
+   USBD_MSC_UAS_SlotTypeDef *s = &MSC_UAS_Handle(pdev)->slot[idx];
+   uint8_t *p                  = (uint8_t *)&s->ready;
+
+   p[0] = iu;
+   p[1] = 0U;
+   p[2] = (uint8_t)(s->tag >> 8);
+   p[3] = (uint8_t)s->tag;
+
+   MSC_UAS_Post(pdev, (uint8_t)(idx | MSC_UAS_TX_READY));
+}
+
+/**
+ * @brief  MSC_UAS_TaskMgmt
+ *         Carry out a Task Management IU on the commands not yet started;
+ *         the command owning the data pipes always runs to completion
+ * @param  pdev: device instance
+ * @param  iu: Task Management IU
+ * @retval response code
+ */
+static uint8_t MSC_UAS_TaskMgmt(USBD_HandleTypeDef *pdev, const uint8_t *iu)
+{
+   USBD_MSC_UAS_HandleTypeDef *uas = MSC_UAS_Handle(pdev);
+   uint16_t tag;
+   uint8_t found = 0U;
+
+   tag = (uint16_t)(((uint16_t)iu[6] << 8) | iu[7]);
+
+   for (uint8_t i = 0U; i < MSC_UAS_QUEUE_DEPTH; i++) {
+      USBD_MSC_UAS_SlotTypeDef *s = &uas->slot[i];
+
+      if ((s->state != MSC_UAS_SLOT_QUEUED) &&
+          (s->state != MSC_UAS_SLOT_ACTIVE)) {
+         continue;
+      }
+
+      switch (iu[4]) {
+         case UAS_TM_ABORT_TASK:
+         case UAS_TM_QUERY_TASK:
+            if (s->tag == tag) {
+               found = 1U;
+               if ((iu[4] == UAS_TM_ABORT_TASK) &&
+                   (s->state == MSC_UAS_SLOT_QUEUED)) {
+                  s->state = MSC_UAS_SLOT_FREE;
+               }
+            }
+            break;
+
+         case UAS_TM_ABORT_TASK_SET:
+         case UAS_TM_CLEAR_TASK_SET:
+         case UAS_TM_LU_RESET:
+            if ((s->lun == iu[9]) && (s->state == MSC_UAS_SLOT_QUEUED)) {
+               s->state = MSC_UAS_SLOT_FREE;
+            }
+            break;
+
+         case UAS_TM_IT_NEXUS_RESET:
+            if (s->state == MSC_UAS_SLOT_QUEUED) {
+               s->state = MSC_UAS_SLOT_FREE;
+            }
+            break;
+
+         default: return UAS_RC_NOT_SUPPORTED;
+      }
+   }
+
+   switch (iu[4]) {
+      case UAS_TM_QUERY_TASK:
+         return (found != 0U) ? UAS_RC_SUCCEEDED : UAS_RC_COMPLETE;
+
+      case UAS_TM_ABORT_TASK:
+      case UAS_TM_ABORT_TASK_SET:
+      case UAS_TM_CLEAR_TASK_SET:
+      case UAS_TM_LU_RESET:
+      case UAS_TM_IT_NEXUS_RESET: return UAS_RC_COMPLETE;
+
+      default: return UAS_RC_NOT_SUPPORTED;
+   }
+}
+
+/**
+ * @brief  MSC_UAS_IsMedium
+ *         Tell whether a command accesses the medium
+ * @param  opcode: CDB operation code
+ * @retval 1 for media commands, 0 otherwise
+ */
+static uint8_t MSC_UAS_IsMedium(uint8_t opcode)
+{
+   switch (opcode) {
+      case SCSI_READ10:
+      case SCSI_READ12:
+      case SCSI_READ16:
+      case SCSI_WRITE10:
+      case SCSI_WRITE12:
+      case SCSI_WRITE16:
+      case SCSI_WRITE_LZ4:
+      case SCSI_UNMAP:
+      case SCSI_WRITE_SAME16:
+      case SCSI_READ_HASH:
+      case SCSI_READ_DIGEST:
+      case SCSI_VERIFY10:
+      case SCSI_SYNCHRONIZE_CACHE10:
+      case SCSI_SYNCHRONIZE_CACHE16:
+      case SCSI_START_STOP_UNIT: return 1U;
+
+      default: return 0U;
+   }
+}
+
+/**
+ * @brief  MSC_UAS_Pick
+ *         Choose the queued command to start next: commands that do not
+ *         touch the medium first, then in arrival order
+ * @param  uas: UAS state
+ * @retval slot number, or NO_SLOT if nothing is queued
+ */
+static uint8_t MSC_UAS_Pick(USBD_MSC_UAS_HandleTypeDef *uas)
+{
+   uint8_t best = NO_SLOT;
+
+   for (uint8_t i = 0U; i < MSC_UAS_QUEUE_DEPTH; i++) {
+      const USBD_MSC_UAS_SlotTypeDef *s = &uas->slot[i];
+
+      if (s->state != MSC_UAS_SLOT_QUEUED) {
+         continue;
+      }
+
+      if (best == NO_SLOT) {
+         best = i;
+         continue;
+      }
+
+      const USBD_MSC_UAS_SlotTypeDef *b = &uas->slot[best];
+      uint8_t m_s                       = MSC_UAS_IsMedium(s->cdb[0]);
+      uint8_t m_b                       = MSC_UAS_IsMedium(b->cdb[0]);
+
+      if ((m_s < m_b) ||
+          ((m_s == m_b) && ((int32_t)(s->seq - b->seq) < 0))) {
+         best = i;
+      }
+   }
+
+   return best;
+}
+
+/**
+ * @brief  MSC_UAS_DataLength
+ *         Work out the data phase a CBW would have announced for a CDB
+ * @param  pdev: device instance
+ * @param  lun: Logical unit number
+ * @param  cdb: command descriptor block
+ * @param  dir_in: set to 1 if data flows to the host
+ * @retval length in bytes
+ */
+static uint32_t MSC_UAS_DataLength(USBD_HandleTypeDef *pdev, uint8_t lun,
+                                   const uint8_t *cdb, uint8_t *dir_in)
+{
+   uint32_t blk_nbr  = 0U;
+   uint16_t blk_size = 0U;
+   uint32_t len      = 0U;
+
+   *dir_in = 1U;
+
+   switch (cdb[0]) {
+      case SCSI_READ10:
+      case SCSI_WRITE10: len = ((uint32_t)cdb[7] << 8) | cdb[8]; break;
+
+      case SCSI_READ12:
+      case SCSI_WRITE12:
+         len = ((uint32_t)cdb[6] << 24) | ((uint32_t)cdb[7] << 16) |
+               ((uint32_t)cdb[8] << 8) | cdb[9];
+         break;
+
+      case SCSI_READ16:
+      case SCSI_WRITE16:
+         len = ((uint32_t)cdb[10] << 24) | ((uint32_t)cdb[11] << 16) |
+               ((uint32_t)cdb[12] << 8) | cdb[13];
+         break;
+
+      /* one block, none with NDOB */
+      case SCSI_WRITE_SAME16: len = ((cdb[1] & 0x01U) != 0U) ? 0U : 1U; break;
+
+      case SCSI_INQUIRY: return ((uint32_t)cdb[3] << 8) | cdb[4];
+
+      case SCSI_REQUEST_SENSE:
+      case SCSI_MODE_SENSE6: return cdb[4];
+
+      case SCSI_MODE_SENSE10:
+      case SCSI_READ_FORMAT_CAPACITIES:
+         return ((uint32_t)cdb[7] << 8) | cdb[8];
+
+      case SCSI_READ_CAPACITY10: return 8U;
+
+      case SCSI_READ_CAPACITY16:
+         return ((uint32_t)cdb[10] << 24) | ((uint32_t)cdb[11] << 16) |
+                ((uint32_t)cdb[12] << 8) | cdb[13];
+
+      case SCSI_READ_HASH:
+         return 4U * (((uint32_t)cdb[6] << 24) | ((uint32_t)cdb[7] << 16) |
+                      ((uint32_t)cdb[8] << 8) | cdb[9]);
+
+      case SCSI_READ_DIGEST:
+         return (cdb[1] == SCSI_DIGEST_SHA256) ? 32U : 4U;
+
+      case SCSI_WRITE_LZ4:
+         *dir_in = 0U;
+         return ((uint32_t)cdb[6] << 24) | ((uint32_t)cdb[7] << 16) |
+                ((uint32_t)cdb[8] << 8) | cdb[9];
+
+      case SCSI_UNMAP: *dir_in = 0U; return ((uint32_t)cdb[7] << 8) | cdb[8];
+
+      default: *dir_in = 0U; return 0U;
+   }
+
+   if ((cdb[0] == SCSI_WRITE10) || (cdb[0] == SCSI_WRITE12) ||
+       (cdb[0] == SCSI_WRITE16) || (cdb[0] == SCSI_WRITE_SAME16)) {
+      *dir_in = 0U;
+   }
+
+   if (((USBD_StorageTypeDef *)pdev->pUserData[pdev->classId])
+           ->GetCapacity(lun, &blk_nbr, &blk_size) != 0) {
+      return 0xFFFFFFFFU; /* the handler reports the medium as not ready */
+   }
+
+   return len * blk_size;
+}
+
+/**
+ * @brief  MSC_UAS_Start
+ *         Run a queued command through the SCSI handlers as if it had come
+ *         in a CBW, and announce its data phase
+ * @param  pdev: device instance
+ * @param  idx: slot number
+ * @retval None
+ */
+static void MSC_UAS_Start(USBD_HandleTypeDef *pdev, uint8_t idx)
+{
+   USBD_MSC_BOT_HandleTypeDef *hmsc =
+       (USBD_MSC_BOT_HandleTypeDef *)pdev->pClassDataCmsit[pdev->classId];
+   USBD_MSC_UAS_SlotTypeDef *s = &hmsc->uas.slot[idx];
+   uint8_t dir_in;
+   uint32_t length;
+
+   hmsc->cbw.dTag        = s->tag;
+   hmsc->cbw.bLUN        = s->lun;
+   hmsc->cbw.bCBLength   = 16U;
+   hmsc->cbw.dDataLength = MSC_UAS_DataLength(pdev, s->lun, s->cdb, &dir_in);
+   hmsc->cbw.bmFlags     = (dir_in != 0U) ? 0x80U : 0x00U;
+   (void)USBD_memcpy(hmsc->cbw.CB, s->cdb, sizeof(s->cdb));
+
+   hmsc->csw.dTag         = s->tag;
+   hmsc->csw.dDataResidue = hmsc->cbw.dDataLength;
+   hmsc->bot_state        = USBD_BOT_IDLE;
+   hmsc->bot_status       = USBD_BOT_STATUS_NORMAL;
+
+   s->state         = MSC_UAS_SLOT_ACTIVE;
+   hmsc->uas.active = idx;
+
+   if (SCSI_ProcessCmd(pdev, s->lun, &hmsc->cbw.CB[0]) != 0) {
+      MSC_UAS_Complete(pdev, USBD_CSW_CMD_FAILED);
+      return;
+   }
+
+   switch (hmsc->bot_state) {
+      case USBD_BOT_DATA_IN:
+      case USBD_BOT_LAST_DATA_IN:
+         MSC_UAS_Ready(pdev, idx, MSC_UAS_IU_READ_READY);
+         break;
+
+      case USBD_BOT_DATA_OUT:
+         MSC_UAS_Ready(pdev, idx, MSC_UAS_IU_WRITE_READY);
+         break;
+
+      default:
+         length = MIN(hmsc->cbw.dDataLength, hmsc->bot_data_length);
+         if (length == 0U) {
+            MSC_UAS_Complete(pdev, USBD_CSW_CMD_PASSED);
+            break;
+         }
+
+         hmsc->csw.dDataResidue -= length;
+         hmsc->bot_state = USBD_BOT_SEND_DATA;
+         (void)USBD_LL_Transmit(pdev, MSCInEpAdd, hmsc->bot_data, length);
+         MSC_UAS_Ready(pdev, idx, MSC_UAS_IU_READ_READY);
+         break;
+   }
+}
+
+#endif /* MSC_UAS_ENABLE */
+
+// end file usbd_msc_uas.c
@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file usbd_msc_uas.h
+ * @brief USB Attached SCSI (UAS) on alternate setting 1 of the MSC interface
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ */
+
+#ifndef USBD_MSC_UAS_H
+#define USBD_MSC_UAS_H
+
+#include "usbd_core.h"
+
+#ifndef MSC_UAS_ENABLE
+#define MSC_UAS_ENABLE 0U
+#endif /* MSC_UAS_ENABLE */
+
+/* Commands accepted before the command pipe is NAKed */
+#ifndef MSC_UAS_QUEUE_DEPTH
+#define MSC_UAS_QUEUE_DEPTH 4U
+#endif /* MSC_UAS_QUEUE_DEPTH */
+
+#define MSC_UAS_ALT 1U
+
+#ifndef MSC_UAS_STATUS_EP
+#define MSC_UAS_STATUS_EP 0x82U
+#endif /* MSC_UAS_STATUS_EP */
+
+#ifndef MSC_UAS_CMD_EP
+#define MSC_UAS_CMD_EP 0x02U
+#endif /* MSC_UAS_CMD_EP */
+
+/* Pipe IDs of the pipe usage descriptors */
+#define MSC_UAS_PIPE_CMD      1U
+#define MSC_UAS_PIPE_STATUS   2U
+#define MSC_UAS_PIPE_DATA_IN  3U
+#define MSC_UAS_PIPE_DATA_OUT 4U
+
+/* Information unit IDs */
+#define MSC_UAS_IU_COMMAND     0x01U
+#define MSC_UAS_IU_SENSE       0x03U
+#define MSC_UAS_IU_RESPONSE    0x04U
+#define MSC_UAS_IU_TASK_MGMT   0x05U
+#define MSC_UAS_IU_READ_READY  0x06U
+#define MSC_UAS_IU_WRITE_READY 0x07U
+
+#define MSC_UAS_CMD_IU_LEN  32U
+#define MSC_UAS_SENSE_LEN   18U
+#define MSC_UAS_STATUS_LEN  (16U + MSC_UAS_SENSE_LEN)
+#define MSC_UAS_RX_LEN      64U
+
+/* Command slot states */
+#define MSC_UAS_SLOT_FREE   0U
+#define MSC_UAS_SLOT_QUEUED 1U /* waiting for the data pipes */
+#define MSC_UAS_SLOT_ACTIVE 2U /* owns the data pipes */
+#define MSC_UAS_SLOT_STATUS 3U /* status IU built, waiting to be sent */
+
+#define MSC_UAS_TX_READY 0x80U
+
+typedef struct {
+   uint8_t state;
+   uint8_t lun;
+   uint16_t tag;
+   uint32_t seq; /* arrival order */
+   uint8_t cdb[16];
+   uint32_t ready;                                  /* READ/WRITE READY IU */
+   uint32_t status[(MSC_UAS_STATUS_LEN + 3U) / 4U]; /* Sense or Response IU */
+   uint16_t status_len;
+} USBD_MSC_UAS_SlotTypeDef;
+
+typedef struct {
+   USBD_MSC_UAS_SlotTypeDef slot[MSC_UAS_QUEUE_DEPTH];
+   uint32_t rx[MSC_UAS_RX_LEN / 4U]; /* command pipe buffer */
+   uint32_t seq;
+   uint8_t rx_armed;
+   uint8_t active; /* slot owning the data pipes, or MSC_UAS_QUEUE_DEPTH */
+
+   /* status pipe: IUs in the order they are to be sent, as slot numbers
+    * with MSC_UAS_TX_READY set for the READY IU of that slot */
+   uint8_t tx_fifo[2U * MSC_UAS_QUEUE_DEPTH];
+   uint8_t tx_head;
+   uint8_t tx_count;
+   uint8_t tx_busy;
+
+   uint32_t cmds;      /* commands received */
+   uint8_t max_queued; /* most commands queued at once */
+} USBD_MSC_UAS_HandleTypeDef;
+
+void MSC_UAS_Init(USBD_HandleTypeDef *pdev);
+void MSC_UAS_DeInit(USBD_HandleTypeDef *pdev);
+void MSC_UAS_CmdOut(USBD_HandleTypeDef *pdev);
+void MSC_UAS_StatusIn(USBD_HandleTypeDef *pdev);
+void MSC_UAS_Complete(USBD_HandleTypeDef *pdev, uint8_t CSW_Status);
+void MSC_UAS_Schedule(USBD_HandleTypeDef *pdev);
+
+#endif // USBD_MSC_UAS_H
+
+// end file usbd_msc_uas.h
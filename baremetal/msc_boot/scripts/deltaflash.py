@@ -0,0 +1,145 @@
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright (c) 2025 Stanford Research Systems, Inc.
+
+# Write a disk image to the msc_boot SD card LUN, skipping the parts that are
+# already correct: the vendor READ HASH command returns the CRC-32 of each
+# 64 kB extent of the card, which is compared with the same hash of the
+# image, and only the extents that differ are written through the block
+# device. The card is read at its own speed inside the device; only four
+# bytes per extent cross the USB.
+#
+# Linux only (SG_IO); needs write access to the device node, e.g. /dev/sdX.
+
+import os
+import sys
+import time
+import zlib
+import struct
+import argparse
+
+from lz4flash import ScsiDevice, BLK_SIZE, SCSI_SYNCHRONIZE_CACHE10
+
+SCSI_READ_HASH = 0xC1
+
+EXTENT_BLKS = 128    # 64 kB, the device default
+EXTENTS_PER_CMD = 256  # 16 MB of card per command; the device takes 4096
+
+
+def cdb_read_hash(lba, extents, extent_blks):
+    return struct.pack(">BBIIH2x", SCSI_READ_HASH, 0, lba, extents,
+                       extent_blks)
+
+
+def read_hashes(dev, lba, extents, extent_blks):
+    data = dev.command(cdb_read_hash(lba, extents, extent_blks),
+                       read_len=4 * extents)
+    if len(data) != 4 * extents:
+        raise IOError("READ HASH returned %d bytes, expected %d"
+                      % (len(data), 4 * extents))
+    return struct.unpack(">%dI" % extents, data)
+
+
+def image_extents(f, size, extent):
+    """Yield (offset, data) for each extent, the last one padded to a
+    whole block with zeros."""
+    off = 0
+    while off < size:
+        data = f.read(extent)
+        if len(data) % BLK_SIZE:
+            data += bytes(BLK_SIZE - len(data) % BLK_SIZE)
+        yield off, data
+        off += len(data)
+
+
+def diff(dev, f, size, lba, extent_blks, per_cmd):
+    """Compare the image with the card; yield the differing extents as
+    (offset, data)."""
+    extent = extent_blks * BLK_SIZE
+    batch = []
+
+    def flush():
+        # one READ HASH per batch of whole extents, and one per short tail
+        full = [e for e in batch if len(e[1]) == extent]
+        groups = [(full, extent_blks)] if full else []
+        groups += [([e], len(e[1]) // BLK_SIZE)
+                   for e in batch if len(e[1]) != extent]
+        for group, blks in groups:
+            hashes = read_hashes(dev, lba + group[0][0] // BLK_SIZE,
+                                 len(group), blks)
+            for (off, data), h in zip(group, hashes):
+                if zlib.crc32(data) != h:
+                    yield off, data
+
+    for off, data in image_extents(f, size, extent):
+        batch.append((off, data))
+        if len(batch) == per_cmd:
+            yield from flush()
+            batch = []
+    yield from flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Write only the parts of a disk image that differ")
+    parser.add_argument("image", help="raw disk image")
+    parser.add_argument("device",
+                        help="block device of the SD card LUN, e.g. /dev/sdb")
+    parser.add_argument("-l", "--lba", type=int, default=0,
+                        help="first block on the device (default 0)")
+    parser.add_argument("-e", "--extent", type=int, default=EXTENT_BLKS,
+                        help="blocks per hashed extent (default %d)"
+                        % EXTENT_BLKS)
+    parser.add_argument("-n", "--dry-run", action="store_true",
+                        help="only report what differs")
+    parser.add_argument("--verify", action="store_true",
+                        help="compare the hashes again after writing")
+    args = parser.parse_args()
+
+    if not 0 < args.extent <= 0xFFFF:
+        parser.error("--extent must be 1 to 65535 blocks")
+
+    size = os.path.getsize(args.image)
+    dev = ScsiDevice(args.device)
+    bdev = None if args.dry_run else os.open(args.device, os.O_WRONLY)
+    t0 = time.monotonic()
+
+    extents = 0
+    written = 0
+    with open(args.image, "rb") as f:
+        for off, data in diff(dev, f, size, args.lba, args.extent,
+                              EXTENTS_PER_CMD):
+            if bdev is not None:
+                os.pwrite(bdev, data, args.lba * BLK_SIZE + off)
+            extents += 1
+            written += len(data)
+            sys.stdout.write("\r%d differing extents, %d MB"
+                             % (extents, written >> 20))
+            sys.stdout.flush()
+
+    # push the writes out of the page cache and then out of the device
+    if bdev is not None:
+        os.fsync(bdev)
+        os.close(bdev)
+        dev.command(struct.pack(">BBIBHB", SCSI_SYNCHRONIZE_CACHE10,
+                                0, 0, 0, 0, 0))
+
+    dt = max(time.monotonic() - t0, 1e-9)
+    total = (size + args.extent * BLK_SIZE - 1) // (args.extent * BLK_SIZE)
+    print("\r%d of %d extents differ: %s %.1f of %.1f MB in %.2f s "
+          "(%.1f MB/s effective)"
+          % (extents, total, "would write" if args.dry_run else "wrote",
+             written / 1e6, size / 1e6, dt, size / dt / 1e6))
+
+    if args.verify and not args.dry_run:
+        with open(args.image, "rb") as f:
+            bad = sum(1 for _ in diff(dev, f, size, args.lba, args.extent,
+                                      EXTENTS_PER_CMD))
+        print("verify: %s" % ("ok" if bad == 0 else "%d extents differ" % bad))
+        if bad:
+            sys.exit(1)
+
+    dev.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,264 @@
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright (c) 2025 Stanford Research Systems, Inc.
+
+# Write a disk image to the msc_boot SD card LUN using the vendor WRITE LZ4
+# command: each chunk of the image is sent as one LZ4 block, which the
+# device decompresses in DDR and writes to the card. Long runs of zeros (or
+# any repeated byte) shrink to almost nothing on the wire. Chunks that do not
+# compress are sent with plain WRITE(10).
+#
+# Uses the lz4 module when installed; otherwise a built-in encoder that only
+# compresses runs of a repeated byte, 512 bytes at a time, which is where
+# most of the gain is for mostly-empty images.
+#
+# Linux only (SG_IO); needs write access to the device node, e.g. /dev/sdX.
+
+import os
+import sys
+import time
+import fcntl
+import ctypes
+import struct
+import argparse
+
+BLK_SIZE = 512
+SCSI_WRITE10 = 0x2A
+SCSI_SYNCHRONIZE_CACHE10 = 0x35
+SCSI_WRITE_LZ4 = 0xC0
+
+# the device stages the decompressed chunk and the compressed data in 8 MB
+MAX_CHUNK = 4 << 20
+
+SG_IO = 0x2285
+SG_DXFER_NONE = -1
+SG_DXFER_TO_DEV = -2
+SG_DXFER_FROM_DEV = -3
+
+try:
+    import lz4.block as lz4_block
+except ImportError:
+    lz4_block = None
+
+
+def _ext_len(out, n):
+    out += b"\xff" * (n // 255)
+    out.append(n % 255)
+
+
+def _sequence(out, lits, match_len):
+    """One LZ4 sequence: literals, then match_len bytes at offset 1."""
+    ml = match_len - 4
+    out.append((min(len(lits), 15) << 4) | min(ml, 15))
+    if len(lits) >= 15:
+        _ext_len(out, len(lits) - 15)
+    out += lits
+    out += b"\x01\x00"
+    if ml >= 15:
+        _ext_len(out, ml - 15)
+
+
+def compress_runs(data):
+    """LZ4 block that encodes 512-byte runs of one byte value as matches."""
+    out = bytearray()
+    n = len(data)
+    lit_start = 0
+    pos = 0
+
+    while pos < n:
+        blk = data[pos:pos + BLK_SIZE]
+        if len(blk) < BLK_SIZE or blk.count(blk[:1]) != BLK_SIZE:
+            pos += BLK_SIZE
+            continue
+
+        end = pos + BLK_SIZE
+        while end < n and data[end:end + BLK_SIZE] == blk:
+            end += BLK_SIZE
+
+        # the first byte of the run is a literal, the rest copies it; the
+        # format wants the last 5 bytes of a block to be literals
+        match_len = end - pos - 1
+        if end == n:
+            match_len -= 5
+        _sequence(out, data[lit_start:pos + 1], match_len)
+        lit_start = pos + 1 + match_len
+        pos = end
+
+    # the last sequence has literals only
+    lits = data[lit_start:]
+    out.append(min(len(lits), 15) << 4)
+    if len(lits) >= 15:
+        _ext_len(out, len(lits) - 15)
+    out += lits
+    return bytes(out)
+
+
+def compress(data):
+    if lz4_block is not None:
+        return lz4_block.compress(data, store_size=False)
+    return compress_runs(data)
+
+
+def cdb_write_lz4(lba, comp_len, blocks):
+    return struct.pack(">BBIII2x", SCSI_WRITE_LZ4, 0, lba, comp_len, blocks)
+
+
+def cdb_write10(lba, blocks):
+    return struct.pack(">BBIBHB", SCSI_WRITE10, 0, lba, 0, blocks, 0)
+
+
+class SgIoHdr(ctypes.Structure):
+    _fields_ = [
+        ("interface_id", ctypes.c_int),
+        ("dxfer_direction", ctypes.c_int),
+        ("cmd_len", ctypes.c_ubyte),
+        ("mx_sb_len", ctypes.c_ubyte),
+        ("iovec_count", ctypes.c_ushort),
+        ("dxfer_len", ctypes.c_uint),
+        ("dxferp", ctypes.c_void_p),
+        ("cmdp", ctypes.c_void_p),
+        ("sbp", ctypes.c_void_p),
+        ("timeout", ctypes.c_uint),
+        ("flags", ctypes.c_uint),
+        ("pack_id", ctypes.c_int),
+        ("usr_ptr", ctypes.c_void_p),
+        ("status", ctypes.c_ubyte),
+        ("masked_status", ctypes.c_ubyte),
+        ("msg_status", ctypes.c_ubyte),
+        ("sb_len_wr", ctypes.c_ubyte),
+        ("host_status", ctypes.c_ushort),
+        ("driver_status", ctypes.c_ushort),
+        ("resid", ctypes.c_int),
+        ("duration", ctypes.c_uint),
+        ("info", ctypes.c_uint),
+    ]
+
+
+class ScsiDevice:
+    def __init__(self, path, timeout_ms=60000):
+        self.fd = os.open(path, os.O_RDWR)
+        self.timeout_ms = timeout_ms
+
+    def close(self):
+        os.close(self.fd)
+
+    def command(self, cdb, data=b"", read_len=0):
+        """Run one command; sends data, or returns read_len bytes read."""
+        cdb_buf = ctypes.create_string_buffer(bytes(cdb), len(cdb))
+        sense = ctypes.create_string_buffer(32)
+        if read_len:
+            data_buf = ctypes.create_string_buffer(read_len)
+            direction = SG_DXFER_FROM_DEV
+        else:
+            data_buf = ctypes.create_string_buffer(bytes(data), len(data))
+            direction = SG_DXFER_TO_DEV if data else SG_DXFER_NONE
+
+        hdr = SgIoHdr()
+        hdr.interface_id = ord("S")
+        hdr.dxfer_direction = direction
+        hdr.cmd_len = len(cdb)
+        hdr.mx_sb_len = len(sense)
+        hdr.dxfer_len = len(data_buf) if (data or read_len) else 0
+        hdr.dxferp = ctypes.addressof(data_buf) if (data or read_len) else None
+        hdr.cmdp = ctypes.addressof(cdb_buf)
+        hdr.sbp = ctypes.addressof(sense)
+        hdr.timeout = self.timeout_ms
+
+        fcntl.ioctl(self.fd, SG_IO, hdr)
+        if hdr.status or hdr.host_status or hdr.driver_status:
+            key = sense.raw[2] & 0x0F if hdr.sb_len_wr > 2 else 0
+            asc = sense.raw[12] if hdr.sb_len_wr > 12 else 0
+            raise IOError("opcode 0x%02x failed: status 0x%02x, host 0x%x, "
+                          "driver 0x%x, sense key %d, ASC 0x%02x"
+                          % (cdb[0], hdr.status, hdr.host_status,
+                             hdr.driver_status, key, asc))
+        return data_buf.raw[:read_len - hdr.resid] if read_len else b""
+
+
+def max_transfer(path):
+    """Largest single transfer the kernel allows for the device, in bytes."""
+    name = os.path.basename(os.path.realpath(path))
+    try:
+        with open("/sys/block/%s/queue/max_sectors_kb" % name) as f:
+            return int(f.read()) * 1024
+    except (OSError, ValueError):
+        return 120 * 1024
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Write a disk image through the WRITE LZ4 command")
+    parser.add_argument("image", help="raw disk image")
+    parser.add_argument("device", nargs="?",
+                        help="block device of the SD card LUN, e.g. /dev/sdb;"
+                        " omit to only report the compression")
+    parser.add_argument("-l", "--lba", type=int, default=0,
+                        help="first block on the device (default 0)")
+    parser.add_argument("-c", "--chunk", type=int, default=MAX_CHUNK,
+                        help="image bytes per command (default %d)"
+                        % MAX_CHUNK)
+    parser.add_argument("-x", "--max-xfer", type=int,
+                        help="largest transfer in bytes (default: from sysfs)")
+    args = parser.parse_args()
+
+    if args.chunk <= 0 or args.chunk % BLK_SIZE or args.chunk > MAX_CHUNK:
+        parser.error("--chunk must be a multiple of %d up to %d"
+                     % (BLK_SIZE, MAX_CHUNK))
+
+    dev = ScsiDevice(args.device) if args.device else None
+    max_xfer = args.max_xfer
+    if max_xfer is None:
+        max_xfer = max_transfer(args.device) if args.device else MAX_CHUNK
+    max_xfer -= max_xfer % BLK_SIZE
+
+    raw_bytes = 0
+    wire_bytes = 0
+    lz4_cmds = 0
+    plain_cmds = 0
+    lba = args.lba
+    t0 = time.monotonic()
+
+    with open(args.image, "rb") as f:
+        while True:
+            chunk = f.read(args.chunk)
+            if not chunk:
+                break
+            if len(chunk) % BLK_SIZE:
+                chunk += bytes(BLK_SIZE - len(chunk) % BLK_SIZE)
+            blocks = len(chunk) // BLK_SIZE
+
+            comp = compress(chunk)
+            if len(comp) < len(chunk) and len(comp) <= max_xfer:
+                if dev:
+                    dev.command(cdb_write_lz4(lba, len(comp), blocks), comp)
+                wire_bytes += len(comp)
+                lz4_cmds += 1
+            else:
+                for off in range(0, len(chunk), max_xfer):
+                    part = chunk[off:off + max_xfer]
+                    if dev:
+                        dev.command(cdb_write10(lba + off // BLK_SIZE,
+                                                len(part) // BLK_SIZE), part)
+                    plain_cmds += 1
+                wire_bytes += len(chunk)
+
+            raw_bytes += len(chunk)
+            lba += blocks
+            sys.stdout.write("\r%d MB" % (raw_bytes >> 20))
+            sys.stdout.flush()
+
+    if dev:
+        dev.command(struct.pack(">BBIBHB", SCSI_SYNCHRONIZE_CACHE10,
+                                0, 0, 0, 0, 0))
+        dev.close()
+
+    dt = max(time.monotonic() - t0, 1e-9)
+    print("\r%.1f MB image sent as %.1f MB (%.1f%%) in %d WRITE LZ4 and %d "
+          "WRITE(10) commands" % (raw_bytes / 1e6, wire_bytes / 1e6,
+                                  100.0 * wire_bytes / max(raw_bytes, 1),
+                                  lz4_cmds, plain_cmds))
+    print("%.2f s: %.1f MB/s effective, %.1f MB/s on the wire"
+          % (dt, raw_bytes / dt / 1e6, wire_bytes / dt / 1e6))
+
+
+if __name__ == "__main__":
+    main()
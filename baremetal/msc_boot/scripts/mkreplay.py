@@ -0,0 +1,138 @@
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright (c) 2025 Stanford Research Systems, Inc.
+
+# Write a Bulk-Only Transport trace for host/replay.c: the bytes a host
+# sends on the bulk OUT endpoint, i.e. each CBW followed by the data of
+# host-to-device commands.
+
+import random
+import struct
+import argparse
+
+from lz4flash import compress, cdb_write_lz4
+from deltaflash import cdb_read_hash
+from verify import cdb_read_digest
+
+BLK_SIZE = 512
+
+
+class Trace:
+    def __init__(self, f):
+        self.f = f
+        self.tag = 1
+
+    def cbw(self, cdb, length, data_in, data=b""):
+        self.f.write(struct.pack("<IIIBBB16s", 0x43425355, self.tag, length,
+                                 0x80 if data_in else 0x00, 0, len(cdb),
+                                 bytes(cdb)))
+        self.f.write(data)
+        self.tag += 1
+
+    def enumerate(self):
+        self.cbw([0x12, 0, 0, 0, 36, 0], 36, True)         # INQUIRY
+        self.cbw([0x00, 0, 0, 0, 0, 0], 0, False)          # TEST UNIT READY
+        self.cbw([0x25] + [0] * 9, 8, True)                # READ CAPACITY(10)
+        self.cbw([0x1A, 0, 0x3F, 0, 192, 0], 192, True)    # MODE SENSE(6)
+        self.cbw([0x03, 0, 0, 0, 18, 0], 18, True)         # REQUEST SENSE
+
+    def read(self, lba, blocks):
+        self.cbw([0x28, 0, *lba.to_bytes(4, "big"), 0,
+                  *blocks.to_bytes(2, "big"), 0], blocks * BLK_SIZE, True)
+
+    def write(self, lba, blocks):
+        data = b"".join(struct.pack("<I", lba + i) * (BLK_SIZE // 4)
+                        for i in range(blocks))
+        self.cbw([0x2A, 0, *lba.to_bytes(4, "big"), 0,
+                  *blocks.to_bytes(2, "big"), 0], len(data), False, data)
+
+    def write_lz4(self, lba, blocks):
+        # stamped blocks in the first half, zeros in the second
+        half = blocks // 2
+        data = b"".join(struct.pack("<I", lba + i) * (BLK_SIZE // 4)
+                        for i in range(half))
+        data += bytes((blocks - half) * BLK_SIZE)
+        comp = compress(data)
+        self.cbw(cdb_write_lz4(lba, len(comp), blocks), len(comp), False,
+                 comp)
+
+    def read_hash(self, lba, extents, extent_blks):
+        self.cbw(cdb_read_hash(lba, extents, extent_blks), 4 * extents, True)
+
+    def read_digest(self, lba, blocks, sha256):
+        self.cbw(cdb_read_digest(1 if sha256 else 0, lba, blocks),
+                 32 if sha256 else 4, True)
+
+    def unmap(self, lba, blocks):
+        # one block descriptor
+        data = struct.pack(">HH4xQI4x", 22, 16, lba, blocks)
+        self.cbw([0x42, 0, 0, 0, 0, 0, 0, 0, len(data), 0], len(data), False,
+                 data)                                 # UNMAP
+
+    def write_same_zero(self, lba, blocks):
+        self.cbw(struct.pack(">BBQIBB", 0x93, 0x08, lba, blocks, 0, 0),
+                 BLK_SIZE, False, bytes(BLK_SIZE))     # WRITE SAME(16)
+
+    def sync(self):
+        self.cbw([0x35] + [0] * 9, 0, False)               # SYNCHRONIZE CACHE
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate a BOT replay trace")
+    parser.add_argument("-o", "--output", required=True, help="trace file")
+    parser.add_argument("-p", "--pattern", default="seq-read",
+                        choices=["seq-read", "seq-write", "rand-read",
+                                 "rand-write", "mixed", "lz4-write",
+                                 "hash", "digest", "unmap"])
+    parser.add_argument("-b", "--blocks", type=int, required=True,
+                        help="size of the image in 512-byte blocks")
+    parser.add_argument("-x", "--xfer", type=int, default=256,
+                        help="blocks per READ/WRITE (default 256)")
+    parser.add_argument("-c", "--count", type=int, default=64,
+                        help="READ/WRITE commands (default 64)")
+    parser.add_argument("-s", "--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    if not 0 < args.xfer <= min(args.blocks, 0xFFFF):
+        parser.error("--xfer must fit the image and a READ(10)")
+
+    rnd = random.Random(args.seed)
+    slots = args.blocks // args.xfer
+
+    with open(args.output, "wb") as f:
+        t = Trace(f)
+        t.enumerate()
+        for i in range(args.count):
+            if args.pattern.startswith("seq"):
+                lba = (i % slots) * args.xfer
+            else:
+                lba = rnd.randrange(slots) * args.xfer
+
+            if args.pattern == "lz4-write":
+                t.write_lz4(lba, args.xfer)
+            elif args.pattern == "hash":
+                # 4 kB extents, so each command covers the same range as
+                # a READ
+                t.read_hash(lba, args.xfer // 8, 8)
+            elif args.pattern == "digest":
+                t.read_digest(lba, args.xfer, i % 2 == 1)
+            elif args.pattern == "unmap":
+                # write, then discard it one way or the other
+                t.write(lba, args.xfer)
+                if i % 2:
+                    t.write_same_zero(lba, args.xfer)
+                else:
+                    t.unmap(lba, args.xfer)
+            elif args.pattern.endswith("read"):
+                t.read(lba, args.xfer)
+            elif args.pattern.endswith("write"):
+                t.write(lba, args.xfer)
+            elif rnd.random() < 0.5:
+                t.read(lba, args.xfer)
+            else:
+                t.write(lba, args.xfer)
+        if args.pattern not in ("seq-read", "rand-read", "hash", "digest"):
+            t.sync()
+
+
+if __name__ == "__main__":
+    main()
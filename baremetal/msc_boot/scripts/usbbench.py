@@ -0,0 +1,138 @@
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright (c) 2025 Stanford Research Systems, Inc.
+
+# Measure raw USB bulk throughput against the msc_boot benchmark class (built
+# with make BENCH=1): bulk IN from the device (source), bulk OUT to it
+# (sink), and OUT followed by IN of the same data (loopback), each for a
+# range of transfer sizes. Next to the host's view, the device's own
+# counters are read back with a vendor request: the rate over the last
+# second and the time from arming a transfer to its completion.
+#
+# Needs pyusb (pip install pyusb) and access to the device, e.g. sudo.
+
+import sys
+import time
+import struct
+import argparse
+
+try:
+    import usb.core
+    import usb.util
+except ImportError:
+    sys.exit("usbbench.py needs pyusb (pip install pyusb)")
+
+VID = 0x0483
+PID = 0x571D
+
+EP_IN = 0x81
+EP_OUT = 0x01
+
+REQ_SET_MODE = 0x01
+REQ_GET_STATS = 0x02
+
+MODES = {"source": 1, "sink": 2, "loopback": 3}
+MAX_XFER = 0x40000
+
+# USBD_BENCH_StatsTypeDef
+STATS = struct.Struct("<IIIIQIIQ")
+
+
+def pattern(size):
+    # the device fills its source buffer with i % 63
+    return bytes(i % 63 for i in range(size))
+
+
+class Bench:
+    def __init__(self, vid, pid, timeout_ms):
+        self.dev = usb.core.find(idVendor=vid, idProduct=pid)
+        if self.dev is None:
+            sys.exit("no device %04x:%04x; is it running a BENCH=1 build?" %
+                     (vid, pid))
+        self.timeout = timeout_ms
+        self.reset()
+
+    def reset(self):
+        # a bus reset drops whatever the last test left in flight
+        self.dev.reset()
+        self.dev.set_configuration()
+
+    def set_mode(self, mode, size):
+        self.dev.ctrl_transfer(0x40, REQ_SET_MODE, mode, 0,
+                               struct.pack("<I", size), self.timeout)
+
+    def stats(self):
+        data = bytes(self.dev.ctrl_transfer(0xC0, REQ_GET_STATS, 0, 0,
+                                            STATS.size, self.timeout))
+        (mode, size, xfers, rate, nbytes, lat_min, lat_max,
+         lat_sum) = STATS.unpack(data)
+        return {"xfers": xfers, "rate": rate, "bytes": nbytes,
+                "lat_min": lat_min if xfers else 0, "lat_max": lat_max,
+                "lat_avg": lat_sum // xfers if xfers else 0}
+
+    def run(self, mode, size, seconds):
+        self.reset()
+        self.set_mode(MODES[mode], size)
+
+        out = pattern(size)
+        ok = True
+        n = 0
+        t0 = time.monotonic()
+        while time.monotonic() - t0 < seconds:
+            if mode == "source":
+                data = self.dev.read(EP_IN, size, self.timeout)
+                if n == 0 and bytes(data) != out:
+                    ok = False
+            elif mode == "sink":
+                self.dev.write(EP_OUT, out, self.timeout)
+            else:
+                self.dev.write(EP_OUT, out, self.timeout)
+                data = self.dev.read(EP_IN, size, self.timeout)
+                if bytes(data) != out:
+                    ok = False
+            n += 1
+        dt = time.monotonic() - t0
+
+        st = self.stats()
+        self.set_mode(0, size)
+
+        # loopback moves every byte both ways
+        moved = n * size * (2 if mode == "loopback" else 1)
+        return moved / dt, st, ok
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="USB bulk throughput against the benchmark class")
+    parser.add_argument("-m", "--mode", action="append",
+                        choices=sorted(MODES),
+                        help="mode to run, repeatable (default: all)")
+    parser.add_argument("-s", "--size", type=int, action="append",
+                        help="bytes per transfer, repeatable "
+                             "(default: 512 to 256k)")
+    parser.add_argument("-t", "--time", type=float, default=2.0,
+                        help="seconds per test (default 2)")
+    parser.add_argument("--vid", type=lambda x: int(x, 16), default=VID)
+    parser.add_argument("--pid", type=lambda x: int(x, 16), default=PID)
+    args = parser.parse_args()
+
+    modes = args.mode or ["source", "sink", "loopback"]
+    sizes = args.size or [512, 4096, 16384, 65536, MAX_XFER]
+    for s in sizes:
+        if not 0 < s <= MAX_XFER:
+            parser.error("--size must be 1 to %d" % MAX_XFER)
+
+    bench = Bench(args.vid, args.pid, timeout_ms=5000)
+
+    print("%-8s %8s %10s %10s %8s %8s %8s  %s" %
+          ("mode", "size", "host MB/s", "dev MB/s", "lat min", "avg", "max",
+           "data"))
+    for mode in modes:
+        for size in sizes:
+            rate, st, ok = bench.run(mode, size, args.time)
+            print("%-8s %8d %10.2f %10.2f %8d %8d %8d  %s" %
+                  (mode, size, rate / 1e6, st["rate"] / 1e6, st["lat_min"],
+                   st["lat_avg"], st["lat_max"], "ok" if ok else "BAD"))
+
+
+if __name__ == "__main__":
+    main()
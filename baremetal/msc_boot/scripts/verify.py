@@ -0,0 +1,93 @@
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright (c) 2025 Stanford Research Systems, Inc.
+
+# Verify that the msc_boot SD card LUN holds a disk image without reading it
+# back: the vendor READ DIGEST command makes the device read a range of the
+# card and return its CRC-32 or SHA-256, which is compared with the same
+# digest of the image. The image is checked in ranges (256 MB by default) so
+# that each command finishes well within the SCSI timeout, and a mismatch
+# is reported by range.
+#
+# Linux only (SG_IO); needs read access to the device node, e.g. /dev/sdX.
+
+import sys
+import time
+import zlib
+import struct
+import hashlib
+import argparse
+
+from lz4flash import ScsiDevice, BLK_SIZE
+
+SCSI_READ_DIGEST = 0xC2
+DIGEST_CRC32 = 0x00
+DIGEST_SHA256 = 0x01
+
+ALGOS = {"crc32": (DIGEST_CRC32, 4), "sha256": (DIGEST_SHA256, 32)}
+
+
+def cdb_read_digest(algo, lba, blocks):
+    return struct.pack(">BBII6x", SCSI_READ_DIGEST, algo, lba, blocks)
+
+
+def digest(algo, data):
+    if algo == DIGEST_SHA256:
+        return hashlib.sha256(data).digest()
+    return struct.pack(">I", zlib.crc32(data))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Verify a disk image on the device with READ DIGEST")
+    parser.add_argument("image", help="raw disk image")
+    parser.add_argument("device",
+                        help="block device of the SD card LUN, e.g. /dev/sdb")
+    parser.add_argument("-l", "--lba", type=int, default=0,
+                        help="first block on the device (default 0)")
+    parser.add_argument("-a", "--algo", choices=sorted(ALGOS),
+                        default="sha256", help="digest (default sha256)")
+    parser.add_argument("-r", "--range", type=int, default=256,
+                        help="MB per command (default 256)")
+    args = parser.parse_args()
+
+    if args.range <= 0:
+        parser.error("--range must be positive")
+
+    algo, size = ALGOS[args.algo]
+    chunk = args.range << 20
+    dev = ScsiDevice(args.device, timeout_ms=600000)
+    t0 = time.monotonic()
+
+    total = 0
+    bad = 0
+    with open(args.image, "rb") as f:
+        while True:
+            data = f.read(chunk)
+            if not data:
+                break
+            if len(data) % BLK_SIZE:
+                data += bytes(BLK_SIZE - len(data) % BLK_SIZE)
+
+            lba = args.lba + total // BLK_SIZE
+            got = dev.command(cdb_read_digest(algo, lba, len(data) // BLK_SIZE),
+                              read_len=size)
+            if got != digest(algo, data):
+                print("\rmismatch in blocks %d to %d" %
+                      (lba, lba + len(data) // BLK_SIZE - 1))
+                bad += 1
+
+            total += len(data)
+            sys.stdout.write("\r%d MB" % (total >> 20))
+            sys.stdout.flush()
+
+    dev.close()
+    dt = max(time.monotonic() - t0, 1e-9)
+    print("\r%.1f MB verified with %s in %.2f s (%.1f MB/s): %s"
+          % (total / 1e6, args.algo, dt, total / dt / 1e6,
+             "ok" if bad == 0 else "%d ranges differ" % bad))
+    if bad:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,672 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file blkcache.c
+ * @brief Write-back block cache in DDR in front of the SD card
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * The card is divided into lines of BLKCACHE_LINE_BLKS blocks; line n can live
+ * in any way of set (n % BLKCACHE_SETS), and the least recently used way is
+ * replaced. Each line keeps a valid and a dirty bit per block, so writes never
+ * need to read the rest of the line first. Dirty blocks are written back when
+ * their line is evicted, when too many lines are dirty, and on
+ * blkcache_flush(); each write-back collects the whole run of dirty blocks
+ * around the one being flushed, across lines, into one multi-block write.
+ *
+ * Write-backs never cross a boundary of the card's allocation unit (AU, from
+ * the SD Status register), and the AU the host is writing into is flushed
+ * last, so a sequential stream reaches the card as whole, aligned AUs, which
+ * the card can program without merging old data. If the card reads erased
+ * blocks as zeros, long runs of zero blocks in a write-back are erased rather
+ * than sent.
+ *
+ * Reads are also watched for a sequential stream. Once one is found, the
+ * window of blocks after it is read from the card in the background into one
+ * of two read-ahead buffers, so the card works while USB sends the previous
+ * data, and the next reads of the stream are copied from DDR. Cached blocks
+ * are patched over read-ahead data the same way as over long reads, and a
+ * write-back to the card drops the windows it overlaps.
+ */
+
+#include "blkcache.h"
+#include "cache.h"
+#include "sd.h"
+#include "stm32mp13xx_hal_sd.h"
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#define LINE_BYTES (BLKCACHE_LINE_BLKS * BLOCKSIZE)
+#define LINE_MASK  ((1U << BLKCACHE_LINE_BLKS) - 1U)
+
+#define AHEAD_BUFS 2U
+
+enum { AHEAD_FREE, AHEAD_BUSY, AHEAD_READY };
+
+struct tag {
+   uint32_t line;  // card address / BLKCACHE_LINE_BLKS
+   uint32_t stamp; // time of last use, for LRU
+   uint8_t valid;  // per block
+   uint8_t dirty;  // per block
+};
+
+struct ahead {
+   uint32_t lba;
+   uint32_t n;
+   uint8_t state;
+};
+
+static struct {
+   uint8_t data[BLKCACHE_WAYS][BLKCACHE_SETS][LINE_BYTES];
+   uint8_t gather[BLKCACHE_GATHER_BLKS * BLOCKSIZE];
+   uint8_t ahead[AHEAD_BUFS][BLKCACHE_AHEAD_MAX * BLOCKSIZE];
+   struct tag tag[BLKCACHE_SETS][BLKCACHE_WAYS];
+} bc __attribute__((section(".blkcache"), aligned(CACHE_LINE)));
+
+static struct blkcache_stats stats;
+static uint32_t lru_clock;
+static uint32_t flush_pos;
+static uint32_t card_blks;
+static uint32_t fill_au;    // AU of the last write
+static uint8_t erased_val; // what the card reads back after an erase
+
+static struct ahead ahead[AHEAD_BUFS];
+static struct {
+   uint32_t pos;  // block after the last one read
+   uint32_t run;  // blocks read in order up to pos, saturating
+   uint32_t next; // first block not read ahead yet
+} stream;
+
+static uint8_t *line_data(const struct tag *t)
+{
+   const uint32_t idx = (uint32_t)(t - &bc.tag[0][0]);
+   return bc.data[idx % BLKCACHE_WAYS][idx / BLKCACHE_WAYS];
+}
+
+static struct tag *lookup(const uint32_t line)
+{
+   struct tag *set = bc.tag[line % BLKCACHE_SETS];
+
+   for (uint32_t w = 0; w < BLKCACHE_WAYS; w++)
+      if ((set[w].valid != 0U) && (set[w].line == line))
+         return &set[w];
+
+   return NULL;
+}
+
+static int is_dirty(const uint32_t lba)
+{
+   const struct tag *t = lookup(lba / BLKCACHE_LINE_BLKS);
+   return (t != NULL) && ((t->dirty >> (lba % BLKCACHE_LINE_BLKS)) & 1U);
+}
+
+static void clear_dirty(struct tag *t, const uint8_t mask)
+{
+   if (t->dirty == 0U)
+      return;
+
+   t->dirty &= (uint8_t)~mask;
+   if (t->dirty == 0U)
+      stats.dirty_lines--;
+}
+
+/**
+ * Copy cached blocks over data read from the card, which can be older.
+ * Returns the number of blocks copied.
+ */
+static uint32_t patch(uint8_t *buf, const uint32_t lba, const uint32_t blk_len)
+{
+   uint32_t n = 0;
+
+   for (uint32_t i = 0; i < blk_len; i++) {
+      const struct tag *t = lookup((lba + i) / BLKCACHE_LINE_BLKS);
+      const uint32_t off  = (lba + i) % BLKCACHE_LINE_BLKS;
+      if ((t != NULL) && ((t->valid >> off) & 1U)) {
+         memcpy(buf + i * BLOCKSIZE, line_data(t) + off * BLOCKSIZE,
+                BLOCKSIZE);
+         n++;
+      }
+   }
+
+   return n;
+}
+
+static void ahead_drop(struct ahead *a)
+{
+   if (a->state == AHEAD_BUSY)
+      sd_read_cancel();
+
+   // blocks the stream had not reached yet were read for nothing
+   if (a->lba + a->n > stream.pos) {
+      const uint32_t from = (a->lba > stream.pos) ? a->lba : stream.pos;
+      stats.ahead_wasted += a->lba + a->n - from;
+      if (stats.ahead_window > BLKCACHE_AHEAD_MIN)
+         stats.ahead_window /= 2U;
+   }
+
+   a->state = AHEAD_FREE;
+}
+
+static void ahead_drop_range(const uint32_t lba, const uint32_t blk_len)
+{
+   for (uint32_t i = 0; i < AHEAD_BUFS; i++) {
+      struct ahead *a = &ahead[i];
+      if ((a->state != AHEAD_FREE) && (lba < a->lba + a->n) &&
+          (a->lba < lba + blk_len))
+         ahead_drop(a);
+   }
+}
+
+/**
+ * Start reading the next window of the stream, if a buffer is free and the
+ * card is not already busy with one.
+ */
+static void ahead_issue(void)
+{
+   struct ahead *a = NULL;
+
+   if ((stream.run < BLKCACHE_AHEAD_TRIGGER) || (stream.next >= card_blks))
+      return;
+
+   for (uint32_t i = 0; i < AHEAD_BUFS; i++) {
+      if (ahead[i].state == AHEAD_BUSY)
+         return;
+      if (ahead[i].state == AHEAD_FREE)
+         a = &ahead[i];
+   }
+   if (a == NULL)
+      return;
+
+   uint32_t n = stats.ahead_window;
+   if (n > card_blks - stream.next)
+      n = card_blks - stream.next;
+
+   if (sd_read_start(bc.ahead[a - ahead], stream.next, n) != 0)
+      return;
+
+   a->lba   = stream.next;
+   a->n     = n;
+   a->state = AHEAD_BUSY;
+   stream.next += n;
+}
+
+/**
+ * Note a finished read-ahead without waiting for one, and start the next.
+ */
+static void ahead_poll(void)
+{
+   for (uint32_t i = 0; i < AHEAD_BUFS; i++) {
+      if (ahead[i].state != AHEAD_BUSY)
+         continue;
+
+      const int ret = sd_read_done();
+      if (ret == 0)
+         return;
+      ahead[i].state = (ret > 0) ? AHEAD_READY : AHEAD_FREE;
+   }
+
+   ahead_issue();
+}
+
+/**
+ * Copy blocks from the read-ahead windows, waiting for one that is still
+ * arriving. Fails unless the windows hold all of the blocks.
+ */
+static int ahead_read(uint8_t *buf, uint32_t lba, uint32_t blk_len)
+{
+   while (blk_len > 0U) {
+      struct ahead *a = NULL;
+      for (uint32_t i = 0; i < AHEAD_BUFS; i++)
+         if ((ahead[i].state != AHEAD_FREE) && (lba >= ahead[i].lba) &&
+             (lba - ahead[i].lba < ahead[i].n))
+            a = &ahead[i];
+      if (a == NULL)
+         return -1;
+
+      if (a->state == AHEAD_BUSY) {
+         stats.ahead_waits++;
+         if (sd_read_wait() != 0) {
+            a->state = AHEAD_FREE;
+            return -1;
+         }
+         a->state = AHEAD_READY;
+      }
+
+      uint32_t n = a->lba + a->n - lba;
+      if (n > blk_len)
+         n = blk_len;
+
+      memcpy(buf, bc.ahead[a - ahead] + (lba - a->lba) * BLOCKSIZE,
+             n * BLOCKSIZE);
+
+      buf += n * BLOCKSIZE;
+      lba += n;
+      blk_len -= n;
+   }
+
+   return 0;
+}
+
+/**
+ * Follow the stream after a read: a jump drops the windows, and a window the
+ * stream has gone past is used up, which makes the next one larger.
+ */
+static void ahead_track(const uint32_t lba, const uint32_t blk_len,
+                        const int hit)
+{
+   if (lba != stream.pos) {
+      for (uint32_t i = 0; i < AHEAD_BUFS; i++)
+         if (ahead[i].state != AHEAD_FREE)
+            ahead_drop(&ahead[i]);
+      stream.run  = 0;
+      stream.next = 0;
+   }
+
+   if (!hit && (stream.run >= BLKCACHE_AHEAD_TRIGGER))
+      stats.ahead_misses += blk_len;
+
+   if (stream.run < BLKCACHE_AHEAD_TRIGGER)
+      stream.run += blk_len;
+   stream.pos = lba + blk_len;
+   if (stream.next < stream.pos)
+      stream.next = stream.pos;
+
+   for (uint32_t i = 0; i < AHEAD_BUFS; i++) {
+      struct ahead *a = &ahead[i];
+      if ((a->state == AHEAD_FREE) || (a->lba + a->n > stream.pos))
+         continue;
+      if ((a->state == AHEAD_READY) &&
+          (stats.ahead_window < BLKCACHE_AHEAD_MAX))
+         stats.ahead_window *= 2U;
+      ahead_drop(a);
+   }
+
+   ahead_issue();
+}
+
+static int is_zero(const uint8_t *blk)
+{
+#ifdef __ARM_NEON
+   uint32x4_t acc = vdupq_n_u32(0U);
+   for (uint32_t i = 0; i < BLOCKSIZE; i += 64U) {
+      acc = vorrq_u32(acc, vld1q_u32((const uint32_t *)(blk + i)));
+      acc = vorrq_u32(acc, vld1q_u32((const uint32_t *)(blk + i + 16U)));
+      acc = vorrq_u32(acc, vld1q_u32((const uint32_t *)(blk + i + 32U)));
+      acc = vorrq_u32(acc, vld1q_u32((const uint32_t *)(blk + i + 48U)));
+   }
+   const uint32x2_t r = vorr_u32(vget_low_u32(acc), vget_high_u32(acc));
+   return (vget_lane_u32(r, 0) | vget_lane_u32(r, 1)) == 0U;
+#else
+   const uint32_t *w = (const uint32_t *)blk;
+   uint32_t acc      = 0;
+   for (uint32_t i = 0; i < BLOCKSIZE / 4U; i++)
+      acc |= w[i];
+   return acc == 0U;
+#endif
+}
+
+static int write_card(const uint32_t start, const uint32_t from,
+                      const uint32_t to)
+{
+   if (to == from)
+      return 0;
+
+   if (sd_write(&bc.gather[from * BLOCKSIZE], start + from, to - from) != 0)
+      return -1;
+
+   stats.flushes++;
+   return 0;
+}
+
+/**
+ * Write n gathered blocks to the card at start, erasing long zero runs
+ * instead when that leaves zeros.
+ */
+static int write_gather(const uint32_t start, const uint32_t n)
+{
+   uint32_t done = 0;
+   uint32_t i    = 0;
+
+   while ((erased_val == 0U) && (i < n)) {
+      if (!is_zero(&bc.gather[i * BLOCKSIZE])) {
+         i++;
+         continue;
+      }
+
+      uint32_t z = i + 1U;
+      while ((z < n) && is_zero(&bc.gather[z * BLOCKSIZE]))
+         z++;
+
+      if (z - i >= BLKCACHE_ZERO_MIN) {
+         if ((write_card(start, done, i) != 0) ||
+             (sd_erase(start + i, z - i) != 0))
+            return -1;
+         stats.erases++;
+         stats.zero_blks += z - i;
+         done = z;
+      }
+      i = z;
+   }
+
+   return write_card(start, done, n);
+}
+
+/**
+ * Write back the dirty run containing the first dirty block of a line,
+ * together with the dirty blocks before and after it in other lines.
+ */
+static int flush_run(const struct tag *t)
+{
+   uint32_t start = t->line * BLKCACHE_LINE_BLKS;
+   while (((t->dirty >> (start % BLKCACHE_LINE_BLKS)) & 1U) == 0U)
+      start++;
+
+   // walk back to the beginning of the run, within the AU
+   const uint32_t au_start = start - start % stats.au_blks;
+   while ((start > au_start) && is_dirty(start - 1U))
+      start--;
+
+   // gather the run into one buffer; an AU fits in it
+   const uint32_t max = au_start + stats.au_blks - start;
+   uint32_t n         = 0;
+   while ((n < max) && is_dirty(start + n)) {
+      const uint32_t lba = start + n;
+      const struct tag *s = lookup(lba / BLKCACHE_LINE_BLKS);
+      memcpy(&bc.gather[n * BLOCKSIZE],
+             line_data(s) + (lba % BLKCACHE_LINE_BLKS) * BLOCKSIZE, BLOCKSIZE);
+      n++;
+   }
+
+   ahead_drop_range(start, n);
+   if (write_gather(start, n) != 0)
+      return -1;
+
+   stats.flush_blks += n;
+
+   for (uint32_t lba = start; lba < start + n; lba++)
+      clear_dirty(lookup(lba / BLKCACHE_LINE_BLKS),
+                  (uint8_t)(1U << (lba % BLKCACHE_LINE_BLKS)));
+
+   return 0;
+}
+
+static int flush_line(const struct tag *t)
+{
+   while (t->dirty != 0U)
+      if (flush_run(t) != 0)
+         return -1;
+
+   return 0;
+}
+
+/**
+ * Write back one dirty line, continuing a round-robin scan of the tags. Lines
+ * in the AU being filled are left for when nothing else is dirty.
+ */
+static int flush_next(void)
+{
+   const uint32_t n = BLKCACHE_SETS * BLKCACHE_WAYS;
+
+   for (uint32_t pass = 0; pass < 2U; pass++) {
+      for (uint32_t i = 0; i < n; i++) {
+         const struct tag *t = &bc.tag[0][0] + (flush_pos + i) % n;
+         if ((t->dirty == 0U) ||
+             ((pass == 0U) &&
+              (t->line * BLKCACHE_LINE_BLKS / stats.au_blks == fill_au)))
+            continue;
+
+         flush_pos = (flush_pos + i + 1U) % n;
+         return flush_line(t);
+      }
+   }
+
+   return 0;
+}
+
+static struct tag *alloc(const uint32_t line)
+{
+   struct tag *set    = bc.tag[line % BLKCACHE_SETS];
+   struct tag *victim = &set[0];
+
+   for (uint32_t w = 0; w < BLKCACHE_WAYS; w++) {
+      if (set[w].valid == 0U) {
+         victim = &set[w];
+         break;
+      }
+      if (set[w].stamp < victim->stamp)
+         victim = &set[w];
+   }
+
+   if (victim->valid != 0U) {
+      if (flush_line(victim) != 0)
+         return NULL;
+      stats.evictions++;
+   }
+
+   victim->line  = line;
+   victim->valid = 0U;
+   victim->dirty = 0U;
+   return victim;
+}
+
+/**
+ * Read the blocks of a line that are not valid yet, one card read per run.
+ */
+static int fill(struct tag *t)
+{
+   const uint32_t base = t->line * BLKCACHE_LINE_BLKS;
+   uint32_t i          = 0;
+
+   while ((i < BLKCACHE_LINE_BLKS) && (base + i < card_blks)) {
+      if ((t->valid >> i) & 1U) {
+         i++;
+         continue;
+      }
+
+      uint32_t n = 1;
+      while ((i + n < BLKCACHE_LINE_BLKS) && (base + i + n < card_blks) &&
+             (((t->valid >> (i + n)) & 1U) == 0U))
+         n++;
+
+      if (sd_read(line_data(t) + i * BLOCKSIZE, base + i, n) != 0)
+         return -1;
+
+      t->valid |= (uint8_t)(((1U << n) - 1U) << i);
+      i += n;
+   }
+
+   return 0;
+}
+
+int blkcache_init(void)
+{
+   uint32_t blk_size;
+
+   memset(bc.tag, 0, sizeof(bc.tag));
+   memset(&stats, 0, sizeof(stats));
+   memset(ahead, 0, sizeof(ahead));
+   memset(&stream, 0, sizeof(stream));
+   lru_clock          = 0;
+   flush_pos          = 0;
+   stats.ahead_window = BLKCACHE_AHEAD_MIN;
+
+   if ((sd_get_capacity(&card_blks, &blk_size) != 0) ||
+       (blk_size != BLOCKSIZE))
+      return -1;
+
+   // without the SCR, assume erased blocks are not zero
+   if (sd_get_erased(&erased_val) != 0)
+      erased_val = 0xFFU;
+
+   // without a usable AU, align to the largest write instead
+   fill_au = UINT32_MAX;
+   if ((sd_get_au(&stats.au_blks) != 0) ||
+       (stats.au_blks > BLKCACHE_GATHER_BLKS) ||
+       (stats.au_blks < BLKCACHE_LINE_BLKS))
+      stats.au_blks = BLKCACHE_GATHER_BLKS;
+
+   return 0;
+}
+
+static int line_read(uint8_t *buf, uint32_t lba, uint32_t blk_len)
+{
+   // long reads: straight from the card, then patch in cached blocks, which
+   // are never older than the card
+   if (blk_len > BLKCACHE_READ_ALLOC_MAX) {
+      if (sd_read(buf, lba, blk_len) != 0)
+         return -1;
+
+      const uint32_t n = patch(buf, lba, blk_len);
+      stats.read_hits += n;
+      stats.read_misses += blk_len - n;
+      return 0;
+   }
+
+   while (blk_len > 0U) {
+      const uint32_t line = lba / BLKCACHE_LINE_BLKS;
+      const uint32_t off  = lba % BLKCACHE_LINE_BLKS;
+      uint32_t n          = BLKCACHE_LINE_BLKS - off;
+      if (n > blk_len)
+         n = blk_len;
+      const uint8_t mask = (uint8_t)(((1U << n) - 1U) << off);
+
+      struct tag *t = lookup(line);
+      if ((t != NULL) && ((t->valid & mask) == mask)) {
+         stats.read_hits += n;
+      } else {
+         if ((t == NULL) && ((t = alloc(line)) == NULL))
+            return -1;
+         if (fill(t) != 0) {
+            return -1;
+         }
+         stats.read_misses += n;
+      }
+
+      memcpy(buf, line_data(t) + off * BLOCKSIZE, n * BLOCKSIZE);
+      t->stamp = ++lru_clock;
+
+      buf += n * BLOCKSIZE;
+      lba += n;
+      blk_len -= n;
+   }
+
+   return 0;
+}
+
+int blkcache_read(uint8_t *buf, uint32_t lba, uint32_t blk_len)
+{
+   int hit = 0;
+
+   ahead_poll();
+   if (ahead_read(buf, lba, blk_len) == 0) {
+      (void)patch(buf, lba, blk_len);
+      stats.ahead_hits += blk_len;
+      hit = 1;
+   } else if (line_read(buf, lba, blk_len) != 0) {
+      return -1;
+   }
+
+   ahead_track(lba, blk_len, hit);
+   return 0;
+}
+
+int blkcache_write(const uint8_t *buf, uint32_t lba, uint32_t blk_len)
+{
+   if (blk_len > 0U)
+      fill_au = (lba + blk_len - 1U) / stats.au_blks;
+
+   while (blk_len > 0U) {
+      const uint32_t line = lba / BLKCACHE_LINE_BLKS;
+      const uint32_t off  = lba % BLKCACHE_LINE_BLKS;
+      uint32_t n          = BLKCACHE_LINE_BLKS - off;
+      if (n > blk_len)
+         n = blk_len;
+      const uint8_t mask = (uint8_t)(((1U << n) - 1U) << off);
+
+      struct tag *t = lookup(line);
+      if (t != NULL) {
+         stats.write_hits += n;
+      } else {
+         if ((t = alloc(line)) == NULL)
+            return -1;
+         stats.write_misses += n;
+      }
+
+      memcpy(line_data(t) + off * BLOCKSIZE, buf, n * BLOCKSIZE);
+      if (t->dirty == 0U)
+         stats.dirty_lines++;
+      t->valid |= mask;
+      t->dirty |= mask;
+      t->stamp = ++lru_clock;
+
+      buf += n * BLOCKSIZE;
+      lba += n;
+      blk_len -= n;
+   }
+
+   while (stats.dirty_lines > BLKCACHE_DIRTY_MAX)
+      if (flush_next() != 0)
+         return -1;
+
+   return 0;
+}
+
+int blkcache_flush(void)
+{
+   while (stats.dirty_lines > 0U)
+      if (flush_next() != 0)
+         return -1;
+
+   return 0;
+}
+
+int blkcache_discard(uint32_t lba, uint32_t blk_len)
+{
+   if (blk_len == 0U)
+      return 0;
+
+   // cached copies of the range go too, dirty or not
+   ahead_drop_range(lba, blk_len);
+   for (uint32_t i = 0; i < BLKCACHE_SETS * BLKCACHE_WAYS; i++) {
+      struct tag *t       = &bc.tag[0][0] + i;
+      const uint32_t base = t->line * BLKCACHE_LINE_BLKS;
+      if ((t->valid == 0U) || (base + BLKCACHE_LINE_BLKS <= lba) ||
+          (base >= lba + blk_len))
+         continue;
+
+      uint8_t mask = 0;
+      for (uint32_t b = 0; b < BLKCACHE_LINE_BLKS; b++)
+         if ((base + b >= lba) && (base + b < lba + blk_len))
+            mask |= (uint8_t)(1U << b);
+
+      clear_dirty(t, mask);
+      t->valid &= (uint8_t)~mask;
+   }
+
+   if (sd_erase(lba, blk_len) != 0)
+      return -1;
+
+   stats.erases++;
+   return 0;
+}
+
+int blkcache_discard_zeroes(void)
+{
+   return erased_val == 0U;
+}
+
+void blkcache_poll(void)
+{
+   ahead_poll();
+}
+
+const struct blkcache_stats *blkcache_get_stats(void)
+{
+   return &stats;
+}
+
+// end file blkcache.c
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file blkcache.h
+ * @brief Write-back block cache in DDR in front of the SD card
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ */
+
+#ifndef BLKCACHE_H
+#define BLKCACHE_H
+
+#include <stdint.h>
+
+// geometry: 4 kB lines, 4-way set associative, 64 MB in total
+#define BLKCACHE_LINE_BLKS 8U
+#define BLKCACHE_WAYS      4U
+#define BLKCACHE_SETS      4096U
+
+// dirty lines allowed before writes start flushing (bounds the flush time
+// on SYNCHRONIZE CACHE or bus reset to about 8 MB of card writes, while
+// leaving room for the allocation unit being filled and a full one)
+#define BLKCACHE_DIRTY_MAX 2048U
+
+// largest coalesced card write, in blocks; also caps the allocation unit
+#define BLKCACHE_GATHER_BLKS 8192U
+
+// when the card erases to zeros, runs of at least this many zero blocks are
+// erased instead of written
+#define BLKCACHE_ZERO_MIN 128U
+
+// longer reads go straight to the card without allocating lines
+#define BLKCACHE_READ_ALLOC_MAX BLKCACHE_LINE_BLKS
+
+// read-ahead: once this many blocks have been read in order, the next window
+// is read from the card in the background, into one of two buffers; the
+// window doubles each time one is used up and halves when one is thrown away
+#define BLKCACHE_AHEAD_TRIGGER 64U
+#define BLKCACHE_AHEAD_MIN     64U
+#define BLKCACHE_AHEAD_MAX     4096U
+
+struct blkcache_stats {
+   uint32_t read_hits;    // blocks
+   uint32_t read_misses;  // blocks
+   uint32_t write_hits;   // blocks
+   uint32_t write_misses; // blocks
+   uint32_t evictions;    // lines
+   uint32_t flushes;      // card write commands
+   uint32_t flush_blks;   // blocks written to the card
+   uint32_t dirty_lines;  // lines currently dirty
+   uint32_t au_blks;      // card writes stay within units of this size
+   uint32_t erases;       // card erase commands
+   uint32_t zero_blks;    // zero blocks erased instead of written
+   uint32_t ahead_hits;   // blocks read from a read-ahead window
+   uint32_t ahead_waits;  // reads that waited for a window to arrive
+   uint32_t ahead_misses; // blocks of sequential reads not read ahead
+   uint32_t ahead_wasted; // blocks read ahead but never used
+   uint32_t ahead_window; // current window, blocks
+};
+
+int blkcache_init(void);
+int blkcache_read(uint8_t *buf, uint32_t lba, uint32_t blk_len);
+int blkcache_write(const uint8_t *buf, uint32_t lba, uint32_t blk_len);
+int blkcache_flush(void);
+int blkcache_discard(uint32_t lba, uint32_t blk_len);
+int blkcache_discard_zeroes(void);
+void blkcache_poll(void);
+const struct blkcache_stats *blkcache_get_stats(void);
+
+#endif // BLKCACHE_H
+
+// end file blkcache.h
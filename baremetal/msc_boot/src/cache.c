@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file cache.c
+ * @brief D-cache maintenance for buffers shared with DMA masters
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ */
+
+#include "cache.h"
+#include "stm32mp13xx.h"
+#include <stdint.h>
+
+extern uint32_t __DMA_NC_START__;
+extern uint32_t __DMA_NC_END__;
+
+int cache_is_coherent(const void *buf, uint32_t len)
+{
+   return ((uint32_t)buf >= (uint32_t)&__DMA_NC_START__) &&
+          ((uint32_t)buf + len <= (uint32_t)&__DMA_NC_END__);
+}
+
+/**
+ * Write a buffer back to memory so that a DMA master reads current data.
+ */
+void cache_clean(const void *buf, uint32_t len)
+{
+   if ((len == 0U) || cache_is_coherent(buf, len))
+      return;
+
+   uint32_t addr = (uint32_t)buf & ~(CACHE_LINE - 1U);
+   while (addr < (uint32_t)buf + len) {
+      L1C_CleanDCacheMVA((void *)addr);
+      addr += CACHE_LINE;
+   }
+   __DSB();
+}
+
+/**
+ * Drop cached copies of a buffer so that reads see what a DMA master wrote.
+ *
+ * Call before starting the transfer and again when it completes, since lines
+ * can be speculatively refilled while the DMA runs. The lines are cleaned as
+ * well, so a buffer that does not start and end on a cache line cannot lose
+ * CPU writes to its neighbours made before the transfer; such neighbours must
+ * not be written while the transfer is in progress.
+ */
+void cache_invalidate(const void *buf, uint32_t len)
+{
+   if ((len == 0U) || cache_is_coherent(buf, len))
+      return;
+
+   uint32_t addr = (uint32_t)buf & ~(CACHE_LINE - 1U);
+   while (addr < (uint32_t)buf + len) {
+      L1C_CleanInvalidateDCacheMVA((void *)addr);
+      addr += CACHE_LINE;
+   }
+   __DSB();
+}
+
+/**
+ * Drop cached copies of a buffer without writing them back, for the end of
+ * a DMA write into it: a clean then could put stale lines over the new data.
+ * The buffer must start on a cache line and own every line up to buf + len.
+ */
+void cache_discard(const void *buf, uint32_t len)
+{
+   if ((len == 0U) || cache_is_coherent(buf, len))
+      return;
+
+   uint32_t addr = (uint32_t)buf & ~(CACHE_LINE - 1U);
+   while (addr < (uint32_t)buf + len) {
+      L1C_InvalidateDCacheMVA((void *)addr);
+      addr += CACHE_LINE;
+   }
+   __DSB();
+}
+
+// end file cache.c
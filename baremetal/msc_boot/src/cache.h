@@ -0,0 +1,28 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file cache.h
+ * @brief D-cache maintenance for buffers shared with DMA masters
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+
+// Cortex-A7 L1 and L2 line size
+#define CACHE_LINE 64U
+
+// buffers that must stay out of the cache (see .dma_nc in the linker script)
+#define DMA_NC __attribute__((section(".dma_nc")))
+
+int cache_is_coherent(const void *buf, uint32_t len);
+void cache_clean(const void *buf, uint32_t len);
+void cache_invalidate(const void *buf, uint32_t len);
+void cache_discard(const void *buf, uint32_t len);
+
+#endif // CACHE_H
+
+// end file cache.h
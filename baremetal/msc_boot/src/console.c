@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file console.c
+ * @brief Console on the USB serial port (CDC-ACM)
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * The writer appends at tx_head; the CDC class takes contiguous pieces from
+ * tx_tail through console_get_tx() and advances tx_tail once the host has
+ * them. Both run in the main loop, so no locking is needed. A piece cut
+ * short by a USB reset is sent again, since tx_tail only moves on
+ * completion.
+ *
+ * When the ring is full, the writer runs the CDC class itself until there
+ * is room, unless it was called from within usb_process() (the USB
+ * interrupt is masked then) or the host has not read anything for
+ * CONSOLE_TIMEOUT_MS. In those cases output is dropped and counted until
+ * the host reads again, so an open but unread port cannot stall the
+ * bootloader.
+ */
+
+#include "console.h"
+#include "cache.h"
+#include "irq_ctrl.h"
+#include "setup.h"
+#include "stm32mp13xx_hal.h"
+#include <stdint.h>
+
+#ifdef USE_USBD_COMPOSITE
+
+// DDR, since SYSRAM has no room for it
+static uint8_t tx_ring[CONSOLE_TX_SIZE] DMA_NC;
+static uint32_t tx_head;
+static uint32_t tx_tail;
+
+static uint8_t rx_ring[CONSOLE_RX_SIZE];
+static uint32_t rx_head;
+static uint32_t rx_tail;
+
+static int port_open;
+static int stalled; // ring full and the host not reading
+static struct console_stats stats;
+
+static void console_open(uint8_t open);
+static void console_receive(const uint8_t *buf, uint32_t len);
+static uint32_t console_get_tx(uint8_t **buf, uint32_t max_len);
+static void console_tx_done(uint32_t len);
+
+USBD_CDC_ItfTypeDef console_fops = {
+    console_open,
+    console_receive,
+    console_get_tx,
+    console_tx_done,
+};
+
+int console_putchar(char ch)
+{
+   if (!port_open)
+      return -1;
+
+   if (tx_head - tx_tail >= CONSOLE_TX_SIZE) {
+      // inside usb_process() the class cannot make progress
+      if (!stalled && IRQ_GetEnableState(OTG_IRQn)) {
+         const uint32_t t0 = HAL_GetTick();
+         while ((tx_head - tx_tail >= CONSOLE_TX_SIZE) && port_open &&
+                (HAL_GetTick() - t0 < CONSOLE_TIMEOUT_MS))
+            usb_process_console();
+         if (!port_open)
+            return -1;
+      }
+
+      if (tx_head - tx_tail >= CONSOLE_TX_SIZE) {
+         stalled = 1;
+         stats.dropped++;
+         return 0;
+      }
+   }
+
+   tx_ring[tx_head & (CONSOLE_TX_SIZE - 1U)] = (uint8_t)ch;
+   tx_head++;
+   return 0;
+}
+
+int console_getchar(void)
+{
+   if (rx_head == rx_tail)
+      return -1;
+
+   const uint8_t ch = rx_ring[rx_tail & (CONSOLE_RX_SIZE - 1U)];
+   rx_tail++;
+   return ch;
+}
+
+int console_is_open(void)
+{
+   return port_open;
+}
+
+void console_get_stats(struct console_stats *s)
+{
+   *s = stats;
+}
+
+static void console_open(uint8_t open)
+{
+   // output written while the port was closed went to the UART; what is
+   // still queued from before is sent when the port opens again
+   port_open = open;
+   stalled   = 0;
+}
+
+static void console_receive(const uint8_t *buf, uint32_t len)
+{
+   // input that does not fit is dropped; it was typed, not streamed
+   for (uint32_t i = 0; i < len; i++) {
+      if (rx_head - rx_tail >= CONSOLE_RX_SIZE)
+         break;
+      rx_ring[rx_head & (CONSOLE_RX_SIZE - 1U)] = buf[i];
+      rx_head++;
+   }
+}
+
+static uint32_t console_get_tx(uint8_t **buf, uint32_t max_len)
+{
+   const uint32_t off = tx_tail & (CONSOLE_TX_SIZE - 1U);
+   uint32_t len       = tx_head - tx_tail;
+
+   // up to the end of the ring; the rest goes in the next transfer
+   if (len > CONSOLE_TX_SIZE - off)
+      len = CONSOLE_TX_SIZE - off;
+   if (len > max_len)
+      len = max_len;
+
+   *buf = &tx_ring[off];
+   return len;
+}
+
+static void console_tx_done(uint32_t len)
+{
+   tx_tail += len;
+   stats.sent += len;
+   stalled = 0;
+}
+
+#endif // USE_USBD_COMPOSITE
+
+// end file console.c
@@ -0,0 +1,51 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file console.h
+ * @brief Console on the USB serial port (CDC-ACM)
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * While the host has the port open, _putchar() stores the output in a ring
+ * in DDR that USBD_CDC_Process() sends from the main loop, at USB rather
+ * than UART speed. When the port is closed, console_putchar() declines and
+ * the character goes to the UART as before.
+ */
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+
+// bytes buffered for the host (power of two)
+#define CONSOLE_TX_SIZE (64U * 1024U)
+
+// bytes received from the host (power of two)
+#define CONSOLE_RX_SIZE 256U
+
+// how long a full ring may hold up the writer before output is dropped
+#define CONSOLE_TIMEOUT_MS 100U
+
+struct console_stats {
+   uint32_t sent;
+   uint32_t dropped; // ring was full
+};
+
+// queue a character; returns -1 if the port is not open
+int console_putchar(char ch);
+
+// next character from the host, or -1 if none
+int console_getchar(void);
+
+int console_is_open(void);
+
+void console_get_stats(struct console_stats *s);
+
+#ifdef USE_USBD_COMPOSITE
+#include "usbd_cdc.h"
+extern USBD_CDC_ItfTypeDef console_fops;
+#endif
+
+#endif // CONSOLE_H
+
+// end file console.h
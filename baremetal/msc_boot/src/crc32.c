@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file crc32.c
+ * @brief CRC-32 as used by zlib, Ethernet and PNG (reflected 0x04C11DB7)
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * The Cortex-A7 has neither the ARMv8 CRC32 instructions nor a 64-bit
+ * carry-less multiply, so this is the table-driven slice-by-4 method: four
+ * 256-entry tables let the inner loop consume a word per iteration. The
+ * tables (4 kB) are built on first use.
+ */
+
+#include "crc32.h"
+#include <stdint.h>
+
+#define CRC32_POLY 0xEDB88320U // 0x04C11DB7 bit-reversed
+
+static uint32_t table[4][256];
+static int table_ready;
+
+static void crc32_init(void)
+{
+   for (uint32_t i = 0U; i < 256U; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++)
+         c = (c & 1U) ? (c >> 1) ^ CRC32_POLY : c >> 1;
+      table[0][i] = c;
+   }
+
+   for (uint32_t i = 0U; i < 256U; i++) {
+      for (int t = 1; t < 4; t++)
+         table[t][i] = (table[t - 1][i] >> 8) ^
+                       table[0][table[t - 1][i] & 0xFFU];
+   }
+
+   table_ready = 1;
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+   if (!table_ready)
+      crc32_init();
+
+   crc = ~crc;
+
+   // bytes up to a word boundary, then whole words, then the rest
+   while ((len > 0U) && (((uintptr_t)buf & 3U) != 0U)) {
+      crc = (crc >> 8) ^ table[0][(crc ^ *buf++) & 0xFFU];
+      len--;
+   }
+
+   const uint32_t *w = (const uint32_t *)(const void *)buf;
+   while (len >= 4U) {
+      crc ^= *w++; // little-endian: the first byte is the low byte
+      crc = table[3][crc & 0xFFU] ^ table[2][(crc >> 8) & 0xFFU] ^
+            table[1][(crc >> 16) & 0xFFU] ^ table[0][crc >> 24];
+      len -= 4U;
+   }
+
+   buf = (const uint8_t *)w;
+   while (len > 0U) {
+      crc = (crc >> 8) ^ table[0][(crc ^ *buf++) & 0xFFU];
+      len--;
+   }
+
+   return ~crc;
+}
+
+// end file crc32.c
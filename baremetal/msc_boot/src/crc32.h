@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file crc32.h
+ * @brief CRC-32 as used by zlib, Ethernet and PNG (reflected 0x04C11DB7)
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ */
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+
+// continue a CRC over len more bytes; start with crc = 0, the result equals
+// zlib's crc32(crc, buf, len)
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, uint32_t len);
+
+#endif // CRC32_H
+
+// end file crc32.h
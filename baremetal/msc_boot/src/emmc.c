@@ -0,0 +1,522 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file emmc.c
+ * @brief eMMC block device on SDMMC2
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * There is no HAL MMC driver in this tree, so the device is driven with the
+ * SDMMC low-level commands directly. Transfers are blocking: one multi-block
+ * command per call (split at the data length register limit), moved by the
+ * internal DMA in single-buffer mode, with the status flags polled for the
+ * end. Buffers must be 32-bit aligned; cacheable ones are maintained here,
+ * so they should also start and end on a cache line.
+ *
+ * emmc_init() identifies the device at 400 kHz on one data line, then
+ * switches it to High Speed and tries the bus modes from the fastest down:
+ * 8-bit DDR52, 8-bit, 4-bit and 1-bit at up to 52 MHz. Each mode is checked
+ * by reading EXT_CSD back before it is kept. A device without High Speed,
+ * or one that refuses the switch, gets the same widths (without DDR) in
+ * legacy timing at up to 26 MHz.
+ *
+ * The boot partitions are reached by switching PARTITION_ACCESS in EXT_CSD
+ * PARTITION_CONFIG before a transfer; the other bits of that byte (which
+ * partition the ROM code boots from) are left as they are.
+ */
+
+#include "emmc.h"
+#include "cache.h"
+#include "stm32mp13xx.h"
+#include "stm32mp13xx_hal.h"
+#include "stm32mp13xx_hal_rcc.h"
+#include "stm32mp13xx_ll_sdmmc.h"
+#include <stdint.h>
+#include <string.h>
+
+#define EMMC_BLK_SIZE 512U
+
+#define EMMC_TIMEOUT_MS       3000U
+#define EMMC_INIT_TIMEOUT_MS  1000U
+#define EMMC_ERASE_TIMEOUT_MS 30000U
+
+#define EMMC_INIT_HZ   400000U
+#define EMMC_LEGACY_HZ 26000000U
+#define EMMC_HS_HZ     52000000U
+
+// most blocks per command; DLEN holds 25 bits
+#define EMMC_MAX_BLKS 0xFFFFU
+
+// CMD1 argument: 2.7-3.6 V, sector addressing
+#define EMMC_OCR_ARG     0x40FF8000U
+#define EMMC_OCR_READY   0x80000000U
+#define EMMC_OCR_SECTORS 0x40000000U
+
+// relative card address we assign with CMD3
+#define EMMC_RCA 1U
+
+// card status (R1)
+#define EMMC_R1_SWITCH_ERROR 0x00000080U
+#define EMMC_R1_STATE(r1)    (((r1) >> 9) & 0xFU)
+#define EMMC_STATE_TRAN      4U
+
+// EXT_CSD fields
+#define EXT_CSD_PARTITION_CONFIG 179U
+#define EXT_CSD_ERASED_MEM_CONT  181U
+#define EXT_CSD_BUS_WIDTH        183U
+#define EXT_CSD_HS_TIMING        185U
+#define EXT_CSD_REV              192U
+#define EXT_CSD_DEVICE_TYPE      196U
+#define EXT_CSD_SEC_COUNT        212U
+#define EXT_CSD_BOOT_SIZE_MULT   226U
+#define EXT_CSD_SEC_FEATURE      231U
+
+#define EXT_CSD_TYPE_HS52   0x02U
+#define EXT_CSD_TYPE_DDR52  0x04U // 1.8 V or 3 V I/O
+#define EXT_CSD_SEC_GB_CL   0x10U // TRIM supported
+#define EXT_CSD_PART_ACCESS 0x07U
+
+// BUS_WIDTH values
+#define EXT_CSD_BUS_1    0U
+#define EXT_CSD_BUS_4    1U
+#define EXT_CSD_BUS_8    2U
+#define EXT_CSD_BUS_8DDR 6U
+
+// CMD38 argument for TRIM
+#define EMMC_TRIM_ARG 0x00000001U
+
+static SDMMC_TypeDef *const sdmmc = SDMMC2;
+
+static struct {
+   int ready;
+   uint32_t div;
+   uint8_t part;        // partition selected on the device
+   uint8_t part_config; // PARTITION_CONFIG as last written
+   uint8_t erased_ones; // ERASED_MEM_CONT
+   uint8_t trim;        // TRIM supported
+   struct emmc_info info;
+} mmc;
+
+// EXT_CSD as read at identification; the IDMA writes it, so it stays out of
+// the cache, as does the copy read back to check a bus mode
+static uint8_t ext_csd[EMMC_BLK_SIZE] DMA_NC __attribute__((aligned(4)));
+static uint8_t ext_csd_chk[EMMC_BLK_SIZE] DMA_NC __attribute__((aligned(4)));
+
+static uint32_t kernel_hz(void)
+{
+   return HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_SDMMC2);
+}
+
+/**
+ * CLKDIV for the fastest clock not above max_hz; DDR needs at least 1.
+ */
+static uint32_t clk_div(const uint32_t max_hz, const int ddr)
+{
+   const uint32_t kernel = kernel_hz();
+   uint32_t div          = 0U;
+
+   if (kernel > max_hz)
+      div = (kernel + 2U * max_hz - 1U) / (2U * max_hz);
+   if (ddr && (div == 0U))
+      div = 1U;
+   return div;
+}
+
+static void set_bus(const uint32_t div, const uint32_t width, const int ddr)
+{
+   uint32_t widbus = SDMMC_BUS_WIDE_1B;
+
+   if (width == 8U)
+      widbus = SDMMC_BUS_WIDE_8B;
+   else if (width == 4U)
+      widbus = SDMMC_BUS_WIDE_4B;
+
+   MODIFY_REG(sdmmc->CLKCR,
+              SDMMC_CLKCR_CLKDIV | SDMMC_CLKCR_WIDBUS | SDMMC_CLKCR_DDR,
+              div | widbus | (ddr ? SDMMC_CLKCR_DDR : 0U));
+
+   mmc.div            = div;
+   mmc.info.clk_hz    = (div == 0U) ? kernel_hz() : kernel_hz() / (2U * div);
+   mmc.info.bus_width = width;
+   mmc.info.ddr       = ddr;
+}
+
+/**
+ * CMD13 until the device is back in the transfer state, e.g. after it has
+ * programmed a write or completed a switch.
+ */
+static int wait_tran(const uint32_t timeout_ms)
+{
+   const uint32_t t0 = HAL_GetTick();
+
+   while (1) {
+      if (SDMMC_CmdSendStatus(sdmmc, EMMC_RCA << 16U) == SDMMC_ERROR_NONE) {
+         const uint32_t r1 = SDMMC_GetResponse(sdmmc, SDMMC_RESP1);
+         if (r1 & EMMC_R1_SWITCH_ERROR)
+            return -1;
+         if (EMMC_R1_STATE(r1) == EMMC_STATE_TRAN)
+            return 0;
+      }
+      if (HAL_GetTick() - t0 > timeout_ms)
+         return -1;
+   }
+}
+
+/**
+ * CMD6: write one byte of EXT_CSD.
+ */
+static int switch_byte(const uint32_t index, const uint32_t value)
+{
+   if (SDMMC_CmdSwitch(sdmmc, (3U << 24) | (index << 16) | (value << 8)) !=
+       SDMMC_ERROR_NONE)
+      return -1;
+
+   return wait_tran(EMMC_TIMEOUT_MS);
+}
+
+/**
+ * Set up the data path and the IDMA for a transfer of blk_len blocks.
+ */
+static void start_data(uint8_t *buf, const uint32_t blk_len, const int write)
+{
+   SDMMC_DataInitTypeDef config;
+
+   config.DataTimeOut   = SDMMC_DATATIMEOUT;
+   config.DataLength    = blk_len * EMMC_BLK_SIZE;
+   config.DataBlockSize = SDMMC_DATABLOCK_SIZE_512B;
+   config.TransferDir =
+       write ? SDMMC_TRANSFER_DIR_TO_CARD : SDMMC_TRANSFER_DIR_TO_SDMMC;
+   config.TransferMode = SDMMC_TRANSFER_MODE_BLOCK;
+   config.DPSM         = SDMMC_DPSM_DISABLE;
+   (void)SDMMC_ConfigData(sdmmc, &config);
+
+   __SDMMC_CMDTRANS_ENABLE(sdmmc);
+   sdmmc->IDMABASER = (uint32_t)buf;
+   sdmmc->IDMACTRL  = SDMMC_ENABLE_IDMA_SINGLE_BUFF;
+}
+
+static void reset_data(void)
+{
+   __SDMMC_CMDTRANS_DISABLE(sdmmc);
+   sdmmc->IDMACTRL = SDMMC_DISABLE_IDMA;
+   sdmmc->DLEN     = 0U;
+   sdmmc->DCTRL    = 0U;
+   __SDMMC_CLEAR_FLAG(sdmmc, SDMMC_STATIC_DATA_FLAGS);
+}
+
+/**
+ * Wait for the data of the command just sent, then stop a multi-block
+ * transfer, or a single block that failed.
+ */
+static int end_data(const int multi)
+{
+   const uint32_t errors = SDMMC_FLAG_DCRCFAIL | SDMMC_FLAG_DTIMEOUT |
+                           SDMMC_FLAG_RXOVERR | SDMMC_FLAG_TXUNDERR |
+                           SDMMC_FLAG_IDMATE;
+   const uint32_t t0     = HAL_GetTick();
+   int ret               = 0;
+
+   while (!__SDMMC_GET_FLAG(sdmmc, SDMMC_FLAG_DATAEND | errors)) {
+      if (HAL_GetTick() - t0 > EMMC_TIMEOUT_MS) {
+         ret = -1;
+         break;
+      }
+   }
+   if (__SDMMC_GET_FLAG(sdmmc, errors))
+      ret = -1;
+   reset_data();
+
+   if (multi) {
+      if (SDMMC_CmdStopTransfer(sdmmc) != SDMMC_ERROR_NONE)
+         ret = -1;
+   } else if (ret != 0) {
+      (void)SDMMC_CmdStopTransfer(sdmmc);
+   }
+
+   return ret;
+}
+
+/**
+ * CMD8: read EXT_CSD.
+ */
+static int read_ext_csd(uint8_t *buf)
+{
+   start_data(buf, 1U, 0);
+   if (SDMMC_CmdSendEXTCSD(sdmmc, 0U) != SDMMC_ERROR_NONE) {
+      reset_data();
+      return -1;
+   }
+
+   return end_data(0);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+   return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+          ((uint32_t)p[3] << 24);
+}
+
+/**
+ * Switch the device and the host to a bus mode and read EXT_CSD back to
+ * see that data arrives intact.
+ */
+static int try_bus(const uint32_t max_hz, const uint32_t width,
+                   const int ddr)
+{
+   uint32_t mode = EXT_CSD_BUS_1;
+
+   if (width == 8U)
+      mode = ddr ? EXT_CSD_BUS_8DDR : EXT_CSD_BUS_8;
+   else if (width == 4U)
+      mode = EXT_CSD_BUS_4;
+
+   if (switch_byte(EXT_CSD_BUS_WIDTH, mode) != 0)
+      return -1;
+   set_bus(clk_div(max_hz, ddr), width, ddr);
+
+   memset(ext_csd_chk, 0, sizeof(ext_csd_chk));
+   if ((read_ext_csd(ext_csd_chk) != 0) ||
+       (get_le32(&ext_csd_chk[EXT_CSD_SEC_COUNT]) !=
+        get_le32(&ext_csd[EXT_CSD_SEC_COUNT])))
+      return -1;
+
+   return 0;
+}
+
+/**
+ * Bring the bus from the identification mode to High Speed, or to legacy
+ * timing if the device is older or refuses the switch, on as many data
+ * lines as work, with DDR if the device has it.
+ */
+static int config_bus(void)
+{
+   const uint8_t type = ext_csd[EXT_CSD_DEVICE_TYPE];
+   const int hs       = (type & EXT_CSD_TYPE_HS52) &&
+                  (switch_byte(EXT_CSD_HS_TIMING, 1U) == 0);
+   const uint32_t hz  = hs ? EMMC_HS_HZ : EMMC_LEGACY_HZ;
+
+   mmc.info.high_speed = hs;
+   set_bus(clk_div(hz, 0), 1U, 0);
+
+   if (hs && (type & EXT_CSD_TYPE_DDR52) && (try_bus(hz, 8U, 1) == 0))
+      return 0;
+   if ((try_bus(hz, 8U, 0) == 0) || (try_bus(hz, 4U, 0) == 0) ||
+       (try_bus(hz, 1U, 0) == 0))
+      return 0;
+
+   return -1;
+}
+
+/**
+ * Select the user area or a boot partition for the following transfers.
+ */
+static int select_part(const uint8_t part)
+{
+   if (part == mmc.part)
+      return 0;
+
+   const uint8_t cfg = (mmc.part_config & ~EXT_CSD_PART_ACCESS) | part;
+   if (switch_byte(EXT_CSD_PARTITION_CONFIG, cfg) != 0)
+      return -1;
+
+   mmc.part_config = cfg;
+   mmc.part        = part;
+   return 0;
+}
+
+static int transfer(const uint8_t part, uint8_t *buf, uint32_t blk_addr,
+                    uint32_t blk_len, const int write)
+{
+   uint8_t *const start = buf;
+   const uint32_t len   = blk_len * EMMC_BLK_SIZE;
+
+   if (!mmc.ready || (((uint32_t)buf & 3U) != 0U) ||
+       (select_part(part) != 0))
+      return -1;
+
+   if (write)
+      cache_clean(start, len);
+   else
+      cache_invalidate(start, len);
+
+   while (blk_len > 0U) {
+      const uint32_t n = (blk_len > EMMC_MAX_BLKS) ? EMMC_MAX_BLKS : blk_len;
+      uint32_t err;
+
+      start_data(buf, n, write);
+      if (write)
+         err = (n > 1U) ? SDMMC_CmdWriteMultiBlock(sdmmc, blk_addr)
+                        : SDMMC_CmdWriteSingleBlock(sdmmc, blk_addr);
+      else
+         err = (n > 1U) ? SDMMC_CmdReadMultiBlock(sdmmc, blk_addr)
+                        : SDMMC_CmdReadSingleBlock(sdmmc, blk_addr);
+
+      if (err != SDMMC_ERROR_NONE)
+         reset_data();
+      if ((err != SDMMC_ERROR_NONE) || (end_data(n > 1U) != 0)) {
+         (void)wait_tran(EMMC_TIMEOUT_MS);
+         return -1;
+      }
+
+      // a write is done when the device has programmed it
+      if (write && (wait_tran(EMMC_TIMEOUT_MS) != 0))
+         return -1;
+
+      buf += n * EMMC_BLK_SIZE;
+      blk_addr += n;
+      blk_len -= n;
+   }
+
+   // lines may have been refilled speculatively during the transfer
+   if (!write)
+      cache_invalidate(start, len);
+
+   return 0;
+}
+
+int emmc_init(void)
+{
+   SDMMC_InitTypeDef init;
+   uint32_t ocr = 0U;
+
+   memset(&mmc, 0, sizeof(mmc));
+
+   init.ClockEdge           = SDMMC_CLOCK_EDGE_RISING;
+   init.ClockPowerSave      = SDMMC_CLOCK_POWER_SAVE_DISABLE;
+   init.BusWide             = SDMMC_BUS_WIDE_1B;
+   init.HardwareFlowControl = SDMMC_HARDWARE_FLOW_CONTROL_DISABLE;
+   init.ClockDiv            = clk_div(EMMC_INIT_HZ, 0);
+   (void)SDMMC_Init(sdmmc, init);
+   (void)SDMMC_PowerState_ON(sdmmc);
+
+   // at least 74 clocks before the first command
+   HAL_Delay(2U);
+
+   if (SDMMC_CmdGoIdleState(sdmmc) != SDMMC_ERROR_NONE)
+      return -1;
+
+   // CMD1 until the device leaves its power-up busy state
+   const uint32_t t0 = HAL_GetTick();
+   while (!(ocr & EMMC_OCR_READY)) {
+      if ((SDMMC_CmdOpCondition(sdmmc, EMMC_OCR_ARG) != SDMMC_ERROR_NONE) ||
+          (HAL_GetTick() - t0 > EMMC_INIT_TIMEOUT_MS))
+         return -1;
+      ocr = SDMMC_GetResponse(sdmmc, SDMMC_RESP1);
+   }
+
+   // byte-addressed devices (2 GB and less) are not supported
+   if (!(ocr & EMMC_OCR_SECTORS))
+      return -1;
+
+   if ((SDMMC_CmdSendCID(sdmmc) != SDMMC_ERROR_NONE) ||
+       (SDMMC_CmdSetRelAddMmc(sdmmc, EMMC_RCA) != SDMMC_ERROR_NONE) ||
+       (SDMMC_CmdSelDesel(sdmmc, EMMC_RCA << 16U) != SDMMC_ERROR_NONE) ||
+       (SDMMC_CmdBlockLength(sdmmc, EMMC_BLK_SIZE) != SDMMC_ERROR_NONE))
+      return -1;
+
+   set_bus(init.ClockDiv, 1U, 0);
+   if (read_ext_csd(ext_csd) != 0)
+      return -1;
+
+   mmc.info.blk_nbr     = get_le32(&ext_csd[EXT_CSD_SEC_COUNT]);
+   mmc.info.boot_blk    = ext_csd[EXT_CSD_BOOT_SIZE_MULT] * 256U; // 128 kB
+   mmc.info.ext_csd_rev = ext_csd[EXT_CSD_REV];
+   mmc.part_config      = ext_csd[EXT_CSD_PARTITION_CONFIG];
+   mmc.part             = mmc.part_config & EXT_CSD_PART_ACCESS;
+   mmc.erased_ones      = ext_csd[EXT_CSD_ERASED_MEM_CONT] & 1U;
+   mmc.trim = (ext_csd[EXT_CSD_SEC_FEATURE] & EXT_CSD_SEC_GB_CL) != 0U;
+
+   if ((mmc.info.blk_nbr == 0U) || (config_bus() != 0))
+      return -1;
+
+   mmc.ready = 1;
+   return 0;
+}
+
+void emmc_get_info(struct emmc_info *info)
+{
+   *info = mmc.info;
+}
+
+int emmc_ready(void)
+{
+   return mmc.ready;
+}
+
+int emmc_get_capacity(uint32_t *blk_nbr, uint32_t *blk_size)
+{
+   if (!mmc.ready)
+      return -1;
+
+   *blk_nbr  = mmc.info.blk_nbr;
+   *blk_size = EMMC_BLK_SIZE;
+   return 0;
+}
+
+int emmc_read(uint8_t *buf, uint32_t blk_addr, uint32_t blk_len)
+{
+   return transfer(EMMC_PART_USER, buf, blk_addr, blk_len, 0);
+}
+
+int emmc_write(const uint8_t *buf, uint32_t blk_addr, uint32_t blk_len)
+{
+   return transfer(EMMC_PART_USER, (uint8_t *)buf, blk_addr, blk_len, 1);
+}
+
+int emmc_discard(uint32_t blk_addr, uint32_t blk_len)
+{
+   // without TRIM, erase works on whole erase groups only
+   if (!mmc.ready || !mmc.trim || (blk_len == 0U) ||
+       (select_part(EMMC_PART_USER) != 0))
+      return -1;
+
+   if ((SDMMC_CmdEraseStartAdd(sdmmc, blk_addr) != SDMMC_ERROR_NONE) ||
+       (SDMMC_CmdEraseEndAdd(sdmmc, blk_addr + blk_len - 1U) !=
+        SDMMC_ERROR_NONE) ||
+       (SDMMC_CmdErase(sdmmc, EMMC_TRIM_ARG) != SDMMC_ERROR_NONE))
+      return -1;
+
+   return wait_tran(EMMC_ERASE_TIMEOUT_MS);
+}
+
+int emmc_can_discard(void)
+{
+   return mmc.ready && mmc.trim;
+}
+
+int emmc_discard_zeroes(void)
+{
+   return !mmc.erased_ones;
+}
+
+int emmc_get_boot_capacity(uint32_t *blk_nbr, uint32_t *blk_size)
+{
+   if (!mmc.ready || (mmc.info.boot_blk == 0U))
+      return -1;
+
+   *blk_nbr  = mmc.info.boot_blk;
+   *blk_size = EMMC_BLK_SIZE;
+   return 0;
+}
+
+int emmc_boot0_read(uint8_t *buf, uint32_t blk_addr, uint32_t blk_len)
+{
+   return transfer(EMMC_PART_BOOT0, buf, blk_addr, blk_len, 0);
+}
+
+int emmc_boot0_write(const uint8_t *buf, uint32_t blk_addr, uint32_t blk_len)
+{
+   return transfer(EMMC_PART_BOOT0, (uint8_t *)buf, blk_addr, blk_len, 1);
+}
+
+int emmc_boot1_read(uint8_t *buf, uint32_t blk_addr, uint32_t blk_len)
+{
+   return transfer(EMMC_PART_BOOT1, buf, blk_addr, blk_len, 0);
+}
+
+int emmc_boot1_write(const uint8_t *buf, uint32_t blk_addr, uint32_t blk_len)
+{
+   return transfer(EMMC_PART_BOOT1, (uint8_t *)buf, blk_addr, blk_len, 1);
+}
+
+// end file emmc.c
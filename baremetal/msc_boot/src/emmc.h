@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file emmc.h
+ * @brief eMMC block device on SDMMC2
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * The read, write and capacity functions have the signatures of the SD card
+ * ones, so each area of the device can back a mass storage LUN or a fastboot
+ * target. The boot partitions are named boot0 and boot1 as in Linux (boot
+ * partitions 1 and 2 in JEDEC terms).
+ */
+
+#ifndef EMMC_H
+#define EMMC_H
+
+#include <stdint.h>
+
+// PARTITION_ACCESS values of EXT_CSD PARTITION_CONFIG
+#define EMMC_PART_USER  0U
+#define EMMC_PART_BOOT0 1U
+#define EMMC_PART_BOOT1 2U
+
+struct emmc_info {
+   uint32_t blk_nbr;   // user area
+   uint32_t boot_blk;  // each boot partition
+   uint32_t clk_hz;    // bus clock
+   uint32_t bus_width; // 1, 4 or 8
+   int high_speed;     // HS_TIMING, else legacy timing up to 26 MHz
+   int ddr;            // DDR52
+   uint8_t ext_csd_rev;
+};
+
+// identify the device and bring the bus up to the fastest mode both sides
+// support; the SDMMC2 clock and pins must be set up
+int emmc_init(void);
+
+void emmc_get_info(struct emmc_info *info);
+
+// user area
+int emmc_ready(void);
+int emmc_get_capacity(uint32_t *blk_nbr, uint32_t *blk_size);
+int emmc_read(uint8_t *buf, uint32_t blk_addr, uint32_t blk_len);
+int emmc_write(const uint8_t *buf, uint32_t blk_addr, uint32_t blk_len);
+int emmc_can_discard(void); // nonzero if the device has TRIM
+int emmc_discard(uint32_t blk_addr, uint32_t blk_len);
+int emmc_discard_zeroes(void);
+
+// boot partitions, both of the same size
+int emmc_get_boot_capacity(uint32_t *blk_nbr, uint32_t *blk_size);
+int emmc_boot0_read(uint8_t *buf, uint32_t blk_addr, uint32_t blk_len);
+int emmc_boot0_write(const uint8_t *buf, uint32_t blk_addr, uint32_t blk_len);
+int emmc_boot1_read(uint8_t *buf, uint32_t blk_addr, uint32_t blk_len);
+int emmc_boot1_write(const uint8_t *buf, uint32_t blk_addr, uint32_t blk_len);
+
+#endif // EMMC_H
+
+// end file emmc.h
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file evlog.c
+ * @brief Lock-free event log ring, formatted and printed from the main loop
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * Producers (any context) reserve a slot by advancing head with a
+ * compare-and-swap, fill it, and publish it by storing the slot's sequence
+ * number last. The single consumer, evlog_drain() in the main loop, prints
+ * slots in order as long as they are published and then advances tail. A
+ * full ring drops the new event and counts it rather than waiting.
+ */
+
+#include "evlog.h"
+#include "printf.h"
+#include "setup.h"
+#include <stdint.h>
+
+struct evlog_entry {
+   uint32_t seq; // index + 1 once the entry is complete
+   uint32_t t_us;
+   const char *fmt;
+   uintptr_t arg[4];
+   uint8_t level;
+};
+
+static struct evlog_entry ring[EVLOG_SIZE];
+static uint32_t head;
+static uint32_t tail;
+static uint32_t logged;
+static uint32_t dropped;
+
+void evlog_put(uint8_t level, const char *fmt, uintptr_t a0, uintptr_t a1,
+               uintptr_t a2, uintptr_t a3)
+{
+   uint32_t h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+
+   do {
+      if (h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= EVLOG_SIZE) {
+         __atomic_fetch_add(&dropped, 1U, __ATOMIC_RELAXED);
+         return;
+      }
+   } while (!__atomic_compare_exchange_n(&head, &h, h + 1U, 1,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+   struct evlog_entry *e = &ring[h & (EVLOG_SIZE - 1U)];
+   e->t_us               = get_time_us();
+   e->fmt                = fmt;
+   e->level              = level;
+   e->arg[0]             = a0;
+   e->arg[1]             = a1;
+   e->arg[2]             = a2;
+   e->arg[3]             = a3;
+   __atomic_store_n(&e->seq, h + 1U, __ATOMIC_RELEASE);
+   __atomic_fetch_add(&logged, 1U, __ATOMIC_RELAXED);
+}
+
+int evlog_drain(void)
+{
+   static const char *const prefix[] = {"ERROR: ", "", "DEBUG : "};
+   static uint32_t reported;
+   const uint32_t d = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+   int n            = 0;
+
+   while (1) {
+      const struct evlog_entry *e = &ring[tail & (EVLOG_SIZE - 1U)];
+
+      if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != tail + 1U)
+         break;
+
+      printf("[%u us] %s", (unsigned)e->t_us,
+             (e->level <= EVLOG_DBG) ? prefix[e->level] : "");
+      printf(e->fmt, e->arg[0], e->arg[1], e->arg[2], e->arg[3]);
+      printf("\r\n");
+
+      __atomic_store_n(&tail, tail + 1U, __ATOMIC_RELEASE);
+      n++;
+   }
+
+   if (d != reported) {
+      printf("evlog: %u events dropped\r\n", (unsigned)(d - reported));
+      reported = d;
+   }
+
+   return n;
+}
+
+void evlog_get_stats(struct evlog_stats *s)
+{
+   s->logged  = __atomic_load_n(&logged, __ATOMIC_RELAXED);
+   s->dropped = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+// end file evlog.c
@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file evlog.h
+ * @brief Lock-free event log ring, formatted and printed from the main loop
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * evlog_put() only stores a timestamp, a level, the format string pointer
+ * (which doubles as the format id) and up to four word-sized arguments, so
+ * it runs in constant time and is safe to call from interrupt handlers. The
+ * text is produced later by evlog_drain(). Because formatting is deferred,
+ * every %s argument must point to a string that is still valid then, e.g. a
+ * literal.
+ */
+
+#ifndef EVLOG_H
+#define EVLOG_H
+
+#include <stdint.h>
+
+// entries in the ring (power of two)
+#define EVLOG_SIZE 64U
+
+#define EVLOG_ERR 0U
+#define EVLOG_USR 1U
+#define EVLOG_DBG 2U
+
+struct evlog_stats {
+   uint32_t logged;
+   uint32_t dropped; // ring was full
+};
+
+// log an event; missing arguments are passed as zero
+#define EVLOG(level, ...) EVLOG_(level, __VA_ARGS__, 0, 0, 0, 0, 0)
+#define EVLOG_(level, fmt, a0, a1, a2, a3, ...)                                \
+   evlog_put(level, fmt, (uintptr_t)(a0), (uintptr_t)(a1), (uintptr_t)(a2),    \
+             (uintptr_t)(a3))
+
+void evlog_put(uint8_t level, const char *fmt, uintptr_t a0, uintptr_t a1,
+               uintptr_t a2, uintptr_t a3);
+
+// print all pending events; returns the number printed
+int evlog_drain(void);
+
+void evlog_get_stats(struct evlog_stats *s);
+
+#endif // EVLOG_H
+
+// end file evlog.h
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file lz4.c
+ * @brief Decoder for the LZ4 block format
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * A block is a series of sequences, each a token byte, literals, a 16-bit
+ * little-endian match offset and the match length. The high nibble of the
+ * token is the literal count and the low nibble the match length minus 4;
+ * a nibble of 15 continues in the following bytes, each added until one is
+ * below 255. The last sequence has literals only. All reads and writes are
+ * bounds checked, so a corrupt block can't write outside dst.
+ */
+
+#include "lz4.h"
+#include <stdint.h>
+#include <string.h>
+
+#define MIN_MATCH 4U
+
+// extend a nibble of 15 with the bytes that follow; returns -1 on overrun
+static int get_len(const uint8_t **ip, const uint8_t *end, uint32_t *len)
+{
+   if (*len != 15U)
+      return 0;
+
+   uint8_t b;
+   do {
+      if (*ip >= end)
+         return -1;
+      b = *(*ip)++;
+      *len += b;
+   } while (b == 255U);
+
+   return 0;
+}
+
+int32_t lz4_decompress(const uint8_t *src, uint32_t src_len, uint8_t *dst,
+                       uint32_t dst_len)
+{
+   const uint8_t *ip       = src;
+   const uint8_t *const ie = src + src_len;
+   uint8_t *op             = dst;
+   const uint8_t *const oe = dst + dst_len;
+
+   while (ip < ie) {
+      const uint8_t token = *ip++;
+      uint32_t len        = token >> 4;
+
+      // literals
+      if ((get_len(&ip, ie, &len) != 0) || (len > (uint32_t)(ie - ip)) ||
+          (len > (uint32_t)(oe - op)))
+         return -1;
+      memcpy(op, ip, len);
+      ip += len;
+      op += len;
+
+      if (ip == ie)
+         break; // the last sequence ends after its literals
+
+      // match
+      if (ie - ip < 2)
+         return -1;
+      const uint32_t offset = (uint32_t)ip[0] | ((uint32_t)ip[1] << 8);
+      ip += 2;
+
+      len = token & 0xFU;
+      if (get_len(&ip, ie, &len) != 0)
+         return -1;
+      len += MIN_MATCH;
+
+      if ((offset == 0U) || (offset > (uint32_t)(op - dst)) ||
+          (len > (uint32_t)(oe - op)))
+         return -1;
+
+      const uint8_t *match = op - offset;
+      if (offset == 1U) {
+         // a run of one byte value, the common case of zero fill
+         memset(op, *match, len);
+         op += len;
+      } else if (offset >= len) {
+         memcpy(op, match, len);
+         op += len;
+      } else {
+         // overlapping: the match repeats bytes it is still producing
+         while (len-- != 0U)
+            *op++ = *match++;
+      }
+   }
+
+   return (int32_t)(op - dst);
+}
+
+// end file lz4.c
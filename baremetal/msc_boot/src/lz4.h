@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file lz4.h
+ * @brief Decoder for the LZ4 block format
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ */
+
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stdint.h>
+
+// decode one LZ4 block (raw block format, no frame header); returns the
+// number of bytes written to dst, or -1 if the block is malformed or does
+// not fit in dst_len bytes
+int32_t lz4_decompress(const uint8_t *src, uint32_t src_len, uint8_t *dst,
+                       uint32_t dst_len);
+
+#endif // LZ4_H
+
+// end file lz4.h
@@ -8,13 +8,31 @@
  */
 
 #include "setup.h"
+#include "blkcache.h"
+#include "cache.h"
+#include "evlog.h"
+#include "sd.h"
+#ifdef EMMC_USE
+#include "emmc.h"
+#endif
 #include "stm32mp135fxx_ca7.h"
 #include "stm32mp13xx_hal.h"
 #include "stm32mp13xx_hal_def.h"
 #include "stm32mp13xx_hal_gpio.h"
 #include "stm32mp13xx_hal_rcc.h"
 #include "stm32mp13xx_hal_sd.h"
+#include "usbd_conf.h"
+#include "usbd_msc.h"
+#include "usbd_msc_storage.h"
+#ifdef USB_BENCH_USE
+#include "usbd_bench.h"
+#endif
+#ifdef USE_USBD_COMPOSITE
+#include "console.h"
+#include "usbd_composite_builder.h"
+#endif
 #include <stdint.h>
+#include <string.h>
 #include "printf.h"
 
 static void print_ddr(const int num_words)
@@ -51,29 +69,168 @@ static void print_ddr(const int num_words)
    }
 }
 
-static void read_sd_blocking(void)
+#ifdef MSC_BENCH_USE
+static uint32_t bench_rate(const uint32_t bytes, const uint32_t ms)
 {
-   const int app_offset   = 0;
-   const int num_blocks   = 1;
-   const int read_timeout = 3000;
+   return (bytes / 1024U) * 1000U / ((ms == 0U) ? 1U : ms);
+}
 
-   static uint8_t block[BLOCKSIZE]; // static array for one block
+static void bench_msc(void)
+{
+   const uint32_t total    = 16U * 1024U * 1024U;
+   const uint16_t blk_len  = MSC_MEDIA_PACKET / BLOCKSIZE;
+   const uint32_t num_pkts = total / MSC_MEDIA_PACKET;
 
-   if (HAL_SD_ReadBlocks(&sd_handle, block, app_offset, num_blocks,
-                         read_timeout) != HAL_OK) {
-      printf("Error in HAL_SD_ReadBlocks()\r\n");
-      Error_Handler();
-   }
+   static uint32_t buf[MSC_MEDIA_PACKET / sizeof(uint32_t)]
+       __attribute__((aligned(CACHE_LINE)));
 
-   // Copy to DRAM in 32-bit words
-   // (Copying byte by byte cause weird data corruption)
-   uint32_t *p = (uint32_t *)DRAM_MEM_BASE;
-   for (unsigned int i = 0; i < 512; i += 4) {
-      uint32_t word = ((uint32_t)block[i + 3U] << 24U) |
-                      ((uint32_t)block[i + 2U] << 16U) |
-                      ((uint32_t)block[i + 1U] << 8U) | (uint32_t)block[i];
-      *p++ = word;
-   }
+#ifdef CACHE_USE
+   printf("MSC media benchmark (cached), %u kB\r\n", total / 1024U);
+#else
+   printf("MSC media benchmark (uncached), %u kB\r\n", total / 1024U);
+#endif
+
+   // same chunking as SCSI_ProcessRead(); read only, since the medium is
+   // the SD card
+   uint32_t t0 = HAL_GetTick();
+   for (uint32_t i = 0; i < num_pkts; i++)
+      USBD_MSC_fops.Read(0, (uint8_t *)buf, i * blk_len, blk_len);
+   uint32_t t1 = HAL_GetTick();
+
+   printf("read: %u ms, %u kB/s\r\n", t1 - t0, bench_rate(total, t1 - t0));
+}
+#endif
+
+#if !defined(FASTBOOT_USE) && !defined(USB_BENCH_USE)
+static void print_msc_stats(void)
+{
+   static uint32_t last_cmds;
+
+#ifdef USE_USBD_COMPOSITE
+   // usb_process() leaves classId at the console
+   const uint32_t id =
+       USBD_CMPSIT_GetClassID(&usbd_device, CLASS_TYPE_MSC, 0);
+   if (id >= USBD_MAX_SUPPORTED_CLASS)
+      return;
+   const USBD_MSC_BOT_HandleTypeDef *hmsc = usbd_device.pClassDataCmsit[id];
+#else
+   const USBD_MSC_BOT_HandleTypeDef *hmsc =
+       usbd_device.pClassDataCmsit[usbd_device.classId];
+#endif
+   if ((hmsc == NULL) || (hmsc->stats.read_cmds == last_cmds))
+      return;
+   last_cmds = hmsc->stats.read_cmds;
+
+   const uint64_t us = (hmsc->stats.read_us == 0U) ? 1U : hmsc->stats.read_us;
+   printf("MSC read: %u cmds, %u kB, %u kB/s (%u buffers)\r\n",
+          hmsc->stats.read_cmds, (uint32_t)(hmsc->stats.read_bytes / 1024U),
+          (uint32_t)(hmsc->stats.read_bytes * 1000U / 1024U * 1000U / us),
+          MSC_MEDIA_BUF_NBR);
+   printf("MSC latency: longest USB interrupt %u us, deferred work %u us\r\n",
+          USBD_LL_GetIrqMaxUs(), hmsc->stats.work_max_us);
+
+#if (MSC_UAS_ENABLE == 1U)
+   if (hmsc->interface == MSC_UAS_ALT)
+      printf("MSC UAS: %u cmds, up to %u queued\r\n", hmsc->uas.cmds,
+             hmsc->uas.max_queued);
+#endif
+}
+#endif // FASTBOOT_USE, USB_BENCH_USE
+
+#ifdef USB_BENCH_USE
+static void print_bench_stats(void)
+{
+   static const char *const mode[] = {"idle", "source", "sink", "loopback"};
+   static uint32_t last_xfers;
+
+   const USBD_BENCH_StatsTypeDef *s = USBD_BENCH_GetStats(&usbd_device);
+   if ((s == NULL) || (s->xfers == 0U) || (s->xfers == last_xfers))
+      return;
+   last_xfers = s->xfers;
+
+   printf("USB bench %s, %u B transfers: %u kB/s, latency %u/%u/%u us "
+          "(min/avg/max)\r\n",
+          (s->mode <= BENCH_LOOPBACK) ? mode[s->mode] : "?", s->xfer_len,
+          s->rate / 1024U, s->lat_min_us,
+          (uint32_t)(s->lat_sum_us / s->xfers), s->lat_max_us);
+}
+#endif
+
+#ifdef USE_USBD_COMPOSITE
+static void print_console_stats(void)
+{
+   static uint32_t last_dropped;
+
+   struct console_stats s;
+   console_get_stats(&s);
+   if (s.dropped == last_dropped)
+      return;
+   last_dropped = s.dropped;
+
+   printf("console: %u kB sent, %u bytes dropped (port not read)\r\n",
+          s.sent / 1024U, s.dropped);
+}
+#endif
+
+static void print_sd_bus(void)
+{
+   static uint32_t last_fallbacks = UINT32_MAX;
+
+   struct sd_bus b;
+   sd_get_bus(&b);
+   if (b.fallbacks == last_fallbacks)
+      return;
+   last_fallbacks = b.fallbacks;
+
+   printf("SD: %u kHz, %s speed", b.clk_hz / 1000U,
+          b.high_speed ? "high" : "default");
+   if (b.tuned)
+      printf(", delay block phase %u/%u", b.phase, b.phases);
+   if (b.fallbacks != 0U)
+      printf(", slowed down %u times on CRC errors", b.fallbacks);
+   printf("\r\n");
+}
+
+#ifdef EMMC_USE
+static void print_emmc(void)
+{
+   struct emmc_info e;
+
+   if (!emmc_ready())
+      return;
+   emmc_get_info(&e);
+   printf("eMMC: %u MB, boot partitions %u kB, %u-bit %s at %u kHz, "
+          "EXT_CSD rev %u\r\n",
+          (unsigned)(e.blk_nbr / 2048U), (unsigned)(e.boot_blk / 2U),
+          (unsigned)e.bus_width,
+          e.ddr ? "DDR" : (e.high_speed ? "SDR" : "legacy timing"),
+          (unsigned)(e.clk_hz / 1000U), (unsigned)e.ext_csd_rev);
+}
+#endif
+
+static void print_cache_stats(void)
+{
+   static struct blkcache_stats last;
+
+   const struct blkcache_stats *s = blkcache_get_stats();
+   if (memcmp(s, &last, sizeof(last)) == 0)
+      return;
+   last = *s;
+
+   printf("cache read: %u hit, %u miss; write: %u hit, %u miss (blocks)\r\n",
+          s->read_hits, s->read_misses, s->write_hits, s->write_misses);
+   printf("cache flush: %u writes, %u blocks (AU %u); %u evictions, %u dirty "
+          "lines\r\n",
+          s->flushes, s->flush_blks, s->au_blks, s->evictions, s->dirty_lines);
+
+   const uint64_t seq = (uint64_t)s->ahead_hits + s->ahead_misses;
+   printf("read-ahead: %u hit, %u miss, %u wasted (blocks), %u%% hit rate; "
+          "%u waits, window %u\r\n",
+          s->ahead_hits, s->ahead_misses, s->ahead_wasted,
+          (seq == 0U) ? 0U : (uint32_t)(s->ahead_hits * 100ULL / seq),
+          s->ahead_waits, s->ahead_window);
+   printf("erase: %u commands, %u zero blocks not written\r\n", s->erases,
+          s->zero_blks);
 }
 
 int main(void)
@@ -85,18 +242,57 @@ int main(void)
    __HAL_RCC_GPIOA_CLK_ENABLE();
    setup_ddr();
    setup_sd();
+#ifdef EMMC_USE
+   setup_emmc();
+#endif
+   if (blkcache_init() != 0) {
+      printf("Error in blkcache_init()\r\n");
+      Error_Handler();
+   }
+#ifdef MSC_BENCH_USE
+   // leaves the benchmark's traffic in the block cache and its statistics
+   bench_msc();
+#endif
    usb_init();
 
    HAL_Delay(1000);
    printf("Hello, world!\r\n");
 
-   // SD and DDR test
-   read_sd_blocking();
+   // SD and DDR test: the IDMA reads straight into DDR
+   if (sd_read((uint8_t *)DRAM_MEM_BASE, 0U, 1U) != 0) {
+      printf("Error in sd_read()\r\n");
+      Error_Handler();
+   }
    print_ddr(BLOCKSIZE / 4);
+   print_sd_bus();
+#ifdef EMMC_USE
+   print_emmc();
+#endif
+
+   uint32_t t_print = HAL_GetTick();
 
    while (1) {
+      // the USB interrupt leaves all media I/O to this loop, so keep it busy
+      usb_process();
+      sd_poll();
+      blkcache_poll();
+      evlog_drain();
+
+      if (HAL_GetTick() - t_print < 1000U)
+         continue;
+      t_print = HAL_GetTick();
+
+#if defined(USB_BENCH_USE)
+      print_bench_stats();
+#elif !defined(FASTBOOT_USE)
+      print_msc_stats();
+#endif
+#ifdef USE_USBD_COMPOSITE
+      print_console_stats();
+#endif
+      print_sd_bus();
+      print_cache_stats();
       printf(":");
       HAL_GPIO_TogglePin(GPIOA, GPIO_PIN_13);
-      HAL_Delay(1000);
    }
 }
@@ -0,0 +1,756 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file sd.c
+ * @brief SD card block device on SDMMC1
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * Transfers use the SDMMC internal DMA (IDMA) in linked-list mode and
+ * complete from the SDMMC1 interrupt. Buffers must be 32-bit aligned;
+ * cacheable ones are maintained here, so they should also start and end on a
+ * cache line.
+ *
+ * Every transfer is a request in one queue. sd_submit() appends it, and the
+ * interrupt that completes one request starts the next, so a chain of reads
+ * runs back to back without the CPU. A request may scatter over several
+ * buffers; each becomes one or more nodes of the IDMA linked list, and the
+ * whole request is a single multi-block command. The blocking calls below
+ * are requests that are waited for.
+ *
+ * After a write the card stays busy programming. Rather than poll for that
+ * in the interrupt, the next request is then started by sd_poll() or a
+ * waiter once CMD13 reports the card ready.
+ *
+ * Multi-block writes announce their length with ACMD23 first, so the card can
+ * pre-erase the whole range instead of merging it block by block.
+ *
+ * sd_config_bus() moves the card from the identification clock to High
+ * Speed when it supports the CMD6 switch, and the SDMMC1 kernel clock (PLL4)
+ * sets how close to 50 MHz the divider can get. At that rate the sampling
+ * point is tuned with the delay block: every phase is tried on a read of the
+ * first blocks, and the middle of the longest passing run is kept. A CRC
+ * error later on halves the clock and retries the request, down to the
+ * default-speed divider.
+ */
+
+#include "sd.h"
+#include "cache.h"
+#include "irq_ctrl.h"
+#include "setup.h"
+#include "stm32mp13xx.h"
+#include "stm32mp13xx_hal.h"
+#include "stm32mp13xx_hal_rcc.h"
+#include "stm32mp13xx_hal_sd.h"
+#include "stm32mp13xx_ll_delayblock.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SD_TIMEOUT_MS       3000U
+#define SD_ERASE_TIMEOUT_MS 30000U
+
+// read while tuning, and how long a try may take at a bad phase
+#define SD_TUNE_BLKS       8U
+#define SD_TUNE_TIMEOUT_MS 50U
+
+// most blocks of a contiguous buffer that fit in one request
+#define SD_REQ_BLKS (SD_MAX_NODES * SD_NODE_BLKS)
+
+// SD Status AU_SIZE codes in blocks; 0 is not defined
+static const uint32_t au_size[16] = {
+    0U,     32U,    64U,    128U,   256U,   512U,   1024U,  2048U,
+    4096U,  8192U,  16384U, 24576U, 32768U, 49152U, 65536U, 131072U};
+
+// linked list of the request on the card; the IDMA fetches it from memory,
+// so it stays out of the cache (one spare entry, see build_list())
+static SD_DMALinkNodeTypeDef nodes[SD_MAX_NODES + 1U] DMA_NC;
+
+// requests, shared with the SDMMC1 interrupt
+static struct {
+   struct sd_req *head; // on the card once started
+   struct sd_req *tail;
+   int started;
+   int err;         // reported ahead of the completion callback
+   int programming; // the card may still be busy with the last write
+   uint32_t t_prog;
+} q;
+
+// background read
+static struct sd_seg bg_seg;
+static struct sd_req bg;
+
+static struct sd_bus bus;
+static int tuning;
+static uint32_t timeout_ms = SD_TIMEOUT_MS;
+
+// tuning reads, compared to what was read at the identification clock
+static uint32_t tune_ref[SD_TUNE_BLKS * BLOCKSIZE / 4U] DMA_NC;
+static uint32_t tune_buf[SD_TUNE_BLKS * BLOCKSIZE / 4U] DMA_NC;
+
+static int set_erase_count(uint32_t blk_len);
+
+static uint32_t lock(void)
+{
+   const uint32_t en = IRQ_GetEnableState(SDMMC1_IRQn);
+   IRQ_Disable(SDMMC1_IRQn);
+   __DSB();
+   __ISB();
+   return en;
+}
+
+static void unlock(const uint32_t en)
+{
+   if (en)
+      IRQ_Enable(SDMMC1_IRQn);
+}
+
+static uint32_t req_blocks(const struct sd_req *req)
+{
+   uint32_t n = 0;
+
+   for (uint32_t i = 0; i < req->num_seg; i++)
+      n += req->seg[i].blk_len;
+   return n;
+}
+
+/**
+ * Describe the segments of a request to the IDMA, splitting those that are
+ * larger than one node can hold.
+ */
+static void build_list(const struct sd_req *req, SD_DMALinkedListTypeDef *list)
+{
+   SD_DMALinkNodeConfTypeDef conf;
+   uint32_t n = 0;
+
+   list->pHeadNode    = NULL;
+   list->pTailNode    = NULL;
+   list->NodesCounter = 0;
+
+   for (uint32_t i = 0; i < req->num_seg; i++) {
+      const struct sd_seg *s = &req->seg[i];
+      for (uint32_t b = 0; b < s->blk_len; b += SD_NODE_BLKS) {
+         const uint32_t left = s->blk_len - b;
+         const uint32_t blks = (left > SD_NODE_BLKS) ? SD_NODE_BLKS : left;
+
+         conf.BufferAddress = (uint32_t)(s->buf + b * BLOCKSIZE);
+         conf.BufferSize    = blks * BLOCKSIZE;
+         (void)HAL_SDEx_DMALinkedList_BuildNode(&nodes[n], &conf);
+         (void)HAL_SDEx_DMALinkedList_InsertNode(list, list->pTailNode,
+                                                 &nodes[n]);
+         n++;
+      }
+   }
+
+   // the HAL loads the head node into the registers and links it to the
+   // next array entry, whatever that holds; make that a harmless copy
+   if (n == 1U)
+      nodes[1] = nodes[0];
+
+   __DSB();
+}
+
+/**
+ * Whether the card has finished programming the last write.
+ */
+static int card_ready(void)
+{
+   if (!q.programming)
+      return 1;
+
+   if ((HAL_SD_GetCardState(&sd_handle) == HAL_SD_CARD_TRANSFER) ||
+       (HAL_GetTick() - q.t_prog > SD_TIMEOUT_MS))
+      q.programming = 0;
+
+   return !q.programming;
+}
+
+static uint32_t kernel_hz(void)
+{
+   return HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_SDMMC1);
+}
+
+/**
+ * SDMMC_CK = kernel / (2 * div), or the kernel clock itself for div = 0.
+ */
+static uint32_t clk_hz(const uint32_t div)
+{
+   return (div == 0U) ? kernel_hz() : kernel_hz() / (2U * div);
+}
+
+static void set_clock(const uint32_t div)
+{
+   MODIFY_REG(sd_handle.Instance->CLKCR, SDMMC_CLKCR_CLKDIV, div);
+   sd_handle.Init.ClockDiv = div;
+   bus.clk_hz              = clk_hz(div);
+}
+
+/**
+ * Sample received data with the delay block output instead of the bus pins.
+ */
+static void sample_delayed(const int on)
+{
+   if (on) {
+      LL_DLYB_Enable(DLYB_SDMMC1);
+      MODIFY_REG(sd_handle.Instance->CLKCR, SDMMC_CLKCR_SELCLKRX,
+                 SDMMC_CLKCR_SELCLKRX_1);
+   } else {
+      MODIFY_REG(sd_handle.Instance->CLKCR, SDMMC_CLKCR_SELCLKRX, 0U);
+      LL_DLYB_Disable(DLYB_SDMMC1);
+   }
+   bus.tuned = on;
+}
+
+/**
+ * After a CRC error, slow the bus down so the failed request can be retried.
+ * Returns 0 once the clock is back at the default-speed divider.
+ */
+static int crc_fallback(void)
+{
+   const uint32_t div = sd_handle.Init.ClockDiv;
+
+   if (tuning || (div >= SDMMC_NSPEED_CLK_DIV) ||
+       !(sd_handle.ErrorCode &
+         (HAL_SD_ERROR_DATA_CRC_FAIL | HAL_SD_ERROR_CMD_CRC_FAIL)))
+      return 0;
+
+   if (bus.tuned)
+      sample_delayed(0);
+   set_clock((div == 0U) ? 1U : 2U * div);
+   bus.fallbacks++;
+   return 1;
+}
+
+/**
+ * Retire the request on the card and tell its owner.
+ */
+static void complete(const int ret)
+{
+   struct sd_req *req = q.head;
+
+   if ((req == NULL) || !q.started)
+      return;
+
+   q.started = 0;
+   q.head    = req->next;
+   if (q.head == NULL)
+      q.tail = NULL;
+
+   if (req->write) {
+      q.programming = 1;
+      q.t_prog      = HAL_GetTick();
+   } else {
+      // lines may have been refilled speculatively during the transfer
+      for (uint32_t i = 0; i < req->num_seg; i++)
+         cache_invalidate(req->seg[i].buf, req->seg[i].blk_len * BLOCKSIZE);
+   }
+
+   req->ret  = ret;
+   req->busy = 0;
+   if (req->done != NULL)
+      req->done(req, ret);
+}
+
+/**
+ * Hand the next request to the card, unless one is running or the card is
+ * still programming. Runs in the interrupt or with it masked.
+ */
+static void start_next(void)
+{
+   while (!q.started && card_ready() && (q.head != NULL)) {
+      struct sd_req *req     = q.head;
+      const uint32_t blk_len = req_blocks(req);
+      SD_DMALinkedListTypeDef list;
+      HAL_StatusTypeDef ret;
+
+      build_list(req, &list);
+      req->t0             = HAL_GetTick();
+      q.err               = 0;
+      q.started           = 1;
+      sd_handle.ErrorCode = HAL_SD_ERROR_NONE;
+
+      if (!req->write)
+         ret = HAL_SDEx_DMALinkedList_ReadBlocks(&sd_handle, &list,
+                                                 req->blk_addr, blk_len);
+      else if (set_erase_count(blk_len) != 0)
+         ret = HAL_ERROR;
+      else
+         ret = HAL_SDEx_DMALinkedList_WriteBlocks(&sd_handle, &list,
+                                                  req->blk_addr, blk_len);
+
+      if (ret != HAL_OK) {
+         if (crc_fallback()) {
+            q.started = 0;
+            continue;
+         }
+         complete(-1);
+      }
+   }
+}
+
+/**
+ * Wait until nothing is queued and the card takes commands again.
+ */
+static void sd_idle(void)
+{
+   while ((q.head != NULL) || q.programming)
+      sd_poll();
+}
+
+void SDMMC1_IRQHandler(void)
+{
+   HAL_SD_IRQHandler(&sd_handle);
+}
+
+void HAL_SD_RxCpltCallback(SD_HandleTypeDef *hsd)
+{
+   (void)hsd;
+   complete(q.err ? -1 : 0);
+   start_next();
+}
+
+void HAL_SD_TxCpltCallback(SD_HandleTypeDef *hsd)
+{
+   (void)hsd;
+   complete(q.err ? -1 : 0);
+   start_next();
+}
+
+void HAL_SD_ErrorCallback(SD_HandleTypeDef *hsd)
+{
+   // a failed CMD12 is reported while busy, and the completion follows
+   if (hsd->State == HAL_SD_STATE_BUSY) {
+      q.err = 1;
+      return;
+   }
+
+   // retry the request on a slower clock
+   if (q.started && crc_fallback()) {
+      q.started = 0;
+      start_next();
+      return;
+   }
+
+   complete(-1);
+   start_next();
+}
+
+/**
+ * ACMD23: tell the card how many blocks the next multi-block write covers,
+ * so it can erase them all up front.
+ */
+static int set_erase_count(const uint32_t blk_len)
+{
+   SDMMC_CmdInitTypeDef cmd;
+
+   if (SDMMC_CmdAppCommand(sd_handle.Instance,
+                           (uint32_t)sd_handle.SdCard.RelCardAdd << 16U) !=
+       HAL_SD_ERROR_NONE)
+      return -1;
+
+   cmd.Argument         = blk_len & 0x7FFFFFU;
+   cmd.CmdIndex         = SDMMC_CMD_SET_BLOCK_COUNT;
+   cmd.Response         = SDMMC_RESPONSE_SHORT;
+   cmd.WaitForInterrupt = SDMMC_WAIT_NO;
+   cmd.CPSM             = SDMMC_CPSM_ENABLE;
+   (void)SDMMC_SendCommand(sd_handle.Instance, &cmd);
+
+   if (SDMMC_GetCmdResp1(sd_handle.Instance, SDMMC_CMD_SET_BLOCK_COUNT,
+                         SDMMC_CMDTIMEOUT) != HAL_SD_ERROR_NONE)
+      return -1;
+
+   return 0;
+}
+
+/**
+ * ACMD51: read the SD Configuration Register; scr[0] gets bits 63..32.
+ */
+static int read_scr(uint32_t scr[2])
+{
+   SDMMC_TypeDef *const sdmmc = sd_handle.Instance;
+   SDMMC_DataInitTypeDef config;
+   uint32_t raw[2]    = {0U, 0U};
+   const uint32_t t0  = HAL_GetTick();
+   int got            = 0;
+
+   if ((SDMMC_CmdBlockLength(sdmmc, 8U) != HAL_SD_ERROR_NONE) ||
+       (SDMMC_CmdAppCommand(sdmmc,
+                            (uint32_t)sd_handle.SdCard.RelCardAdd << 16U) !=
+        HAL_SD_ERROR_NONE))
+      return -1;
+
+   config.DataTimeOut   = SDMMC_DATATIMEOUT;
+   config.DataLength    = 8U;
+   config.DataBlockSize = SDMMC_DATABLOCK_SIZE_8B;
+   config.TransferDir   = SDMMC_TRANSFER_DIR_TO_SDMMC;
+   config.TransferMode  = SDMMC_TRANSFER_MODE_BLOCK;
+   config.DPSM          = SDMMC_DPSM_ENABLE;
+   (void)SDMMC_ConfigData(sdmmc, &config);
+
+   if (SDMMC_CmdSendSCR(sdmmc) != HAL_SD_ERROR_NONE)
+      return -1;
+
+   while (!__HAL_SD_GET_FLAG(&sd_handle,
+                             SDMMC_FLAG_RXOVERR | SDMMC_FLAG_DCRCFAIL |
+                                 SDMMC_FLAG_DTIMEOUT | SDMMC_FLAG_DBCKEND |
+                                 SDMMC_FLAG_DATAEND)) {
+      if (!got && !__HAL_SD_GET_FLAG(&sd_handle, SDMMC_FLAG_RXFIFOE)) {
+         raw[0] = SDMMC_ReadFIFO(sdmmc);
+         raw[1] = SDMMC_ReadFIFO(sdmmc);
+         got    = 1;
+      }
+      if (HAL_GetTick() - t0 > SD_TIMEOUT_MS)
+         return -1;
+   }
+
+   const int err = __HAL_SD_GET_FLAG(&sd_handle, SDMMC_FLAG_RXOVERR |
+                                                     SDMMC_FLAG_DCRCFAIL |
+                                                     SDMMC_FLAG_DTIMEOUT);
+   __HAL_SD_CLEAR_FLAG(&sd_handle, SDMMC_STATIC_DATA_FLAGS);
+
+   // back to the block size of the data transfers
+   if (err || (SDMMC_CmdBlockLength(sdmmc, BLOCKSIZE) != HAL_SD_ERROR_NONE))
+      return -1;
+
+   // the register arrives most significant byte first
+   scr[0] = __REV(raw[0]);
+   scr[1] = __REV(raw[1]);
+   return 0;
+}
+
+/**
+ * Whether the first blocks read back as they did at the identification clock.
+ */
+static int probe(void)
+{
+   memset(tune_buf, 0, sizeof(tune_buf));
+   return (sd_read((uint8_t *)tune_buf, 0U, SD_TUNE_BLKS) == 0) &&
+          (memcmp(tune_buf, tune_ref, sizeof(tune_buf)) == 0);
+}
+
+/**
+ * Sweep the delay block over one clock period and settle in the middle of
+ * the widest window of good reads.
+ */
+static int tune(void)
+{
+   LL_DLYB_CfgTypeDef cfg;
+   uint32_t best = 0U, best_len = 0U, run = 0U;
+
+   LL_DLYB_Enable(DLYB_SDMMC1);
+   if ((LL_DLYB_GetClockPeriod(DLYB_SDMMC1, &cfg) != SUCCESS) ||
+       (cfg.PhaseSel == 0U)) {
+      LL_DLYB_Disable(DLYB_SDMMC1);
+      return -1;
+   }
+   bus.phases = (cfg.PhaseSel > DLYB_MAX_SELECT) ? DLYB_MAX_SELECT
+                                                 : cfg.PhaseSel;
+
+   sample_delayed(1);
+   for (uint32_t sel = 0U; sel < bus.phases; sel++) {
+      cfg.PhaseSel = sel;
+      LL_DLYB_SetDelay(DLYB_SDMMC1, &cfg);
+      if (probe()) {
+         if (++run > best_len) {
+            best_len = run;
+            best     = sel + 1U - run;
+         }
+      } else {
+         run = 0U;
+      }
+   }
+
+   if (best_len == 0U)
+      return -1;
+
+   bus.phase    = best + best_len / 2U;
+   cfg.PhaseSel = bus.phase;
+   LL_DLYB_SetDelay(DLYB_SDMMC1, &cfg);
+   return probe() ? 0 : -1;
+}
+
+uint32_t sd_clk_div(const uint32_t max_hz)
+{
+   const uint32_t kernel = kernel_hz();
+
+   if (kernel <= max_hz)
+      return 0U;
+
+   return (kernel + 2U * max_hz - 1U) / (2U * max_hz);
+}
+
+int sd_config_bus(void)
+{
+   bus.clk_hz = clk_hz(sd_handle.Init.ClockDiv);
+
+   // reference data at the clock the card came up with
+   if (sd_read((uint8_t *)tune_ref, 0U, SD_TUNE_BLKS) != 0)
+      return -1;
+
+   if ((sd_handle.SdCard.CardSpeed == CARD_NORMAL_SPEED) ||
+       (HAL_SD_ConfigSpeedBusOperation(&sd_handle, SDMMC_SPEED_MODE_HIGH) !=
+        HAL_OK))
+      return 0;
+
+   bus.high_speed = 1;
+   set_clock(sd_clk_div(SD_HIGH_SPEED_HZ));
+
+   tuning     = 1;
+   timeout_ms = SD_TUNE_TIMEOUT_MS;
+   if (tune() != 0) {
+      sample_delayed(0);
+      if (!probe())
+         set_clock(sd_clk_div(SD_DEFAULT_SPEED_HZ));
+   }
+   tuning     = 0;
+   timeout_ms = SD_TIMEOUT_MS;
+
+   return 0;
+}
+
+void sd_get_bus(struct sd_bus *b)
+{
+   *b = bus;
+}
+
+int sd_ready(void)
+{
+   return HAL_SD_GetState(&sd_handle) != HAL_SD_STATE_RESET;
+}
+
+int sd_get_capacity(uint32_t *blk_nbr, uint32_t *blk_size)
+{
+   HAL_SD_CardInfoTypeDef info;
+
+   if (HAL_SD_GetCardInfo(&sd_handle, &info) != HAL_OK)
+      return -1;
+
+   *blk_nbr  = info.LogBlockNbr;
+   *blk_size = info.LogBlockSize;
+   return 0;
+}
+
+int sd_get_au(uint32_t *blk_nbr)
+{
+   HAL_SD_CardStatusTypeDef status;
+
+   sd_idle();
+   if (HAL_SD_GetCardStatus(&sd_handle, &status) != HAL_OK)
+      return -1;
+
+   *blk_nbr = au_size[status.AllocationUnitSize & 0xFU];
+   return (*blk_nbr == 0U) ? -1 : 0;
+}
+
+int sd_get_erased(uint8_t *val)
+{
+   uint32_t scr[2];
+
+   sd_idle();
+   if (read_scr(scr) != 0)
+      return -1;
+
+   // DATA_STAT_AFTER_ERASE, SCR bit 55
+   *val = ((scr[0] >> 23) & 1U) ? 0xFFU : 0x00U;
+   return 0;
+}
+
+int sd_erase(uint32_t blk_addr, uint32_t blk_len)
+{
+   sd_idle();
+
+   const uint32_t t0 = HAL_GetTick();
+   if (HAL_SD_Erase(&sd_handle, blk_addr, blk_addr + blk_len - 1U) != HAL_OK)
+      return -1;
+
+   // the card signals busy until the range is erased
+   while (HAL_SD_GetCardState(&sd_handle) != HAL_SD_CARD_TRANSFER) {
+      if (HAL_GetTick() - t0 > SD_ERASE_TIMEOUT_MS)
+         return -1;
+   }
+
+   return 0;
+}
+
+/**
+ * Move a contiguous buffer in requests of up to SD_REQ_BLKS blocks and wait
+ * for them.
+ */
+static int transfer(uint8_t *buf, uint32_t blk_addr, uint32_t blk_len,
+                    const int write)
+{
+   struct sd_seg seg;
+   struct sd_req req;
+
+   while (blk_len > 0U) {
+      seg.buf      = buf;
+      seg.blk_len  = (blk_len > SD_REQ_BLKS) ? SD_REQ_BLKS : blk_len;
+      req.blk_addr = blk_addr;
+      req.seg      = &seg;
+      req.num_seg  = 1U;
+      req.write    = write;
+      req.done     = NULL;
+
+      if ((sd_submit(&req) != 0) || (sd_req_wait(&req) != 0))
+         return -1;
+
+      buf += seg.blk_len * BLOCKSIZE;
+      blk_addr += seg.blk_len;
+      blk_len -= seg.blk_len;
+   }
+
+   return 0;
+}
+
+int sd_read(uint8_t *buf, uint32_t blk_addr, uint32_t blk_len)
+{
+   return transfer(buf, blk_addr, blk_len, 0);
+}
+
+int sd_write(const uint8_t *buf, uint32_t blk_addr, uint32_t blk_len)
+{
+   return transfer((uint8_t *)buf, blk_addr, blk_len, 1);
+}
+
+int sd_submit(struct sd_req *req)
+{
+   uint32_t n = 0;
+
+   if (req->num_seg == 0U)
+      return -1;
+
+   for (uint32_t i = 0; i < req->num_seg; i++) {
+      const struct sd_seg *s = &req->seg[i];
+      if ((s->blk_len == 0U) || (((uint32_t)s->buf & 3U) != 0U))
+         return -1;
+      n += (s->blk_len + SD_NODE_BLKS - 1U) / SD_NODE_BLKS;
+   }
+   if (n > SD_MAX_NODES)
+      return -1;
+
+   for (uint32_t i = 0; i < req->num_seg; i++) {
+      const struct sd_seg *s = &req->seg[i];
+      if (req->write)
+         cache_clean(s->buf, s->blk_len * BLOCKSIZE);
+      else
+         cache_invalidate(s->buf, s->blk_len * BLOCKSIZE);
+   }
+
+   req->next = NULL;
+   req->ret  = 0;
+   req->busy = 1;
+
+   const uint32_t en = lock();
+   if (q.tail != NULL)
+      q.tail->next = req;
+   else
+      q.head = req;
+   q.tail = req;
+   start_next();
+   unlock(en);
+
+   return 0;
+}
+
+int sd_req_wait(struct sd_req *req)
+{
+   while (req->busy)
+      sd_poll();
+
+   return req->ret;
+}
+
+void sd_cancel(struct sd_req *req)
+{
+   const uint32_t en = lock();
+
+   if (!req->busy) {
+      unlock(en);
+      return;
+   }
+
+   if ((req == q.head) && q.started) {
+      HAL_SD_Abort(&sd_handle);
+      complete(-1);
+   } else {
+      // still queued: unlink it
+      struct sd_req *prev = NULL;
+      for (struct sd_req *r = q.head; r != req; r = r->next)
+         prev = r;
+
+      if (prev == NULL)
+         q.head = req->next;
+      else
+         prev->next = req->next;
+      if (q.tail == req)
+         q.tail = prev;
+
+      req->ret  = -1;
+      req->busy = 0;
+      if (req->done != NULL)
+         req->done(req, -1);
+   }
+
+   start_next();
+   unlock(en);
+}
+
+void sd_poll(void)
+{
+   // Called from the USB interrupt, the SDMMC interrupt cannot preempt us
+   // (no nesting), so run its handler here when it is pending
+   if (((__get_CPSR() & CPSR_I_Msk) != 0U) &&
+       (IRQ_GetPending(SDMMC1_IRQn) != 0U))
+      HAL_SD_IRQHandler(&sd_handle);
+
+   const uint32_t en = lock();
+   if (q.started && (HAL_GetTick() - q.head->t0 > timeout_ms)) {
+      HAL_SD_Abort(&sd_handle);
+      complete(-1);
+   }
+   start_next();
+   unlock(en);
+}
+
+int sd_read_start(uint8_t *buf, uint32_t blk_addr, uint32_t blk_len)
+{
+   // one background read at a time
+   if (bg.busy)
+      (void)sd_req_wait(&bg);
+
+   bg_seg.buf     = buf;
+   bg_seg.blk_len = blk_len;
+   bg.blk_addr    = blk_addr;
+   bg.seg         = &bg_seg;
+   bg.num_seg     = 1U;
+   bg.write       = 0;
+   bg.done        = NULL;
+
+   if (sd_submit(&bg) != 0) {
+      bg.ret = -1;
+      return -1;
+   }
+
+   return 0;
+}
+
+int sd_read_done(void)
+{
+   sd_poll();
+   if (bg.busy)
+      return 0;
+
+   return (bg.ret == 0) ? 1 : -1;
+}
+
+int sd_read_wait(void)
+{
+   return sd_req_wait(&bg);
+}
+
+void sd_read_cancel(void)
+{
+   sd_cancel(&bg);
+}
+
+// end file sd.c
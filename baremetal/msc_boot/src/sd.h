@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file sd.h
+ * @brief SD card block device on SDMMC1
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ */
+
+#ifndef SD_H
+#define SD_H
+
+#include <stdint.h>
+
+void SDMMC1_IRQHandler(void);
+
+int sd_ready(void);
+int sd_get_capacity(uint32_t *blk_nbr, uint32_t *blk_size);
+int sd_get_au(uint32_t *blk_nbr);
+int sd_get_erased(uint8_t *val);
+int sd_erase(uint32_t blk_addr, uint32_t blk_len);
+int sd_read(uint8_t *buf, uint32_t blk_addr, uint32_t blk_len);
+int sd_write(const uint8_t *buf, uint32_t blk_addr, uint32_t blk_len);
+
+// IDMA linked-list nodes per request; each covers up to SD_NODE_BLKS blocks
+#define SD_MAX_NODES 64U
+#define SD_NODE_BLKS 255U
+
+// one piece of a scattered transfer; buf must be 32-bit aligned
+struct sd_seg {
+   uint8_t *buf;
+   uint32_t blk_len;
+};
+
+// blk_addr onwards to or from the segments in order, as one card command
+struct sd_req {
+   uint32_t blk_addr;
+   const struct sd_seg *seg; // must stay valid until done
+   uint32_t num_seg;
+   int write;
+
+   // called from the SDMMC1 interrupt with 0 or -1; may submit again
+   void (*done)(struct sd_req *req, int ret);
+   void *arg;
+
+   // owned by sd.c while busy
+   struct sd_req *next;
+   uint32_t t0;
+   volatile int busy;
+   volatile int ret;
+};
+
+// queue a request behind the ones already submitted; -1 if it is malformed
+// or needs more than SD_MAX_NODES nodes
+int sd_submit(struct sd_req *req);
+
+// block until the request has completed; returns its result
+int sd_req_wait(struct sd_req *req);
+
+// drop a request; if it is on the card, the transfer is aborted
+void sd_cancel(struct sd_req *req);
+
+// time out a stuck transfer and start the next one after a write; call from
+// the main loop
+void sd_poll(void);
+
+// background read: start it, then poll sd_read_done() (1 done, 0 running, -1
+// failed) or block in sd_read_wait() (0 done, -1 failed)
+int sd_read_start(uint8_t *buf, uint32_t blk_addr, uint32_t blk_len);
+int sd_read_done(void);
+int sd_read_wait(void);
+void sd_read_cancel(void);
+
+// bus clock limits of the default and High Speed modes
+#define SD_DEFAULT_SPEED_HZ 25000000U
+#define SD_HIGH_SPEED_HZ    50000000U
+
+struct sd_bus {
+   uint32_t clk_hz;     // SDMMC_CK
+   int high_speed;      // card switched to High Speed with CMD6
+   int tuned;           // sampling through the delay block
+   uint32_t phase;      // delay block phase in use,
+   uint32_t phases;     // of this many per clock period
+   uint32_t fallbacks;  // CRC errors that slowed the bus down
+};
+
+// SDMMC_CLKCR.CLKDIV for the fastest clock not above max_hz
+uint32_t sd_clk_div(uint32_t max_hz);
+
+// after HAL_SD_Init(): switch to High Speed if the card has it, raise the
+// clock and tune the sampling point; stays at default speed on failure
+int sd_config_bus(void);
+
+void sd_get_bus(struct sd_bus *b);
+
+#endif // SD_H
+
+// end file sd.h
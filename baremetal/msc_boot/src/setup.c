@@ -8,6 +8,11 @@
  */
 
 #include "setup.h"
+#include "irq_ctrl.h"
+#include "sd.h"
+#ifdef EMMC_USE
+#include "emmc.h"
+#endif
 #include "stm32mp135fxx_ca7.h"
 #include "stm32mp13xx.h"
 #include "stm32mp13xx_hal.h"
@@ -24,8 +29,23 @@
 #include "usbd_core.h"
 #include "usbd_def.h"
 #include "usbd_desc.h"
+#ifdef FASTBOOT_USE
+#include "usbd_fastboot.h"
+#include "usbd_fastboot_storage.h"
+#elif defined(USB_BENCH_USE)
+#include "usbd_bench.h"
+#else
 #include "usbd_msc.h"
 #include "usbd_msc_storage.h"
+#endif
+#ifdef USE_USBD_COMPOSITE
+#if defined(FASTBOOT_USE) || defined(USB_BENCH_USE)
+#error "the USB console (CDC=1) is only available with mass storage"
+#endif
+#include "console.h"
+#include "usbd_cdc.h"
+#include "usbd_composite_builder.h"
+#endif
 #include <stdint.h>
 #include "printf.h"
 
@@ -207,7 +227,13 @@ void PeriphCommonClock_Config(void)
    }
 
    pclk.PeriphClockSelection = RCC_PERIPHCLK_SDMMC2;
+#ifdef EMMC_USE
+   // HCLK6 as in the CubeMX project, for eMMC High Speed (PLL4P at 48 MHz
+   // would leave DDR52 at 24 MHz)
+   pclk.Sdmmc2ClockSelection = RCC_SDMMC2CLKSOURCE_HCLK6;
+#else
    pclk.Sdmmc2ClockSelection = RCC_SDMMC2CLKSOURCE_PLL4;
+#endif
    if (HAL_RCCEx_PeriphCLKConfig(&pclk) != HAL_OK) {
       error_msg("SDMMC2");
    }
@@ -379,6 +405,10 @@ void HAL_SD_MspInit(SD_HandleTypeDef *hsd)
    gpio_init.Alternate = GPIO_AF12_SDIO1;
    gpio_init.Pin       = GPIO_PIN_2;
    HAL_GPIO_Init(GPIOD, &gpio_init);
+
+   /* SDMMC1 interrupt signals DMA transfer completion */
+   IRQ_SetPriority(SDMMC1_IRQn, 6);
+   IRQ_Enable(SDMMC1_IRQn);
 }
 
 void MX_UART4_Init(void)
@@ -413,11 +443,26 @@ void MX_UART4_Init(void)
 
 void _putchar(char ch)
 {
+#ifdef USE_USBD_COMPOSITE
+   // the USB serial port, while the host has it open
+   if (console_putchar(ch) == 0)
+      return;
+#endif
    HAL_UART_Transmit(&huart4, (uint8_t *)(&ch), 1, 0xFFFF);
 }
 
 int __io_getchar(void)
 {
+#ifdef USE_USBD_COMPOSITE
+   while (console_is_open()) {
+      const int c = console_getchar();
+      if (c >= 0) {
+         console_putchar((char)c);
+         return c;
+      }
+      usb_process_console();
+   }
+#endif
    uint8_t ch = 0;
    __HAL_UART_CLEAR_OREFLAG(&huart4);
    HAL_UART_Receive(&huart4, &ch, 1, 0xFFFF);
@@ -439,12 +484,13 @@ void setup_sd(void)
    sd_handle.Instance = SDMMC1;
    HAL_SD_DeInit(&sd_handle);
 
-   // SDMMC IP clock xx MHz, SDCard clock xx MHz
+   // kernel clock from PLL4P; identify at default speed, then let
+   // sd_config_bus() move to High Speed
    sd_handle.Init.ClockEdge           = SDMMC_CLOCK_EDGE_RISING;
    sd_handle.Init.ClockPowerSave      = SDMMC_CLOCK_POWER_SAVE_DISABLE;
    sd_handle.Init.BusWide             = SDMMC_BUS_WIDE_4B;
    sd_handle.Init.HardwareFlowControl = SDMMC_HARDWARE_FLOW_CONTROL_DISABLE;
-   sd_handle.Init.ClockDiv            = SDMMC_NSPEED_CLK_DIV;
+   sd_handle.Init.ClockDiv            = sd_clk_div(SD_DEFAULT_SPEED_HZ);
 
    if (HAL_SD_Init(&sd_handle) != HAL_OK) {
       error_msg("HAL_SD_Init");
@@ -452,14 +498,143 @@ void setup_sd(void)
 
    while (HAL_SD_GetCardState(&sd_handle) != HAL_SD_CARD_TRANSFER)
       ;
+
+   if (sd_config_bus() != 0)
+      error_msg("sd_config_bus");
+}
+
+#ifdef EMMC_USE
+void setup_emmc(void)
+{
+   // unsecure SDMMC2, like SDMMC1
+   LL_ETZPC_Set_SDMMC2_PeriphProtection(
+       ETZPC, LL_ETZPC_PERIPH_PROTECTION_READ_WRITE_NONSECURE);
+
+   __HAL_RCC_SDMMC2_CLK_ENABLE();
+   __HAL_RCC_SDMMC2_FORCE_RESET();
+   __HAL_RCC_SDMMC2_RELEASE_RESET();
+
+   __HAL_RCC_GPIOB_CLK_ENABLE();
+   __HAL_RCC_GPIOC_CLK_ENABLE();
+   __HAL_RCC_GPIOE_CLK_ENABLE();
+   __HAL_RCC_GPIOF_CLK_ENABLE();
+   __HAL_RCC_GPIOG_CLK_ENABLE();
+
+   // UNVERIFIED: pins as in ST's STM32MP13 device tree (sdmmc2_b4_pins_a
+   // and sdmmc2_d47_pins_a). The board's CubeMX project assigns no SDMMC2
+   // pins, so check these against the schematic of the eMMC board revision
+   // before building with EMMC=1 for it.
+   GPIO_InitTypeDef gpio_init;
+   gpio_init.Mode      = GPIO_MODE_AF_PP;
+   gpio_init.Pull      = GPIO_PULLUP;
+   gpio_init.Speed     = GPIO_SPEED_FREQ_VERY_HIGH;
+   gpio_init.Alternate = GPIO_AF10_SDIO2;
+
+   /* D0 D1 D2 D3 D5 on PB14 PB15 PB3 PB4 PB9 */
+   gpio_init.Pin = GPIO_PIN_14 | GPIO_PIN_15 | GPIO_PIN_3 | GPIO_PIN_4 |
+                   GPIO_PIN_9;
+   HAL_GPIO_Init(GPIOB, &gpio_init);
+
+   /* D6 D7 on PC6 PC7 */
+   gpio_init.Pin = GPIO_PIN_6 | GPIO_PIN_7;
+   HAL_GPIO_Init(GPIOC, &gpio_init);
+
+   /* D4 on PF0 */
+   gpio_init.Pin = GPIO_PIN_0;
+   HAL_GPIO_Init(GPIOF, &gpio_init);
+
+   /* CMD on PG6 */
+   gpio_init.Pin = GPIO_PIN_6;
+   HAL_GPIO_Init(GPIOG, &gpio_init);
+
+   /* CK on PE3, no pull */
+   gpio_init.Pull = GPIO_NOPULL;
+   gpio_init.Pin  = GPIO_PIN_3;
+   HAL_GPIO_Init(GPIOE, &gpio_init);
+
+   // boards without the eMMC still boot; its LUNs report no medium
+   if (emmc_init() != 0)
+      printf("eMMC not found on SDMMC2\r\n");
+}
+#endif
+
+uint32_t get_time_us(void)
+{
+   // same time base as HAL_GetTick(), the free-running STGEN counter
+   if ((RCC->STGENCKSELR & RCC_STGENCKSELR_STGENSRC) ==
+       RCC_STGENCLKSOURCE_HSE) {
+      return (uint32_t)(PL1_GetCurrentPhysicalValue() / (HSE_VALUE / 1000000UL));
+   } else {
+      return (uint32_t)(PL1_GetCurrentPhysicalValue() / (HSI_VALUE / 1000000UL));
+   }
 }
 
 void usb_init(void)
 {
    USBD_Init(&usbd_device, &MSC_Desc, 0);
+#ifdef FASTBOOT_USE
+   USBD_RegisterClass(&usbd_device, USBD_FASTBOOT_CLASS);
+   USBD_FASTBOOT_RegisterInterface(&usbd_device, &USBD_FASTBOOT_fops);
+#elif defined(USB_BENCH_USE)
+   USBD_RegisterClass(&usbd_device, USBD_BENCH_CLASS);
+#elif defined(USE_USBD_COMPOSITE)
+   // mass storage on interface 0, the serial console on 1 and 2; the MSC
+   // data endpoints come first so the BOT code finds them
+   static uint8_t msc_ep[] = {MSC_EPIN_ADDR, MSC_EPOUT_ADDR, MSC_UAS_STATUS_EP,
+                              MSC_UAS_CMD_EP};
+   static uint8_t cdc_ep[] = {CDC_IN_EP, CDC_OUT_EP, CDC_CMD_EP};
+
+   USBD_RegisterClassComposite(&usbd_device, USBD_MSC_CLASS, CLASS_TYPE_MSC,
+                               msc_ep);
+   USBD_CMPSIT_SetClassID(&usbd_device, CLASS_TYPE_MSC, 0);
+   USBD_MSC_RegisterStorage(&usbd_device, &USBD_MSC_fops);
+
+   USBD_RegisterClassComposite(&usbd_device, USBD_CDC_CLASS, CLASS_TYPE_CDC,
+                               cdc_ep);
+   USBD_CMPSIT_SetClassID(&usbd_device, CLASS_TYPE_CDC, 0);
+   USBD_CDC_RegisterInterface(&usbd_device, &console_fops);
+#else
    USBD_RegisterClass(&usbd_device, USBD_MSC_CLASS);
    USBD_MSC_RegisterStorage(&usbd_device, &USBD_MSC_fops);
+#endif
    USBD_Start(&usbd_device);
 }
 
+void usb_process(void)
+{
+   // the class state is shared with the OTG interrupt, so hold it off (and
+   // only it) while the deferred work runs
+   IRQ_Disable(OTG_IRQn);
+   __DSB();
+   __ISB();
+#ifdef FASTBOOT_USE
+   USBD_FASTBOOT_Process(&usbd_device);
+#elif defined(USB_BENCH_USE)
+   // the benchmark class does all its work in the interrupt
+#elif defined(USE_USBD_COMPOSITE)
+   // the classes find their state through classId
+   USBD_CMPSIT_SetClassID(&usbd_device, CLASS_TYPE_MSC, 0);
+   USBD_MSC_Process(&usbd_device);
+   USBD_CMPSIT_SetClassID(&usbd_device, CLASS_TYPE_CDC, 0);
+   USBD_CDC_Process(&usbd_device);
+#else
+   USBD_MSC_Process(&usbd_device);
+#endif
+   IRQ_Enable(OTG_IRQn);
+}
+
+#ifdef USE_USBD_COMPOSITE
+void usb_process_console(void)
+{
+   // only the serial port, so it can drain from within printf() without
+   // running SCSI commands there
+   IRQ_Disable(OTG_IRQn);
+   __DSB();
+   __ISB();
+   USBD_CMPSIT_SetClassID(&usbd_device, CLASS_TYPE_CDC, 0);
+   USBD_CDC_Process(&usbd_device);
+   IRQ_Enable(OTG_IRQn);
+}
+#endif
+
 // end file setup.c
@@ -15,9 +15,11 @@
 #include "stm32mp13xx_hal_pcd.h"
 #include "stm32mp13xx_hal_sd.h"
 #include "stm32mp13xx_hal_uart.h"
+#include "usbd_def.h"
 
 // global variables
 extern SD_HandleTypeDef sd_handle;
+extern USBD_HandleTypeDef usbd_device;
 
 // clocks and memory
 void SystemClock_Config(void);
@@ -36,12 +38,20 @@ void MX_UART4_Init(void);
 int __io_putchar(int ch);
 int __io_getchar(void);
 void Error_Handler(void);
+uint32_t get_time_us(void);
 
 // SD
 void setup_sd(void);
 
+// eMMC
+#ifdef EMMC_USE
+void setup_emmc(void);
+#endif
+
 // USB
 void usb_init(void);
+void usb_process(void);
+void usb_process_console(void);
 
 #endif // SETUP_H
 
@@ -0,0 +1,211 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file sha256.c
+ * @brief SHA-256 digest, on the HASH1 peripheral or in software
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ */
+
+#include "sha256.h"
+#include <stdint.h>
+#include <string.h>
+
+#ifdef HASH_HW_USE
+
+#include "stm32mp13xx.h"
+#include "stm32mp13xx_hal_rcc.h"
+
+// CR.ALGO for SHA2-256; byte data, so the peripheral swaps each word
+#define HASH_ALGO_SHA256 (HASH_CR_ALGO_1 | HASH_CR_ALGO_0)
+#define HASH_DATATYPE_8B HASH_CR_DATATYPE_1
+
+void sha256_init(struct sha256_ctx *ctx)
+{
+   __HAL_RCC_HASH1_CLK_ENABLE();
+
+   ctx->len     = 0U;
+   ctx->buf_len = 0U;
+
+   HASH->CR = HASH_ALGO_SHA256 | HASH_DATATYPE_8B;
+   HASH->CR |= HASH_CR_INIT;
+}
+
+// a full input FIFO stalls the write until the core has taken the block,
+// which is also what the HAL's polling mode relies on
+static void hash_write(const uint8_t *p)
+{
+   uint32_t w;
+   memcpy(&w, p, 4U);
+   HASH->DIN = w;
+}
+
+void sha256_update(struct sha256_ctx *ctx, const uint8_t *data, uint32_t len)
+{
+   ctx->len += len;
+
+   // complete a word left over from the previous call
+   while ((ctx->buf_len > 0U) && (len > 0U)) {
+      ctx->buf[ctx->buf_len++] = *data++;
+      len--;
+      if (ctx->buf_len == 4U) {
+         hash_write(ctx->buf);
+         ctx->buf_len = 0U;
+      }
+   }
+
+   for (; len >= 4U; len -= 4U, data += 4U)
+      hash_write(data);
+
+   memcpy(ctx->buf, data, len);
+   ctx->buf_len = len;
+}
+
+void sha256_final(struct sha256_ctx *ctx, uint8_t out[SHA256_SIZE])
+{
+   // valid bits in the last word, 0 meaning all 32
+   if (ctx->buf_len > 0U) {
+      memset(&ctx->buf[ctx->buf_len], 0, 4U - ctx->buf_len);
+      hash_write(ctx->buf);
+   }
+   HASH->STR = (ctx->buf_len * 8U) & HASH_STR_NBLW;
+   HASH->STR |= HASH_STR_DCAL;
+
+   while ((HASH->SR & HASH_SR_DCIS) == 0U) {
+   }
+
+   for (uint32_t i = 0U; i < 8U; i++) {
+      const uint32_t w = HASH_DIGEST->HR[i];
+      out[(4U * i) + 0U] = (uint8_t)(w >> 24);
+      out[(4U * i) + 1U] = (uint8_t)(w >> 16);
+      out[(4U * i) + 2U] = (uint8_t)(w >> 8);
+      out[(4U * i) + 3U] = (uint8_t)w;
+   }
+}
+
+#else // HASH_HW_USE
+
+static const uint32_t k[64] = {
+    0x428a2f98U, 0x71374491U, 0xb5c0fbcfU, 0xe9b5dba5U, 0x3956c25bU,
+    0x59f111f1U, 0x923f82a4U, 0xab1c5ed5U, 0xd807aa98U, 0x12835b01U,
+    0x243185beU, 0x550c7dc3U, 0x72be5d74U, 0x80deb1feU, 0x9bdc06a7U,
+    0xc19bf174U, 0xe49b69c1U, 0xefbe4786U, 0x0fc19dc6U, 0x240ca1ccU,
+    0x2de92c6fU, 0x4a7484aaU, 0x5cb0a9dcU, 0x76f988daU, 0x983e5152U,
+    0xa831c66dU, 0xb00327c8U, 0xbf597fc7U, 0xc6e00bf3U, 0xd5a79147U,
+    0x06ca6351U, 0x14292967U, 0x27b70a85U, 0x2e1b2138U, 0x4d2c6dfcU,
+    0x53380d13U, 0x650a7354U, 0x766a0abbU, 0x81c2c92eU, 0x92722c85U,
+    0xa2bfe8a1U, 0xa81a664bU, 0xc24b8b70U, 0xc76c51a3U, 0xd192e819U,
+    0xd6990624U, 0xf40e3585U, 0x106aa070U, 0x19a4c116U, 0x1e376c08U,
+    0x2748774cU, 0x34b0bcb5U, 0x391c0cb3U, 0x4ed8aa4aU, 0x5b9cca4fU,
+    0x682e6ff3U, 0x748f82eeU, 0x78a5636fU, 0x84c87814U, 0x8cc70208U,
+    0x90befffaU, 0xa4506cebU, 0xbef9a3f7U, 0xc67178f2U,
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32U - (n))))
+
+static void sha256_block(uint32_t h[8], const uint8_t *p)
+{
+   uint32_t w[64];
+
+   for (uint32_t i = 0U; i < 16U; i++)
+      w[i] = ((uint32_t)p[4U * i] << 24) | ((uint32_t)p[(4U * i) + 1U] << 16) |
+             ((uint32_t)p[(4U * i) + 2U] << 8) | (uint32_t)p[(4U * i) + 3U];
+
+   for (uint32_t i = 16U; i < 64U; i++) {
+      const uint32_t s0 =
+          ROR(w[i - 15U], 7U) ^ ROR(w[i - 15U], 18U) ^ (w[i - 15U] >> 3);
+      const uint32_t s1 =
+          ROR(w[i - 2U], 17U) ^ ROR(w[i - 2U], 19U) ^ (w[i - 2U] >> 10);
+      w[i] = w[i - 16U] + s0 + w[i - 7U] + s1;
+   }
+
+   uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+   uint32_t e = h[4], f = h[5], g = h[6], hh = h[7];
+
+   for (uint32_t i = 0U; i < 64U; i++) {
+      const uint32_t t1 = hh + (ROR(e, 6U) ^ ROR(e, 11U) ^ ROR(e, 25U)) +
+                          ((e & f) ^ (~e & g)) + k[i] + w[i];
+      const uint32_t t2 = (ROR(a, 2U) ^ ROR(a, 13U) ^ ROR(a, 22U)) +
+                          ((a & b) ^ (a & c) ^ (b & c));
+      hh = g;
+      g  = f;
+      f  = e;
+      e  = d + t1;
+      d  = c;
+      c  = b;
+      b  = a;
+      a  = t1 + t2;
+   }
+
+   h[0] += a;
+   h[1] += b;
+   h[2] += c;
+   h[3] += d;
+   h[4] += e;
+   h[5] += f;
+   h[6] += g;
+   h[7] += hh;
+}
+
+void sha256_init(struct sha256_ctx *ctx)
+{
+   static const uint32_t h0[8] = {0x6a09e667U, 0xbb67ae85U, 0x3c6ef372U,
+                                  0xa54ff53aU, 0x510e527fU, 0x9b05688cU,
+                                  0x1f83d9abU, 0x5be0cd19U};
+
+   memcpy(ctx->h, h0, sizeof(h0));
+   ctx->len     = 0U;
+   ctx->buf_len = 0U;
+}
+
+void sha256_update(struct sha256_ctx *ctx, const uint8_t *data, uint32_t len)
+{
+   ctx->len += len;
+
+   if (ctx->buf_len > 0U) {
+      const uint32_t n = (len < (64U - ctx->buf_len)) ? len
+                                                      : (64U - ctx->buf_len);
+      memcpy(&ctx->buf[ctx->buf_len], data, n);
+      ctx->buf_len += n;
+      data += n;
+      len -= n;
+      if (ctx->buf_len < 64U)
+         return;
+      sha256_block(ctx->h, ctx->buf);
+      ctx->buf_len = 0U;
+   }
+
+   for (; len >= 64U; len -= 64U, data += 64U)
+      sha256_block(ctx->h, data);
+
+   memcpy(ctx->buf, data, len);
+   ctx->buf_len = len;
+}
+
+void sha256_final(struct sha256_ctx *ctx, uint8_t out[SHA256_SIZE])
+{
+   const uint64_t bits = ctx->len * 8U;
+
+   // a one bit, zeros up to 56 mod 64, then the length in bits
+   ctx->buf[ctx->buf_len++] = 0x80U;
+   if (ctx->buf_len > 56U) {
+      memset(&ctx->buf[ctx->buf_len], 0, 64U - ctx->buf_len);
+      sha256_block(ctx->h, ctx->buf);
+      ctx->buf_len = 0U;
+   }
+   memset(&ctx->buf[ctx->buf_len], 0, 56U - ctx->buf_len);
+   for (uint32_t i = 0U; i < 8U; i++)
+      ctx->buf[56U + i] = (uint8_t)(bits >> (56U - (8U * i)));
+   sha256_block(ctx->h, ctx->buf);
+
+   for (uint32_t i = 0U; i < 8U; i++) {
+      out[(4U * i) + 0U] = (uint8_t)(ctx->h[i] >> 24);
+      out[(4U * i) + 1U] = (uint8_t)(ctx->h[i] >> 16);
+      out[(4U * i) + 2U] = (uint8_t)(ctx->h[i] >> 8);
+      out[(4U * i) + 3U] = (uint8_t)ctx->h[i];
+   }
+}
+
+#endif // HASH_HW_USE
+
+// end file sha256.c
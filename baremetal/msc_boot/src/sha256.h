@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file sha256.h
+ * @brief SHA-256 digest, on the HASH1 peripheral or in software
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * Built with HASH_HW_USE, the digest is computed by the HASH1 peripheral,
+ * which holds the state of one digest at a time: finish one context before
+ * starting the next. Without it (e.g. the host build) it is computed in
+ * software and any number of contexts may be open.
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+
+#define SHA256_SIZE 32U
+
+struct sha256_ctx {
+   uint32_t h[8];
+   uint64_t len;    // bytes hashed so far
+   uint8_t buf[64]; // partial block (software) or word (HASH1)
+   uint32_t buf_len;
+};
+
+void sha256_init(struct sha256_ctx *ctx);
+void sha256_update(struct sha256_ctx *ctx, const uint8_t *data, uint32_t len);
+void sha256_final(struct sha256_ctx *ctx, uint8_t out[SHA256_SIZE]);
+
+#endif // SHA256_H
+
+// end file sha256.h
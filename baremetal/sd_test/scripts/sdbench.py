@@ -0,0 +1,172 @@
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright (c) 2025 Stanford Research Systems, Inc.
+
+# Run the sd_test benchmark over the UART and collect its results into CSV,
+# one row per test, next to the card's identity (CID) and a free-form lot
+# label, so that numbers from different cards and lots land in one table.
+# Rows are appended; the header is written when the file is new.
+#
+# Column hN of a row counts commands that took 2^N to 2^(N+1) - 1 us (h0
+# also holds those under 1 us, the last column everything slower).
+#
+# With -i, a console log captured earlier is parsed instead of the UART.
+#
+# Needs pyserial (pip install pyserial).
+
+import os
+import sys
+import csv
+import time
+import argparse
+
+CARD_KEYS = ["mid", "oid", "pnm", "prv", "psn", "mdt", "blocks", "kernel_hz",
+             "high_speed"]
+RESULT_KEYS = ["mode", "op", "pattern", "div", "clk_hz", "blks", "cmds",
+               "errors", "bytes", "us", "kB_s", "lat_min_us", "lat_avg_us",
+               "lat_max_us"]
+
+
+def parse_pairs(words):
+    pairs = {}
+    for w in words:
+        key, sep, val = w.partition("=")
+        if sep:
+            pairs[key] = val
+    return pairs
+
+
+class Collector:
+    def __init__(self):
+        self.card = {}
+        self.results = []
+        self.done = False
+        self.error = None
+
+    def feed(self, line):
+        words = line.strip().split()
+        if len(words) < 2 or words[0] != "sdbench":
+            return
+        kind = words[1]
+        if kind == "begin":
+            self.card = {}
+            self.results = []
+        elif kind == "card":
+            self.card = parse_pairs(words[2:])
+        elif kind == "result":
+            self.results.append(parse_pairs(words[2:]))
+        elif kind == "end":
+            self.done = True
+        elif kind == "error":
+            self.error = " ".join(words[2:])
+            self.done = True
+
+
+def from_serial(args, col, log):
+    try:
+        import serial
+    except ImportError:
+        sys.exit("sdbench.py needs pyserial (pip install pyserial)")
+
+    with serial.Serial(args.com_port, args.baud, timeout=1) as port:
+        port.reset_input_buffer()
+        # any key starts a run
+        port.write(b"\r")
+        t0 = time.monotonic()
+        while not col.done:
+            if time.monotonic() - t0 > args.timeout:
+                sys.exit("no complete run within %d s" % args.timeout)
+            line = port.readline().decode("ascii", "replace")
+            if not line:
+                continue
+            if log:
+                log.write(line)
+            if args.verbose:
+                print(line.rstrip())
+            col.feed(line)
+
+
+def from_file(path, col):
+    with open(path, errors="replace") as f:
+        for line in f:
+            col.feed(line)
+            if col.done:
+                break
+    if not col.done:
+        sys.exit("%s holds no complete run" % path)
+
+
+def write_csv(path, args, col):
+    nbins = max((len(r.get("hist", "").split(",")) for r in col.results),
+                default=0)
+    header = (["time", "lot", "label"] + CARD_KEYS + RESULT_KEYS +
+              ["h%d" % i for i in range(nbins)])
+
+    new = not os.path.exists(path) or os.path.getsize(path) == 0
+    stamp = time.strftime("%Y-%m-%d %H:%M:%S")
+    with open(path, "a", newline="") as f:
+        w = csv.writer(f)
+        if new:
+            w.writerow(header)
+        for r in col.results:
+            hist = r.get("hist", "").split(",")
+            w.writerow([stamp, args.lot, args.label] +
+                       [col.card.get(k, "") for k in CARD_KEYS] +
+                       [r.get(k, "") for k in RESULT_KEYS] + hist)
+
+
+def print_summary(col):
+    c = col.card
+    print("card %s %s %s rev %s sn %s made %s, %s blocks, high speed %s" %
+          (c.get("mid"), c.get("oid"), c.get("pnm"), c.get("prv"),
+           c.get("psn"), c.get("mdt"), c.get("blocks"), c.get("high_speed")))
+    print("%-5s %-6s %-5s %6s %6s %9s %8s %8s %8s %6s" %
+          ("mode", "op", "patt", "MHz", "blks", "kB/s", "lat min", "avg",
+           "max", "errors"))
+    for r in col.results:
+        print("%-5s %-6s %-5s %6.2f %6s %9s %8s %8s %8s %6s" %
+              (r["mode"], r["op"], r["pattern"], int(r["clk_hz"]) / 1e6,
+               r["blks"], r["kB_s"], r["lat_min_us"], r["lat_avg_us"],
+               r["lat_max_us"], r["errors"]))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="collect sd_test benchmark results into CSV")
+    src = parser.add_mutually_exclusive_group(required=True)
+    src.add_argument("-c", "--com_port", help="COM port of the board")
+    src.add_argument("-i", "--input", help="parse a saved console log")
+    parser.add_argument("-o", "--output", default="sdbench.csv",
+                        help="CSV file to append to (default sdbench.csv)")
+    parser.add_argument("-l", "--lot", default="",
+                        help="card lot, copied into every row")
+    parser.add_argument("--label", default="",
+                        help="free-form note, copied into every row")
+    parser.add_argument("--log", help="also save the console output here")
+    parser.add_argument("-b", "--baud", type=int, default=115200)
+    parser.add_argument("-t", "--timeout", type=int, default=1800,
+                        help="seconds to wait for a run (default 1800)")
+    parser.add_argument("-v", "--verbose", action="store_true",
+                        help="echo the console")
+    args = parser.parse_args()
+
+    col = Collector()
+    if args.input:
+        from_file(args.input, col)
+    else:
+        log = open(args.log, "w") if args.log else None
+        try:
+            from_serial(args, col, log)
+        finally:
+            if log:
+                log.close()
+
+    if col.error:
+        sys.exit("board reports: %s" % col.error)
+
+    write_csv(args.output, args, col)
+    print_summary(col)
+    print("%d tests appended to %s" % (len(col.results), args.output))
+
+
+if __name__ == "__main__":
+    main()
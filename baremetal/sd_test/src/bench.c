@@ -0,0 +1,330 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file bench.c
+ * @brief SD card throughput and latency benchmark
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * Each test issues commands of one size back to back for BENCH_TEST_MS and
+ * times every command from issue to completion; a write is complete once
+ * the card has programmed it (CMD13 reports the transfer state). The three
+ * ways of driving the card are
+ *
+ * - poll: HAL_SD_ReadBlocks() / HAL_SD_WriteBlocks(), the CPU moving the
+ *   FIFO,
+ * - it:   the same from the FIFO interrupts,
+ * - dma:  one request of the IDMA queue in sd.c.
+ *
+ * The CPU modes run with hardware flow control, which stops the bus clock
+ * when the FIFO is full or empty, so they measure what the CPU can move
+ * rather than fail with overruns.
+ *
+ * Random addresses come from a fixed seed, so every card sees the same
+ * sequence. Before each write the target blocks are read (untimed) and the
+ * same data written back, so the test area survives unless power is lost in
+ * the middle of a write.
+ *
+ * The output lines start with "sdbench"; results are "key=value" pairs.
+ */
+
+#include "bench.h"
+#include "sd.h"
+#include "setup.h"
+#include "stm32mp13xx_hal.h"
+#include "stm32mp13xx_hal_sd.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// bus clock limits of the default and High Speed modes
+#define BENCH_DS_HZ 25000000U
+#define BENCH_HS_HZ 50000000U
+
+// random access is only tested for sizes where the access time dominates
+#define BENCH_RAND_MAX_BLKS 64U
+
+enum { MODE_POLL, MODE_IT, MODE_DMA, NUM_MODES };
+
+static const char *const mode_name[NUM_MODES] = {"poll", "it", "dma"};
+
+// transfer sizes in blocks, 512 B to 4 MB (about the most one request holds)
+static const uint32_t sizes[] = {1U, 8U, 64U, 512U, 2048U, 8192U};
+
+// clock dividers, fastest first; those beyond the card's mode are skipped
+static const uint32_t divs[] = {0U, 1U, 2U, 4U, SDMMC_NSPEED_CLK_DIV};
+
+struct result {
+   uint32_t cmds;
+   uint32_t errors;
+   uint32_t bytes;
+   uint32_t us;
+   uint32_t lat_min;
+   uint32_t lat_max;
+   uint64_t lat_sum;
+   uint32_t hist[BENCH_HIST_BINS];
+};
+
+static uint8_t *const buf = (uint8_t *)DRAM_MEM_BASE;
+static uint32_t rng;
+
+static uint32_t xorshift(void)
+{
+   rng ^= rng << 13;
+   rng ^= rng >> 17;
+   rng ^= rng << 5;
+   return rng;
+}
+
+static uint32_t clk_hz(const uint32_t div)
+{
+   const uint32_t kernel = HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_SDMMC1);
+
+   // SDMMC_CK = kernel / (2 * div), or the kernel clock for div = 0
+   return (div == 0U) ? kernel : kernel / (2U * div);
+}
+
+static void set_div(const uint32_t div)
+{
+   MODIFY_REG(SDHandle.Instance->CLKCR, SDMMC_CLKCR_CLKDIV, div);
+   SDHandle.Init.ClockDiv = div;
+}
+
+static void set_flow_control(const int on)
+{
+   if (on)
+      SET_BIT(SDHandle.Instance->CLKCR, SDMMC_CLKCR_HWFC_EN);
+   else
+      CLEAR_BIT(SDHandle.Instance->CLKCR, SDMMC_CLKCR_HWFC_EN);
+}
+
+static int wait_card(void)
+{
+   const uint32_t t0 = HAL_GetTick();
+
+   while (HAL_SD_GetCardState(&SDHandle) != HAL_SD_CARD_TRANSFER) {
+      if (HAL_GetTick() - t0 > BENCH_CMD_MS)
+         return -1;
+   }
+
+   return 0;
+}
+
+static int wait_it(void)
+{
+   const uint32_t t0 = HAL_GetTick();
+
+   while (HAL_SD_GetState(&SDHandle) == HAL_SD_STATE_BUSY) {
+      if (HAL_GetTick() - t0 > BENCH_CMD_MS) {
+         HAL_SD_Abort(&SDHandle);
+         return -1;
+      }
+   }
+
+   return (SDHandle.ErrorCode == HAL_SD_ERROR_NONE) ? 0 : -1;
+}
+
+static int command(const int mode, const int write, const uint32_t addr,
+                   const uint32_t blks)
+{
+   struct sd_seg seg;
+   struct sd_req req;
+   HAL_StatusTypeDef ret;
+
+   if (mode == MODE_POLL) {
+      if (write)
+         ret = HAL_SD_WriteBlocks(&SDHandle, buf, addr, blks, BENCH_CMD_MS);
+      else
+         ret = HAL_SD_ReadBlocks(&SDHandle, buf, addr, blks, BENCH_CMD_MS);
+      if (ret != HAL_OK)
+         return -1;
+   } else if (mode == MODE_IT) {
+      if (write)
+         ret = HAL_SD_WriteBlocks_IT(&SDHandle, buf, addr, blks);
+      else
+         ret = HAL_SD_ReadBlocks_IT(&SDHandle, buf, addr, blks);
+      if ((ret != HAL_OK) || (wait_it() != 0))
+         return -1;
+   } else {
+      seg.buf      = buf;
+      seg.blk_len  = blks;
+      req.blk_addr = addr;
+      req.seg      = &seg;
+      req.num_seg  = 1U;
+      req.write    = write;
+      req.done     = NULL;
+      if ((sd_submit(&req) != 0) || (sd_req_wait(&req) != 0))
+         return -1;
+   }
+
+   // a write is done once the card has programmed it
+   return write ? wait_card() : 0;
+}
+
+static uint32_t hist_bin(uint32_t us)
+{
+   uint32_t i = 0U;
+
+   while ((us >= 2U) && (i < BENCH_HIST_BINS - 1U)) {
+      us >>= 1;
+      i++;
+   }
+   return i;
+}
+
+static void run_test(const int mode, const int write, const int random,
+                     const uint32_t blks, struct result *r)
+{
+   const uint32_t slots = BENCH_AREA_BLKS / blks;
+   uint32_t slot        = 0U;
+
+   memset(r, 0, sizeof(*r));
+   r->lat_min = UINT32_MAX;
+   rng        = 1U;
+
+   const uint32_t t0 = HAL_GetTick();
+   while ((r->cmds + r->errors == 0U) || (HAL_GetTick() - t0 < BENCH_TEST_MS)) {
+      const uint32_t n    = random ? (xorshift() % slots) : (slot++ % slots);
+      const uint32_t addr = BENCH_AREA_BLK + n * blks;
+
+      // data to write back; not timed
+      if (write && (sd_read(buf, addr, blks) != 0)) {
+         r->errors++;
+         continue;
+      }
+
+      const uint32_t t  = get_time_us();
+      const int ret     = command(mode, write, addr, blks);
+      const uint32_t us = get_time_us() - t;
+
+      if (ret != 0) {
+         r->errors++;
+         (void)wait_card();
+         continue;
+      }
+
+      r->cmds++;
+      r->bytes += blks * BLOCKSIZE;
+      r->us += us;
+      r->lat_sum += us;
+      if (us < r->lat_min)
+         r->lat_min = us;
+      if (us > r->lat_max)
+         r->lat_max = us;
+      r->hist[hist_bin(us)]++;
+   }
+
+   if (r->cmds == 0U)
+      r->lat_min = 0U;
+}
+
+static void print_result(const int mode, const int write, const int random,
+                         const uint32_t div, const uint32_t blks,
+                         const struct result *r)
+{
+   const uint64_t kb_s =
+       (r->us == 0U) ? 0U : (uint64_t)r->bytes * 1000000U / 1024U / r->us;
+
+   printf("sdbench result mode=%s op=%s pattern=%s div=%u clk_hz=%u blks=%u "
+          "cmds=%u errors=%u bytes=%u us=%u kB_s=%u ",
+          mode_name[mode], write ? "write" : "read", random ? "rand" : "seq",
+          (unsigned)div, (unsigned)clk_hz(div), (unsigned)blks,
+          (unsigned)r->cmds, (unsigned)r->errors, (unsigned)r->bytes,
+          (unsigned)r->us, (unsigned)kb_s);
+   printf("lat_min_us=%u lat_avg_us=%u lat_max_us=%u hist=",
+          (unsigned)r->lat_min,
+          (unsigned)((r->cmds == 0U) ? 0U : r->lat_sum / r->cmds),
+          (unsigned)r->lat_max);
+   for (uint32_t i = 0; i < BENCH_HIST_BINS; i++)
+      printf("%u%s", (unsigned)r->hist[i],
+             (i + 1U < BENCH_HIST_BINS) ? "," : "\r\n");
+}
+
+// CID text fields may hold anything; keep the output one token per value
+static char cid_char(const uint32_t c)
+{
+   return isalnum((int)(c & 0xFFU)) ? (char)c : '_';
+}
+
+static int print_card(const int high_speed)
+{
+   HAL_SD_CardCIDTypeDef cid;
+   HAL_SD_CardInfoTypeDef info;
+
+   if ((HAL_SD_GetCardCID(&SDHandle, &cid) != HAL_OK) ||
+       (HAL_SD_GetCardInfo(&SDHandle, &info) != HAL_OK))
+      return -1;
+
+   // MDT: year since 2000 in bits 11:4, month in bits 3:0
+   printf("sdbench card mid=0x%02x oid=%c%c pnm=%c%c%c%c%c prv=%u.%u "
+          "psn=0x%08x mdt=%u-%02u blocks=%u kernel_hz=%u high_speed=%d\r\n",
+          (unsigned)cid.ManufacturerID, cid_char(cid.OEM_AppliID >> 8),
+          cid_char(cid.OEM_AppliID), cid_char(cid.ProdName1 >> 24),
+          cid_char(cid.ProdName1 >> 16), cid_char(cid.ProdName1 >> 8),
+          cid_char(cid.ProdName1), cid_char(cid.ProdName2),
+          (unsigned)(cid.ProdRev >> 4), (unsigned)(cid.ProdRev & 0xFU),
+          (unsigned)cid.ProdSN, 2000U + ((cid.ManufactDate >> 4) & 0xFFU),
+          (unsigned)(cid.ManufactDate & 0xFU), (unsigned)info.LogBlockNbr,
+          (unsigned)clk_hz(0U), high_speed);
+
+   return (info.LogBlockNbr >= BENCH_AREA_BLK + BENCH_AREA_BLKS) ? 0 : -1;
+}
+
+void bench_run(void)
+{
+   const uint32_t div0 = SDHandle.Init.ClockDiv;
+   struct result r;
+   uint32_t tests = 0U;
+
+   // CMD6 to High Speed, so the dividers above 25 MHz can be tried too
+   const int hs = (SDHandle.SdCard.CardSpeed != CARD_NORMAL_SPEED) &&
+                  (HAL_SD_ConfigSpeedBusOperation(
+                       &SDHandle, SDMMC_SPEED_MODE_HIGH) == HAL_OK);
+   const uint32_t max_hz = hs ? BENCH_HS_HZ : BENCH_DS_HZ;
+
+   printf("sdbench begin\r\n");
+   if (print_card(hs) != 0) {
+      printf("sdbench error card too small or unreadable\r\n");
+      return;
+   }
+
+   for (uint32_t d = 0; d < sizeof(divs) / sizeof(divs[0]); d++) {
+      const uint32_t hz = clk_hz(divs[d]);
+      if (hz > max_hz)
+         continue;
+      set_div(divs[d]);
+
+      for (int mode = 0; mode < NUM_MODES; mode++) {
+         set_flow_control(mode != MODE_DMA);
+
+         for (int write = 0; write <= 1; write++) {
+            for (int random = 0; random <= 1; random++) {
+               for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]);
+                    s++) {
+                  const uint32_t blks = sizes[s];
+
+                  if (random && (blks > BENCH_RAND_MAX_BLKS))
+                     continue;
+
+                  // one command must fit in a test at this clock (4 bits
+                  // per cycle)
+                  if ((uint64_t)blks * BLOCKSIZE * 2U * 1000U / hz >
+                      BENCH_TEST_MS)
+                     continue;
+
+                  run_test(mode, write, random, blks, &r);
+                  print_result(mode, write, random, divs[d], blks, &r);
+                  tests++;
+               }
+            }
+         }
+      }
+   }
+
+   set_flow_control(0);
+   set_div(div0);
+   printf("sdbench end tests=%u\r\n", (unsigned)tests);
+}
+
+// end file bench.c
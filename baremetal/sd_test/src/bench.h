@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file bench.h
+ * @brief SD card throughput and latency benchmark
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * Sequential and random reads and writes for a range of transfer sizes, with
+ * the card driven by polling, by interrupts or by the IDMA request queue, at
+ * each usable SDMMC clock divider. Every test prints one line of
+ * "key=value" pairs on the console; scripts/sdbench.py collects them into
+ * CSV.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+// area of the card the tests use: 128 MB from 128 MB in, clear of the boot
+// partitions; writes put back the data that was there
+#define BENCH_AREA_BLK  0x40000U
+#define BENCH_AREA_BLKS 0x40000U
+
+// how long each test runs, and how long one command may take
+#define BENCH_TEST_MS 500U
+#define BENCH_CMD_MS  5000U
+
+// latency histogram: bucket i counts commands of 2^i to 2^(i+1) - 1 us,
+// the last one everything slower
+#define BENCH_HIST_BINS 20U
+
+// run the whole suite once
+void bench_run(void);
+
+#endif // BENCH_H
+
+// end file bench.h
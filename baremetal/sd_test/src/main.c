@@ -2,6 +2,8 @@
 #include <ctype.h>
 #include "stm32mp13xx_hal.h"
 #include "setup.h"
+#include "sd.h"
+#include "bench.h"
 
 // global variables
 SD_HandleTypeDef SDHandle;
@@ -57,26 +59,58 @@ void fill_dram(const int num_bytes) {
         i += 4;
     }
 }
-void read_sd_blocking(void)
+// SD card into DDR as queued requests; the IDMA writes each buffer directly
+#define LOAD_REQS     4U
+#define LOAD_REQ_BLKS 2048U
+
+static volatile uint32_t load_left;
+static volatile int load_err;
+
+static void load_done(struct sd_req *req, int ret)
+{
+   (void)req;
+   if (ret != 0)
+      load_err = 1;
+   load_left--;
+}
+
+void load_sd(void)
 {
-    const int app_offset = 0;
-    const int num_blocks = 1;
-    const int read_timeout = 3000;
+   static struct sd_seg seg[LOAD_REQS];
+   static struct sd_req req[LOAD_REQS];
 
-    static uint8_t block[BLOCKSIZE];  // static array for one block
+   load_left = LOAD_REQS;
+   load_err  = 0;
 
-    if (HAL_SD_ReadBlocks(&SDHandle, block, app_offset, num_blocks, read_timeout) != HAL_OK) {
-        printf("Error in HAL_SD_ReadBlocks()\r\n");
-        Error_Handler();
-    }
+   const uint32_t t0 = HAL_GetTick();
+   for (uint32_t i = 0; i < LOAD_REQS; i++) {
+      const uint32_t blk = i * LOAD_REQ_BLKS;
 
-    // Copy to DRAM in 32-bit words
-    // (Copying byte by byte cause weird data corruption)
-    uint32_t *p = (uint32_t *)DRAM_MEM_BASE;
-    for (int i = 0; i < 512; i += 4) {
-       uint32_t word = (block[i+3] << 24) | (block[i+2] << 16) | (block[i+1] << 8) | block[i];
-       *p++ = word;
-    }
+      seg[i].buf      = (uint8_t *)DRAM_MEM_BASE + blk * BLOCKSIZE;
+      seg[i].blk_len  = LOAD_REQ_BLKS;
+      req[i].blk_addr = blk;
+      req[i].seg      = &seg[i];
+      req[i].num_seg  = 1U;
+      req[i].write    = 0;
+      req[i].done     = load_done;
+      if (sd_submit(&req[i]) != 0) {
+         printf("Error in sd_submit()\r\n");
+         Error_Handler();
+      }
+   }
+
+   while (load_left > 0U)
+      sd_poll();
+   const uint32_t ms = HAL_GetTick() - t0;
+
+   if (load_err) {
+      printf("Error in SD load\r\n");
+      Error_Handler();
+   }
+
+   printf("loaded %u kB in %u ms\r\n",
+          (unsigned)(LOAD_REQS * LOAD_REQ_BLKS * BLOCKSIZE / 1024U),
+          (unsigned)ms);
 }
 
 int main(void)
@@ -89,12 +123,16 @@ int main(void)
    setup_ddr();
    SDHandle = setup_sd();
 
+   load_sd();
+   print_ddr(BLOCKSIZE / 4);
+
    while (1) {
-      printf("\r\n");
+      printf("\r\npress a key to run the SD benchmark\r\n");
       HAL_GPIO_TogglePin(GPIOA, GPIO_PIN_13);
-      HAL_Delay(50);
 
-      read_sd_blocking();
-      print_ddr(BLOCKSIZE / 4);
+      // __io_getchar() gives 0 when it times out
+      while (__io_getchar() == 0)
+         ;
+      bench_run();
    }
 }
@@ -456,6 +456,17 @@ SD_HandleTypeDef setup_sd(void)
    return SDHandle;
 }
 
+uint32_t get_time_us(void)
+{
+   // same time base as HAL_GetTick(), the free-running STGEN counter
+   if ((RCC->STGENCKSELR & RCC_STGENCKSELR_STGENSRC) ==
+       RCC_STGENCLKSOURCE_HSE) {
+      return (uint32_t)(PL1_GetCurrentPhysicalValue() / (HSE_VALUE / 1000000UL));
+   } else {
+      return (uint32_t)(PL1_GetCurrentPhysicalValue() / (HSI_VALUE / 1000000UL));
+   }
+}
+
 
 
 // end file setup.c
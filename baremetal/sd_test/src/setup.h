@@ -3,6 +3,9 @@
 
 #include "stm32mp13xx_hal.h"
 
+// global variables
+extern SD_HandleTypeDef SDHandle;
+
 // clocks and memory
 void SystemClock_Config(void);
 void PeriphCommonClock_Config(void);
@@ -25,6 +28,9 @@ void Error_Handler(void);
 // SD
 SD_HandleTypeDef setup_sd(void);
 
+// time
+uint32_t get_time_us(void);
+
 #endif // SETUP_H
 
 // end file setup.h
@@ -3,6 +3,7 @@
 #include "stm32mp13xx_hal.h"
 #include "stm32mp13xx_hal_etzpc.h"
 #include "setup.h"
+#include "sd.h"
 
 void print_ddr(const int num_words)
 {
@@ -55,28 +56,6 @@ void fill_dram(const int num_bytes) {
         i += 4;
     }
 }
-void read_sd_blocking(void)
-{
-    const int app_offset = 0;
-    const int num_blocks = 1;
-    const int read_timeout = 3000;
-
-    static uint8_t block[BLOCKSIZE];  // static array for one block
-
-    if (HAL_SD_ReadBlocks(&SDHandle, block, app_offset, num_blocks, read_timeout) != HAL_OK) {
-        printf("Error in HAL_SD_ReadBlocks()\r\n");
-        Error_Handler();
-    }
-
-    // Copy to DRAM in 32-bit words
-    // (Copying byte by byte cause weird data corruption)
-    uint32_t *p = (uint32_t *)DRAM_MEM_BASE;
-    for (int i = 0; i < 512; i += 4) {
-       uint32_t word = (block[i+3] << 24) | (block[i+2] << 16) | (block[i+1] << 8) | block[i];
-       *p++ = word;
-    }
-}
-
 int main(void)
 {
    HAL_Init();
@@ -91,8 +70,11 @@ int main(void)
    HAL_Delay(1000);
    printf("Hello, world!\r\n");
 
-   // SD and DDR test
-   read_sd_blocking();
+   // SD and DDR test: the IDMA reads straight into DDR
+   if (sd_read((uint8_t *)DRAM_MEM_BASE, 0U, 1U) != 0) {
+      printf("Error in sd_read()\r\n");
+      Error_Handler();
+   }
    print_ddr(BLOCKSIZE / 4);
 
    while (1) {
@@ -0,0 +1,389 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file sd.c
+ * @brief Queued SD card transfers on SDMMC1
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * Transfers use the SDMMC internal DMA (IDMA) in linked-list mode and
+ * complete from the SDMMC1 interrupt, straight to or from the caller's
+ * buffers. Buffers must be 32-bit aligned; cacheable ones are maintained
+ * here, so they should also start and end on a cache line.
+ *
+ * Every transfer is a request in one queue. sd_submit() appends it, and the
+ * interrupt that completes one request starts the next, so a chain of reads
+ * runs back to back without the CPU. A request may scatter over several
+ * buffers; each becomes one or more nodes of the IDMA linked list, and the
+ * whole request is a single multi-block command.
+ *
+ * After a write the card stays busy programming. Rather than poll for that
+ * in the interrupt, the next request is then started by sd_poll() or a
+ * waiter once CMD13 reports the card ready.
+ */
+
+#include "sd.h"
+#include "irq_ctrl.h"
+#include "setup.h"
+#include "stm32mp13xx.h"
+#include "stm32mp13xx_hal.h"
+#include "stm32mp13xx_hal_sd.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define SD_TIMEOUT_MS 3000U
+
+// most blocks of a contiguous buffer that fit in one request
+#define SD_REQ_BLKS (SD_MAX_NODES * SD_NODE_BLKS)
+
+// Cortex-A7 L1 and L2 line size
+#define CACHE_LINE 64U
+
+// linked list of the request on the card; the IDMA fetches it from memory,
+// so it is cleaned from the cache once built (one spare entry, see
+// build_list())
+static SD_DMALinkNodeTypeDef nodes[SD_MAX_NODES + 1U]
+    __attribute__((aligned(CACHE_LINE)));
+
+// requests, shared with the SDMMC1 interrupt
+static struct {
+   struct sd_req *head; // on the card once started
+   struct sd_req *tail;
+   int started;
+   int err;         // reported ahead of the completion callback
+   int programming; // the card may still be busy with the last write
+   uint32_t t_prog;
+} q;
+
+/**
+ * Write a buffer back to memory so that the IDMA reads current data.
+ */
+static void cache_clean(const void *buf, uint32_t len)
+{
+   uint32_t addr = (uint32_t)buf & ~(CACHE_LINE - 1U);
+   while (addr < (uint32_t)buf + len) {
+      L1C_CleanDCacheMVA((void *)addr);
+      addr += CACHE_LINE;
+   }
+   __DSB();
+}
+
+/**
+ * Drop cached copies of a buffer so that reads see what the IDMA wrote. Call
+ * before the transfer and again when it completes, since lines can be
+ * speculatively refilled while it runs.
+ */
+static void cache_invalidate(const void *buf, uint32_t len)
+{
+   uint32_t addr = (uint32_t)buf & ~(CACHE_LINE - 1U);
+   while (addr < (uint32_t)buf + len) {
+      L1C_CleanInvalidateDCacheMVA((void *)addr);
+      addr += CACHE_LINE;
+   }
+   __DSB();
+}
+
+static uint32_t lock(void)
+{
+   const uint32_t en = IRQ_GetEnableState(SDMMC1_IRQn);
+   IRQ_Disable(SDMMC1_IRQn);
+   __DSB();
+   __ISB();
+   return en;
+}
+
+static void unlock(const uint32_t en)
+{
+   if (en)
+      IRQ_Enable(SDMMC1_IRQn);
+}
+
+static uint32_t req_blocks(const struct sd_req *req)
+{
+   uint32_t n = 0;
+
+   for (uint32_t i = 0; i < req->num_seg; i++)
+      n += req->seg[i].blk_len;
+   return n;
+}
+
+/**
+ * Describe the segments of a request to the IDMA, splitting those that are
+ * larger than one node can hold.
+ */
+static void build_list(const struct sd_req *req, SD_DMALinkedListTypeDef *list)
+{
+   SD_DMALinkNodeConfTypeDef conf;
+   uint32_t n = 0;
+
+   list->pHeadNode    = NULL;
+   list->pTailNode    = NULL;
+   list->NodesCounter = 0;
+
+   for (uint32_t i = 0; i < req->num_seg; i++) {
+      const struct sd_seg *s = &req->seg[i];
+      for (uint32_t b = 0; b < s->blk_len; b += SD_NODE_BLKS) {
+         const uint32_t left = s->blk_len - b;
+         const uint32_t blks = (left > SD_NODE_BLKS) ? SD_NODE_BLKS : left;
+
+         conf.BufferAddress = (uint32_t)(s->buf + b * BLOCKSIZE);
+         conf.BufferSize    = blks * BLOCKSIZE;
+         (void)HAL_SDEx_DMALinkedList_BuildNode(&nodes[n], &conf);
+         (void)HAL_SDEx_DMALinkedList_InsertNode(list, list->pTailNode,
+                                                 &nodes[n]);
+         n++;
+      }
+   }
+
+   // the HAL loads the head node into the registers and links it to the
+   // next array entry, whatever that holds; make that a harmless copy
+   if (n == 1U)
+      nodes[1] = nodes[0];
+
+   cache_clean(nodes, (n + 1U) * sizeof(nodes[0]));
+}
+
+/**
+ * Whether the card has finished programming the last write.
+ */
+static int card_ready(void)
+{
+   if (!q.programming)
+      return 1;
+
+   if ((HAL_SD_GetCardState(&SDHandle) == HAL_SD_CARD_TRANSFER) ||
+       (HAL_GetTick() - q.t_prog > SD_TIMEOUT_MS))
+      q.programming = 0;
+
+   return !q.programming;
+}
+
+/**
+ * Retire the request on the card and tell its owner.
+ */
+static void complete(const int ret)
+{
+   struct sd_req *req = q.head;
+
+   if ((req == NULL) || !q.started)
+      return;
+
+   q.started = 0;
+   q.head    = req->next;
+   if (q.head == NULL)
+      q.tail = NULL;
+
+   if (req->write) {
+      q.programming = 1;
+      q.t_prog      = HAL_GetTick();
+   } else {
+      // lines may have been refilled speculatively during the transfer
+      for (uint32_t i = 0; i < req->num_seg; i++)
+         cache_invalidate(req->seg[i].buf, req->seg[i].blk_len * BLOCKSIZE);
+   }
+
+   req->ret  = ret;
+   req->busy = 0;
+   if (req->done != NULL)
+      req->done(req, ret);
+}
+
+/**
+ * Hand the next request to the card, unless one is running or the card is
+ * still programming. Runs in the interrupt or with it masked.
+ */
+static void start_next(void)
+{
+   while (!q.started && card_ready() && (q.head != NULL)) {
+      struct sd_req *req     = q.head;
+      const uint32_t blk_len = req_blocks(req);
+      SD_DMALinkedListTypeDef list;
+      HAL_StatusTypeDef ret;
+
+      build_list(req, &list);
+      req->t0   = HAL_GetTick();
+      q.err     = 0;
+      q.started = 1;
+
+      if (req->write)
+         ret = HAL_SDEx_DMALinkedList_WriteBlocks(&SDHandle, &list,
+                                                  req->blk_addr, blk_len);
+      else
+         ret = HAL_SDEx_DMALinkedList_ReadBlocks(&SDHandle, &list,
+                                                 req->blk_addr, blk_len);
+
+      if (ret != HAL_OK)
+         complete(-1);
+   }
+}
+
+/**
+ * Wait until nothing is queued and the card takes commands again.
+ */
+void SDMMC1_IRQHandler(void)
+{
+   HAL_SD_IRQHandler(&SDHandle);
+}
+
+void HAL_SD_RxCpltCallback(SD_HandleTypeDef *hsd)
+{
+   (void)hsd;
+   complete(q.err ? -1 : 0);
+   start_next();
+}
+
+void HAL_SD_TxCpltCallback(SD_HandleTypeDef *hsd)
+{
+   (void)hsd;
+   complete(q.err ? -1 : 0);
+   start_next();
+}
+
+void HAL_SD_ErrorCallback(SD_HandleTypeDef *hsd)
+{
+   // a failed CMD12 is reported while busy, and the completion follows
+   if (hsd->State == HAL_SD_STATE_BUSY) {
+      q.err = 1;
+      return;
+   }
+
+   complete(-1);
+   start_next();
+}
+
+/**
+ * Move a contiguous buffer in requests of up to SD_REQ_BLKS blocks and wait
+ * for them.
+ */
+static int transfer(uint8_t *buf, uint32_t blk_addr, uint32_t blk_len,
+                    const int write)
+{
+   struct sd_seg seg;
+   struct sd_req req;
+
+   while (blk_len > 0U) {
+      seg.buf      = buf;
+      seg.blk_len  = (blk_len > SD_REQ_BLKS) ? SD_REQ_BLKS : blk_len;
+      req.blk_addr = blk_addr;
+      req.seg      = &seg;
+      req.num_seg  = 1U;
+      req.write    = write;
+      req.done     = NULL;
+
+      if ((sd_submit(&req) != 0) || (sd_req_wait(&req) != 0))
+         return -1;
+
+      buf += seg.blk_len * BLOCKSIZE;
+      blk_addr += seg.blk_len;
+      blk_len -= seg.blk_len;
+   }
+
+   return 0;
+}
+
+int sd_read(uint8_t *buf, uint32_t blk_addr, uint32_t blk_len)
+{
+   return transfer(buf, blk_addr, blk_len, 0);
+}
+
+int sd_submit(struct sd_req *req)
+{
+   uint32_t n = 0;
+
+   if (req->num_seg == 0U)
+      return -1;
+
+   for (uint32_t i = 0; i < req->num_seg; i++) {
+      const struct sd_seg *s = &req->seg[i];
+      if ((s->blk_len == 0U) || (((uint32_t)s->buf & 3U) != 0U))
+         return -1;
+      n += (s->blk_len + SD_NODE_BLKS - 1U) / SD_NODE_BLKS;
+   }
+   if (n > SD_MAX_NODES)
+      return -1;
+
+   for (uint32_t i = 0; i < req->num_seg; i++) {
+      const struct sd_seg *s = &req->seg[i];
+      if (req->write)
+         cache_clean(s->buf, s->blk_len * BLOCKSIZE);
+      else
+         cache_invalidate(s->buf, s->blk_len * BLOCKSIZE);
+   }
+
+   req->next = NULL;
+   req->ret  = 0;
+   req->busy = 1;
+
+   const uint32_t en = lock();
+   if (q.tail != NULL)
+      q.tail->next = req;
+   else
+      q.head = req;
+   q.tail = req;
+   start_next();
+   unlock(en);
+
+   return 0;
+}
+
+int sd_req_wait(struct sd_req *req)
+{
+   while (req->busy)
+      sd_poll();
+
+   return req->ret;
+}
+
+void sd_cancel(struct sd_req *req)
+{
+   const uint32_t en = lock();
+
+   if (!req->busy) {
+      unlock(en);
+      return;
+   }
+
+   if ((req == q.head) && q.started) {
+      HAL_SD_Abort(&SDHandle);
+      complete(-1);
+   } else {
+      // still queued: unlink it
+      struct sd_req *prev = NULL;
+      for (struct sd_req *r = q.head; r != req; r = r->next)
+         prev = r;
+
+      if (prev == NULL)
+         q.head = req->next;
+      else
+         prev->next = req->next;
+      if (q.tail == req)
+         q.tail = prev;
+
+      req->ret  = -1;
+      req->busy = 0;
+      if (req->done != NULL)
+         req->done(req, -1);
+   }
+
+   start_next();
+   unlock(en);
+}
+
+void sd_poll(void)
+{
+   // Called from the USB interrupt, the SDMMC interrupt cannot preempt us
+   // (no nesting), so run its handler here when it is pending
+   if (((__get_CPSR() & CPSR_I_Msk) != 0U) &&
+       (IRQ_GetPending(SDMMC1_IRQn) != 0U))
+      HAL_SD_IRQHandler(&SDHandle);
+
+   const uint32_t en = lock();
+   if (q.started && (HAL_GetTick() - q.head->t0 > SD_TIMEOUT_MS)) {
+      HAL_SD_Abort(&SDHandle);
+      complete(-1);
+   }
+   start_next();
+   unlock(en);
+}
+
+// end file sd.c
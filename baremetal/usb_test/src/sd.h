@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file sd.h
+ * @brief Queued SD card transfers on SDMMC1
+ * @author Jakob Kastelic
+ * @copyright 2025 Stanford Research Systems, Inc.
+ *
+ * The request queue of msc_boot's sd.c, without the storage extras (erase,
+ * ACMD23, card registers).
+ */
+
+#ifndef SD_H
+#define SD_H
+
+#include <stdint.h>
+
+void SDMMC1_IRQHandler(void);
+
+int sd_read(uint8_t *buf, uint32_t blk_addr, uint32_t blk_len);
+
+// IDMA linked-list nodes per request; each covers up to SD_NODE_BLKS blocks
+#define SD_MAX_NODES 64U
+#define SD_NODE_BLKS 255U
+
+// one piece of a scattered transfer; buf must be 32-bit aligned
+struct sd_seg {
+   uint8_t *buf;
+   uint32_t blk_len;
+};
+
+// blk_addr onwards to or from the segments in order, as one card command
+struct sd_req {
+   uint32_t blk_addr;
+   const struct sd_seg *seg; // must stay valid until done
+   uint32_t num_seg;
+   int write;
+
+   // called from the SDMMC1 interrupt with 0 or -1; may submit again
+   void (*done)(struct sd_req *req, int ret);
+   void *arg;
+
+   // owned by sd.c while busy
+   struct sd_req *next;
+   uint32_t t0;
+   volatile int busy;
+   volatile int ret;
+};
+
+// queue a request behind the ones already submitted; -1 if it is malformed
+// or needs more than SD_MAX_NODES nodes
+int sd_submit(struct sd_req *req);
+
+// block until the request has completed; returns its result
+int sd_req_wait(struct sd_req *req);
+
+// drop a request; if it is on the card, the transfer is aborted
+void sd_cancel(struct sd_req *req);
+
+// time out a stuck transfer and start the next one after a write; call from
+// the main loop
+void sd_poll(void);
+
+#endif // SD_H
+
+// end file sd.h